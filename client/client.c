@@ -0,0 +1,531 @@
+/**
+ * @file client.c
+ * @brief Headless client library for the players and the spectators, driven with poll and callbacks
+ * @date 2024-05-30
+ */
+
+#include "client.h"
+
+/**
+ * @fn int start_connection(client_t* client, char* ip, int port)
+ * @brief Opens a non-blocking socket and starts connecting it
+ * @param client: client whose socket is replaced
+ * @param ip: address to connect to
+ * @param port: port to connect to
+ * @return int: 0 if the connection is started, -1 otherwise
+ */
+static int start_connection(client_t* client, char* ip, int port) {
+	struct sockaddr_in address;
+	int no_delay = 1;
+
+	client->file_descriptor = socket(PF_INET, SOCK_STREAM, 0);
+	if (client->file_descriptor == -1)
+		return -1;
+
+	// Sending each message at once, the requests are not answered one by one
+	fcntl(client->file_descriptor, F_SETFL, fcntl(client->file_descriptor, F_GETFL) | O_NONBLOCK);
+	setsockopt(client->file_descriptor, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+	addr2struct(&address, ip, port);
+	if (connect(client->file_descriptor, (struct sockaddr *)&address, sizeof(address)) == -1 && errno != EINPROGRESS) {
+		close(client->file_descriptor);
+		client->file_descriptor = -1;
+		return -1;
+	}
+
+	client->input_size = 0;
+	client->output_size = 0;
+	client->pending_count = 0;
+	return 0;
+}
+
+/**
+ * @fn void close_client(client_t* client)
+ * @brief Closes the connection of a client and lets the application know
+ * @param client: client
+ */
+static void close_client(client_t* client) {
+	if (client->state == CLIENT_CLOSED)
+		return;
+
+	close(client->file_descriptor);
+	client->file_descriptor = -1;
+	client->state = CLIENT_CLOSED;
+
+	if (client->callbacks->on_closed != NULL)
+		client->callbacks->on_closed(client);
+}
+
+/**
+ * @fn int queue_message(client_t* client, char code, char* data, char request)
+ * @brief Adds a message to the output of a client (sent by client_process)
+ * @param client: client
+ * @param code: message code
+ * @param data: message data
+ * @param request: code of the request expecting OK or NOK, 0 if none is expected
+ * @return int: 0 if queued, -1 if the output buffer or the pending requests are full
+ */
+static int queue_message(client_t* client, char code, char* data, char request) {
+	message_t message;
+	buffer_t serialized;
+	size_t size;
+
+	if (client->state == CLIENT_CLOSED)
+		return -1;
+
+	prepare_message(&message, code, data);
+	serialize_message(&message, serialized);
+	size = strlen(serialized) + 1;
+
+	if (client->output_size + size > CLIENT_BUFFER_SIZE
+	|| (request != 0 && client->pending_count == CLIENT_MAX_PENDING))
+		return -1;
+
+	memcpy(client->output + client->output_size, serialized, size);
+	client->output_size += size;
+
+	// The answers of the server come in the order of the requests
+	if (request != 0) {
+		client->pending[(client->pending_head + client->pending_count) % CLIENT_MAX_PENDING] = request;
+		client->pending_count++;
+	}
+
+	return 0;
+}
+
+/**
+ * @fn int flush_output(client_t* client)
+ * @brief Sends as much of the output of a client as the socket accepts
+ * @param client: client
+ * @return int: 0, -1 if the connection is lost
+ */
+static int flush_output(client_t* client) {
+	ssize_t write_size;
+
+	while (client->output_size > 0) {
+		write_size = send(client->file_descriptor, client->output, client->output_size, MSG_NOSIGNAL);
+		if (write_size == -1)
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+		memmove(client->output, client->output + write_size, client->output_size - write_size);
+		client->output_size -= write_size;
+	}
+
+	return 0;
+}
+
+/**
+ * @fn void connect_to_court(client_t* client, char* data)
+ * @brief Leaves the server for the court it has given ("ip:port:id")
+ * @param client: player
+ * @param data: data of COURT_FOUND
+ */
+static void connect_to_court(client_t* client, char* data) {
+	char *save_ptr, *ip, *port, *id;
+
+	ip = strtok_r(data, ":", &save_ptr);
+	port = strtok_r(NULL, ":", &save_ptr);
+	id = strtok_r(NULL, ":", &save_ptr);
+	client->court_id = id == NULL ? 0 : atoi(id);
+	if (ip == NULL || port == NULL) {
+		close_client(client);
+		return;
+	}
+
+	if (client->callbacks->on_court_found != NULL)
+		client->callbacks->on_court_found(client, ip, atoi(port));
+
+	// The connection to the server is no longer needed
+	close(client->file_descriptor);
+	client->state = CLIENT_CONNECTING_TO_COURT;
+	client->points_sent = 0;
+	if (start_connection(client, ip, atoi(port)) == -1)
+		close_client(client);
+}
+
+/**
+ * @fn void handle_message(client_t* client, message_t* message)
+ * @brief Calls the callback of a message received from the server or the court
+ * @param client: client
+ * @param message: message received
+ */
+static void handle_message(client_t* client, message_t* message) {
+	const client_callbacks_t* callbacks = client->callbacks;
+	char *save_ptr, *token, *last_name, *trace_text, request;
+	trace_t trace;
+
+	// The answers of the court carry the sequence number of the point
+	if (client->state == CLIENT_ON_COURT) {
+		if (message->code == (char) END_MATCH) {
+			if (callbacks->on_match_end != NULL)
+				callbacks->on_match_end(client, 0);
+		}
+		else if (callbacks->on_point != NULL)
+			callbacks->on_point(client, strtoul(message->data, NULL, 10), message->code == (char) OK);
+		return;
+	}
+
+	switch (message->code) {
+		case (char) OK:
+		case (char) NOK:
+			if (client->pending_count == 0)
+				break;
+			request = client->pending[client->pending_head];
+			client->pending_head = (client->pending_head + 1) % CLIENT_MAX_PENDING;
+			client->pending_count--;
+			if (callbacks->on_answer != NULL)
+				callbacks->on_answer(client, request, message->code == (char) OK, message->data);
+			break;
+
+		case INFO_PLAYER:
+			if (callbacks->on_player_id != NULL)
+				callbacks->on_player_id(client, atoi(message->data));
+			break;
+
+		case INVITE:
+			// Formatted example: "Nadal:Rafael"
+			last_name = strtok_r(message->data, ":", &save_ptr);
+			token = strtok_r(NULL, ":", &save_ptr);
+			if (callbacks->on_invitation != NULL)
+				callbacks->on_invitation(client, last_name == NULL ? "" : last_name, token == NULL ? "" : token);
+			break;
+
+		case LIST_PLAYERS:
+			if (callbacks->on_players != NULL)
+				callbacks->on_players(client, message->data);
+			break;
+
+		case LIST_COURTS:
+			// A long list comes in pages, the last line of a page gives the next one ("+42")
+			token = strchr(message->data, '+');
+			if (token != NULL) {
+				*token = '\0';
+				queue_message(client, ASK_COURTS, strtok_r(token + 1, "\n", &save_ptr), 0);
+			}
+			if (callbacks->on_courts != NULL)
+				callbacks->on_courts(client, message->data, token != NULL);
+			break;
+
+		case QUEUED:
+			// Formatted example: "3:420" (position, estimated wait in seconds)
+			token = strchr(message->data, ':');
+			if (callbacks->on_queued != NULL)
+				callbacks->on_queued(client, atoi(message->data), token == NULL ? -1 : atoi(token + 1));
+			break;
+
+		case COURT_FOUND:
+			connect_to_court(client, message->data);
+			break;
+
+		case SCORE:
+			// Formatted example: "3|40/15:6/1:4/2:0/0", followed by the trace of the point if it has one
+			token = strchr(message->data, '|');
+			trace_text = token == NULL ? NULL : strchr(token + 1, '|');
+			if (trace_text != NULL) {
+				*trace_text = '\0';
+				if (parse_trace(trace_text + 1, &trace) == 0)
+					record_span(&trace, TRACE_SPECTATOR_RECEIVED, atoi(message->data));
+			}
+			if (token != NULL && callbacks->on_score != NULL)
+				callbacks->on_score(client, atoi(message->data), token + 1);
+			break;
+
+		case END_MATCH:
+			if (callbacks->on_match_end != NULL)
+				callbacks->on_match_end(client, atoi(message->data));
+			break;
+
+		default:
+			break;
+	}
+}
+
+/**
+ * @fn int read_input(client_t* client)
+ * @brief Reads what has arrived on the socket of a client and handles the complete messages
+ * @param client: client
+ * @return int: 0, -1 if the connection is closed
+ */
+static int read_input(client_t* client) {
+	message_t message;
+	ssize_t read_size;
+	size_t size;
+	char* end;
+	int state = client->state;
+
+	while (1) {
+		read_size = recv(client->file_descriptor, client->input + client->input_size,
+						 CLIENT_BUFFER_SIZE - client->input_size, 0);
+		if (read_size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (read_size <= 0)
+			return -1;
+		client->input_size += read_size;
+
+		// Handling the messages, each one ends with a \0
+		while ((end = memchr(client->input, '\0', client->input_size)) != NULL) {
+			size = end - client->input + 1;
+			if (size > MAX_BUFFER)
+				return -1;
+			deserialize_message(&message, client->input);
+			memmove(client->input, client->input + size, client->input_size - size);
+			client->input_size -= size;
+
+			handle_message(client, &message);
+
+			// The player has left the server for the court (or the client has been closed)
+			if (client->state != state)
+				return 0;
+		}
+
+		// A message longer than the buffer is not one of the protocol
+		if (client->input_size == CLIENT_BUFFER_SIZE)
+			return -1;
+	}
+}
+
+/**
+ * @fn client_t* client_connect(char* ip, int port, const client_callbacks_t* callbacks, void* user_data)
+ * @brief Starts connecting a client to the server (the requests made meanwhile are sent once connected)
+ * @param ip: server's address
+ * @param port: server's port
+ * @param callbacks: functions called for the messages received
+ * @param user_data: data of the application, kept in the client
+ * @return client_t*: new client, NULL if the connection cannot be started
+ */
+client_t* client_connect(char* ip, int port, const client_callbacks_t* callbacks, void* user_data) {
+	client_t* client = (client_t*) malloc(sizeof(client_t));
+
+	client->state = CLIENT_CONNECTING;
+	client->pending_head = 0;
+	client->points_sent = 0;
+	client->court_id = 0;
+	client->callbacks = callbacks;
+	client->user_data = user_data;
+
+	if (start_connection(client, ip, port) == -1) {
+		free(client);
+		return NULL;
+	}
+
+	return client;
+}
+
+/**
+ * @fn void client_free(client_t* client)
+ * @brief Closes the connection of a client and frees it
+ * @param client: client to free
+ */
+void client_free(client_t* client) {
+	if (client->state != CLIENT_CLOSED)
+		close(client->file_descriptor);
+	free(client);
+}
+
+/**
+ * @fn short client_events(client_t* client)
+ * @brief Gives the events to poll the socket of a client for
+ * @param client: client
+ * @return short: POLLIN, and POLLOUT while connecting or with bytes to send
+ */
+short client_events(client_t* client) {
+	if (client->state == CLIENT_CONNECTING || client->state == CLIENT_CONNECTING_TO_COURT)
+		return POLLOUT;
+
+	return client->output_size > 0 ? POLLIN | POLLOUT : POLLIN;
+}
+
+/**
+ * @fn int client_process(client_t* client, short revents)
+ * @brief Handles the events of the socket of a client: sends what it can, calls the callbacks of the messages received
+ * @param client: client
+ * @param revents: events returned by poll for the socket of the client
+ * @return int: 0, -1 once the connection is closed
+ */
+int client_process(client_t* client, short revents) {
+	socklen_t length = sizeof(int);
+	int error = 0;
+
+	if (client->state == CLIENT_CLOSED)
+		return -1;
+
+	// Finishing the connection
+	if (client->state == CLIENT_CONNECTING || client->state == CLIENT_CONNECTING_TO_COURT) {
+		if (revents == 0)
+			return 0;
+		getsockopt(client->file_descriptor, SOL_SOCKET, SO_ERROR, &error, &length);
+		if (error != 0) {
+			close_client(client);
+			return -1;
+		}
+		client->state = client->state == CLIENT_CONNECTING ? CLIENT_CONNECTED : CLIENT_ON_COURT;
+	}
+
+	if ((revents & (POLLIN | POLLHUP | POLLERR)) && read_input(client) == -1) {
+		close_client(client);
+		return -1;
+	}
+
+	// Sending once connected (the player may have just left the server for the court)
+	if ((client->state == CLIENT_CONNECTED || client->state == CLIENT_ON_COURT) && flush_output(client) == -1) {
+		close_client(client);
+		return -1;
+	}
+
+	return client->state == CLIENT_CLOSED ? -1 : 0;
+}
+
+/**
+ * @fn int client_poll(client_t** clients, int nb_clients, int timeout)
+ * @brief Waits for the events of several clients and handles them
+ * @param clients: clients (the closed ones are skipped)
+ * @param nb_clients: number of clients
+ * @param timeout: maximum wait (ms), -1 to wait for an event
+ * @return int: number of clients with events, -1 on error
+ */
+int client_poll(client_t** clients, int nb_clients, int timeout) {
+	struct pollfd* file_descriptors = (struct pollfd*) malloc(nb_clients * sizeof(struct pollfd));
+	int nb_events, i;
+
+	for (i = 0; i < nb_clients; i++) {
+		file_descriptors[i].fd = clients[i]->state == CLIENT_CLOSED ? -1 : clients[i]->file_descriptor;
+		file_descriptors[i].events = client_events(clients[i]);
+		file_descriptors[i].revents = 0;
+	}
+
+	nb_events = poll(file_descriptors, nb_clients, timeout);
+	for (i = 0; i < nb_clients && nb_events > 0; i++)
+		if (file_descriptors[i].revents != 0)
+			client_process(clients[i], file_descriptors[i].revents);
+
+	free(file_descriptors);
+	return nb_events;
+}
+
+/**
+ * @fn int client_authenticate(client_t* client, int role, char* last_name, char* first_name)
+ * @brief Authenticates a client as a player (HOST_AUTH or INVITED_AUTH) or a spectator (SPECTATOR_AUTH)
+ * @param client: client
+ * @param role: HOST_AUTH, INVITED_AUTH or SPECTATOR_AUTH
+ * @param last_name: player's last name (NULL for a spectator)
+ * @param first_name: player's first name (NULL for a spectator)
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_authenticate(client_t* client, int role, char* last_name, char* first_name) {
+	buffer_t data;
+
+	if (role == SPECTATOR_AUTH)
+		sprintf(data, "%d", role);
+	else
+		snprintf(data, sizeof(buffer_t), "%d:%s:%s", role, last_name, first_name);
+
+	return queue_message(client, AUTH, data, AUTH);
+}
+
+/**
+ * @fn int client_ask_players(client_t* client)
+ * @brief Asks the server for the list of the available players (answered with on_players)
+ * @param client: host player
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_ask_players(client_t* client) {
+	return queue_message(client, ASK_PLAYERS, "", 0);
+}
+
+/**
+ * @fn int client_invite(client_t* client, int player_id)
+ * @brief Invites a player (answered with on_answer, then on_court_found)
+ * @param client: host player
+ * @param player_id: id of the invited player
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_invite(client_t* client, int player_id) {
+	buffer_t data;
+
+	sprintf(data, "%d", player_id);
+	return queue_message(client, PLAY_WITH, data, PLAY_WITH);
+}
+
+/**
+ * @fn int client_answer_invitation(client_t* client, int accepted)
+ * @brief Accepts or refuses the last invitation received
+ * @param client: invited player
+ * @param accepted: 1 to accept, 0 to refuse
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_answer_invitation(client_t* client, int accepted) {
+	return queue_message(client, (char) (accepted ? OK : NOK), "", 0);
+}
+
+/**
+ * @fn int client_join_queue(client_t* client)
+ * @brief Joins the matchmaking queue without a partner (answered with on_answer, on_queued, then on_court_found)
+ * @param client: host player
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_join_queue(client_t* client) {
+	return queue_message(client, QUEUE, "", QUEUE);
+}
+
+/**
+ * @fn long client_send_point(client_t* client)
+ * @brief Sends a point to the court, without waiting for the answers of the previous ones (answered with on_point)
+ * @param client: player on a court
+ * @return long: sequence number of the point, -1 if it cannot be sent
+ */
+long client_send_point(client_t* client) {
+	buffer_t data;
+	trace_t trace;
+	int length;
+
+	if (client->state != CLIENT_ON_COURT && client->state != CLIENT_CONNECTING_TO_COURT)
+		return -1;
+
+	// The point carries its trace to the spectators ("12|9f3a1c2b44d0e1f7.1717584000123456")
+	new_trace(&trace);
+	length = sprintf(data, "%lu|", client->points_sent + 1);
+	format_trace(&trace, data + length, sizeof(buffer_t) - length);
+	if (queue_message(client, INCREMENT_SCORE, data, 0) == -1)
+		return -1;
+	record_span(&trace, TRACE_POINT_SENT, client->court_id);
+
+	return (long) ++client->points_sent;
+}
+
+/**
+ * @fn int client_ask_courts(client_t* client)
+ * @brief Asks the server for the list of the courts (answered with on_courts)
+ * @param client: spectator
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_ask_courts(client_t* client) {
+	return queue_message(client, ASK_COURTS, "", 0);
+}
+
+/**
+ * @fn int client_subscribe(client_t* client, int court_id)
+ * @brief Follows the score of a court (answered with on_answer, then on_score)
+ * @param client: spectator
+ * @param court_id: court's id
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_subscribe(client_t* client, int court_id) {
+	buffer_t data;
+
+	sprintf(data, "%d", court_id);
+	return queue_message(client, SUBSCRIBE, data, SUBSCRIBE);
+}
+
+/**
+ * @fn int client_unsubscribe(client_t* client, int court_id)
+ * @brief Stops following the score of a court (answered with on_answer)
+ * @param client: spectator
+ * @param court_id: court's id
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_unsubscribe(client_t* client, int court_id) {
+	buffer_t data;
+
+	sprintf(data, "%d", court_id);
+	return queue_message(client, UNSUBSCRIBE, data, UNSUBSCRIBE);
+}
@@ -0,0 +1,265 @@
+#ifndef PANTALLA_DEPORTIVA_V2_CLIENT_H
+#define PANTALLA_DEPORTIVA_V2_CLIENT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+
+#include "../socket/data.h"
+#include "../serialization/serialization.h"
+#include "../common/codes.h"
+#include "../trace/trace.h"
+
+/**
+ * @def HOST_AUTH
+ * @brief This code is the one to let the server know that the client is a player (inviting)
+ */
+#define HOST_AUTH 1
+/**
+ * @def INVITED_AUTH
+ * @brief This code is the one to let the server know that the client is a player (invited)
+ */
+#define INVITED_AUTH 2
+/**
+ * @def SPECTATOR_AUTH
+ * @brief This code is the one to let the server know that the client is a spectator
+ */
+#define SPECTATOR_AUTH 4
+
+/**
+ * @def CLIENT_BUFFER_SIZE
+ * @brief Size of the input and output buffers of a client (several messages)
+ */
+#define CLIENT_BUFFER_SIZE (16 * MAX_BUFFER)
+
+/**
+ * @def CLIENT_MAX_PENDING
+ * @brief Number of requests that can wait for the answer of the server
+ */
+#define CLIENT_MAX_PENDING 1024
+
+/**
+ * @def CLIENT_CONNECTING
+ * @brief The client is connecting to the server
+ */
+#define CLIENT_CONNECTING 0
+/**
+ * @def CLIENT_CONNECTED
+ * @brief The client is connected to the server
+ */
+#define CLIENT_CONNECTED 1
+/**
+ * @def CLIENT_CONNECTING_TO_COURT
+ * @brief The player is connecting to the court given by the server
+ */
+#define CLIENT_CONNECTING_TO_COURT 2
+/**
+ * @def CLIENT_ON_COURT
+ * @brief The player is connected to their court
+ */
+#define CLIENT_ON_COURT 3
+/**
+ * @def CLIENT_CLOSED
+ * @brief The connection is closed (by either side)
+ */
+#define CLIENT_CLOSED 4
+
+typedef struct client client_t;
+
+/**
+ * @struct client_callbacks
+ * @brief Functions called by client_process when the server or the court sends something (each one is optional)
+ * @var on_answer: OK (accepted = 1) or NOK to a request (AUTH, PLAY_WITH, QUEUE, SUBSCRIBE or UNSUBSCRIBE)
+ * @var on_player_id: id given to an invited player
+ * @var on_invitation: invitation received by an invited player, answered with client_answer_invitation
+ * @var on_players: list of the available players ("id:last name:first name:...")
+ * @var on_courts: page of the list of the courts (one id per line), more = 1 if the next page has been asked for
+ * @var on_queued: position in the matchmaking queue and estimated wait (s, -1 if unknown)
+ * @var on_court_found: court given to the player, the client connects to it
+ * @var on_point: answer of the court to a point (accepted = 0 while the opponent is not there)
+ * @var on_score: score of a court followed by a spectator
+ * @var on_match_end: end of the match (court's id for a spectator, 0 for a player)
+ * @var on_closed: connection closed, the client can be freed once client_process has returned
+ */
+struct client_callbacks {
+	void (*on_answer)(client_t* client, char request, int accepted, char* data);
+	void (*on_player_id)(client_t* client, int id);
+	void (*on_invitation)(client_t* client, char* last_name, char* first_name);
+	void (*on_players)(client_t* client, char* list);
+	void (*on_courts)(client_t* client, char* list, int more);
+	void (*on_queued)(client_t* client, int position, int wait);
+	void (*on_court_found)(client_t* client, char* ip, int port);
+	void (*on_point)(client_t* client, unsigned long sequence, int accepted);
+	void (*on_score)(client_t* client, int court, char* score);
+	void (*on_match_end)(client_t* client, int court);
+	void (*on_closed)(client_t* client);
+};
+
+/**
+ * @typedef client_callbacks_t
+ * @brief Typedef for the client_callbacks structure
+ */
+typedef struct client_callbacks client_callbacks_t;
+
+/**
+ * @struct client
+ * @brief Session of a player or a spectator, driven without blocking
+ * @var file_descriptor: socket to the server, then to the court for a player
+ * @var state: CLIENT_CONNECTING, CLIENT_CONNECTED, CLIENT_CONNECTING_TO_COURT, CLIENT_ON_COURT or CLIENT_CLOSED
+ * @var input: bytes received, not handled yet
+ * @var input_size: number of bytes in input
+ * @var output: bytes to send, not sent yet
+ * @var output_size: number of bytes in output
+ * @var pending: codes of the requests waiting for OK or NOK, oldest first
+ * @var pending_head: index of the oldest request
+ * @var pending_count: number of requests waiting
+ * @var points_sent: sequence number of the last point sent to the court
+ * @var court_id: id of the player's court (0 before COURT_FOUND)
+ * @var callbacks: functions called for the messages received
+ * @var user_data: data of the application
+ */
+struct client {
+	int file_descriptor;
+	int state;
+	char input[CLIENT_BUFFER_SIZE];
+	size_t input_size;
+	char output[CLIENT_BUFFER_SIZE];
+	size_t output_size;
+	char pending[CLIENT_MAX_PENDING];
+	int pending_head;
+	int pending_count;
+	unsigned long points_sent;
+	int court_id;
+	const client_callbacks_t* callbacks;
+	void* user_data;
+};
+
+/**
+ * @fn client_t* client_connect(char* ip, int port, const client_callbacks_t* callbacks, void* user_data)
+ * @brief Starts connecting a client to the server (the requests made meanwhile are sent once connected)
+ * @param ip: server's address
+ * @param port: server's port
+ * @param callbacks: functions called for the messages received
+ * @param user_data: data of the application, kept in the client
+ * @return client_t*: new client, NULL if the connection cannot be started
+ */
+client_t* client_connect(char* ip, int port, const client_callbacks_t* callbacks, void* user_data);
+
+/**
+ * @fn void client_free(client_t* client)
+ * @brief Closes the connection of a client and frees it
+ * @param client: client to free
+ */
+void client_free(client_t* client);
+
+/**
+ * @fn short client_events(client_t* client)
+ * @brief Gives the events to poll the socket of a client for
+ * @param client: client
+ * @return short: POLLIN, and POLLOUT while connecting or with bytes to send
+ */
+short client_events(client_t* client);
+
+/**
+ * @fn int client_process(client_t* client, short revents)
+ * @brief Handles the events of the socket of a client: sends what it can, calls the callbacks of the messages received
+ * @param client: client
+ * @param revents: events returned by poll for the socket of the client
+ * @return int: 0, -1 once the connection is closed
+ */
+int client_process(client_t* client, short revents);
+
+/**
+ * @fn int client_poll(client_t** clients, int nb_clients, int timeout)
+ * @brief Waits for the events of several clients and handles them
+ * @param clients: clients (the closed ones are skipped)
+ * @param nb_clients: number of clients
+ * @param timeout: maximum wait (ms), -1 to wait for an event
+ * @return int: number of clients with events, -1 on error
+ */
+int client_poll(client_t** clients, int nb_clients, int timeout);
+
+/**
+ * @fn int client_authenticate(client_t* client, int role, char* last_name, char* first_name)
+ * @brief Authenticates a client as a player (HOST_AUTH or INVITED_AUTH) or a spectator (SPECTATOR_AUTH)
+ * @param client: client
+ * @param role: HOST_AUTH, INVITED_AUTH or SPECTATOR_AUTH
+ * @param last_name: player's last name (NULL for a spectator)
+ * @param first_name: player's first name (NULL for a spectator)
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_authenticate(client_t* client, int role, char* last_name, char* first_name);
+
+/**
+ * @fn int client_ask_players(client_t* client)
+ * @brief Asks the server for the list of the available players (answered with on_players)
+ * @param client: host player
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_ask_players(client_t* client);
+
+/**
+ * @fn int client_invite(client_t* client, int player_id)
+ * @brief Invites a player (answered with on_answer, then on_court_found)
+ * @param client: host player
+ * @param player_id: id of the invited player
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_invite(client_t* client, int player_id);
+
+/**
+ * @fn int client_answer_invitation(client_t* client, int accepted)
+ * @brief Accepts or refuses the last invitation received
+ * @param client: invited player
+ * @param accepted: 1 to accept, 0 to refuse
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_answer_invitation(client_t* client, int accepted);
+
+/**
+ * @fn int client_join_queue(client_t* client)
+ * @brief Joins the matchmaking queue without a partner (answered with on_answer, on_queued, then on_court_found)
+ * @param client: host player
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_join_queue(client_t* client);
+
+/**
+ * @fn long client_send_point(client_t* client)
+ * @brief Sends a point to the court, without waiting for the answers of the previous ones (answered with on_point)
+ * @param client: player on a court
+ * @return long: sequence number of the point, -1 if it cannot be sent
+ */
+long client_send_point(client_t* client);
+
+/**
+ * @fn int client_ask_courts(client_t* client)
+ * @brief Asks the server for the list of the courts (answered with on_courts)
+ * @param client: spectator
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_ask_courts(client_t* client);
+
+/**
+ * @fn int client_subscribe(client_t* client, int court_id)
+ * @brief Follows the score of a court (answered with on_answer, then on_score)
+ * @param client: spectator
+ * @param court_id: court's id
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_subscribe(client_t* client, int court_id);
+
+/**
+ * @fn int client_unsubscribe(client_t* client, int court_id)
+ * @brief Stops following the score of a court (answered with on_answer)
+ * @param client: spectator
+ * @param court_id: court's id
+ * @return int: 0 if queued for sending, -1 if the output buffer is full
+ */
+int client_unsubscribe(client_t* client, int court_id);
+
+#endif //PANTALLA_DEPORTIVA_V2_CLIENT_H
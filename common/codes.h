@@ -39,14 +39,19 @@
 #define INFO_PLAYER 6
 /**
  * @def LIST_COURTS
- * @brief Notification code with the list of courts
+ * @brief Notification code with a page of the list of courts (one id per line, then "+<offset>" if another page follows)
  */
 #define LIST_COURTS 7
 /**
  * @def ASK_COURTS
- * @brief Request code for getting the list of courts
+ * @brief Request code for getting the list of courts (from an offset, for the next pages)
  */
 #define ASK_COURTS 8
+/**
+ * @def COURT_LINE_SIZE
+ * @brief Maximum size of a line of LIST_COURTS (an id, or the next page, and '\n')
+ */
+#define COURT_LINE_SIZE 13
 /**
  * @def SUBSCRIBE
  * @brief Request code for subscribing to a court (getting the score updated)
@@ -82,5 +87,25 @@
  * @brief Notification code for the end of a match
  */
 #define END_MATCH 15
+/**
+ * @def QUEUE
+ * @brief Request code for joining the matchmaking queue without a partner
+ */
+#define QUEUE 16
+/**
+ * @def QUEUED
+ * @brief Notification code with the position in the matchmaking queue and the estimated wait
+ */
+#define QUEUED 17
+/**
+ * @def UNSUBSCRIBE
+ * @brief Request code for unsubscribing from a court
+ */
+#define UNSUBSCRIBE 18
+/**
+ * @def REPLICATE
+ * @brief Notification code for a change of the registries, streamed from the primary server to a standby
+ */
+#define REPLICATE 19
 
 #endif //PANTALLA_DEPORTIVA_V2_CODES_H
@@ -1,354 +1,767 @@
 /**
  * @file court.c
- * @brief Court module
+ * @brief Court module, hosting one or several courts with a single event loop
  * @date 2024-05-01
  */
 
 #include "court.h"
 
-socket_t listen_socket, server_socket; // Declared globally to be accessed from functions
+socket_t server_socket; // Declared globally to be accessed from functions
+char* server_ip; // Server's address, to reconnect
+int server_port; // Server's port, to reconnect
+uplink_t uplink; // Messages for the server (for all the courts), sent by a dedicated thread
 
-score_t score; // Global score
-pthread_mutex_t score_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for the score
+court_t* courts; // Courts hosted by the process
+int nb_courts = 1; // Number of courts hosted by the process
+int epoll_fd; // Event loop watching the listen sockets and the players' sockets
+const scoring_format_t* format; // Rules of the matches played on the courts
+long base_window = DEFAULT_COALESCING_WINDOW * 1000L; // Minimum time between two score updates of a court (us)
+journal_t journal; // Points of the courts, to resume their matches after a crash
+leaving_player_t* leaving_players = NULL; // Players whose match is over, until their connections are closed
+volatile sig_atomic_t stopping = 0; // Set by SIGINT, the event loop then closes the court process
 
 int main(int argc, char** argv) {
-	socket_t player1, player2;
-	pthread_t p1_thread, p2_thread;
-	message_t send_msg, received_msg;
-	player_data_t player1_data, player2_data; // Structure used to pass two arguments to the player_thread function
+	struct epoll_event events[16];
+	struct sigaction action;
+	sigset_t interrupt, unblocked;
+	endpoint_t* endpoint;
+	int nb_events, nb_points, i;
 
 	if (argc < 3) {
-		fprintf(stderr, "Usage: %s <ServerIP> <ServerPort>\n", argv[0]);
+		fprintf(stderr, "Usage: %s <ServerIP> <ServerPort> [NbCourts] [Format] [WindowMs] [Journal]\n", argv[0]);
 		return 1;
 	}
 
-	// Connecting to the server
-	server_socket = connect_to(argv[1], atoi(argv[2]));
+	// SIGINT is only received by the event loop, while it waits (the other threads inherit the mask)
+	sigemptyset(&interrupt);
+	sigaddset(&interrupt, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &interrupt, &unblocked);
 
-	// Setting up signal handler to close the socket properly
-	signal(SIGINT, sigint_handler);
+	// The hops of the points seen here are printed on stderr on each SIGUSR2 (kill -USR2)
+	start_trace_dumper();
 
-	// Authenticating
-	authenticate(server_socket);
+	// Events are written by a background thread (threshold from LOG_LEVEL)
+	log_init();
 
-	// Opening listen socket
-	listen_socket = create_listen_socket("0.0.0.0", 0);
+	// Rules of the matches (bo3, bo5, bo3-super, bo3-noad or bo5-advantage)
+	format = find_scoring_format(argc > 4 ? argv[4] : DEFAULT_SCORING_FORMAT);
+	if (format == NULL) {
+		fprintf(stderr, "Unknown format: %s\n", argv[4]);
+		return 1;
+	}
+
+	// Coalescing window of the score updates (0 sends every point)
+	if (argc > 5)
+		base_window = atol(argv[5]) * 1000L;
 
-	// Sending listen port to server
-	send_listen_port(
-			server_socket,
-			ntohs(((struct sockaddr_in*)&listen_socket.local_address)->sin_port)
-	);
+	// Number of courts to host
+	if (argc > 3)
+		nb_courts = atoi(argv[3]);
+	if (nb_courts < 1 || nb_courts > JOURNAL_MAX_COURTS) {
+		fprintf(stderr, "Invalid number of courts: %s (1 to %d)\n", argv[3], JOURNAL_MAX_COURTS);
+		return 1;
+	}
+	courts = (court_t*) calloc(nb_courts, sizeof(court_t));
+
+	// Opening the journal, the matches interrupted by a crash are resumed with their score
+	CHECK(open_journal(&journal, argc > 6 ? argv[6] : DEFAULT_JOURNAL_FILE, nb_courts, format), "Can't open journal");
+	for (i = 0; i < nb_courts; i++) {
+		courts[i].index = i;
+		nb_points = replay_journal(&journal, i, format, &courts[i].score);
+		courts[i].resumed = (nb_points != -1);
+		if (courts[i].resumed)
+			log_message(LOG_INFO, "Court #%d: resuming its match (%d points replayed)", i + 1, nb_points);
+	}
+
+	// Opening the listen sockets, kept across the reconnections to the server
+	for (i = 0; i < nb_courts; i++)
+		courts[i].listen_socket = create_listen_socket("0.0.0.0", 0);
+
+	// A lost server connection is noticed by the uplink, which reconnects
+	signal(SIGPIPE, SIG_IGN);
+
+	// Connecting to the server, then authenticating and registering the courts (they share the socket), SIGINT ending
+	// the process at once if the server cannot be reached
+	server_ip = argv[1];
+	server_port = atoi(argv[2]);
+	pthread_sigmask(SIG_SETMASK, &unblocked, NULL);
+	connect_to_server(&server_socket);
+	pthread_sigmask(SIG_BLOCK, &interrupt, NULL);
+
+	// From now on, only the uplink threads use the server socket
+	start_uplink(&uplink, &server_socket, connect_to_server);
+
+	// Waiting for players on every court
+	CHECK(epoll_fd = epoll_create1(0), "Can't create event loop");
+	for (i = 0; i < nb_courts; i++) {
+		courts[i].listen_endpoint.court = &courts[i];
+		courts[i].listen_endpoint.index = LISTEN_ENDPOINT;
+		courts[i].player_endpoints[0].court = &courts[i];
+		courts[i].player_endpoints[0].index = 0;
+		courts[i].player_endpoints[1].court = &courts[i];
+		courts[i].player_endpoints[1].index = 1;
+		courts[i].nb_players = 0;
+		watch_endpoint(&courts[i].listen_endpoint, courts[i].listen_socket.file_descriptor);
+
+		// The spectators get the score of a resumed match right away
+		if (courts[i].resumed)
+			send_score_to_server(&courts[i]);
+
+		// A match won just before the process stopped is over, the court waits for the next players
+		if (courts[i].resumed && courts[i].score.winner != 0) {
+			courts[i].resumed = 0;
+			report_match_end(&courts[i]);
+		}
+	}
+
+	// Setting up signal handler to close the sockets properly
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = sigint_handler;
+	sigaction(SIGINT, &action, NULL);
+
+	// Event loop: each point is handled as soon as it arrives, on any court, until SIGINT
+	while (!stopping) {
+		// Closing the connections of the players who have not left in time (before any event can point to them)
+		expire_leaving_players();
+
+		nb_events = epoll_pwait(epoll_fd, events, 16, next_timeout(), &unblocked);
+
+		// Sending the delayed score updates that are due
+		for (i = 0; i < nb_courts; i++)
+			update_score(&courts[i], 0);
+
+		if (nb_events == -1)
+			continue; // Interrupted by a signal
+
+		for (i = 0; i < nb_events; i++) {
+			endpoint = (endpoint_t*) events[i].data.ptr;
+
+			if (endpoint->index == LISTEN_ENDPOINT)
+				accept_player(endpoint->court);
+			else if (endpoint->index == CLOSING_ENDPOINT)
+				drain_leaving_player((leaving_player_t*) endpoint, events[i].events);
+			else
+				handle_player_events(endpoint->court, endpoint->index, events[i].events);
+		}
+	}
+
+	// Closing the sockets (the log is written at exit)
+	for (i = 0; i < nb_courts; i++)
+		close(courts[i].listen_socket.file_descriptor);
+	close(server_socket.file_descriptor);
+	log_message(LOG_INFO, "Court closed.");
+
+	return 0;
+}
+
+/**
+ * @fn void connect_to_server(socket_t* socket)
+ * @brief Connects to the server, authenticates and registers the courts, retrying with a growing delay
+ * @param socket: filled with the server socket
+ */
+void connect_to_server(socket_t* socket) {
+	long delay = RECONNECT_MIN_DELAY;
+	int i, registered;
 
 	while (1) {
-		// Waiting for incoming connections (2 players)
-		player1 = accept_client(listen_socket);
-		printf("Player 1 connected\n");
-		player2 = accept_client(listen_socket);
-		printf("Player 2 connected\n");
-
-		// Initializing score
-		init_score();
-
-		// Creating player data for both of them
-		player1_data.socket = &player1;
-		player1_data.player_number = 1;
-		player2_data.socket = &player2;
-		player2_data.player_number = 2;
-
-		// Creating threads for the players
-		pthread_create(&p1_thread, NULL, (void *) player_thread, (void *) &player1_data);
-		pthread_create(&p2_thread, NULL, (void *) player_thread, (void *) &player2_data);
-
-		// Waiting for the game to finish
-		while (!is_match_finished())
-			sleep(1);
-
-		// Send an END_MATCH message to the server
-		send_end_match(server_socket);
+		*socket = create_socket(SOCK_STREAM);
+		addr2struct(&socket->remote_address, server_ip, server_port);
+
+		if (connect(socket->file_descriptor, (struct sockaddr *)&socket->remote_address, sizeof(socket->remote_address)) == 0
+		&& authenticate(*socket) == 0) {
+			for (registered = 1, i = 0; i < nb_courts && registered; i++)
+				registered = (register_court(*socket, &courts[i]) == 0);
+			if (registered)
+				return;
+		}
+
+		close(socket->file_descriptor);
+		log_message(LOG_WARNING, "Can't reach the server, retrying in %ld ms", delay);
+		usleep(delay * 1000);
+		delay = delay * 2 > RECONNECT_MAX_DELAY ? RECONNECT_MAX_DELAY : delay * 2;
 	}
 }
 
 /**
- * @brief Authenticates the spectator
+ * @fn int exchange_with_server(socket_t socket, message_t* message)
+ * @brief Sends a message to the server and waits for its answer, HANDSHAKE_TIMEOUT at most (only used before the event
+ * loop starts, and by the uplink's thread when it reconnects: a lost or silent server is tried again later)
+ * @param socket: server socket
+ * @param message: message to send, filled with the answer
+ * @return int: 0 if answered, -1 otherwise
+ */
+int exchange_with_server(socket_t socket, message_t* message) {
+	struct pollfd answer = {socket.file_descriptor, POLLIN, 0};
+	buffer_t serialized;
+	size_t size;
+
+	serialize_message(message, serialized);
+	size = strlen(serialized) + 1;
+
+	// Without exiting (nor being killed by SIGPIPE) if the server has left meanwhile
+	if (send(socket.file_descriptor, serialized, size, MSG_NOSIGNAL) != (ssize_t) size)
+		return -1;
+
+	if (poll(&answer, 1, HANDSHAKE_TIMEOUT) != 1)
+		return -1;
+
+	return receive_message(&socket, message, deserialize_message) == 0 ? -1 : 0;
+}
+
+/**
+ * @fn int authenticate(socket_t socket)
+ * @brief Authenticates the court process
  * @param socket: Server socket
+ * @return int: 0 if authenticated, -1 otherwise
  */
-void authenticate(socket_t socket) {
+int authenticate(socket_t socket) {
 	message_t message;
 	char data[2];
 
-	sprintf(data, "%d", COURT_AUTH); // Converting SPECTATOR_AUTH to a string
+	sprintf(data, "%d", COURT_AUTH); // Converting COURT_AUTH to a string
 
 	// Preparing the authentication message
 	prepare_message(&message, AUTH, data);
 
-	// Sending the message
-	send_message(&socket, &message, serialize_message);
-
-	// Waiting for the OK response
-	receive_message(&socket, &message, deserialize_message);
+	// Sending the message and waiting for the OK response
+	if (exchange_with_server(socket, &message) == -1 || message.code != (char) OK) {
+		log_message(LOG_ERROR, "Authentication failed");
+		return -1;
+	}
 
-	if (message.code == (char) OK)
-		printf("Authenticated successfully\n");
-	else
-		printf("Authentication failed\n");
+	log_message(LOG_INFO, "Authenticated successfully");
+	return 0;
 }
 
-
 /**
- * @brief Sends the listen port to the server
+ * @fn int register_court(socket_t socket, court_t* court)
+ * @brief Registers a court with the server, which recognizes its key after a reconnection or a restart
  * @param socket: Server socket
- * @param port: Listen port
+ * @param court: court to register (its id is given by the server)
+ * @return int: 0 if registered, -1 otherwise
  */
-void send_listen_port(socket_t socket, int port) {
+int register_court(socket_t socket, court_t* court) {
 	message_t message;
-	char data[6];
+	buffer_t data;
+	int port;
 
-	sprintf(data, "%d", port); // Converting port to a string
+	port = ntohs(((struct sockaddr_in*)&court->listen_socket.local_address)->sin_port);
+
+	// Formatting the port, the format of the matches and the court's key ("4242:bo3:5be1c0de...")
+	sprintf(data, "%d:%s:%llx", port, format->name, (unsigned long long) journal_court_key(&journal, court->index));
 
 	// Preparing the message
 	prepare_message(&message, LISTEN_PORT, data);
 
-	// Sending the message
-	send_message(&socket, &message, serialize_message);
+	// Sending the message and waiting for the OK response, with the court's id
+	if (exchange_with_server(socket, &message) == -1 || message.code != (char) OK) {
+		log_message(LOG_ERROR, "Registration failed");
+		return -1;
+	}
+	// Read by the event loop meanwhile, the messages queued for the old id are sent with the new one
+	atomic_store(&court->id, atoi(message.data));
+	log_message(LOG_INFO, "Court %d is listening on port %d", atomic_load(&court->id), port);
+
+	return 0;
+}
+
+/**
+ * @fn void send_score_to_server(court_t* court)
+ * @brief Queues an update message with the current score of a court and its pending points for the server
+ * @param court: court whose score has changed
+ */
+void send_score_to_server(court_t* court) {
+	char data[MAX_BUFFER - UPLINK_TAG_SIZE];
+	char trace_text[TRACE_TEXT_SIZE];
+	int length;
+
+	// Formatting data, followed by the number of points played and the sequence number (the uplink tags it with the
+	// court's id when it is sent)
+	length = format_match_score(format, &court->score, data, sizeof(data));
+	length += snprintf(data + length, sizeof(data) - length, "|%d|%u",
+			court->pending_points, journal_sequence(&journal, court->index));
+	if (format_trace(&court->pending_trace, trace_text, sizeof(trace_text)) > 0)
+		snprintf(data + length, sizeof(data) - length, "|%s", trace_text);
+	// Formatted examples (sent as "1|30/30:4/2:0/0:0/0|1|57"):
+	// 30/30:4/2:0/0:0/0|1|57
+	// 40/15:6/1:4/2:0/0|5|1204|9f3a1c2b44d0e1f7.1717584000123456
+
+	log_sampled(LOG_SAMPLING, LOG_INFO, "Court %d: %s", court->id, data);
+
+	// Queuing the message, the uplink thread sends it
+	uplink_send(&uplink, SCORE, &court->id, data);
+	record_span(&court->pending_trace, TRACE_COURT_QUEUED, court->id);
+}
+
+/**
+ * @fn long coalescing_window()
+ * @brief Gives the time between two score updates of a court, adapted to the round-trip time to the server
+ * @return long: window (us)
+ */
+long coalescing_window() {
+	long window;
+
+	// No need to send faster than the server answers
+	window = base_window + uplink_rtt(&uplink);
+	if (window > MAX_COALESCING_WINDOW * 1000L)
+		window = MAX_COALESCING_WINDOW * 1000L;
+
+	return window;
+}
+
+/**
+ * @fn void update_score(court_t* court, int force)
+ * @brief Sends the pending points of a court, unless an update was sent less than a window ago
+ * @param court: court whose score has changed
+ * @param force: 1 to send the pending points right away
+ */
+void update_score(court_t* court, int force) {
+	long now;
+
+	if (court->pending_points == 0)
+		return;
+
+	// A point after a quiet period is sent right away, the next ones wait for the end of the window
+	now = monotonic_time();
+	if (!force && now - court->last_update < coalescing_window())
+		return;
+
+	send_score_to_server(court);
+	court->pending_points = 0;
+	court->pending_trace.id = 0;
+	court->last_update = now;
+}
+
+/**
+ * @fn int next_timeout()
+ * @brief Gives the time until the next delayed score update, or the next deadline of a player leaving, is due
+ * @return int: timeout for the event loop (ms), -1 if nothing is due
+ */
+int next_timeout() {
+	long now = monotonic_time(), window = coalescing_window(), due, timeout = -1;
+	leaving_player_t* leaving;
+	int i;
+
+	for (i = 0; i < nb_courts; i++) {
+		if (courts[i].pending_points == 0)
+			continue;
+
+		// Rounding up, so the update is due when the loop wakes up
+		due = courts[i].last_update + window - now;
+		due = due <= 0 ? 0 : (due + 999) / 1000;
+		if (timeout == -1 || due < timeout)
+			timeout = due;
+	}
+
+	for (leaving = leaving_players; leaving != NULL; leaving = leaving->next) {
+		due = leaving->deadline - now;
+		due = due <= 0 ? 0 : (due + 999) / 1000;
+		if (timeout == -1 || due < timeout)
+			timeout = due;
+	}
+
+	return (int) timeout;
 }
 
 /**
- * @fn void init_score(score_t *score)
- * @brief Initializes the score structure
+ * @fn void watch_endpoint(endpoint_t* endpoint, int file_descriptor)
+ * @brief Adds a socket to the event loop
+ * @param endpoint: endpoint of the socket
+ * @param file_descriptor: socket's file descriptor
  */
-void init_score() {
-	pthread_mutex_lock(&score_mutex);
-
-	score.player1 = LOVE;
-	score.player2 = LOVE;
-	score.player1_games[0] = 0;
-	score.player1_games[1] = 0;
-	score.player1_games[2] = 0;
-	score.player2_games[0] = 0;
-	score.player2_games[1] = 0;
-	score.player2_games[2] = 0;
-	score.player1_sets = 0;
-	score.player2_sets = 0;
-	score.current_set = 0;
-
-	pthread_mutex_unlock(&score_mutex);
+void watch_endpoint(endpoint_t* endpoint, int file_descriptor) {
+	struct epoll_event event;
+
+	event.events = EPOLLIN;
+	event.data.ptr = endpoint;
+	CHECK(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, file_descriptor, &event), "Can't watch socket");
 }
 
 /**
- * @fn int is_match_finished()
- * @brief Checks if the match is finished by looking at the sets won by each player
- * @return 1 if the match is finished, 0 otherwise
+ * @fn void watch_output(endpoint_t* endpoint, int file_descriptor, size_t output_size)
+ * @brief Watches a socket for writing as long as it has bytes waiting to be sent, and for reading
+ * @param endpoint: endpoint of the socket
+ * @param file_descriptor: socket's file descriptor
+ * @param output_size: number of bytes waiting to be sent
  */
-int is_match_finished() {
-	return (score.player1_sets == 2 || score.player2_sets == 2);
+void watch_output(endpoint_t* endpoint, int file_descriptor, size_t output_size) {
+	struct epoll_event event;
+
+	event.events = output_size > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN;
+	event.data.ptr = endpoint;
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, file_descriptor, &event);
 }
 
 /**
- * @fn void increment_score(int player)
- * @brief Increments the score of a player
- * @param player: Player to increment the score (1 or 2)
+ * @fn int flush_output(int file_descriptor, char* output, size_t* output_size)
+ * @brief Sends what the socket of a player takes without blocking, the rest stays in the output
+ * @param file_descriptor: player's socket
+ * @param output: bytes to send
+ * @param output_size: number of bytes to send (updated)
+ * @return int: 0 if the connection is fine, -1 if it is lost
  */
-void increment_score(int player) {
-	int *player_score, *opponent_score, *player_games, *opponent_games, *player_sets;
+int flush_output(int file_descriptor, char* output, size_t* output_size) {
+	ssize_t write_size;
 
-	pthread_mutex_lock(&score_mutex);
+	while (*output_size > 0) {
+		write_size = send(file_descriptor, output, *output_size, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (write_size == -1)
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
 
-	if (player == 1) {
-		player_score = &score.player1;
-		opponent_score = &score.player2;
-		player_games = score.player1_games;
-		opponent_games = score.player2_games;
-		player_sets = &score.player1_sets;
+		*output_size -= write_size;
+		memmove(output, output + write_size, *output_size);
 	}
-	else {
-		player_score = &score.player2;
-		opponent_score = &score.player1;
-		player_games = score.player2_games;
-		opponent_games = score.player1_games;
-		player_sets = &score.player2_sets;
+
+	return 0;
+}
+
+/**
+ * @fn void send_to_player(court_t* court, int index, char code, char* data)
+ * @brief Sends a message to a player without blocking the event loop (what their socket cannot take yet is sent once
+ * it can)
+ * @param court: court of the player
+ * @param index: player's index (0 or 1)
+ * @param code: message code
+ * @param data: message data
+ */
+void send_to_player(court_t* court, int index, char code, char* data) {
+	player_connection_t* player = &court->players[index];
+	message_t message;
+	buffer_t serialized;
+	size_t size, pending = player->output_size;
+
+	prepare_message(&message, code, data);
+	serialize_message(&message, serialized);
+	size = strlen(serialized) + 1;
+
+	// A player who does not read their answers is disconnected (the event loop then sees them leave)
+	if (player->output_size + size > PLAYER_BUFFER_SIZE) {
+		log_message(LOG_WARNING, "Court %d: player %d does not read their answers", court->id, index + 1);
+		shutdown(player->socket.file_descriptor, SHUT_RDWR);
+		return;
 	}
+	memcpy(player->output + player->output_size, serialized, size);
+	player->output_size += size;
+
+	if (flush_output(player->socket.file_descriptor, player->output, &player->output_size) == -1)
+		shutdown(player->socket.file_descriptor, SHUT_RDWR);
+	else if ((pending == 0) != (player->output_size == 0))
+		watch_output(&court->player_endpoints[index], player->socket.file_descriptor, player->output_size);
+}
 
-	switch (*player_score) {
-		case LOVE:
-		case FIFTEEN:
-		case THIRTY:
-			(*player_score)++;
-			break;
-		case FORTY:
-			if (*opponent_score == FORTY)
-				*player_score = ADVANTAGE;
-			else if (*opponent_score == ADVANTAGE)
-				*opponent_score = FORTY;
-			else {
-				player_games[score.current_set]++;
-				*player_score = LOVE;
-				*opponent_score = LOVE;
-			}
-			break;
-		case ADVANTAGE:
-			player_games[score.current_set]++;
-			*player_score = LOVE;
-			*opponent_score = LOVE;
-			break;
+/**
+ * @fn void accept_player(court_t* court)
+ * @brief Accepts a player on a court, the match starts once both players are connected
+ * @param court: court whose listen socket is readable
+ */
+void accept_player(court_t* court) {
+	player_connection_t* player = &court->players[court->nb_players];
+	socklen_t address_size = sizeof(struct sockaddr_in);
+	int index = court->nb_players, no_delay = 1;
+
+	// A player who has given up before being accepted is no reason to stop
+	player->socket.file_descriptor = accept(court->listen_socket.file_descriptor,
+											(struct sockaddr *)&player->socket.remote_address, &address_size);
+	if (player->socket.file_descriptor == -1)
+		return;
+	player->socket.mode = SOCK_STREAM;
+	player->input_size = 0;
+	player->output_size = 0;
+
+	// Never blocking the event loop (the other courts), and answering each point at once: the player may have sent
+	// the next ones already
+	fcntl(player->socket.file_descriptor, F_SETFL, fcntl(player->socket.file_descriptor, F_GETFL) | O_NONBLOCK);
+	setsockopt(player->socket.file_descriptor, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+	watch_endpoint(&court->player_endpoints[index], player->socket.file_descriptor);
+	court->nb_players++;
+	log_message(LOG_INFO, "Court %d: player %d connected", court->id, index + 1);
+
+	// Starting the match, the next players wait in the backlog of the listen socket
+	if (court->nb_players == 2) {
+		if (!court->resumed) {
+			init_match_score(&court->score);
+			journal_append(&journal, court->index, MATCH_START_RECORD, 0);
+		}
+		court->resumed = 0;
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, court->listen_socket.file_descriptor, NULL);
 	}
+}
 
-	// If the set is finished, increment the current set (and increment the winner's set count)
-	if ((player_games[score.current_set] == 6 && opponent_games[score.current_set] <= 4)
-	|| (player_games[score.current_set] == 7)) {
-		score.current_set++;
-		(*player_sets)++;
+/**
+ * @fn void player_left(court_t* court, int index)
+ * @brief Ends the match of a player who has left (before the match, the court waits for them again)
+ * @param court: court of the player
+ * @param index: player's index (0 or 1)
+ */
+void player_left(court_t* court, int index) {
+	log_message(LOG_INFO, "Court %d: player %d has left", court->id, index + 1);
+
+	// Before the match, nothing was played: the court stays reserved for the pair, and waits for the player again
+	if (court->nb_players < 2) {
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, court->players[index].socket.file_descriptor, NULL);
+		close(court->players[index].socket.file_descriptor);
+		court->nb_players = 0;
+		return;
+	}
+
+	end_match(court);
+}
+
+/**
+ * @fn void handle_player_events(court_t* court, int index, uint32_t events)
+ * @brief Sends the answers waiting for a player and reads their messages, without blocking
+ * @param court: court of the player
+ * @param index: player's index (0 or 1)
+ * @param events: events of the player's socket
+ */
+void handle_player_events(court_t* court, int index, uint32_t events) {
+	player_connection_t* player = &court->players[index];
+	message_t received_msg;
+	char *frame, *end;
+	ssize_t read_size;
+
+	// Event of a player whose match has just ended in the same batch
+	if (index >= court->nb_players)
+		return;
+
+	// Sending the answers the player's socket could not take before
+	if (events & EPOLLOUT) {
+		if (flush_output(player->socket.file_descriptor, player->output, &player->output_size) == -1) {
+			player_left(court, index);
+			return;
+		}
+		if (player->output_size == 0)
+			watch_output(&court->player_endpoints[index], player->socket.file_descriptor, 0);
 	}
 
-	printf("Score incremented by player %d\n", player);
-	printf("New score : %d/%d:%d/%d:%d/%d:%d/%d\n",
-			score.player1, score.player2,
-			score.player1_games[0], score.player2_games[0],
-			score.player1_games[1], score.player2_games[1],
-			score.player1_games[2], score.player2_games[2]);
+	if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+		return;
+
+	// Reading what has arrived (the end of the stream, or an error, is the player leaving)
+	read_size = recv(player->socket.file_descriptor, player->input + player->input_size,
+					 PLAYER_BUFFER_SIZE - player->input_size, MSG_DONTWAIT);
+	if (read_size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	if (read_size <= 0) {
+		player_left(court, index);
+		return;
+	}
+	player->input_size += read_size;
+
+	// Handling each complete message, an incomplete one waits for the rest
+	frame = player->input;
+	while ((end = memchr(frame, '\0', player->input_size - (frame - player->input))) != NULL) {
+		if (end - frame >= MAX_BUFFER - 1) {
+			log_message(LOG_WARNING, "Court %d: message too long from player %d", court->id, index + 1);
+			player_left(court, index);
+			return;
+		}
+		deserialize_message(&received_msg, frame);
+		frame = end + 1;
+
+		// Once the match is over, the rest is not read
+		if (handle_player_message(court, index, &received_msg) == -1)
+			return;
+	}
 
-	pthread_mutex_unlock(&score_mutex);
+	player->input_size -= frame - player->input;
+	memmove(player->input, frame, player->input_size);
+	if (player->input_size >= MAX_BUFFER - 1) {
+		log_message(LOG_WARNING, "Court %d: message too long from player %d", court->id, index + 1);
+		player_left(court, index);
+	}
 }
 
 /**
- * @fn void send_score_to_server()
- * @brief Sends an update message to the server with the current score
+ * @fn int handle_player_message(court_t* court, int index, message_t* received_msg)
+ * @brief Handles a message from a player (INCREMENT_SCORE)
+ * @param court: court of the player
+ * @param index: player's index (0 or 1)
+ * @param received_msg: message received
+ * @return int: 0 if the match goes on, -1 if it is over
  */
-void send_score_to_server() {
-	message_t send_msg;
-	buffer_t data;
-	char formatted_p1_score[5], formatted_p2_score[5];
-
-	pthread_mutex_lock(&score_mutex);
-
-	switch (score.player1) {
-		case LOVE:
-			strcpy(formatted_p1_score, "0");
-			break;
-		case FIFTEEN:
-			strcpy(formatted_p1_score, "15");
-			break;
-		case THIRTY:
-			strcpy(formatted_p1_score, "30");
-			break;
-		case FORTY:
-			strcpy(formatted_p1_score, "40");
-			break;
-		case ADVANTAGE:
-			strcpy(formatted_p1_score, "ADV");
-			break;
+int handle_player_message(court_t* court, int index, message_t* received_msg) {
+	char* trace_text;
+	trace_t trace;
+
+	if (received_msg->code != (char) INCREMENT_SCORE) {
+		log_message(LOG_WARNING, "Court %d: received unknown message from player %d: %d", court->id, index + 1, received_msg->code);
+		return 0;
 	}
-	switch (score.player2) {
-		case LOVE:
-			strcpy(formatted_p2_score, "0");
-			break;
-		case FIFTEEN:
-			strcpy(formatted_p2_score, "15");
-			break;
-		case THIRTY:
-			strcpy(formatted_p2_score, "30");
-			break;
-		case FORTY:
-			strcpy(formatted_p2_score, "40");
-			break;
-		case ADVANTAGE:
-			strcpy(formatted_p2_score, "ADV");
-			break;
+
+	// Points only count once both players are there (the answer carries the point's sequence number, if any)
+	if (court->nb_players < 2) {
+		send_to_player(court, index, (char) NOK, received_msg->data);
+		return 0;
 	}
 
-	// Formatting data
-	sprintf(data, "%s/%s:%d/%d:%d/%d:%d/%d",
-			formatted_p1_score, formatted_p2_score,
-			score.player1_games[0], score.player2_games[0],
-			score.player1_games[1], score.player2_games[1],
-			score.player1_games[2], score.player2_games[2]
-	);
-	// Formatted examples:
-	// 30/30:4/2:0/0:0/0
-	// 40/15:6/1:4/2:0/0
-
-	pthread_mutex_unlock(&score_mutex);
-
-	// Sending message
-	prepare_message(&send_msg, SCORE, data);
-	send_message(&server_socket, &send_msg, serialize_message);
-
-	// Waiting for OK
-	receive_message(&server_socket, &send_msg, deserialize_message);
-	if (send_msg.code == (char) OK)
-		printf("Score sent to the server successfully.\n");
-	else
-		printf("Server has answered NOK when updating the score.\n");
+	// The point's trace follows its sequence number ("12|9f3a1c2b44d0e1f7.1717584000123456")
+	trace_text = strchr(received_msg->data, '|');
+	parse_trace(trace_text == NULL ? NULL : trace_text + 1, &trace);
+	record_span(&trace, TRACE_COURT_RECEIVED, court->id);
+
+	// Incrementing the score, the server gets it now or with the next points (with the trace of the oldest one)
+	journal_append(&journal, court->index, POINT_RECORD, index + 1);
+	court->pending_points++;
+	if (court->pending_trace.id == 0)
+		court->pending_trace = trace;
+	if (score_point(format, &court->score, index + 1)) {
+		end_match(court);
+		return -1;
+	}
+	update_score(court, 0);
+
+	// Answering OK to the player, who may have sent the next points already
+	send_to_player(court, index, (char) OK, received_msg->data);
+	return 0;
 }
 
 /**
- * @fn void player_thread(void* player_data)
- * @brief Thread for the player
- * @param player_data: Structure containing the player's socket and number
+ * @fn void release_player(court_t* court, int index)
+ * @brief Closes the connection of a player once they have read END_MATCH (closing it with their next points unread would reset it, END_MATCH with it)
+ * @param court: court of the player
+ * @param index: player's index (0 or 1)
  */
-void player_thread(void* player_data) {
-	player_data_t* player = ((player_data_t*) player_data);
-	message_t received_msg, send_msg;
+void release_player(court_t* court, int index) {
+	leaving_player_t* leaving = (leaving_player_t*) malloc(sizeof(leaving_player_t));
+	player_connection_t* player = &court->players[index];
+
+	leaving->endpoint.court = court;
+	leaving->endpoint.index = CLOSING_ENDPOINT;
+	leaving->endpoint.file_descriptor = player->socket.file_descriptor;
+
+	// The answers not sent yet, END_MATCH last, go before the end of the stream
+	memcpy(leaving->output, player->output, player->output_size);
+	leaving->output_size = player->output_size;
+	player->output_size = 0;
+
+	// A player who never reads nor closes is not waited for longer than CLOSING_TIMEOUT
+	leaving->deadline = monotonic_time() + CLOSING_TIMEOUT * 1000L;
+	leaving->next = leaving_players;
+	leaving_players = leaving;
+
+	// The player sees the end of the stream after END_MATCH, and closes first
+	if (leaving->output_size == 0)
+		shutdown(leaving->endpoint.file_descriptor, SHUT_WR);
+	watch_endpoint(&leaving->endpoint, leaving->endpoint.file_descriptor);
+	watch_output(&leaving->endpoint, leaving->endpoint.file_descriptor, leaving->output_size);
+}
 
-	// Waiting for any score-increment update
-	while (1) {
-		printf("Waiting for a message from player %d...\n", player->player_number);
-		receive_message(player->socket, &received_msg, deserialize_message);
-
-		if (received_msg.code == (char) INCREMENT_SCORE) {
-			if (!is_match_finished()) {
-				// Incrementing the score
-				increment_score(player->player_number);
-
-				// Sending the updated score to the server
-				send_score_to_server();
-
-				// Answering OK to the player
-				prepare_message(&send_msg, (char) OK, "");
-				send_message(player->socket, &send_msg, serialize_message);
-			}
-			else {
-				// Answering the player the match is finished
-				prepare_message(&send_msg, (char) END_MATCH, "");
-				send_message(player->socket, &send_msg, serialize_message);
-				break;
-			}
+/**
+ * @fn void drain_leaving_player(leaving_player_t* leaving, uint32_t events)
+ * @brief Sends what a player whose match is over has not received yet, discards what they still send, and closes the
+ * connection once they have
+ * @param leaving: player leaving
+ * @param events: events of the player's socket
+ */
+void drain_leaving_player(leaving_player_t* leaving, uint32_t events) {
+	int file_descriptor = leaving->endpoint.file_descriptor;
+	char discarded[MAX_BUFFER];
+	ssize_t read_size = 1;
+
+	// Sending the rest, then the end of the stream
+	if ((events & EPOLLOUT) && leaving->output_size > 0) {
+		if (flush_output(file_descriptor, leaving->output, &leaving->output_size) == -1)
+			read_size = 0;
+		else if (leaving->output_size == 0) {
+			shutdown(file_descriptor, SHUT_WR);
+			watch_output(&leaving->endpoint, file_descriptor, 0);
 		}
-		else
-			fprintf(stderr, "Received unknown message from player %d: %d\n", player->player_number, received_msg.code);
 	}
 
-	printf("Match ended!\n");
+	if (read_size != 0 && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+		read_size = recv(file_descriptor, discarded, sizeof(discarded), MSG_DONTWAIT);
+		if (read_size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			read_size = 1;
+	}
+	if (read_size > 0)
+		return;
+
+	close_leaving_player(leaving);
 }
 
 /**
- * @fn void send_end_match(socket_t socket)
- * @brief Sends an END_MATCH message to the server
- * @param socket: Server socket
+ * @fn void close_leaving_player(leaving_player_t* leaving)
+ * @brief Closes the connection of a player whose match is over
+ * @param leaving: player leaving
  */
-void send_end_match(socket_t socket) {
-	message_t message;
+void close_leaving_player(leaving_player_t* leaving) {
+	leaving_player_t** current;
+
+	for (current = &leaving_players; *current != leaving; current = &(*current)->next);
+	*current = leaving->next;
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, leaving->endpoint.file_descriptor, NULL);
+	close(leaving->endpoint.file_descriptor);
+	free(leaving);
+}
+
+/**
+ * @fn void expire_leaving_players()
+ * @brief Closes the connections of the players leaving who are past their deadline (reset, they do not read)
+ */
+void expire_leaving_players() {
+	struct linger reset = {1, 0};
+	leaving_player_t *leaving, *next;
+	long now = monotonic_time();
+
+	for (leaving = leaving_players; leaving != NULL; leaving = next) {
+		next = leaving->next;
+		if (leaving->deadline > now)
+			continue;
+
+		// Without waiting for the bytes they have not read to be sent
+		log_message(LOG_WARNING, "Court %d: a player has not left in time", leaving->endpoint.court->id);
+		setsockopt(leaving->endpoint.file_descriptor, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+		close_leaving_player(leaving);
+	}
+}
+
+/**
+ * @fn void report_match_end(court_t* court)
+ * @brief Writes the end of the match of a court in the journal, and sends END_MATCH to the server (the court is given
+ * to the next players)
+ * @param court: court whose match is over
+ */
+void report_match_end(court_t* court) {
+	buffer_t data;
+
+	journal_append(&journal, court->index, MATCH_END_RECORD, 0);
+
+	sprintf(data, "%u", journal_sequence(&journal, court->index));
+	uplink_send(&uplink, END_MATCH, &court->id, data);
+	log_message(LOG_INFO, "Court %d: match ended.", court->id);
+}
+
+/**
+ * @fn void end_match(court_t* court)
+ * @brief Ends the match: END_MATCH to the players and the server, then waits for the next players
+ * @param court: court whose match is over (both players are there)
+ */
+void end_match(court_t* court) {
+	int i;
 
-	// Sending END_MATCH
-	prepare_message(&message, END_MATCH, "");
-	send_message(&socket, &message, serialize_message);
+	// The final score goes before END_MATCH
+	update_score(court, 1);
 
-	// Waiting for OK
-	receive_message(&socket, &message, deserialize_message);
-	if (message.code == (char) OK)
-		printf("Match ended successfully (server is OK).\n");
-	else
-		printf("Match ended unsuccessfully (server is NOK). Please reload the court.\n");
+	// Letting the players know the match is over
+	for (i = 0; i < court->nb_players; i++) {
+		send_to_player(court, i, END_MATCH, "");
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, court->players[i].socket.file_descriptor, NULL);
+		release_player(court, i);
+	}
+	court->nb_players = 0;
+	report_match_end(court);
+
+	// Waiting for the next players
+	watch_endpoint(&court->listen_endpoint, court->listen_socket.file_descriptor);
 }
 
 /**
  * @fn void sigint_handler(int signum)
- * @brief Signal handler for SIGINT, closing the socket properly
+ * @brief Signal handler for SIGINT, asking the event loop to close the court process (only async-signal-safe code here)
  * @param signum: unused
  */
 void sigint_handler(int signum) {
-	close(listen_socket.file_descriptor);
-	close(server_socket.file_descriptor);
-	printf("\nCourt closed.\n");
-	exit(0);
-}
\ No newline at end of file
+	stopping = 1;
+}
@@ -2,82 +2,179 @@
 #define PANTALLA_DEPORTIVA_V2_COURT_H
 
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <signal.h>
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
 
 #include "../socket/data.h"
 #include "../serialization/serialization.h"
 #include "../common/codes.h"
+#include "../log/log.h"
+#include "../trace/trace.h"
+#include "../scoring/scoring.h"
+#include "uplink.h"
+#include "journal.h"
 
 /**
- * @def LOVE
- * @brief Score of 0 points
+ * @struct endpoint
+ * @brief Socket of a court watched by the event loop
+ * @var court: court the socket belongs to
+ * @var index: player's index (0 or 1), LISTEN_ENDPOINT for the listen socket, or CLOSING_ENDPOINT
+ * @var file_descriptor: socket of a player leaving (CLOSING_ENDPOINT only)
  */
-#define LOVE 0
+struct endpoint {
+	struct court* court;
+	int index;
+	int file_descriptor;
+};
+
 /**
- * @def FIFTEEN
- * @brief Score of 15 point
+ * @typedef endpoint_t
+ * @brief Typedef for the endpoint structure
  */
-#define FIFTEEN 1
+typedef struct endpoint endpoint_t;
+
 /**
- * @def THIRTY
- * @brief Score of 30 points
+ * @def PLAYER_BUFFER_SIZE
+ * @brief Size of the buffers of a player's connection (several messages)
  */
-#define THIRTY 2
+#define PLAYER_BUFFER_SIZE (4 * MAX_BUFFER)
+
 /**
- * @def FORTY
- * @brief Score of 40 points
+ * @struct player_connection
+ * @brief Non-blocking connection of a player
+ * @var socket: player's socket
+ * @var input: bytes received, the last message may be incomplete
+ * @var input_size: number of bytes received
+ * @var output: answers not sent yet
+ * @var output_size: number of bytes not sent yet
  */
-#define FORTY 3
+struct player_connection {
+	socket_t socket;
+	char input[PLAYER_BUFFER_SIZE];
+	size_t input_size;
+	char output[PLAYER_BUFFER_SIZE];
+	size_t output_size;
+};
+
 /**
- * @def ADVANTAGE
- * @brief When a player has the advantage (one point after 40)
+ * @typedef player_connection_t
+ * @brief Typedef for the player_connection structure
  */
-#define ADVANTAGE 4
+typedef struct player_connection player_connection_t;
 
 /**
- * @struct score
- * @brief Structure to store the score of the match
- * @var player1: Score of player 1
- * @var player2: Score of player 2
- * @var player1_games: Array with the games won by player 1 in each set
- * @var player2_games: Array with the games won by player 2 in each set
- * @var player1_sets: Number of sets won by player 1
- * @var player2_sets: Number of sets won by player 2
- * @var current_set: Current set being played (0, 1 or 2)
+ * @struct leaving_player
+ * @brief Player whose match is over, their connection is closed once they have read END_MATCH
+ * @var endpoint: endpoint of the player (CLOSING_ENDPOINT, first for the event loop)
+ * @var output: answers not sent yet, END_MATCH last
+ * @var output_size: number of bytes not sent yet
+ * @var deadline: time the connection is closed at, even if the player has not closed it (us)
+ * @var next: next player leaving
  */
-struct score {
-	int player1;
-	int player2;
-	int player1_games[3];
-	int player2_games[3];
-	int player1_sets;
-	int player2_sets;
-	int current_set;
+struct leaving_player {
+	endpoint_t endpoint;
+	char output[PLAYER_BUFFER_SIZE];
+	size_t output_size;
+	long deadline;
+	struct leaving_player* next;
 };
 
 /**
- * @typedef score_t
- * @brief Typedef for the score structure
+ * @typedef leaving_player_t
+ * @brief Typedef for the leaving_player structure
  */
-typedef struct score score_t;
+typedef struct leaving_player leaving_player_t;
 
 /**
- * @struct player_data
- * @brief Structure to store the player's socket and number
- * @var socket: Player's socket
- * @var player_number: Player's number (1 or 2)
+ * @def LISTEN_ENDPOINT
+ * @brief Index of the endpoint of the listen socket
  */
-struct player_data {
-	socket_t* socket;
-	int player_number;
+#define LISTEN_ENDPOINT -1
+
+/**
+ * @def CLOSING_ENDPOINT
+ * @brief Index of the endpoint of a player whose match is over, closed once they have read END_MATCH
+ */
+#define CLOSING_ENDPOINT -2
+
+/**
+ * @struct court
+ * @brief Structure of a court hosted by the process
+ * @var id: court's id, given by the server (again by the uplink's thread at each reconnection)
+ * @var index: court's index in the process (and in the journal)
+ * @var listen_socket: socket the players connect to
+ * @var players: players' connections
+ * @var nb_players: number of players connected (the match starts with 2)
+ * @var score: score of the match
+ * @var resumed: 1 if the score is the one of a match interrupted by the end of the process
+ * @var pending_points: points played since the last score update sent to the server
+ * @var pending_trace: trace of the oldest pending point that has one (id 0 if none), carried by the next update
+ * @var last_update: time the last score update was sent at (us)
+ * @var listen_endpoint: endpoint of the listen socket
+ * @var player_endpoints: endpoints of the players' sockets
+ */
+struct court {
+	atomic_int id;
+	int index;
+	socket_t listen_socket;
+	player_connection_t players[2];
+	int nb_players;
+	match_score_t score;
+	int resumed;
+	int pending_points;
+	trace_t pending_trace;
+	long last_update;
+	endpoint_t listen_endpoint;
+	endpoint_t player_endpoints[2];
 };
 
 /**
- * @typedef player_data_t
- * @brief Typedef for the player_data structure
+ * @typedef court_t
+ * @brief Typedef for the court structure
+ */
+typedef struct court court_t;
+
+/**
+ * @def DEFAULT_COALESCING_WINDOW
+ * @brief Minimum time between two score updates of a court (ms), the points in between are sent together
  */
-typedef struct player_data player_data_t;
+#define DEFAULT_COALESCING_WINDOW 20
+
+/**
+ * @def MAX_COALESCING_WINDOW
+ * @brief Maximum time between two score updates of a court (ms), whatever the round-trip time
+ */
+#define MAX_COALESCING_WINDOW 250
+
+/**
+ * @def RECONNECT_MIN_DELAY
+ * @brief Delay before the first new attempt to reach the server (ms), doubled after each failure
+ */
+#define RECONNECT_MIN_DELAY 100
+
+/**
+ * @def RECONNECT_MAX_DELAY
+ * @brief Maximum delay between two attempts to reach the server (ms)
+ */
+#define RECONNECT_MAX_DELAY 5000
+
+/**
+ * @def CLOSING_TIMEOUT
+ * @brief Maximum time given to a player whose match is over to read END_MATCH and close their connection (ms)
+ */
+#define CLOSING_TIMEOUT 2000
+
+/**
+ * @def HANDSHAKE_TIMEOUT
+ * @brief Maximum time to wait for an answer of the server while connecting to it (ms)
+ */
+#define HANDSHAKE_TIMEOUT 2000
 
 /**
  * @def COURT_AUTH
@@ -86,61 +183,188 @@ typedef struct player_data player_data_t;
 #define COURT_AUTH 3 // Court code for authentication
 
 /**
- * @brief Authenticates the spectator
+ * @fn void connect_to_server(socket_t* socket)
+ * @brief Connects to the server, authenticates and registers the courts, retrying with a growing delay
+ * @param socket: filled with the server socket
+ */
+void connect_to_server(socket_t* socket);
+
+/**
+ * @fn int exchange_with_server(socket_t socket, message_t* message)
+ * @brief Sends a message to the server and waits for its answer, HANDSHAKE_TIMEOUT at most (only used before the event
+ * loop starts, and by the uplink's thread when it reconnects: a lost or silent server is tried again later)
+ * @param socket: server socket
+ * @param message: message to send, filled with the answer
+ * @return int: 0 if answered, -1 otherwise
+ */
+int exchange_with_server(socket_t socket, message_t* message);
+
+/**
+ * @fn int authenticate(socket_t socket)
+ * @brief Authenticates the court process
  * @param socket: Server socket
+ * @return int: 0 if authenticated, -1 otherwise
  */
-void authenticate(socket_t socket);
+int authenticate(socket_t socket);
 
 /**
- * @brief Sends the listen port to the server
+ * @fn int register_court(socket_t socket, court_t* court)
+ * @brief Registers a court with the server, which recognizes its key after a reconnection or a restart
  * @param socket: Server socket
- * @param port: Listen port
+ * @param court: court to register (its id is given by the server)
+ * @return int: 0 if registered, -1 otherwise
  */
-void send_listen_port(socket_t socket, int port);
+int register_court(socket_t socket, court_t* court);
 
 /**
- * @fn void init_score(score_t *score)
- * @brief Initializes the score structure
+ * @fn void send_score_to_server(court_t* court)
+ * @brief Queues an update message with the current score of a court and its pending points for the server
+ * @param court: court whose score has changed
  */
-void init_score();
+void send_score_to_server(court_t* court);
 
 /**
- * @fn int is_match_finished()
- * @brief Checks if the match is finished by looking at the sets won by each player
- * @return 1 if the match is finished, 0 otherwise
+ * @fn long coalescing_window()
+ * @brief Gives the time between two score updates of a court, adapted to the round-trip time to the server
+ * @return long: window (us)
  */
-int is_match_finished();
+long coalescing_window();
 
 /**
- * @fn void increment_score(int player)
- * @brief Increments the score of a player
- * @param player: Player to increment the score (1 or 2)
+ * @fn void update_score(court_t* court, int force)
+ * @brief Sends the pending points of a court, unless an update was sent less than a window ago
+ * @param court: court whose score has changed
+ * @param force: 1 to send the pending points right away
  */
-void increment_score(int player);
+void update_score(court_t* court, int force);
 
 /**
- * @fn void send_score_to_server()
- * @brief Sends an update message to the server with the current score
+ * @fn int next_timeout()
+ * @brief Gives the time until the next delayed score update, or the next deadline of a player leaving, is due
+ * @return int: timeout for the event loop (ms), -1 if nothing is due
  */
-void send_score_to_server();
+int next_timeout();
 
 /**
- * @fn void player_thread(void* player_data)
- * @brief Thread for the player
- * @param player_data: Structure containing the player's socket and number
+ * @fn void watch_endpoint(endpoint_t* endpoint, int file_descriptor)
+ * @brief Adds a socket to the event loop
+ * @param endpoint: endpoint of the socket
+ * @param file_descriptor: socket's file descriptor
  */
-void player_thread(void* player_data);
+void watch_endpoint(endpoint_t* endpoint, int file_descriptor);
 
 /**
- * @fn void send_end_match(socket_t socket)
- * @brief Sends an END_MATCH message to the server
- * @param socket: Server socket
+ * @fn void watch_output(endpoint_t* endpoint, int file_descriptor, size_t output_size)
+ * @brief Watches a socket for writing as long as it has bytes waiting to be sent, and for reading
+ * @param endpoint: endpoint of the socket
+ * @param file_descriptor: socket's file descriptor
+ * @param output_size: number of bytes waiting to be sent
+ */
+void watch_output(endpoint_t* endpoint, int file_descriptor, size_t output_size);
+
+/**
+ * @fn int flush_output(int file_descriptor, char* output, size_t* output_size)
+ * @brief Sends what the socket of a player takes without blocking, the rest stays in the output
+ * @param file_descriptor: player's socket
+ * @param output: bytes to send
+ * @param output_size: number of bytes to send (updated)
+ * @return int: 0 if the connection is fine, -1 if it is lost
+ */
+int flush_output(int file_descriptor, char* output, size_t* output_size);
+
+/**
+ * @fn void send_to_player(court_t* court, int index, char code, char* data)
+ * @brief Sends a message to a player without blocking the event loop (what their socket cannot take yet is sent once
+ * it can)
+ * @param court: court of the player
+ * @param index: player's index (0 or 1)
+ * @param code: message code
+ * @param data: message data
+ */
+void send_to_player(court_t* court, int index, char code, char* data);
+
+/**
+ * @fn void accept_player(court_t* court)
+ * @brief Accepts a player on a court, the match starts once both players are connected
+ * @param court: court whose listen socket is readable
+ */
+void accept_player(court_t* court);
+
+/**
+ * @fn void player_left(court_t* court, int index)
+ * @brief Ends the match of a player who has left (before the match, the court waits for them again)
+ * @param court: court of the player
+ * @param index: player's index (0 or 1)
+ */
+void player_left(court_t* court, int index);
+
+/**
+ * @fn void handle_player_events(court_t* court, int index, uint32_t events)
+ * @brief Sends the answers waiting for a player and reads their messages, without blocking
+ * @param court: court of the player
+ * @param index: player's index (0 or 1)
+ * @param events: events of the player's socket
+ */
+void handle_player_events(court_t* court, int index, uint32_t events);
+
+/**
+ * @fn int handle_player_message(court_t* court, int index, message_t* received_msg)
+ * @brief Handles a message from a player (INCREMENT_SCORE)
+ * @param court: court of the player
+ * @param index: player's index (0 or 1)
+ * @param received_msg: message received
+ * @return int: 0 if the match goes on, -1 if it is over
+ */
+int handle_player_message(court_t* court, int index, message_t* received_msg);
+
+/**
+ * @fn void release_player(court_t* court, int index)
+ * @brief Closes the connection of a player once they have read END_MATCH (closing it with their next points unread would reset it, END_MATCH with it)
+ * @param court: court of the player
+ * @param index: player's index (0 or 1)
+ */
+void release_player(court_t* court, int index);
+
+/**
+ * @fn void drain_leaving_player(leaving_player_t* leaving, uint32_t events)
+ * @brief Sends what a player whose match is over has not received yet, discards what they still send, and closes the
+ * connection once they have
+ * @param leaving: player leaving
+ * @param events: events of the player's socket
+ */
+void drain_leaving_player(leaving_player_t* leaving, uint32_t events);
+
+/**
+ * @fn void report_match_end(court_t* court)
+ * @brief Writes the end of the match of a court in the journal, and sends END_MATCH to the server (the court is given
+ * to the next players)
+ * @param court: court whose match is over
+ */
+void report_match_end(court_t* court);
+
+/**
+ * @fn void close_leaving_player(leaving_player_t* leaving)
+ * @brief Closes the connection of a player whose match is over
+ * @param leaving: player leaving
+ */
+void close_leaving_player(leaving_player_t* leaving);
+
+/**
+ * @fn void expire_leaving_players()
+ * @brief Closes the connections of the players leaving who are past their deadline (reset, they do not read)
+ */
+void expire_leaving_players();
+
+/**
+ * @fn void end_match(court_t* court)
+ * @brief Ends the match: END_MATCH to the players and the server, then waits for the next players
+ * @param court: court whose match is over (both players are there)
  */
-void send_end_match(socket_t socket);
+void end_match(court_t* court);
 
 /**
  * @fn void sigint_handler(int signum)
- * @brief Signal handler for SIGINT, closing the socket properly
+ * @brief Signal handler for SIGINT, asking the event loop to close the court process (only async-signal-safe code here)
  * @param signum: unused
  */
 void sigint_handler(int signum);
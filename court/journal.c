@@ -0,0 +1,250 @@
+/**
+ * @file journal.c
+ * @brief Crash-safe journal of the points of the courts, in a memory-mapped file
+ * @date 2024-05-27
+ */
+
+#include "journal.h"
+
+/**
+ * @def JOURNAL_HEADER_SIZE
+ * @brief Size of the header, the logs of the courts start on the next page
+ */
+#define JOURNAL_HEADER_SIZE 4096
+
+/**
+ * @def JOURNAL_MAGIC
+ * @brief Identifies a journal file
+ */
+#define JOURNAL_MAGIC "PDJRNL1"
+
+/**
+ * @fn uint16_t record_checksum(journal_record_t* record)
+ * @brief Computes the checksum of a record (FNV-1a of its fields, folded to 16 bits)
+ * @param record: record to check
+ * @return uint16_t: checksum
+ */
+static uint16_t record_checksum(journal_record_t* record) {
+	uint32_t hash = 2166136261u;
+
+	hash = (hash ^ record->sequence) * 16777619u;
+	hash = (hash ^ record->type) * 16777619u;
+	hash = (hash ^ record->player) * 16777619u;
+
+	return (uint16_t) (hash ^ (hash >> 16));
+}
+
+/**
+ * @fn int is_valid_record(journal_record_t* record, uint32_t sequence)
+ * @brief Checks that a record was fully written and follows the previous one
+ * @param record: record to check
+ * @param sequence: expected sequence number (0 for the first record)
+ * @return int: 1 if the record is valid, 0 otherwise
+ */
+static int is_valid_record(journal_record_t* record, uint32_t sequence) {
+	return record->sequence != 0
+		&& (sequence == 0 || record->sequence == sequence)
+		&& record->checksum == record_checksum(record);
+}
+
+/**
+ * @fn void scan_log(journal_log_t* log, uint32_t sequence)
+ * @brief Finds the end of the valid records of a court (a torn or stale record ends the log)
+ * @param log: log of the court
+ * @param sequence: next sequence number kept in the header while the log was full (0 if none)
+ */
+static void scan_log(journal_log_t* log, uint32_t sequence) {
+	uint32_t i;
+
+	if (!is_valid_record(&log->records[0], 0)) {
+		log->next = 0;
+		log->sequence = sequence > 1 ? sequence : 1;
+		return;
+	}
+
+	for (i = 1; i < JOURNAL_CAPACITY; i++)
+		if (!is_valid_record(&log->records[i], log->records[0].sequence + i))
+			break;
+
+	// The numbers given while the log was full are never given again (the server would take them for duplicates)
+	log->next = i;
+	log->sequence = log->records[0].sequence + i;
+	if (sequence > log->sequence)
+		log->sequence = sequence;
+}
+
+/**
+ * @fn void journal_sync_thread(void* journal)
+ * @brief Group commit: writes all the records appended since the last commit to the disk at once
+ * @param journal: journal of the courts
+ */
+void journal_sync_thread(void* journal) {
+	journal_t* j = (journal_t*) journal;
+	unsigned long appended, synced = 0;
+
+	while (1) {
+		usleep(JOURNAL_SYNC_INTERVAL * 1000);
+
+		appended = atomic_load(&j->appended);
+		if (appended == synced)
+			continue;
+
+		msync(j->mapping, j->size, MS_SYNC);
+		synced = appended;
+	}
+}
+
+/**
+ * @fn int open_journal(journal_t* journal, const char* path, int nb_courts, const scoring_format_t* format)
+ * @brief Maps the journal file (created if needed) and starts the thread committing it to the disk
+ * @param journal: journal to open
+ * @param path: journal file
+ * @param nb_courts: number of courts
+ * @param format: rules of the matches (a journal of another format or number of courts is reset)
+ * @return int: 0 on success, -1 if the file cannot be mapped
+ */
+int open_journal(journal_t* journal, const char* path, int nb_courts, const scoring_format_t* format) {
+	journal_header_t* header;
+	int file_descriptor, i;
+
+	journal->size = JOURNAL_HEADER_SIZE + (size_t) nb_courts * JOURNAL_CAPACITY * sizeof(journal_record_t);
+	journal->nb_courts = nb_courts;
+	atomic_init(&journal->appended, 0);
+
+	// Mapping the file, the records are in the page cache (safe from a crash of the process) once written
+	file_descriptor = open(path, O_RDWR | O_CREAT, 0644);
+	if (file_descriptor == -1)
+		return -1;
+	if (ftruncate(file_descriptor, journal->size) == -1) {
+		close(file_descriptor);
+		return -1;
+	}
+	journal->mapping = mmap(NULL, journal->size, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+	close(file_descriptor);
+	if (journal->mapping == MAP_FAILED)
+		return -1;
+
+	// Resetting a journal written for other courts
+	header = journal->header = (journal_header_t*) journal->mapping;
+	if (strcmp(header->magic, JOURNAL_MAGIC) != 0
+	|| strcmp(header->format, format->name) != 0
+	|| header->nb_courts != (uint32_t) nb_courts) {
+		memset(journal->mapping, 0, journal->size);
+		strcpy(header->magic, JOURNAL_MAGIC);
+		snprintf(header->format, sizeof(header->format), "%s", format->name);
+		header->nb_courts = nb_courts;
+	}
+
+	// Giving each new court its durable identity
+	for (i = 0; i < nb_courts; i++)
+		while (header->court_keys[i] == 0)
+			if (getrandom(&header->court_keys[i], sizeof(uint64_t), 0) != sizeof(uint64_t))
+				header->court_keys[i] = ((uint64_t) time(NULL) << 32) ^ ((uint64_t) getpid() << 16) ^ i;
+	msync(journal->mapping, JOURNAL_HEADER_SIZE, MS_SYNC);
+
+	// Finding where each court has stopped
+	journal->logs = (journal_log_t*) malloc(nb_courts * sizeof(journal_log_t));
+	for (i = 0; i < nb_courts; i++) {
+		journal->logs[i].records = (journal_record_t*) (journal->mapping + JOURNAL_HEADER_SIZE)
+			+ (size_t) i * JOURNAL_CAPACITY;
+		scan_log(&journal->logs[i], header->court_sequences[i]);
+	}
+
+	pthread_create(&journal->sync_thread, NULL, (void*) journal_sync_thread, (void*) journal);
+	pthread_detach(journal->sync_thread);
+
+	return 0;
+}
+
+/**
+ * @fn int replay_journal(journal_t* journal, int court, const scoring_format_t* format, match_score_t* score)
+ * @brief Rebuilds the score of the match of a court that was in progress when the process stopped
+ * @param journal: journal of the courts
+ * @param court: court's index
+ * @param format: rules of the match
+ * @param score: filled with the score of the match
+ * @return int: number of points replayed, -1 if no match was in progress
+ */
+int replay_journal(journal_t* journal, int court, const scoring_format_t* format, match_score_t* score) {
+	journal_log_t* log = &journal->logs[court];
+	int start = -1, nb_points = 0, i;
+
+	// Finding the last match, which must not have ended
+	for (i = log->next - 1; i >= 0 && start == -1; i--) {
+		if (log->records[i].type == MATCH_END_RECORD)
+			return -1;
+		if (log->records[i].type == MATCH_START_RECORD)
+			start = i;
+	}
+	if (start == -1)
+		return -1;
+
+	// Playing its points again
+	init_match_score(score);
+	for (i = start + 1; i < (int) log->next; i++) {
+		score_point(format, score, log->records[i].player);
+		nb_points++;
+	}
+
+	return nb_points;
+}
+
+/**
+ * @fn void journal_append(journal_t* journal, int court, int type, int player)
+ * @brief Writes an event of a court in the journal (on the disk with the next group commit)
+ * @param journal: journal of the courts
+ * @param court: court's index
+ * @param type: MATCH_START_RECORD, POINT_RECORD or MATCH_END_RECORD
+ * @param player: player who has won the point (1 or 2), 0 for the other records
+ */
+void journal_append(journal_t* journal, int court, int type, int player) {
+	journal_log_t* log = &journal->logs[court];
+	journal_record_t record;
+
+	// A new match starts from the beginning once past the half (the older records no longer follow)
+	if (type == MATCH_START_RECORD && log->next > JOURNAL_CAPACITY / 2)
+		log->next = 0;
+
+	// The sequence number still increases, it orders the messages sent to the server: kept in the header, since no
+	// record has it (a restart would give it again)
+	if (log->next == JOURNAL_CAPACITY) {
+		log_message(LOG_ERROR, "Journal of court %d is full, the match cannot be resumed.", court);
+		log->sequence++;
+		journal->header->court_sequences[court] = log->sequence;
+		atomic_fetch_add_explicit(&journal->appended, 1, memory_order_release);
+		return;
+	}
+
+	record.sequence = log->sequence;
+	record.type = type;
+	record.player = player;
+	record.checksum = record_checksum(&record);
+
+	// One 8-byte store in the mapping, no system call
+	log->records[log->next] = record;
+	log->next++;
+	log->sequence++;
+	atomic_fetch_add_explicit(&journal->appended, 1, memory_order_release);
+}
+
+/**
+ * @fn uint32_t journal_sequence(journal_t* journal, int court)
+ * @brief Gives the sequence number of the last record of a court (it increases across restarts)
+ * @param journal: journal of the courts
+ * @param court: court's index
+ * @return uint32_t: sequence number, 0 if the court has no record
+ */
+uint32_t journal_sequence(journal_t* journal, int court) {
+	return journal->logs[court].sequence - 1;
+}
+
+/**
+ * @fn uint64_t journal_court_key(journal_t* journal, int court)
+ * @brief Gives the durable identity of a court, kept in the journal
+ * @param journal: journal of the courts
+ * @param court: court's index
+ * @return uint64_t: court's key
+ */
+uint64_t journal_court_key(journal_t* journal, int court) {
+	return journal->header->court_keys[court];
+}
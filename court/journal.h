@@ -0,0 +1,199 @@
+#ifndef PANTALLA_DEPORTIVA_V2_JOURNAL_H
+#define PANTALLA_DEPORTIVA_V2_JOURNAL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+
+#include "../scoring/scoring.h"
+#include "../log/log.h"
+
+/**
+ * @def DEFAULT_JOURNAL_FILE
+ * @brief Journal file used when none is given
+ */
+#define DEFAULT_JOURNAL_FILE "court.journal"
+
+/**
+ * @def JOURNAL_CAPACITY
+ * @brief Number of records of the journal of a court (a new match starts from the beginning past the half)
+ */
+#define JOURNAL_CAPACITY 65536
+
+/**
+ * @def JOURNAL_MAX_COURTS
+ * @brief Maximum number of courts of a journal (their keys fit in the header)
+ */
+#define JOURNAL_MAX_COURTS 256
+
+/**
+ * @def JOURNAL_SYNC_INTERVAL
+ * @brief Time between two group commits of the journal to the disk (ms)
+ */
+#define JOURNAL_SYNC_INTERVAL 10
+
+/**
+ * @def MATCH_START_RECORD
+ * @brief Record of the start of a match
+ */
+#define MATCH_START_RECORD 1
+/**
+ * @def POINT_RECORD
+ * @brief Record of a point, won by the player of the record
+ */
+#define POINT_RECORD 2
+/**
+ * @def MATCH_END_RECORD
+ * @brief Record of the end of a match (finished or abandoned)
+ */
+#define MATCH_END_RECORD 3
+
+/**
+ * @struct journal_record
+ * @brief Event of a court, as written in the journal
+ * @var sequence: sequence number of the record (consecutive in a valid journal)
+ * @var type: MATCH_START_RECORD, POINT_RECORD or MATCH_END_RECORD
+ * @var player: player who has won the point (1 or 2)
+ * @var checksum: checksum of the other fields, written with them
+ */
+struct journal_record {
+	uint32_t sequence;
+	uint8_t type;
+	uint8_t player;
+	uint16_t checksum;
+};
+
+/**
+ * @typedef journal_record_t
+ * @brief Typedef for the journal_record structure
+ */
+typedef struct journal_record journal_record_t;
+
+/**
+ * @struct journal_header
+ * @brief First page of the journal file
+ * @var magic: identifies a journal file
+ * @var format: name of the scoring format of the records
+ * @var nb_courts: number of courts (one log each, after the header)
+ * @var court_keys: durable identity of each court, given to the server to be recognized after a restart
+ * @var court_sequences: next sequence number of each court whose log was full (0 if never), the records no longer have it
+ */
+struct journal_header {
+	char magic[8];
+	char format[24];
+	uint32_t nb_courts;
+	uint64_t court_keys[JOURNAL_MAX_COURTS];
+	uint32_t court_sequences[JOURNAL_MAX_COURTS];
+};
+
+/**
+ * @typedef journal_header_t
+ * @brief Typedef for the journal_header structure
+ */
+typedef struct journal_header journal_header_t;
+
+/**
+ * @struct journal_log
+ * @brief Records of one court
+ * @var records: mapped records
+ * @var next: index of the next record to write
+ * @var sequence: sequence number of the next record
+ */
+struct journal_log {
+	journal_record_t* records;
+	uint32_t next;
+	uint32_t sequence;
+};
+
+/**
+ * @typedef journal_log_t
+ * @brief Typedef for the journal_log structure
+ */
+typedef struct journal_log journal_log_t;
+
+/**
+ * @struct journal
+ * @brief Memory-mapped journal of the events of the courts of a process
+ * @var mapping: mapped file
+ * @var header: header of the file
+ * @var size: size of the mapping
+ * @var logs: log of each court
+ * @var nb_courts: number of courts
+ * @var appended: number of records written (read by the sync thread)
+ * @var sync_thread: thread writing the records to the disk, several at once
+ */
+struct journal {
+	char* mapping;
+	journal_header_t* header;
+	size_t size;
+	journal_log_t* logs;
+	int nb_courts;
+	atomic_ulong appended;
+	pthread_t sync_thread;
+};
+
+/**
+ * @typedef journal_t
+ * @brief Typedef for the journal structure
+ */
+typedef struct journal journal_t;
+
+/**
+ * @fn int open_journal(journal_t* journal, const char* path, int nb_courts, const scoring_format_t* format)
+ * @brief Maps the journal file (created if needed) and starts the thread committing it to the disk
+ * @param journal: journal to open
+ * @param path: journal file
+ * @param nb_courts: number of courts (JOURNAL_MAX_COURTS at most)
+ * @param format: rules of the matches (a journal of another format or number of courts is reset)
+ * @return int: 0 on success, -1 if the file cannot be mapped
+ */
+int open_journal(journal_t* journal, const char* path, int nb_courts, const scoring_format_t* format);
+
+/**
+ * @fn int replay_journal(journal_t* journal, int court, const scoring_format_t* format, match_score_t* score)
+ * @brief Rebuilds the score of the match of a court that was in progress when the process stopped
+ * @param journal: journal of the courts
+ * @param court: court's index
+ * @param format: rules of the match
+ * @param score: filled with the score of the match
+ * @return int: number of points replayed, -1 if no match was in progress
+ */
+int replay_journal(journal_t* journal, int court, const scoring_format_t* format, match_score_t* score);
+
+/**
+ * @fn void journal_append(journal_t* journal, int court, int type, int player)
+ * @brief Writes an event of a court in the journal (on the disk with the next group commit)
+ * @param journal: journal of the courts
+ * @param court: court's index
+ * @param type: MATCH_START_RECORD, POINT_RECORD or MATCH_END_RECORD
+ * @param player: player who has won the point (1 or 2), 0 for the other records
+ */
+void journal_append(journal_t* journal, int court, int type, int player);
+
+/**
+ * @fn uint32_t journal_sequence(journal_t* journal, int court)
+ * @brief Gives the sequence number of the last record of a court (it increases across restarts)
+ * @param journal: journal of the courts
+ * @param court: court's index
+ * @return uint32_t: sequence number, 0 if the court has no record
+ */
+uint32_t journal_sequence(journal_t* journal, int court);
+
+/**
+ * @fn uint64_t journal_court_key(journal_t* journal, int court)
+ * @brief Gives the durable identity of a court, kept in the journal
+ * @param journal: journal of the courts
+ * @param court: court's index
+ * @return uint64_t: court's key
+ */
+uint64_t journal_court_key(journal_t* journal, int court);
+
+#endif //PANTALLA_DEPORTIVA_V2_JOURNAL_H
@@ -0,0 +1,209 @@
+/**
+ * @file uplink.c
+ * @brief Asynchronous connection from the court to the server, reconnected when lost
+ * @date 2024-05-22
+ */
+
+#include "uplink.h"
+
+/**
+ * @fn void tag_message(message_t* message, atomic_int* tag)
+ * @brief Writes the current id a queued message is about in front of its data ("3|...")
+ * @param message: message to send, tagged in place
+ * @param tag: id the message is about (NULL if none)
+ */
+static void tag_message(message_t* message, atomic_int* tag) {
+	buffer_t data;
+
+	if (tag == NULL)
+		return;
+
+	strcpy(data, message->data);
+	snprintf(message->data, sizeof(buffer_t), "%d|%s", atomic_load(tag), data);
+}
+
+/**
+ * @fn int send_frame(int file_descriptor, message_t* message)
+ * @brief Sends a message without exiting (nor being killed by SIGPIPE) if the connection is lost
+ * @param file_descriptor: server socket
+ * @param message: message to send
+ * @return int: 0 if sent, -1 if the connection is lost
+ */
+static int send_frame(int file_descriptor, message_t* message) {
+	buffer_t serialized;
+	size_t size, offset = 0;
+	ssize_t write_size;
+
+	serialize_message(message, serialized);
+	size = strlen(serialized) + 1;
+
+	while (offset < size) {
+		write_size = send(file_descriptor, serialized + offset, size - offset, MSG_NOSIGNAL);
+		if (write_size == -1)
+			return -1;
+		offset += write_size;
+	}
+
+	return 0;
+}
+
+/**
+ * @fn void sender_thread(void* uplink)
+ * @brief Sends the queued messages to the server, in order, without waiting for the answers
+ * @param uplink: uplink to the server
+ */
+void sender_thread(void* uplink) {
+	uplink_t* u = (uplink_t*) uplink;
+	message_t message;
+	int slot, file_descriptor;
+
+	while (1) {
+		pthread_mutex_lock(&u->mutex);
+
+		while (!u->connected || u->in_flight == u->count)
+			pthread_cond_wait(&u->not_empty, &u->mutex);
+
+		// Taking the oldest message not sent on this connection (it stays queued until acked)
+		slot = (u->head + u->in_flight) % UPLINK_QUEUE_SIZE;
+		message = u->queue[slot];
+		tag_message(&message, u->tags[slot]);
+		u->send_times[slot] = monotonic_time();
+		u->in_flight++;
+		u->sending = 1;
+		file_descriptor = u->socket->file_descriptor;
+
+		pthread_mutex_unlock(&u->mutex);
+
+		// The receiver sees the connection closed and reconnects
+		if (send_frame(file_descriptor, &message) == -1)
+			shutdown(file_descriptor, SHUT_RDWR);
+
+		pthread_mutex_lock(&u->mutex);
+		u->sending = 0;
+		u->sent++;
+		pthread_cond_broadcast(&u->idle);
+		pthread_mutex_unlock(&u->mutex);
+	}
+}
+
+/**
+ * @fn void receiver_thread(void* uplink)
+ * @brief Reads the answers of the server to the messages sent, and reconnects when the connection is lost
+ * @param uplink: uplink to the server
+ */
+void receiver_thread(void* uplink) {
+	uplink_t* u = (uplink_t*) uplink;
+	message_t message;
+	long rtt;
+
+	while (1) {
+		if (receive_message(u->socket, &message, deserialize_message) == 0) {
+			// Stopping the sender, the messages not acked are sent again on the next connection
+			pthread_mutex_lock(&u->mutex);
+			u->connected = 0;
+			u->in_flight = 0;
+			shutdown(u->socket->file_descriptor, SHUT_RDWR);
+			while (u->sending)
+				pthread_cond_wait(&u->idle, &u->mutex);
+			pthread_mutex_unlock(&u->mutex);
+
+			close(u->socket->file_descriptor);
+			log_message(LOG_WARNING, "Connection to the server lost, reconnecting...");
+			u->reconnect(u->socket);
+
+			pthread_mutex_lock(&u->mutex);
+			u->connected = 1;
+			pthread_cond_signal(&u->not_empty);
+			pthread_mutex_unlock(&u->mutex);
+			continue;
+		}
+
+		if (message.code != (char) OK)
+			log_message(LOG_WARNING, "Server has answered NOK to message %lu.", u->acked + 1);
+
+		pthread_mutex_lock(&u->mutex);
+
+		// The answers come in order: the oldest message in flight is acked
+		if (u->in_flight > 0) {
+			rtt = monotonic_time() - u->send_times[u->head];
+			u->rtt = u->rtt == 0 ? rtt : (7 * u->rtt + rtt) / 8;
+
+			u->head = (u->head + 1) % UPLINK_QUEUE_SIZE;
+			u->count--;
+			u->in_flight--;
+			u->acked++;
+			pthread_cond_signal(&u->not_full);
+		}
+
+		pthread_mutex_unlock(&u->mutex);
+	}
+}
+
+/**
+ * @fn void start_uplink(uplink_t* uplink, socket_t* socket, void (*reconnect)(socket_t*))
+ * @brief Starts the threads sending the messages to the server and reading its answers
+ * @param uplink: uplink to start
+ * @param socket: server socket (connected)
+ * @param reconnect: function connecting the socket again once the connection is lost
+ */
+void start_uplink(uplink_t* uplink, socket_t* socket, void (*reconnect)(socket_t*)) {
+	uplink->socket = socket;
+	uplink->reconnect = reconnect;
+	uplink->head = 0;
+	uplink->count = 0;
+	uplink->in_flight = 0;
+	uplink->connected = 1;
+	uplink->sending = 0;
+	uplink->sent = 0;
+	uplink->acked = 0;
+	uplink->rtt = 0;
+	pthread_mutex_init(&uplink->mutex, NULL);
+	pthread_cond_init(&uplink->not_empty, NULL);
+	pthread_cond_init(&uplink->not_full, NULL);
+	pthread_cond_init(&uplink->idle, NULL);
+
+	pthread_create(&uplink->sender, NULL, (void*) sender_thread, (void*) uplink);
+	pthread_create(&uplink->receiver, NULL, (void*) receiver_thread, (void*) uplink);
+}
+
+/**
+ * @fn void uplink_send(uplink_t* uplink, char code, atomic_int* tag, char* data)
+ * @brief Queues a message for the server (waits only if the queue is full)
+ * @param uplink: uplink to the server
+ * @param code: message code
+ * @param tag: id the message is about (NULL if none), read when the message is sent: a message sent again after a
+ * reconnection carries the id given by the new connection
+ * @param data: message data (without the id, UPLINK_TAG_SIZE shorter than a buffer)
+ */
+void uplink_send(uplink_t* uplink, char code, atomic_int* tag, char* data) {
+	int slot;
+
+	pthread_mutex_lock(&uplink->mutex);
+
+	while (uplink->count == UPLINK_QUEUE_SIZE)
+		pthread_cond_wait(&uplink->not_full, &uplink->mutex);
+
+	slot = (uplink->head + uplink->count) % UPLINK_QUEUE_SIZE;
+	prepare_message(&uplink->queue[slot], code, data);
+	uplink->tags[slot] = tag;
+	uplink->count++;
+	pthread_cond_signal(&uplink->not_empty);
+
+	pthread_mutex_unlock(&uplink->mutex);
+}
+
+/**
+ * @fn long uplink_rtt(uplink_t* uplink)
+ * @brief Gives the smoothed round-trip time to the server
+ * @param uplink: uplink to the server
+ * @return long: round-trip time (us), 0 before the first answer
+ */
+long uplink_rtt(uplink_t* uplink) {
+	long rtt;
+
+	pthread_mutex_lock(&uplink->mutex);
+	rtt = uplink->rtt;
+	pthread_mutex_unlock(&uplink->mutex);
+
+	return rtt;
+}
@@ -0,0 +1,108 @@
+#ifndef PANTALLA_DEPORTIVA_V2_UPLINK_H
+#define PANTALLA_DEPORTIVA_V2_UPLINK_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../socket/data.h"
+#include "../serialization/serialization.h"
+#include "../common/codes.h"
+#include "../log/log.h"
+#include "../trace/trace.h"
+
+/**
+ * @def UPLINK_QUEUE_SIZE
+ * @brief Maximum number of messages not acked by the server yet
+ */
+#define UPLINK_QUEUE_SIZE 64
+
+/**
+ * @def UPLINK_TAG_SIZE
+ * @brief Room taken in front of the data of a tagged message by its id and its '|'
+ */
+#define UPLINK_TAG_SIZE 12
+
+/**
+ * @struct uplink
+ * @brief Queue of the messages for the server, sent in order by a dedicated thread and kept until acked
+ * @var socket: server socket (only used by the uplink threads once started)
+ * @var reconnect: function connecting the socket again once the connection is lost
+ * @var queue: circular buffer of the messages not acked yet
+ * @var tags: id each message of the queue is about (NULL if none), written in front of its data when it is sent
+ * @var head: index of the oldest message not acked
+ * @var count: number of messages in the queue
+ * @var in_flight: number of messages sent on the current connection and not acked yet
+ * @var connected: 0 while reconnecting
+ * @var sending: 1 while the sender is writing to the socket
+ * @var mutex: mutex for the queue
+ * @var not_empty: condition signaled when a message is queued or the connection is back
+ * @var not_full: condition signaled when a message is acked
+ * @var idle: condition signaled when the sender has finished writing
+ * @var sent: number of messages sent to the server
+ * @var acked: number of answers received from the server
+ * @var send_times: time each message of the queue was sent at (us), to measure the round-trip time
+ * @var rtt: smoothed round-trip time to the server (us)
+ * @var sender: thread sending the messages
+ * @var receiver: thread reading the answers of the server (and reconnecting)
+ */
+struct uplink {
+	socket_t* socket;
+	void (*reconnect)(socket_t* socket);
+	message_t queue[UPLINK_QUEUE_SIZE];
+	atomic_int* tags[UPLINK_QUEUE_SIZE];
+	int head;
+	int count;
+	int in_flight;
+	int connected;
+	int sending;
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	pthread_cond_t idle;
+	unsigned long sent;
+	unsigned long acked;
+	long send_times[UPLINK_QUEUE_SIZE];
+	long rtt;
+	pthread_t sender;
+	pthread_t receiver;
+};
+
+/**
+ * @typedef uplink_t
+ * @brief Typedef for the uplink structure
+ */
+typedef struct uplink uplink_t;
+
+/**
+ * @fn void start_uplink(uplink_t* uplink, socket_t* socket, void (*reconnect)(socket_t*))
+ * @brief Starts the threads sending the messages to the server and reading its answers
+ * @param uplink: uplink to start
+ * @param socket: server socket (connected)
+ * @param reconnect: function connecting the socket again once the connection is lost
+ */
+void start_uplink(uplink_t* uplink, socket_t* socket, void (*reconnect)(socket_t*));
+
+/**
+ * @fn void uplink_send(uplink_t* uplink, char code, atomic_int* tag, char* data)
+ * @brief Queues a message for the server (waits only if the queue is full)
+ * @param uplink: uplink to the server
+ * @param code: message code
+ * @param tag: id the message is about (NULL if none), read when the message is sent: a message sent again after a
+ * reconnection carries the id given by the new connection
+ * @param data: message data (without the id, UPLINK_TAG_SIZE shorter than a buffer)
+ */
+void uplink_send(uplink_t* uplink, char code, atomic_int* tag, char* data);
+
+/**
+ * @fn long uplink_rtt(uplink_t* uplink)
+ * @brief Gives the smoothed round-trip time to the server
+ * @param uplink: uplink to the server
+ * @return long: round-trip time (us), 0 before the first answer
+ */
+long uplink_rtt(uplink_t* uplink);
+
+#endif //PANTALLA_DEPORTIVA_V2_UPLINK_H
@@ -0,0 +1,49 @@
+#!/bin/sh
+# End-to-end latency benchmark: for each number of courts and of spectators, starts a server and a court
+# process, plays a match on each court with loadgen.exe and appends its results (one JSON object per run)
+#
+# Usage: ./benchmark.sh [Results]
+# Environment: COURTS="1 10 100", SPECTATORS="0 10 100", SUBSCRIPTIONS, SKEW, POINT_RATE, FORMAT, WINDOW_MS,
+#              DURATION, PORT
+
+RESULTS=${1:-benchmark.jsonl}
+COURTS=${COURTS:-"1 10 100"}
+SPECTATORS=${SPECTATORS:-"0 10 100"}
+SUBSCRIPTIONS=${SUBSCRIPTIONS:-1}
+SKEW=${SKEW:-0}
+POINT_RATE=${POINT_RATE:-100}
+FORMAT=${FORMAT:-bo3}
+WINDOW_MS=${WINDOW_MS:-0}
+DURATION=${DURATION:-10}
+PORT=${PORT:-47000}
+
+cd "$(dirname "$0")" || exit 1
+JOURNAL=$(mktemp)
+STATE=$(mktemp -d)
+
+for nb_courts in $COURTS; do
+	for nb_spectators in $SPECTATORS; do
+		PORT=$((PORT + 1))
+
+		# A fresh server and court process for each run, so that a run does not see the courts of the previous one (nor
+		# restores them from its history and snapshot)
+		../server/server.exe $PORT -1 "$STATE/history.$PORT" "$STATE/snapshot.$PORT" > /dev/null 2>&1 &
+		server=$!
+		sleep 0.5
+		: > "$JOURNAL"
+		../court/court.exe 127.0.0.1 $PORT $nb_courts $FORMAT $WINDOW_MS "$JOURNAL" > /dev/null 2>&1 &
+		court=$!
+		sleep 1
+
+		# One pair of players per court, so that every court is playing
+		./loadgen.exe 127.0.0.1 $PORT --external-courts --json --matches $nb_courts --spectators $nb_spectators \
+			--subscriptions $SUBSCRIPTIONS --skew $SKEW --point-rate $POINT_RATE --duration $DURATION >> "$RESULTS"
+		echo "courts $nb_courts, spectators $nb_spectators: $(tail -n 1 "$RESULTS")"
+
+		kill $court $server 2> /dev/null
+		wait $court $server 2> /dev/null
+	done
+done
+
+rm -f "$JOURNAL"
+rm -rf "$STATE"
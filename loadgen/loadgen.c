@@ -0,0 +1,826 @@
+/**
+ * @file loadgen.c
+ * @brief Headless load generator: simulated courts, players and spectators speaking the real protocol
+ * @date 2024-05-29
+ */
+
+#include "loadgen.h"
+
+config_t config = {"127.0.0.1", 0, 1, 10, 10, 10, 1, 0.0, 0.0, 100, 0.0, 10, 0, 0}; // Parameters of the load
+
+sim_court_t* courts_by_id[MAX_COURT_ID]; // Simulated courts, by their id on the server
+int* court_ids; // Ids of the simulated courts, from the most to the least popular
+double* popularity; // Cumulative distribution of the subscriptions over court_ids
+int nb_court_ids = 0; // Number of simulated courts registered
+pthread_mutex_t court_ids_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for court_ids
+pthread_cond_t court_registered = PTHREAD_COND_INITIALIZER; // Signaled when a court process has registered its courts
+
+atomic_long points_played; // Points acked by the courts
+atomic_long matches_played; // Matches played until the end
+atomic_long updates_received; // Score updates received by the spectators
+
+recorder_t point_latencies; // INCREMENT_SCORE to its OK, seen by the players
+recorder_t propagation_latencies; // SCORE sent by a court to the spectator receiving it
+
+/**
+ * @fn long now_us()
+ * @brief Gives the time of a monotonic clock
+ * @return long: time (us)
+ */
+long now_us() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+/**
+ * @fn int send_frame(socket_t* socket, char code, char* data)
+ * @brief Sends a message without exiting (nor being killed by SIGPIPE) if the connection is closed
+ * @param socket: socket to send on
+ * @param code: message code
+ * @param data: message data
+ * @return int: 0 if sent, -1 if the connection is closed
+ */
+int send_frame(socket_t* socket, char code, char* data) {
+	message_t message;
+	buffer_t serialized;
+	size_t size, offset = 0;
+	ssize_t write_size;
+
+	prepare_message(&message, code, data);
+	serialize_message(&message, serialized);
+	size = strlen(serialized) + 1;
+
+	while (offset < size) {
+		write_size = send(socket->file_descriptor, serialized + offset, size - offset, MSG_NOSIGNAL);
+		if (write_size == -1)
+			return -1;
+		offset += write_size;
+	}
+
+	return 0;
+}
+
+/**
+ * @fn void init_recorder(recorder_t* recorder)
+ * @brief Initializes a recorder of latency samples
+ * @param recorder: recorder to initialize
+ */
+void init_recorder(recorder_t* recorder) {
+	recorder->capacity = 1 << 16;
+	recorder->samples = (long*) malloc(recorder->capacity * sizeof(long));
+	recorder->count = 0;
+	pthread_mutex_init(&recorder->mutex, NULL);
+}
+
+/**
+ * @fn void record_sample(local_samples_t* local, long latency)
+ * @brief Records a latency sample
+ * @param local: samples of the thread
+ * @param latency: latency (us)
+ */
+void record_sample(local_samples_t* local, long latency) {
+	recorder_t* recorder = local->recorder;
+	long now = now_us();
+
+	local->samples[local->count++] = latency;
+	if (local->count < LOCAL_SAMPLES && now - local->flushed < FLUSH_INTERVAL)
+		return;
+
+	// Adding the samples by batches, so the threads rarely wait for each other
+	pthread_mutex_lock(&recorder->mutex);
+	if (recorder->count + local->count > recorder->capacity) {
+		recorder->capacity *= 2;
+		recorder->samples = (long*) realloc(recorder->samples, recorder->capacity * sizeof(long));
+	}
+	memcpy(recorder->samples + recorder->count, local->samples, local->count * sizeof(long));
+	recorder->count += local->count;
+	pthread_mutex_unlock(&recorder->mutex);
+
+	local->count = 0;
+	local->flushed = now;
+}
+
+/**
+ * @fn void start_thread(void (*function)(void*), long arg)
+ * @brief Starts a detached thread with a small stack
+ * @param function: function of the thread
+ * @param arg: index given to the thread
+ */
+void start_thread(void (*function)(void*), long arg) {
+	pthread_attr_t attributes;
+	pthread_t thread;
+
+	pthread_attr_init(&attributes);
+	pthread_attr_setstacksize(&attributes, THREAD_STACK_SIZE);
+	pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+	CHECK(pthread_create(&thread, &attributes, (void*) function, (void*) arg) == 0 ? 0 : -1, "Can't create thread");
+	pthread_attr_destroy(&attributes);
+}
+
+/**
+ * @fn void watch(int epoll_fd, int file_descriptor, uint64_t tag)
+ * @brief Adds a socket to the event loop of a court process
+ * @param epoll_fd: event loop
+ * @param file_descriptor: socket's file descriptor
+ * @param tag: court's index * 3 + 0 for the listen socket, 1 or 2 for the players
+ */
+void watch(int epoll_fd, int file_descriptor, uint64_t tag) {
+	struct epoll_event event;
+
+	event.events = EPOLLIN;
+	event.data.u64 = tag;
+	CHECK(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, file_descriptor, &event), "Can't watch socket");
+}
+
+/**
+ * @fn void end_sim_match(sim_court_t* court, socket_t* server, int epoll_fd, uint64_t tag)
+ * @brief Ends the match of a simulated court and waits for the next players
+ * @param court: simulated court
+ * @param server: server socket of the court process
+ * @param epoll_fd: event loop of the court process
+ * @param tag: tag of the listen socket of the court
+ */
+void end_sim_match(sim_court_t* court, socket_t* server, int epoll_fd, uint64_t tag) {
+	buffer_t data;
+	int i;
+
+	for (i = 0; i < court->nb_players; i++) {
+		send_frame(&court->players[i], (char) END_MATCH, "");
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, court->players[i].file_descriptor, NULL);
+		close(court->players[i].file_descriptor);
+	}
+
+	if (court->nb_players == 2 && court->points >= config.points_per_match)
+		atomic_fetch_add(&matches_played, 1);
+	if (court->nb_players == 2)
+		watch(epoll_fd, court->listen_socket.file_descriptor, tag);
+	court->nb_players = 0;
+	court->points = 0;
+
+	sprintf(data, "%d|%lu", court->id, ++court->sequence);
+	send_frame(server, (char) END_MATCH, data);
+}
+
+/**
+ * @fn void court_process_thread(void* arg)
+ * @brief Simulated court process: registers its courts, accepts the players and sends the score updates
+ * @param arg: index of the court process
+ */
+void court_process_thread(void* arg) {
+	sim_court_t* courts = (sim_court_t*) calloc(config.courts, sizeof(sim_court_t));
+	struct epoll_event events[64];
+	message_t message;
+	socket_t server;
+	struct send_time* send_time;
+	sim_court_t* court;
+	buffer_t data;
+	uint64_t tag;
+	int epoll_fd, nb_events, i, j, player;
+
+	// Authenticating as a court process, then registering the courts
+	server = connect_to(config.server_ip, config.server_port);
+	send_frame(&server, (char) AUTH, "3");
+	receive_message(&server, &message, deserialize_message);
+
+	for (i = 0; i < config.courts; i++) {
+		courts[i].listen_socket = create_listen_socket("0.0.0.0", 0);
+		sprintf(data, "%d", ntohs(((struct sockaddr_in*)&courts[i].listen_socket.local_address)->sin_port));
+		send_frame(&server, (char) LISTEN_PORT, data);
+		if (receive_message(&server, &message, deserialize_message) == 0 || message.code != (char) OK) {
+			fprintf(stderr, "Court process %ld: registration failed\n", (long) arg);
+			exit(1);
+		}
+		courts[i].id = atoi(message.data);
+		if (courts[i].id < MAX_COURT_ID)
+			courts_by_id[courts[i].id] = &courts[i];
+	}
+
+	pthread_mutex_lock(&court_ids_mutex);
+	for (i = 0; i < config.courts; i++)
+		court_ids[nb_court_ids++] = courts[i].id;
+	pthread_cond_broadcast(&court_registered);
+	pthread_mutex_unlock(&court_ids_mutex);
+
+	// One event loop for the acks of the server and all the players of the courts
+	CHECK(epoll_fd = epoll_create1(0), "Can't create event loop");
+	watch(epoll_fd, server.file_descriptor, (uint64_t) -1);
+	for (i = 0; i < config.courts; i++)
+		watch(epoll_fd, courts[i].listen_socket.file_descriptor, (uint64_t) i * 3);
+
+	while (1) {
+		nb_events = epoll_wait(epoll_fd, events, 64, -1);
+
+		for (j = 0; j < nb_events; j++) {
+			tag = events[j].data.u64;
+
+			// Acks of the server
+			if (tag == (uint64_t) -1) {
+				if (receive_message(&server, &message, deserialize_message) == 0) {
+					fprintf(stderr, "Court process %ld: connection to the server lost\n", (long) arg);
+					exit(1);
+				}
+				continue;
+			}
+
+			court = &courts[tag / 3];
+			player = (int) (tag % 3) - 1;
+
+			// A player connects, the match starts with the second one
+			if (player == -1) {
+				court->players[court->nb_players] = accept_client(court->listen_socket);
+				watch(epoll_fd, court->players[court->nb_players].file_descriptor, tag + 1 + court->nb_players);
+				court->nb_players++;
+				if (court->nb_players == 2)
+					epoll_ctl(epoll_fd, EPOLL_CTL_DEL, court->listen_socket.file_descriptor, NULL);
+				continue;
+			}
+
+			// Ignoring the events of the players of a match ended in this batch
+			if (player >= court->nb_players)
+				continue;
+
+			if (receive_message(&court->players[player], &message, deserialize_message) == 0) {
+				end_sim_match(court, &server, epoll_fd, tag - 1 - player);
+				continue;
+			}
+
+			if (court->nb_players < 2) {
+				send_frame(&court->players[player], (char) NOK, "");
+				continue;
+			}
+
+			// The score published is the point number, so the spectators can find its send time
+			court->points++;
+			sprintf(data, "%d|%d/0:0/0:0/0:0/0|1|%lu", court->id, court->points, ++court->sequence);
+			send_time = &court->send_times[court->points % SEND_TIMES];
+			atomic_store(&send_time->time, now_us());
+			atomic_store(&send_time->point, court->points);
+			send_frame(&server, (char) SCORE, data);
+			atomic_fetch_add(&points_played, 1);
+
+			if (court->points >= config.points_per_match)
+				end_sim_match(court, &server, epoll_fd, tag - 1 - player);
+			else
+				send_frame(&court->players[player], (char) OK, "");
+		}
+	}
+}
+
+/**
+ * @fn int join_as_solo(socket_t* socket, long index, int number)
+ * @brief Connects a simulated player and makes them join the queue as a solo player
+ * @param socket: filled with the server socket
+ * @param index: index of the pair
+ * @param number: player's number in the pair
+ * @return int: 0 on success, -1 otherwise
+ */
+int join_as_solo(socket_t* socket, long index, int number) {
+	message_t message;
+	buffer_t data;
+
+	*socket = connect_to(config.server_ip, config.server_port);
+	sprintf(data, "1:Load:Solo%ld-%d", index, number);
+	send_frame(socket, (char) AUTH, data);
+	if (receive_message(socket, &message, deserialize_message) == 0 || message.code != (char) OK)
+		return -1;
+
+	send_frame(socket, (char) QUEUE, "");
+	if (receive_message(socket, &message, deserialize_message) == 0 || message.code != (char) OK)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * @fn int join_by_invitation(socket_t players[2], long index)
+ * @brief Connects a pair of simulated players, the first one inviting the second one
+ * @param players: filled with the server sockets
+ * @param index: index of the pair
+ * @return int: 0 on success, -1 otherwise
+ */
+int join_by_invitation(socket_t players[2], long index) {
+	message_t message;
+	buffer_t data, id;
+
+	// The invited player waits in the list of available players
+	players[1] = connect_to(config.server_ip, config.server_port);
+	sprintf(data, "2:Load:Guest%ld", index);
+	send_frame(&players[1], (char) AUTH, data);
+	if (receive_message(&players[1], &message, deserialize_message) == 0 || message.code != (char) OK)
+		return -1;
+	if (receive_message(&players[1], &message, deserialize_message) == 0 || message.code != (char) INFO_PLAYER)
+		return -1;
+	strcpy(id, message.data);
+
+	// The host invites them, they accept
+	players[0] = connect_to(config.server_ip, config.server_port);
+	sprintf(data, "1:Load:Host%ld", index);
+	send_frame(&players[0], (char) AUTH, data);
+	if (receive_message(&players[0], &message, deserialize_message) == 0 || message.code != (char) OK)
+		return -1;
+
+	send_frame(&players[0], (char) PLAY_WITH, id);
+	if (receive_message(&players[1], &message, deserialize_message) == 0 || message.code != (char) INVITE)
+		return -1;
+	send_frame(&players[1], (char) OK, "");
+	if (receive_message(&players[0], &message, deserialize_message) == 0 || message.code != (char) OK)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * @fn void match_thread(void* arg)
+ * @brief Pair of simulated players: gets a court (by invitation or through the queue) and plays, again and again
+ * @param arg: index of the pair
+ */
+void match_thread(void* arg) {
+	long index = (long) arg, interval, next_point, sent_at;
+	local_samples_t local = {&point_latencies, {0}, 0, 0};
+	socket_t players[2], courts[2];
+	message_t message;
+	unsigned int seed = (unsigned int) index * 7919 + 1;
+	struct timespec deadline;
+	struct send_time* send_time;
+	sim_court_t* times = NULL;
+	char *port, *id;
+	int playing[2], status, points, i;
+
+	interval = config.point_rate > 0 ? (long) (1000000 / config.point_rate) : 0;
+
+	while (1) {
+		// Getting a court, through the queue or by invitation (the two players must share the court with external courts)
+		if (!config.external_courts && (double) rand_r(&seed) / RAND_MAX < config.queue_ratio)
+			status = (join_as_solo(&players[0], index, 1) == -1 || join_as_solo(&players[1], index, 2) == -1) ? -1 : 0;
+		else
+			status = join_by_invitation(players, index);
+
+		for (i = 0; i < 2 && status == 0; i++) {
+			do {
+				if (receive_message(&players[i], &message, deserialize_message) == 0)
+					status = -1;
+			} while (status == 0 && message.code == (char) QUEUED);
+
+			// Formatted example: "127.0.0.1:4242:3"
+			if (status == 0 && message.code == (char) COURT_FOUND) {
+				port = strchr(message.data, ':');
+				*port++ = '\0';
+				id = strchr(port, ':');
+				if (config.external_courts)
+					times = court_times(id == NULL ? 0 : atoi(id + 1));
+				courts[i] = connect_to(message.data, atoi(port));
+				playing[i] = 1;
+			}
+			else
+				status = -1;
+		}
+
+		close(players[0].file_descriptor);
+		close(players[1].file_descriptor);
+		if (status == -1) {
+			fprintf(stderr, "Pair %ld: no court\n", index);
+			sleep(1);
+			continue;
+		}
+
+		// Playing until the courts end the matches (the opponent may be from another pair with the queue)
+		next_point = now_us();
+		points = 0;
+		while (playing[0] || playing[1]) {
+			for (i = 0; i < 2; i++) {
+				if (!playing[i])
+					continue;
+
+				// With external courts, the first player wins all the points, so the spectators can count them from the score
+				if (config.external_courts && i == 1) {
+					if (playing[0])
+						continue;
+					while (receive_message(&courts[1], &message, deserialize_message) != 0 && message.code != (char) END_MATCH);
+					close(courts[1].file_descriptor);
+					playing[1] = 0;
+					continue;
+				}
+
+				if (interval > 0) {
+					next_point += interval;
+					deadline.tv_sec = next_point / 1000000;
+					deadline.tv_nsec = (next_point % 1000000) * 1000;
+					clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+				}
+
+				sent_at = now_us();
+				if (times != NULL) {
+					send_time = &times->send_times[(points + 1) % SEND_TIMES];
+					atomic_store(&send_time->time, sent_at);
+					atomic_store(&send_time->point, points + 1);
+				}
+				if (send_frame(&courts[i], (char) INCREMENT_SCORE, "") == -1
+				|| receive_message(&courts[i], &message, deserialize_message) == 0
+				|| message.code == (char) END_MATCH) {
+					if (config.external_courts && message.code == (char) END_MATCH)
+						atomic_fetch_add(&matches_played, 1);
+					close(courts[i].file_descriptor);
+					playing[i] = 0;
+				}
+				else if (message.code == (char) OK) {
+					record_sample(&local, now_us() - sent_at);
+					points++;
+					if (config.external_courts)
+						atomic_fetch_add(&points_played, 1);
+				}
+				else
+					usleep(1000); // The opponent has not connected yet
+			}
+		}
+	}
+}
+
+/**
+ * @fn sim_court_t* court_times(int id)
+ * @brief Gives the send times of the points of a real court (created on first use)
+ * @param id: court's id
+ * @return sim_court_t*: court whose send_times are used, NULL if the id is too high
+ */
+sim_court_t* court_times(int id) {
+	sim_court_t* court;
+
+	if (id <= 0 || id >= MAX_COURT_ID)
+		return NULL;
+
+	pthread_mutex_lock(&court_ids_mutex);
+	if (courts_by_id[id] == NULL) {
+		court = (sim_court_t*) calloc(1, sizeof(sim_court_t));
+		court->id = id;
+		courts_by_id[id] = court;
+	}
+	court = courts_by_id[id];
+	pthread_mutex_unlock(&court_ids_mutex);
+
+	return court;
+}
+
+/**
+ * @fn long points_of_score(char* score)
+ * @brief Gives the number of points played in a match whose points are all won by the same player
+ * @param score: score of the match ("0/30:6/0:2/0:0/0" gives 4 * 8 + 2 = 34)
+ * @return long: number of points played
+ */
+long points_of_score(char* score) {
+	long points = 0, first, second, winner;
+	char* field = score;
+
+	// The points of the current game, 0, 15, 30 or 40 for the winner
+	first = atol(field);
+	field = strchr(field, '/');
+	second = field == NULL ? 0 : atol(field + 1);
+	winner = first > second ? first : second;
+	points = winner == 15 ? 1 : winner == 30 ? 2 : winner == 40 ? 3 : 0;
+
+	// Then four points per game won
+	while (field != NULL && (field = strchr(field, ':')) != NULL) {
+		field++;
+		first = atol(field);
+		second = strchr(field, '/') == NULL ? 0 : atol(strchr(field, '/') + 1);
+		points += 4 * (first > second ? first : second);
+	}
+
+	return points;
+}
+
+/**
+ * @fn int fetch_court_ids()
+ * @brief Gets the ids of the courts registered on the server, followed by the spectators with external courts
+ * @return int: number of courts
+ */
+int fetch_court_ids() {
+	message_t message;
+	socket_t socket;
+	char *save_ptr, *token, next_page[COURT_LINE_SIZE] = "";
+	int nb_courts = 0, capacity = MAX_BUFFER;
+
+	socket = connect_to(config.server_ip, config.server_port);
+	send_frame(&socket, (char) AUTH, "4");
+	receive_message(&socket, &message, deserialize_message);
+	court_ids = (int*) malloc(capacity * sizeof(int));
+
+	// One id per line, the last line of a page gives the next one ("+42")
+	do {
+		send_frame(&socket, (char) ASK_COURTS, next_page);
+		if (receive_message(&socket, &message, deserialize_message) == 0 || message.code != (char) LIST_COURTS)
+			break;
+
+		next_page[0] = '\0';
+		for (token = strtok_r(message.data, "\n", &save_ptr); token != NULL; token = strtok_r(NULL, "\n", &save_ptr)) {
+			if (token[0] == '+')
+				snprintf(next_page, sizeof(next_page), "%s", token + 1);
+			else if (atoi(token) > 0) {
+				if (nb_courts == capacity) {
+					capacity *= 2;
+					court_ids = (int*) realloc(court_ids, capacity * sizeof(int));
+				}
+				court_ids[nb_courts++] = atoi(token);
+			}
+		}
+	} while (next_page[0] != '\0');
+	close(socket.file_descriptor);
+	nb_court_ids = nb_courts;
+
+	return nb_courts;
+}
+
+/**
+ * @fn int pick_court(unsigned int* seed)
+ * @brief Picks a court following the popularity of the courts
+ * @param seed: random state of the thread
+ * @return int: court's id
+ */
+int pick_court(unsigned int* seed) {
+	double random = (double) rand_r(seed) / RAND_MAX;
+	int low = 0, high = nb_court_ids - 1, middle;
+
+	while (low < high) {
+		middle = (low + high) / 2;
+		if (popularity[middle] < random)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return court_ids[low];
+}
+
+/**
+ * @fn void spectator_thread(void* arg)
+ * @brief Simulated spectator: follows courts chosen by popularity and measures the score propagation latency
+ * @param arg: index of the spectator
+ */
+void spectator_thread(void* arg) {
+	local_samples_t local = {&propagation_latencies, {0}, 0, 0};
+	unsigned int seed = (unsigned int) (long) arg * 104729 + 7;
+	struct send_time* send_time;
+	message_t message;
+	socket_t socket;
+	sim_court_t* court;
+	buffer_t data;
+	long point, sent_at;
+	char* score;
+	int i, id;
+
+	socket = connect_to(config.server_ip, config.server_port);
+	send_frame(&socket, (char) AUTH, "4");
+	receive_message(&socket, &message, deserialize_message);
+
+	// Following the courts (a popular court may be picked twice, it is then followed once)
+	for (i = 0; i < config.subscriptions; i++) {
+		sprintf(data, "%d", pick_court(&seed));
+		send_frame(&socket, (char) SUBSCRIBE, data);
+	}
+
+	while (receive_message(&socket, &message, deserialize_message) != 0) {
+		if (message.code != (char) SCORE)
+			continue;
+
+		// Formatted example: "3|57/0:0/0:0/0:0/0", 57 being the point number
+		id = atoi(message.data);
+		score = strchr(message.data, '|');
+		if (score == NULL || id <= 0 || id >= MAX_COURT_ID || (court = courts_by_id[id]) == NULL)
+			continue;
+		point = config.external_courts ? points_of_score(score + 1) : atol(score + 1);
+		atomic_fetch_add(&updates_received, 1);
+
+		// The send time is still there unless the court has sent SEND_TIMES updates since
+		send_time = &court->send_times[point % SEND_TIMES];
+		if (point == 0 || atomic_load(&send_time->point) != point)
+			continue;
+		sent_at = atomic_load(&send_time->time);
+		if (atomic_load(&send_time->point) == point)
+			record_sample(&local, now_us() - sent_at);
+	}
+
+	fprintf(stderr, "Spectator %ld: connection to the server lost\n", (long) arg);
+}
+
+/**
+ * @fn int compare_samples(const void* a, const void* b)
+ * @brief Compares two latency samples for qsort
+ * @param a: first sample
+ * @param b: second sample
+ * @return int: negative, 0 or positive
+ */
+int compare_samples(const void* a, const void* b) {
+	long x = *(const long*) a, y = *(const long*) b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * @fn void print_latencies(char* name, recorder_t* recorder)
+ * @brief Prints the percentiles of the latency samples of a recorder
+ * @param name: name of the latency
+ * @param recorder: recorder of the samples
+ */
+void print_latencies(char* name, recorder_t* recorder) {
+	double percentiles[] = {50, 90, 99, 99.9};
+	char key[64];
+	long* samples;
+	size_t count, i;
+
+	pthread_mutex_lock(&recorder->mutex);
+	count = recorder->count;
+	samples = (long*) malloc((count + 1) * sizeof(long));
+	memcpy(samples, recorder->samples, count * sizeof(long));
+	pthread_mutex_unlock(&recorder->mutex);
+
+	sprintf(key, "%s_samples", name);
+	print_metric(key, count);
+	if (count == 0) {
+		free(samples);
+		return;
+	}
+
+	qsort(samples, count, sizeof(long), compare_samples);
+	for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+		sprintf(key, "%s_p%g_us", name, percentiles[i]);
+		print_metric(key, samples[(size_t) (percentiles[i] / 100 * (count - 1))]);
+	}
+	sprintf(key, "%s_max_us", name);
+	print_metric(key, samples[count - 1]);
+
+	free(samples);
+}
+
+/**
+ * @fn void print_metric(char* name, double value)
+ * @brief Prints a result, as a "name value" line or as a member of the JSON object of the results (--json)
+ * @param name: name of the result
+ * @param value: value (printed without decimals when it is a whole number)
+ */
+void print_metric(char* name, double value) {
+	static int printed = 0;
+
+	if (config.json)
+		printf("%s\"%s\": ", printed++ == 0 ? "{" : ", ", name);
+	else
+		printf("%s ", name);
+
+	if (value == (long) value)
+		printf("%ld", (long) value);
+	else
+		printf("%.3f", value);
+
+	if (!config.json)
+		printf("\n");
+}
+
+/**
+ * @fn void usage(char* name)
+ * @brief Prints the usage and exits
+ * @param name: name of the executable
+ */
+void usage(char* name) {
+	fprintf(stderr,
+			"Usage: %s <ServerIP> <ServerPort> [options]\n"
+			"  --court-processes N   simulated court processes (%d)\n"
+			"  --courts N            courts of each court process (%d)\n"
+			"  --matches N           pairs of players (%d)\n"
+			"  --spectators N        spectators (%d)\n"
+			"  --subscriptions N     courts followed by each spectator (%d)\n"
+			"  --skew S              Zipf exponent of the popularity of the courts, 0 for uniform (%g)\n"
+			"  --point-rate R        points per second of each match, 0 for as fast as possible (%g)\n"
+			"  --points-per-match N  points played on a court before it ends the match (%d)\n"
+			"  --queue-ratio F       proportion of pairs joining the queue instead of inviting (%g)\n"
+			"  --duration S          measured duration in seconds (%d)\n"
+			"  --external-courts     plays on the courts registered on the server (real court processes) instead of\n"
+			"                        simulating them, and measures from INCREMENT_SCORE to the spectators\n"
+			"  --json                prints the results as one JSON object\n",
+			name, config.court_processes, config.courts, config.matches, config.spectators,
+			config.subscriptions, config.skew, config.point_rate, config.points_per_match,
+			config.queue_ratio, config.duration);
+	exit(1);
+}
+
+int main(int argc, char** argv) {
+	struct option options[] = {
+		{"court-processes", required_argument, NULL, 'c'},
+		{"courts", required_argument, NULL, 'n'},
+		{"matches", required_argument, NULL, 'm'},
+		{"spectators", required_argument, NULL, 's'},
+		{"subscriptions", required_argument, NULL, 'k'},
+		{"skew", required_argument, NULL, 'z'},
+		{"point-rate", required_argument, NULL, 'r'},
+		{"points-per-match", required_argument, NULL, 'P'},
+		{"queue-ratio", required_argument, NULL, 'q'},
+		{"duration", required_argument, NULL, 'd'},
+		{"external-courts", no_argument, NULL, 'e'},
+		{"json", no_argument, NULL, 'j'},
+		{NULL, 0, NULL, 0}
+	};
+	long points_start, updates_start, matches_start, start, i;
+	double seconds, total = 0;
+	int option, nb_courts;
+
+	while ((option = getopt_long(argc, argv, "", options, NULL)) != -1) {
+		switch (option) {
+			case 'c': config.court_processes = atoi(optarg); break;
+			case 'n': config.courts = atoi(optarg); break;
+			case 'm': config.matches = atoi(optarg); break;
+			case 's': config.spectators = atoi(optarg); break;
+			case 'k': config.subscriptions = atoi(optarg); break;
+			case 'z': config.skew = atof(optarg); break;
+			case 'r': config.point_rate = atof(optarg); break;
+			case 'P': config.points_per_match = atoi(optarg); break;
+			case 'q': config.queue_ratio = atof(optarg); break;
+			case 'd': config.duration = atoi(optarg); break;
+			case 'e': config.external_courts = 1; break;
+			case 'j': config.json = 1; break;
+			default: usage(argv[0]);
+		}
+	}
+	if (argc - optind < 2)
+		usage(argv[0]);
+	config.server_ip = argv[optind];
+	config.server_port = atoi(argv[optind + 1]);
+
+	// A closed connection is seen when reading, not as a signal
+	signal(SIGPIPE, SIG_IGN);
+
+	init_recorder(&point_latencies);
+	init_recorder(&propagation_latencies);
+
+	// Registering the courts first, so the spectators can pick them (or taking the ones already on the server)
+	if (config.external_courts) {
+		nb_courts = fetch_court_ids();
+		if (nb_courts == 0) {
+			fprintf(stderr, "No court registered on the server\n");
+			return 1;
+		}
+	}
+	else {
+		nb_courts = config.court_processes * config.courts;
+		court_ids = (int*) malloc(nb_courts * sizeof(int));
+		for (i = 0; i < config.court_processes; i++)
+			start_thread(court_process_thread, i);
+
+		pthread_mutex_lock(&court_ids_mutex);
+		while (nb_court_ids < nb_courts)
+			pthread_cond_wait(&court_registered, &court_ids_mutex);
+		pthread_mutex_unlock(&court_ids_mutex);
+	}
+	popularity = (double*) malloc(nb_courts * sizeof(double));
+
+	// Zipf popularity: the court of rank r is followed in proportion to 1 / r^skew
+	for (i = 0; i < nb_courts; i++) {
+		total += 1 / pow(i + 1, config.skew);
+		popularity[i] = total;
+	}
+	for (i = 0; i < nb_courts; i++)
+		popularity[i] /= total;
+
+	for (i = 0; i < config.spectators; i++)
+		start_thread(spectator_thread, i);
+	for (i = 0; i < config.matches; i++)
+		start_thread(match_thread, i);
+
+	// Printed with the results in JSON, so that each line of the output is one run
+	if (!config.json) {
+		printf("courts %d\nplayers %d\nspectators %d\n", nb_courts, 2 * config.matches, config.spectators);
+		fflush(stdout);
+	}
+
+	// Measuring from now on
+	pthread_mutex_lock(&point_latencies.mutex);
+	point_latencies.count = 0;
+	pthread_mutex_unlock(&point_latencies.mutex);
+	pthread_mutex_lock(&propagation_latencies.mutex);
+	propagation_latencies.count = 0;
+	pthread_mutex_unlock(&propagation_latencies.mutex);
+
+	start = now_us();
+	points_start = atomic_load(&points_played);
+	updates_start = atomic_load(&updates_received);
+	matches_start = atomic_load(&matches_played);
+
+	sleep(config.duration);
+
+	seconds = (now_us() - start) / 1e6;
+	if (config.json) {
+		print_metric("courts", nb_courts);
+		print_metric("players", 2 * config.matches);
+		print_metric("spectators", config.spectators);
+		print_metric("subscriptions", config.subscriptions);
+	}
+	print_metric("duration_s", seconds);
+	print_metric("matches_completed", atomic_load(&matches_played) - matches_start);
+	print_metric("points_per_second", (long) ((atomic_load(&points_played) - points_start) / seconds));
+	print_metric("updates_received_per_second", (long) ((atomic_load(&updates_received) - updates_start) / seconds));
+	print_latencies("point", &point_latencies);
+
+	// With external courts, the latency from the press of the player to the spectators, through the court and the server
+	print_latencies(config.external_courts ? "end_to_end" : "propagation", &propagation_latencies);
+	if (config.json)
+		printf("}\n");
+
+	return 0;
+}
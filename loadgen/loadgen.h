@@ -0,0 +1,254 @@
+#ifndef PANTALLA_DEPORTIVA_V2_LOADGEN_H
+#define PANTALLA_DEPORTIVA_V2_LOADGEN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+
+#include "../socket/data.h"
+#include "../serialization/serialization.h"
+#include "../common/codes.h"
+
+/**
+ * @def SEND_TIMES
+ * @brief Number of score updates of a simulated court whose send time is kept (to measure the latency)
+ */
+#define SEND_TIMES 1024
+
+/**
+ * @def MAX_COURT_ID
+ * @brief Highest court id the spectators can measure the latency of
+ */
+#define MAX_COURT_ID 65536
+
+/**
+ * @def LOCAL_SAMPLES
+ * @brief Number of latency samples a thread keeps before adding them to the recorder
+ */
+#define LOCAL_SAMPLES 256
+
+/**
+ * @def FLUSH_INTERVAL
+ * @brief Maximum time the samples of a thread are kept before being added to the recorder (us)
+ */
+#define FLUSH_INTERVAL 100000
+
+/**
+ * @def THREAD_STACK_SIZE
+ * @brief Stack size of the simulated clients (there can be thousands of them)
+ */
+#define THREAD_STACK_SIZE (256 * 1024)
+
+/**
+ * @struct config
+ * @brief Parameters of the load
+ * @var server_ip: server's address
+ * @var server_port: server's port
+ * @var court_processes: number of simulated court processes (one connection to the server each)
+ * @var courts: number of courts of each court process
+ * @var matches: number of pairs of players playing at the same time (or waiting for a court)
+ * @var spectators: number of spectators
+ * @var subscriptions: number of courts followed by each spectator
+ * @var skew: Zipf exponent of the popularity of the courts (0 for uniform subscriptions)
+ * @var point_rate: points per second of each match (0 for as fast as possible)
+ * @var points_per_match: points played before a simulated court ends its match
+ * @var queue_ratio: proportion of the pairs joining the queue as solo players instead of inviting
+ * @var duration: measured duration (s)
+ * @var external_courts: 1 to play on the courts of real court processes instead of simulated ones
+ * @var json: 1 to print the results as one JSON object
+ */
+struct config {
+	char* server_ip;
+	int server_port;
+	int court_processes;
+	int courts;
+	int matches;
+	int spectators;
+	int subscriptions;
+	double skew;
+	double point_rate;
+	int points_per_match;
+	double queue_ratio;
+	int duration;
+	int external_courts;
+	int json;
+};
+
+/**
+ * @typedef config_t
+ * @brief Typedef for the config structure
+ */
+typedef struct config config_t;
+
+/**
+ * @struct send_time
+ * @brief Time a score update of a simulated court was sent at
+ * @var point: point number of the update (the score published is this number)
+ * @var time: send time (us)
+ */
+struct send_time {
+	atomic_long point;
+	atomic_long time;
+};
+
+/**
+ * @struct sim_court
+ * @brief Court simulated by a court process thread
+ * @var id: court's id, given by the server
+ * @var listen_socket: socket the players connect to
+ * @var players: players' sockets
+ * @var nb_players: number of players connected
+ * @var points: points played in the current match
+ * @var sequence: sequence number of the last message sent to the server
+ * @var send_times: send times of the last score updates
+ */
+struct sim_court {
+	int id;
+	socket_t listen_socket;
+	socket_t players[2];
+	int nb_players;
+	int points;
+	unsigned long sequence;
+	struct send_time send_times[SEND_TIMES];
+};
+
+/**
+ * @typedef sim_court_t
+ * @brief Typedef for the sim_court structure
+ */
+typedef struct sim_court sim_court_t;
+
+/**
+ * @struct recorder
+ * @brief Latency samples of all the threads
+ * @var samples: latencies (us)
+ * @var count: number of samples
+ * @var capacity: size of the samples array
+ * @var mutex: mutex for the samples
+ */
+struct recorder {
+	long* samples;
+	size_t count;
+	size_t capacity;
+	pthread_mutex_t mutex;
+};
+
+/**
+ * @typedef recorder_t
+ * @brief Typedef for the recorder structure
+ */
+typedef struct recorder recorder_t;
+
+/**
+ * @struct local_samples
+ * @brief Latency samples of one thread, added to a recorder by batches
+ * @var recorder: recorder to add the samples to
+ * @var samples: latencies (us)
+ * @var count: number of samples
+ * @var flushed: time of the last batch added to the recorder (us)
+ */
+struct local_samples {
+	recorder_t* recorder;
+	long samples[LOCAL_SAMPLES];
+	int count;
+	long flushed;
+};
+
+/**
+ * @typedef local_samples_t
+ * @brief Typedef for the local_samples structure
+ */
+typedef struct local_samples local_samples_t;
+
+/**
+ * @fn long now_us()
+ * @brief Gives the time of a monotonic clock
+ * @return long: time (us)
+ */
+long now_us();
+
+/**
+ * @fn int send_frame(socket_t* socket, char code, char* data)
+ * @brief Sends a message without exiting (nor being killed by SIGPIPE) if the connection is closed
+ * @param socket: socket to send on
+ * @param code: message code
+ * @param data: message data
+ * @return int: 0 if sent, -1 if the connection is closed
+ */
+int send_frame(socket_t* socket, char code, char* data);
+
+/**
+ * @fn void record_sample(local_samples_t* local, long latency)
+ * @brief Records a latency sample
+ * @param local: samples of the thread
+ * @param latency: latency (us)
+ */
+void record_sample(local_samples_t* local, long latency);
+
+/**
+ * @fn sim_court_t* court_times(int id)
+ * @brief Gives the send times of the points of a real court (created on first use)
+ * @param id: court's id
+ * @return sim_court_t*: court whose send_times are used, NULL if the id is too high
+ */
+sim_court_t* court_times(int id);
+
+/**
+ * @fn long points_of_score(char* score)
+ * @brief Gives the number of points played in a match whose points are all won by the same player
+ * @param score: score of the match ("0/30:6/0:2/0:0/0" gives 4 * 8 + 2 = 34)
+ * @return long: number of points played
+ */
+long points_of_score(char* score);
+
+/**
+ * @fn int fetch_court_ids()
+ * @brief Gets the ids of the courts registered on the server, followed by the spectators with external courts
+ * @return int: number of courts
+ */
+int fetch_court_ids();
+
+/**
+ * @fn void court_process_thread(void* arg)
+ * @brief Simulated court process: registers its courts, accepts the players and sends the score updates
+ * @param arg: index of the court process
+ */
+void court_process_thread(void* arg);
+
+/**
+ * @fn void match_thread(void* arg)
+ * @brief Pair of simulated players: gets a court (by invitation or through the queue) and plays, again and again
+ * @param arg: index of the pair
+ */
+void match_thread(void* arg);
+
+/**
+ * @fn void spectator_thread(void* arg)
+ * @brief Simulated spectator: follows courts chosen by popularity and measures the score propagation latency
+ * @param arg: index of the spectator
+ */
+void spectator_thread(void* arg);
+
+/**
+ * @fn void print_latencies(char* name, recorder_t* recorder)
+ * @brief Prints the percentiles of the latency samples of a recorder
+ * @param name: name of the latency
+ * @param recorder: recorder of the samples
+ */
+void print_latencies(char* name, recorder_t* recorder);
+
+/**
+ * @fn void print_metric(char* name, double value)
+ * @brief Prints a result, as a "name value" line or as a member of the JSON object of the results (--json)
+ * @param name: name of the result
+ * @param value: value (printed without decimals when it is a whole number)
+ */
+void print_metric(char* name, double value);
+
+#endif //PANTALLA_DEPORTIVA_V2_LOADGEN_H
@@ -0,0 +1,417 @@
+/**
+ * @file log.c
+ * @brief Asynchronous log: each thread copies its events in its own ring, a writer thread formats and writes them
+ * @date 2024-06-05
+ */
+
+#include "log.h"
+
+/**
+ * @def LOG_BATCH_SIZE
+ * @brief Size of the buffer a stream is written with (one write per pass, unless it fills up)
+ */
+#define LOG_BATCH_SIZE 65536
+
+const char* level_names[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+
+int threshold = LOG_INFO; // Lowest level logged, set once by log_init
+
+log_ring_t* rings = NULL; // Rings of the threads that have logged
+pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for the list of rings (never taken to log)
+pthread_mutex_t drain_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for reading the rings (writer thread and log_flush)
+
+__thread log_ring_t* own_ring = NULL; // Ring of the calling thread, created on its first event
+pthread_key_t ring_key; // Closes the ring of a thread when it ends
+pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+log_record_t* batch = NULL; // Records of a pass, sorted by time before being written (drain_mutex)
+size_t batch_capacity = 0;
+
+/**
+ * @fn void close_ring(void* ring)
+ * @brief Marks the ring of a thread that ends, the writer frees it once read
+ * @param ring: ring of the thread
+ */
+void close_ring(void* ring) {
+	atomic_store_explicit(&((log_ring_t*) ring)->closed, 1, memory_order_release);
+}
+
+/**
+ * @fn void create_ring_key()
+ * @brief Creates the key closing the rings of the threads that end
+ */
+void create_ring_key() {
+	pthread_key_create(&ring_key, close_ring);
+}
+
+/**
+ * @fn log_ring_t* register_ring()
+ * @brief Creates the ring of the calling thread
+ * @return log_ring_t*: ring
+ */
+log_ring_t* register_ring() {
+	log_ring_t* ring = (log_ring_t*) aligned_alloc(LOG_CACHE_LINE, sizeof(log_ring_t));
+
+	memset(ring, 0, sizeof(log_ring_t));
+
+	pthread_once(&ring_key_once, create_ring_key);
+	pthread_setspecific(ring_key, ring);
+
+	// Once per thread: the next events go straight to the ring
+	pthread_mutex_lock(&rings_mutex);
+	ring->next = rings;
+	rings = ring;
+	pthread_mutex_unlock(&rings_mutex);
+
+	own_ring = ring;
+	return ring;
+}
+
+/**
+ * @fn const char* next_conversion(const char* format, char* spec, char* conversion, int* length)
+ * @brief Finds the next conversion of a format
+ * @param format: format, from where to search
+ * @param spec: filled with the conversion ("%-5ld"), at least 32 characters
+ * @param conversion: filled with its letter ('d')
+ * @param length: filled with the number of 'l' (0, 1 or 2)
+ * @return const char*: format after the conversion, NULL if there is none
+ */
+const char* next_conversion(const char* format, char* spec, char* conversion, int* length) {
+	int size = 0;
+
+	// Skipping the text and the %%
+	while ((format = strchr(format, '%')) != NULL && format[1] == '%')
+		format += 2;
+	if (format == NULL)
+		return NULL;
+
+	// Flags, width and precision are kept in the spec as they are
+	*length = 0;
+	spec[size++] = *format++;
+	while (*format != '\0' && strchr("-+ #0123456789.", *format) != NULL && size < 28)
+		spec[size++] = *format++;
+	while (*format == 'l' || *format == 'z') {
+		*length += 1;
+		spec[size++] = 'l';
+		format++;
+	}
+
+	*conversion = *format;
+	spec[size++] = *format;
+	spec[size] = '\0';
+
+	return *format != '\0' ? format + 1 : format;
+}
+
+/**
+ * @fn void log_init()
+ * @brief Starts the writer, the threshold being read from LOG_LEVEL (debug, info, warning or error)
+ */
+void log_init() {
+	void log_writer();
+	char* level = getenv("LOG_LEVEL");
+	pthread_t thread;
+	int i;
+
+	for (i = LOG_DEBUG; level != NULL && i <= LOG_ERROR; i++)
+		if (strcasecmp(level, level_names[i]) == 0)
+			threshold = i;
+
+	// The events logged before an exit are still written
+	atexit(log_flush);
+
+	pthread_create(&thread, NULL, (void*) log_writer, NULL);
+	pthread_detach(thread);
+}
+
+/**
+ * @fn int log_threshold()
+ * @brief Gives the lowest level logged
+ * @return int: LOG_DEBUG, LOG_INFO, LOG_WARNING or LOG_ERROR
+ */
+int log_threshold() {
+	return threshold;
+}
+
+/**
+ * @fn void log_message(int level, const char* format, ...)
+ * @brief Logs an event without formatting it nor waiting: the arguments are copied in the ring of the thread
+ * @param level: level of the event
+ * @param format: format, a literal with the conversions of printf (%d, %ld, %lu, %llx, %s, %c, %f...)
+ * @param ...: arguments (at most LOG_MAX_ARGS besides the strings)
+ */
+void log_message(int level, const char* format, ...) {
+	log_ring_t* ring;
+	log_record_t* record;
+	struct timespec now;
+	unsigned long tail;
+	char spec[32], conversion;
+	const char* string;
+	size_t text_size = 0, string_size;
+	int length, nb_args = 0;
+	va_list args;
+
+	if (level < threshold)
+		return;
+
+	ring = own_ring != NULL ? own_ring : register_ring();
+
+	// Full ring: the event is dropped rather than waiting for the writer
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) >= LOG_RING_SIZE) {
+		atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1,
+							  memory_order_relaxed);
+		return;
+	}
+
+	record = &ring->records[tail % LOG_RING_SIZE];
+	clock_gettime(CLOCK_REALTIME, &now);
+	record->time = now.tv_sec * 1000000000L + now.tv_nsec;
+	record->format = format;
+	record->level = level;
+
+	// Copying the arguments, the formatting is left to the writer
+	va_start(args, format);
+	while ((format = next_conversion(format, spec, &conversion, &length)) != NULL && conversion != '\0') {
+		if (conversion == 's') {
+			string = va_arg(args, const char*);
+			if (string == NULL)
+				string = "(null)";
+			string_size = strnlen(string, LOG_TEXT_SIZE);
+			if (text_size + string_size >= LOG_TEXT_SIZE)
+				string_size = text_size < LOG_TEXT_SIZE ? LOG_TEXT_SIZE - 1 - text_size : 0;
+			if (text_size < LOG_TEXT_SIZE) {
+				memcpy(record->text + text_size, string, string_size);
+				record->text[text_size + string_size] = '\0';
+				text_size += string_size + 1;
+			}
+			continue;
+		}
+
+		if (nb_args == LOG_MAX_ARGS)
+			break;
+
+		if (strchr("feEgGaA", conversion) != NULL)
+			record->args[nb_args++].real = va_arg(args, double);
+		else if (conversion == 'p')
+			record->args[nb_args++].integer = (long long) (intptr_t) va_arg(args, void*);
+		else if (length == 0)
+			record->args[nb_args++].integer = va_arg(args, int);
+		else if (length == 1)
+			record->args[nb_args++].integer = va_arg(args, long);
+		else
+			record->args[nb_args++].integer = va_arg(args, long long);
+	}
+	va_end(args);
+
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/**
+ * @fn size_t format_record(log_record_t* record, char* line, size_t size)
+ * @brief Formats a record, as printf would have
+ * @param record: record
+ * @param line: filled with the line, ending with \n
+ * @param size: size of the line
+ * @return size_t: length of the line
+ */
+size_t format_record(log_record_t* record, char* line, size_t size) {
+	const char *format = record->format, *text = record->text;
+	char spec[32], conversion;
+	time_t seconds = record->time / 1000000000L;
+	long long integer;
+	struct tm date;
+	size_t used;
+	int length, nb_args = 0;
+
+	localtime_r(&seconds, &date);
+	used = strftime(line, size, "%H:%M:%S", &date);
+	used += snprintf(line + used, size - used, ".%06ld %-7s ", record->time % 1000000000L / 1000,
+					 level_names[record->level]);
+
+	// One character is kept for the \n
+	size--;
+	while (*format != '\0' && used < size) {
+		if (*format != '%' || format[1] == '%') {
+			line[used++] = *format;
+			format += *format == '%' ? 2 : 1;
+			continue;
+		}
+
+		format = next_conversion(format, spec, &conversion, &length);
+		if (conversion == '\0')
+			break;
+
+		if (conversion == 's') {
+			// Strings beyond LOG_TEXT_SIZE were not copied
+			if (text < record->text + LOG_TEXT_SIZE) {
+				used += snprintf(line + used, size - used, spec, text);
+				text += strlen(text) + 1;
+			}
+			continue;
+		}
+
+		if (nb_args == LOG_MAX_ARGS)
+			break;
+
+		integer = record->args[nb_args].integer;
+		if (strchr("feEgGaA", conversion) != NULL)
+			used += snprintf(line + used, size - used, spec, record->args[nb_args].real);
+		else if (conversion == 'p')
+			used += snprintf(line + used, size - used, spec, (void*) (intptr_t) integer);
+		else if (strchr("uxXo", conversion) != NULL)
+			used += length == 0 ? snprintf(line + used, size - used, spec, (unsigned int) integer) :
+					length == 1 ? snprintf(line + used, size - used, spec, (unsigned long) integer) :
+					snprintf(line + used, size - used, spec, (unsigned long long) integer);
+		else
+			used += length == 0 ? snprintf(line + used, size - used, spec, (int) integer) :
+					length == 1 ? snprintf(line + used, size - used, spec, (long) integer) :
+					snprintf(line + used, size - used, spec, integer);
+		nb_args++;
+	}
+
+	// Truncated lines still end the line
+	if (used > size - 1)
+		used = size - 1;
+	line[used++] = '\n';
+	line[used] = '\0';
+
+	return used;
+}
+
+/**
+ * @fn int compare_records(const void* a, const void* b)
+ * @brief Orders two records by time
+ * @param a: first record
+ * @param b: second record
+ * @return int: negative if a is older, positive if b is older, 0 otherwise
+ */
+int compare_records(const void* a, const void* b) {
+	long time_a = ((log_record_t*) a)->time, time_b = ((log_record_t*) b)->time;
+
+	return (time_a > time_b) - (time_a < time_b);
+}
+
+/**
+ * @fn size_t collect_ring(log_ring_t* ring, size_t count)
+ * @brief Moves the records of a ring to the batch
+ * @param ring: ring
+ * @param count: records already in the batch
+ * @return size_t: records in the batch
+ */
+size_t collect_ring(log_ring_t* ring, size_t count) {
+	unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	unsigned long dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+
+	if (count + (tail - head) + 1 > batch_capacity) {
+		batch_capacity = 2 * (count + (tail - head) + 1);
+		batch = (log_record_t*) realloc(batch, batch_capacity * sizeof(log_record_t));
+	}
+
+	for (; head != tail; head++)
+		batch[count++] = ring->records[head % LOG_RING_SIZE];
+
+	// The thread can write the records again
+	atomic_store_explicit(&ring->head, head, memory_order_release);
+
+	// The drops are reported as an event of their own
+	if (dropped != ring->reported_drops) {
+		batch[count].time = count > 0 ? batch[count - 1].time : 0;
+		batch[count].format = "%lu events dropped by a thread (log ring full)";
+		batch[count].level = LOG_WARNING;
+		batch[count++].args[0].integer = (long long) (dropped - ring->reported_drops);
+		ring->reported_drops = dropped;
+	}
+
+	return count;
+}
+
+/**
+ * @fn void write_batch(FILE* stream, char* buffer, size_t* used)
+ * @brief Writes the buffer of a stream
+ * @param stream: stdout or stderr
+ * @param buffer: lines to write
+ * @param used: length of the lines, reset
+ */
+void write_batch(FILE* stream, char* buffer, size_t* used) {
+	if (*used == 0)
+		return;
+
+	fwrite(buffer, 1, *used, stream);
+	fflush(stream);
+	*used = 0;
+}
+
+/**
+ * @fn void log_flush()
+ * @brief Writes the records logged so far (before exiting)
+ */
+void log_flush() {
+	static char out[LOG_BATCH_SIZE], err[LOG_BATCH_SIZE];
+	log_ring_t *ring, **node_ptr;
+	size_t count = 0, out_used = 0, err_used = 0, i;
+	char line[512];
+	size_t line_size;
+	int closed;
+
+	pthread_mutex_lock(&drain_mutex);
+
+	// The threads keep logging while their rings are read, only the list is locked
+	pthread_mutex_lock(&rings_mutex);
+	node_ptr = &rings;
+	while ((ring = *node_ptr) != NULL) {
+		closed = atomic_load_explicit(&ring->closed, memory_order_acquire);
+		count = collect_ring(ring, count);
+
+		// A thread that has ended logs no more: its ring is freed once read
+		if (closed) {
+			*node_ptr = ring->next;
+			free(ring);
+		} else {
+			node_ptr = &ring->next;
+		}
+	}
+	pthread_mutex_unlock(&rings_mutex);
+
+	// Formatting out of the locks, in the order of the events
+	qsort(batch, count, sizeof(log_record_t), compare_records);
+	for (i = 0; i < count; i++) {
+		line_size = format_record(&batch[i], line, sizeof(line));
+
+		if (batch[i].level >= LOG_WARNING) {
+			if (err_used + line_size > LOG_BATCH_SIZE)
+				write_batch(stderr, err, &err_used);
+			memcpy(err + err_used, line, line_size);
+			err_used += line_size;
+		} else {
+			if (out_used + line_size > LOG_BATCH_SIZE)
+				write_batch(stdout, out, &out_used);
+			memcpy(out + out_used, line, line_size);
+			out_used += line_size;
+		}
+	}
+
+	write_batch(stdout, out, &out_used);
+	write_batch(stderr, err, &err_used);
+
+	pthread_mutex_unlock(&drain_mutex);
+}
+
+/**
+ * @fn void log_writer()
+ * @brief Writes the records of all the threads every LOG_FLUSH_INTERVAL
+ */
+void log_writer() {
+	struct timespec interval = {0, LOG_FLUSH_INTERVAL * 1000000L};
+	sigset_t signals;
+
+	// The signals go to the other threads: a handler exiting here would wait for its own flush
+	sigfillset(&signals);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	while (1) {
+		nanosleep(&interval, NULL);
+		log_flush();
+	}
+}
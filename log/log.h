@@ -0,0 +1,179 @@
+#ifndef PANTALLA_DEPORTIVA_V2_LOG_H
+#define PANTALLA_DEPORTIVA_V2_LOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * @def LOG_DEBUG
+ * @brief Level of the events useful to follow everything (all the samples of the sampled events)
+ */
+#define LOG_DEBUG 0
+/**
+ * @def LOG_INFO
+ * @brief Level of the normal events (default threshold)
+ */
+#define LOG_INFO 1
+/**
+ * @def LOG_WARNING
+ * @brief Level of the events that are handled but unexpected (written on stderr)
+ */
+#define LOG_WARNING 2
+/**
+ * @def LOG_ERROR
+ * @brief Level of the failures (written on stderr)
+ */
+#define LOG_ERROR 3
+
+/**
+ * @def LOG_RING_SIZE
+ * @brief Records a thread can log between two passes of the writer (more are dropped and counted)
+ */
+#define LOG_RING_SIZE 128
+
+/**
+ * @def LOG_MAX_ARGS
+ * @brief Arguments of a record, not counting its strings
+ */
+#define LOG_MAX_ARGS 6
+
+/**
+ * @def LOG_TEXT_SIZE
+ * @brief Room for the strings of a record (truncated beyond)
+ */
+#define LOG_TEXT_SIZE 64
+
+/**
+ * @def LOG_FLUSH_INTERVAL
+ * @brief Time between two passes of the writer (ms)
+ */
+#define LOG_FLUSH_INTERVAL 10
+
+/**
+ * @def LOG_SAMPLING
+ * @brief Default sampling of the high-rate events: one logged out of LOG_SAMPLING (all of them at LOG_DEBUG)
+ */
+#define LOG_SAMPLING 100
+
+/**
+ * @def LOG_CACHE_LINE
+ * @brief Size of a cache line, separating the indexes written by the thread and by the writer
+ */
+#define LOG_CACHE_LINE 64
+
+/**
+ * @def log_sampled
+ * @brief Logs one call out of rate of this call site in each thread, or all of them at LOG_DEBUG
+ * @param rate: sampling (LOG_SAMPLING for instance)
+ * @param level: level of the event
+ * @param ...: format and arguments, as for log_message
+ */
+#define log_sampled(rate, level, ...) do { \
+	static __thread unsigned long log_calls_; \
+	if (log_calls_++ % (rate) == 0 || log_threshold() == LOG_DEBUG) \
+		log_message(level, __VA_ARGS__); \
+} while (0)
+
+/**
+ * @union log_arg
+ * @brief Argument of a record, kept as is until the writer formats it
+ */
+union log_arg {
+	long long integer;
+	double real;
+};
+
+/**
+ * @typedef log_arg_t
+ * @brief Typedef for log_arg union
+ */
+typedef union log_arg log_arg_t;
+
+/**
+ * @struct log_record
+ * @brief Event logged by a thread, formatted later by the writer
+ * @var time: time of the event (ns since the epoch)
+ * @var format: format of the message (a literal: only its address is kept)
+ * @var level: level of the event
+ * @var args: numeric arguments, in the order of the format
+ * @var text: string arguments, one after the other with their \0
+ */
+struct log_record {
+	long time;
+	const char* format;
+	int level;
+	log_arg_t args[LOG_MAX_ARGS];
+	char text[LOG_TEXT_SIZE];
+};
+
+/**
+ * @typedef log_record_t
+ * @brief Typedef for log_record structure
+ */
+typedef struct log_record log_record_t;
+
+/**
+ * @struct log_ring
+ * @brief Records of a thread, written by this thread only and read by the writer only (no lock)
+ * @var head: index of the next record to read, written by the writer
+ * @var tail: index of the next record to write, written by the thread
+ * @var dropped: records dropped because the ring was full, written by the thread
+ * @var closed: 1 once the thread has ended, the writer frees the ring once read
+ * @var reported_drops: drops already reported, written by the writer
+ * @var records: records
+ * @var next: next ring in the list of the writer
+ */
+struct log_ring {
+	_Alignas(LOG_CACHE_LINE) atomic_ulong head;
+	_Alignas(LOG_CACHE_LINE) atomic_ulong tail;
+	atomic_ulong dropped;
+	atomic_int closed;
+	unsigned long reported_drops;
+	log_record_t records[LOG_RING_SIZE];
+	struct log_ring* next;
+};
+
+/**
+ * @typedef log_ring_t
+ * @brief Typedef for log_ring structure
+ */
+typedef struct log_ring log_ring_t;
+
+/**
+ * @fn void log_init()
+ * @brief Starts the writer, the threshold being read from LOG_LEVEL (debug, info, warning or error)
+ */
+void log_init();
+
+/**
+ * @fn int log_threshold()
+ * @brief Gives the lowest level logged
+ * @return int: LOG_DEBUG, LOG_INFO, LOG_WARNING or LOG_ERROR
+ */
+int log_threshold();
+
+/**
+ * @fn void log_message(int level, const char* format, ...)
+ * @brief Logs an event without formatting it nor waiting: the arguments are copied in the ring of the thread
+ * @param level: level of the event
+ * @param format: format, a literal with the conversions of printf (%d, %ld, %lu, %llx, %s, %c, %f...)
+ * @param ...: arguments (at most LOG_MAX_ARGS besides the strings)
+ */
+void log_message(int level, const char* format, ...);
+
+/**
+ * @fn void log_flush()
+ * @brief Writes the records logged so far (before exiting)
+ */
+void log_flush();
+
+#endif //PANTALLA_DEPORTIVA_V2_LOG_H
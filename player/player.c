@@ -1,168 +1,149 @@
 #include "player.h"
 
+const client_callbacks_t callbacks = {
+	.on_answer = on_answer,
+	.on_player_id = on_player_id,
+	.on_invitation = on_invitation,
+	.on_players = on_players,
+	.on_queued = on_queued,
+	.on_court_found = on_court_found,
+	.on_point = on_point,
+	.on_match_end = on_match_end,
+	.on_closed = on_closed
+};
+
 int main(int argc, char** argv) {
-	socket_t socket, court_socket;
-	buffer_t first_name, last_name;
-	char choice;
+	player_session_t session = {0};
+	struct pollfd file_descriptors[2];
+	buffer_t first_name, last_name, choice;
+	client_t* client;
 
 	if (argc < 3) {
 		fprintf(stderr, "Usage: %s <ServerIP> <ServerPort>\n", argv[0]);
 		return 1;
 	}
 
-	// Connecting to the server
-	socket = connect_to(argv[1], atoi(argv[2]));
+	// The hops of the points seen here are printed on stderr on each SIGUSR2 (kill -USR2)
+	start_trace_dumper();
 
 	// Asking the player for their first and last name
 	printf("Entrez votre prénom : ");
-	fgets(first_name, sizeof(buffer_t), stdin);
-	first_name[strlen(first_name) - 1] = '\0'; // Removing the newline character
+	fflush(stdout);
+	read_line(first_name, sizeof(buffer_t));
 
 	printf("Entrez votre nom : ");
-	fgets(last_name, sizeof(buffer_t), stdin);
-	last_name[strlen(last_name) - 1] = '\0'; // Removing the newline character
+	fflush(stdout);
+	read_line(last_name, sizeof(buffer_t));
 
 	printf("Que voulez-vous faire ?\n"
 	       "1. Etre invité par votre partenaire\n"
 	       "2. Inviter votre partenaire\n"
 	       "Votre choix : ");
-	scanf("%c", &choice);
+	fflush(stdout);
+	read_line(choice, sizeof(buffer_t));
 
-	// Authenticating as an invited or inviting player
-	switch (choice) {
+	switch (choice[0]) {
 		case '1':
-			// Authenticating as an invited player
-			authenticate(socket, INVITED_AUTH, first_name, last_name);
-
-			// Invited player function
-			invited_player(socket);
+			session.role = INVITED_AUTH;
 			break;
-
 		case '2':
-			// Authenticating as an inviting player
-			authenticate(socket, HOST_AUTH, first_name, last_name);
-
-			// Inviting a partner
-			invite_partner(socket);
+			session.role = HOST_AUTH;
 			break;
-
 		default:
 			fprintf(stderr, "Choix invalide\n");
 			exit(1);
 	}
 
-	// Connecting to the court
-	printf("Attente de la réception du court...\n");
-	court_socket = connect_to_court(&socket);
+	// Connecting to the server and authenticating as an invited or inviting player
+	client = client_connect(argv[1], atoi(argv[2]), &callbacks, &session);
+	if (client == NULL) {
+		fprintf(stderr, "Impossible de se connecter au serveur\n");
+		exit(1);
+	}
+	client_authenticate(client, session.role, last_name, first_name);
+
+	// The answers of the server, then of the court, and the points pressed meanwhile
+	while (!session.over) {
+		file_descriptors[0].fd = client->file_descriptor;
+		file_descriptors[0].events = client_events(client);
+		file_descriptors[0].revents = 0;
+
+		// Reading the points only while the court can take more
+		file_descriptors[1].fd = (session.on_court && !session.input_closed
+			&& client->points_sent - session.answered < PIPELINE_SIZE) ? STDIN_FILENO : -1;
+		file_descriptors[1].events = POLLIN;
+		file_descriptors[1].revents = 0;
 
-	// Entering match mode
-	match_mode(&court_socket);
+		if (poll(file_descriptors, 2, -1) == -1)
+			break;
+
+		if (file_descriptors[1].revents != 0)
+			read_points(client);
+		if (file_descriptors[0].revents != 0)
+			client_process(client, file_descriptors[0].revents);
+	}
 
-	// Closing socket
-	close(socket.file_descriptor);
+	client_free(client);
 
 	return 0;
 }
 
 /**
- * @brief Authenticates the player
- * @param socket: Server socket
- * @param type: Whether the player is inviting or invited
- * @param first_name: Player's first name
- * @param last_name: Player's last name
+ * @fn int read_line(char* line, size_t size)
+ * @brief Reads a line of the input, without the newline (read as is, the input is then polled in match mode)
+ * @param line: filled with the line
+ * @param size: size of line
+ * @return int: length of the line, -1 at the end of the input
  */
-void authenticate(socket_t socket, char type, char* first_name, char* last_name) {
-	message_t message;
-	buffer_t data;
-
-	// Preparing the data
-	sprintf(data, "%d:%s:%s", type, last_name, first_name);
-
-	// Preparing the authentication message
-	prepare_message(&message, AUTH, data);
-
-	// Sending the message
-	send_message(&socket, &message, serialize_message);
-
-	// Waiting for the OK response
-	receive_message(&socket, &message, deserialize_message);
+int read_line(char* line, size_t size) {
+	size_t length = 0;
+	char c;
+
+	// One byte at a time, so that nothing after the line is read in advance
+	while (read(STDIN_FILENO, &c, 1) == 1) {
+		if (c == '\n') {
+			line[length] = '\0';
+			return (int) length;
+		}
+		if (length < size - 1)
+			line[length++] = c;
+	}
 
-	if (message.code == (char) OK)
-		printf("Authenticated successfully\n");
-	else
-		printf("Authentication failed\n");
+	line[length] = '\0';
+	return length > 0 ? (int) length : -1;
 }
 
 /**
- * @fn void wait_for_partner(socket_t socket)
- * @brief Function for the player waiting for an invitation
- * @param socket: Server socket
+ * @fn void choose_partner(client_t* client)
+ * @brief Asks the host who to invite (or to list the players, or to join the queue)
+ * @param client: host player
  */
-void wait_for_partner(socket_t socket) {
-	message_t received_msg, send_msg;
-	buffer_t last_name, first_name;
-	char* save_ptr;
+void choose_partner(client_t* client) {
+	buffer_t line;
 	int choice;
 
-	do {
-		printf("En attente d'une invitation...\n");
-
-		// Waiting to receive an INVITE from the server
-		receive_message(&socket, &received_msg, deserialize_message);
-		if (received_msg.code != INVITE) {
-			fprintf(stderr, "Erreur lors de la réception de l'invitation\n");
-			exit(1);
-		}
-
-		// Getting the first name and last name of the inviting player
-		strcpy(last_name, strtok_r(received_msg.data, ":", &save_ptr));
-		strcpy(first_name, strtok_r(NULL, ":", &save_ptr));
-
-		// Asking for validation
-		printf("Invitation reçue de la part de '%s %s'\n"
-		       "1) Accepter\n"
-		       "2) Refuser et attendre une invitation\n"
-		       ": ", first_name, last_name);
+	// Asking for who to invite
+	printf("Qui voulez-vous inviter ? (numéro de joueur)\n"
+	       "(0 pour afficher la liste des joueurs, -1 pour jouer contre le prochain joueur sans partenaire)\n\n"
+	       "Numéro : ");
+	fflush(stdout);
+	if (read_line(line, sizeof(buffer_t)) == -1)
+		exit(0);
+	choice = atoi(line);
 
-		// Getting user's choice
-		scanf("%d", &choice);
+	// Printing the list of players if asked
+	if (choice == 0)
+		client_ask_players(client);
 
-		if (choice == 1) {
-			printf("Invitation acceptée\n");
+	// Joining the matchmaking queue without a partner
+	else if (choice == -1)
+		client_join_queue(client);
 
-			// Sending response to the server
-			prepare_message(&send_msg, (char) OK, "");
-			send_message(&socket, &send_msg, serialize_message);
-		}
-		else {
-			printf("Invitation refusée\n");
-
-			// Sending response to the server
-			prepare_message(&send_msg, (char) NOK, "");
-			send_message(&socket, &send_msg, serialize_message);
-		}
-	} while (choice != 1);
-}
-
-/**
- * @fn void invited_player(socket_t socket)
- * @brief Function for the invited player
- * @param socket: Server socket
- */
-void invited_player(socket_t socket) {
-	message_t received_msg;
-
-	// Getting the player's ID as a response
-	receive_message(&socket, &received_msg, deserialize_message);
-	if (received_msg.code == INFO_PLAYER)
-		printf("Votre ID est : %s\n", received_msg.data);
+	// Inviting the player
 	else {
-		fprintf(stderr, "Erreur lors de la réception de l'ID\n");
-		exit(1);
+		client_invite(client, choice);
+		printf("Invitation envoyée, en attente de validation\n");
 	}
-
-	// Waiting for a partner
-	wait_for_partner(socket);
 }
 
 /**
@@ -173,142 +154,226 @@ void invited_player(socket_t socket) {
 void print_list_of_players(char* data) {
 	char *save_ptr, *number, *last_name, *first_name;
 
-	if (data == NULL) {
+	if (data == NULL || data[0] == '\0') {
 		printf("Aucun joueur n'est connecté\n");
 		return;
 	}
 
-	do {
-		number = strtok_r(data, ":", &save_ptr);
+	number = strtok_r(data, ":", &save_ptr);
+	while (number != NULL) {
 		last_name = strtok_r(NULL, ":", &save_ptr);
 		first_name = strtok_r(NULL, ":", &save_ptr);
+		if (last_name == NULL || first_name == NULL)
+			break;
 		printf("-> [%s] %s %s\n", number, last_name, first_name);
-	} while (number != NULL && last_name != NULL && first_name != NULL);
+		number = strtok_r(NULL, ":", &save_ptr);
+	}
 }
 
 /**
- * @fn void invite_partner(socket_t socket)
- * @brief Function to invite a partner
- * @param socket: Server socket
+ * @fn void on_answer(client_t* client, char request, int accepted, char* data)
+ * @brief Handles the answer of the server to the authentication, an invitation or joining the queue
+ * @param client: player
+ * @param request: code of the request
+ * @param accepted: 1 for OK, 0 for NOK
+ * @param data: data of the answer
  */
-void invite_partner(socket_t socket) {
-	message_t send_msg, received_msg;
-	buffer_t data;
-	int choice, partner_found = 0;
-
-	do {
-		// Asking for who to invite
-		printf("Qui voulez-vous inviter ? (numéro de joueur)\n"
-		       "(0 pour afficher la liste des joueurs)\n\n"
-		       "Numéro : ");
-
-		// Getting user's choice
-		scanf("%d", &choice);
-
-		// Printing the list of players if asked
-		if (choice == 0) {
-			// Sending the request
-			prepare_message(&send_msg, ASK_PLAYERS, "");
-			send_message(&socket, &send_msg, serialize_message);
-
-			// Receiving the list of players
-			receive_message(&socket, &received_msg, deserialize_message);
-			if (received_msg.code == LIST_PLAYERS) {
-				//print_list_of_players(received_msg.data);
-				printf("Liste des joueurs : %s\n", received_msg.data);
+void on_answer(client_t* client, char request, int accepted, char* data) {
+	player_session_t* session = (player_session_t*) client->user_data;
+
+	switch (request) {
+		case AUTH:
+			if (!accepted) {
+				fprintf(stderr, "Authentication failed\n");
+				exit(1);
 			}
+			printf("Authenticated successfully\n");
+
+			// The invited player waits for their id, then for an invitation
+			if (session->role == HOST_AUTH)
+				choose_partner(client);
+			break;
+
+		case PLAY_WITH:
+			if (accepted)
+				printf("Invitation acceptée par le joueur !\nAttente de la réception du court...\n");
 			else {
-				fprintf(stderr, "Erreur lors de la réception de la liste des joueurs\n");
-				fprintf(stderr, "reçu : %d\n", received_msg.code);
+				printf("Le partenaire a refusé ou n'existe pas.\nVeuillez choisir un autre partenaire\n");
+				choose_partner(client);
 			}
-		}
+			break;
 
-		// Inviting the player
-		else if (choice != 0) {
-			// Sending the invitation
-			sprintf(data, "%d", choice); // Player's ID
-			prepare_message(&send_msg, PLAY_WITH, data);
-			send_message(&socket, &send_msg, serialize_message);
-			printf("Invitation envoyée, en attente de validation\n");
-
-			// Waiting for the response of the player
-			receive_message(&socket, &received_msg, deserialize_message);
-			if (received_msg.code == (char) OK) {
-				printf("Invitation acceptée par le joueur !\n");
-				partner_found = 1;
+		case QUEUE:
+			if (accepted)
+				printf("Vous êtes dans la file d'attente !\nAttente de la réception du court...\n");
+			else {
+				fprintf(stderr, "Impossible de rejoindre la file d'attente\n");
+				choose_partner(client);
 			}
-			else
-				printf("Le partenaire a refusé ou n'existe pas.\nVeuillez choisir un autre partenaire\n");
-		}
-	} while (!partner_found);
+			break;
+
+		default:
+			break;
+	}
+}
+
+/**
+ * @fn void on_player_id(client_t* client, int id)
+ * @brief Prints the id given to the invited player
+ * @param client: invited player
+ * @param id: player's id
+ */
+void on_player_id(client_t* client, int id) {
+	printf("Votre ID est : %d\n", id);
+	printf("En attente d'une invitation...\n");
 }
 
 /**
- * @fn socket_t connect_to_court()
- * @brief Connects to a court given by the server
- * @param socket: Server socket
- * @return Court socket
+ * @fn void on_invitation(client_t* client, char* last_name, char* first_name)
+ * @brief Asks the invited player to accept or refuse an invitation
+ * @param client: invited player
+ * @param last_name: last name of the host
+ * @param first_name: first name of the host
  */
-socket_t connect_to_court(socket_t* socket) {
-	message_t received_msg;
-	buffer_t court_ip;
-	int court_port;
-	char* save_ptr;
-
-	// Receiving the court
-	sleep(1);
-	receive_message(socket, &received_msg, deserialize_message);
-	if (received_msg.code == COURT_FOUND)
-		printf("Court trouvé !\n");
+void on_invitation(client_t* client, char* last_name, char* first_name) {
+	buffer_t line;
+
+	// Asking for validation
+	printf("Invitation reçue de la part de '%s %s'\n"
+	       "1) Accepter\n"
+	       "2) Refuser et attendre une invitation\n"
+	       ": ", first_name, last_name);
+	fflush(stdout);
+	if (read_line(line, sizeof(buffer_t)) == -1)
+		exit(0);
+
+	if (atoi(line) == 1) {
+		printf("Invitation acceptée\nAttente de la réception du court...\n");
+		client_answer_invitation(client, 1);
+	}
 	else {
-		fprintf(stderr, "Erreur lors de la réception du court\n");
-		fprintf(stderr, "reçu : %d\n", received_msg.code);
-		exit(1);
+		printf("Invitation refusée\nEn attente d'une invitation...\n");
+		client_answer_invitation(client, 0);
 	}
+}
 
-	// Retrieving the court's IP and port
-	strcpy(court_ip, strtok_r(received_msg.data, ":", &save_ptr));
-	court_port = atoi(strtok_r(NULL, ":", &save_ptr));
+/**
+ * @fn void on_players(client_t* client, char* list)
+ * @brief Prints the list of the available players and asks again who to invite
+ * @param client: host player
+ * @param list: formatted list of players
+ */
+void on_players(client_t* client, char* list) {
+	printf("Liste des joueurs :\n");
+	print_list_of_players(list);
+	choose_partner(client);
+}
 
-	// Creating a new socket to connect to the court
-	return connect_to(court_ip, court_port);
+/**
+ * @fn void on_queued(client_t* client, int position, int wait)
+ * @brief Prints the position in the matchmaking queue and the estimated wait
+ * @param client: player
+ * @param position: position in the queue
+ * @param wait: estimated wait (s), negative if no court is available
+ */
+void on_queued(client_t* client, int position, int wait) {
+	if (wait < 0)
+		printf("Position dans la file d'attente : %d (aucun terrain pour le moment)\n", position);
+	else
+		printf("Position dans la file d'attente : %d (attente estimée : %d min)\n", position, (wait + 59) / 60);
 }
 
 /**
- * @fn void match_mode(socket_t court_socket)
- * @brief Enters the match mode
- * @param court_socket: Court socket
+ * @fn void on_court_found(client_t* client, char* ip, int port)
+ * @brief Enters the match mode once the court is found
+ * @param client: player
+ * @param ip: court's address
+ * @param port: court's port
  */
-void match_mode(socket_t* court_socket) {
-	message_t send_msg, received_msg;
+void on_court_found(client_t* client, char* ip, int port) {
+	player_session_t* session = (player_session_t*) client->user_data;
 
+	printf("Court trouvé !\n");
 	printf("Appuyez sur Entrée pour ajouter un point au score !\n");
+	session->on_court = 1;
+}
 
-	getchar(); // Removing the newline character from the buffer
-	while (1) {
-		// Waiting for the player to press Enter
-		getchar();
-		printf("Ajout d'un point...\n");
-
-		// Sending the point
-		printf("Envoi du message au terrain\n");
-		prepare_message(&send_msg, INCREMENT_SCORE, "");
-		send_message(court_socket, &send_msg, serialize_message);
-		sleep(1);
-
-		// Waiting for an OK
-		printf("Attente de la réponse du terrain\n");
-		receive_message(court_socket, &received_msg, deserialize_message);
-		if (received_msg.code == (char) OK)
-			printf("Point ajouté !\n");
-		else if (received_msg.code == (char) END_MATCH) {
-			printf("Fin du match !\n");
-			break;
-		}
-		else {
-			fprintf(stderr, "Erreur lors de l'ajout du point\n");
-			break;
-		}
-		sleep(1);
+/**
+ * @fn void on_point(client_t* client, unsigned long sequence, int accepted)
+ * @brief Prints the answer of the court to a point
+ * @param client: player
+ * @param sequence: sequence number of the point
+ * @param accepted: 1 if the point is counted
+ */
+void on_point(client_t* client, unsigned long sequence, int accepted) {
+	player_session_t* session = (player_session_t*) client->user_data;
+	long latency = monotonic_time() - session->send_times[sequence % PIPELINE_SIZE];
+
+	if (sequence > session->answered)
+		session->answered = sequence;
+
+	if (accepted)
+		printf("Point %lu ajouté ! (%.1f ms)\n", sequence, latency / 1000.0);
+	else
+		printf("Point %lu refusé, votre adversaire n'est pas encore sur le terrain\n", sequence);
+
+	// Piped input: leaving once its last point is answered
+	if (session->input_closed && session->answered == client->points_sent)
+		session->over = 1;
+}
+
+/**
+ * @fn void on_match_end(client_t* client, int court)
+ * @brief Ends the match mode
+ * @param client: player
+ * @param court: unused
+ */
+void on_match_end(client_t* client, int court) {
+	player_session_t* session = (player_session_t*) client->user_data;
+
+	printf("Fin du match !\n");
+	session->over = 1;
+}
+
+/**
+ * @fn void on_closed(client_t* client)
+ * @brief Stops the player once the connection is closed
+ * @param client: player
+ */
+void on_closed(client_t* client) {
+	player_session_t* session = (player_session_t*) client->user_data;
+
+	if (!session->over)
+		fprintf(stderr, "Connexion perdue\n");
+	session->over = 1;
+}
+
+/**
+ * @fn void read_points(client_t* client)
+ * @brief Sends a point for each Enter pressed, without waiting for the answers of the court
+ * @param client: player on a court
+ */
+void read_points(client_t* client) {
+	player_session_t* session = (player_session_t*) client->user_data;
+	char input[PIPELINE_SIZE];
+	ssize_t read_size, i;
+	long sequence;
+
+	// Reading no more presses than the court can take now, the others stay in the input
+	read_size = read(STDIN_FILENO, input, PIPELINE_SIZE - (client->points_sent - session->answered));
+	if (read_size <= 0) {
+		session->input_closed = 1;
+		if (session->answered == client->points_sent)
+			session->over = 1;
+		return;
 	}
-}
\ No newline at end of file
+
+	for (i = 0; i < read_size; i++) {
+		if (input[i] != '\n')
+			continue;
+
+		sequence = client_send_point(client);
+		if (sequence != -1)
+			session->send_times[sequence % PIPELINE_SIZE] = monotonic_time();
+	}
+}
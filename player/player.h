@@ -2,45 +2,56 @@
 #define PANTALLA_DEPORTIVA_V2_PLAYER_H
 
 #include <stdio.h>
+#include <time.h>
 
-#include "../socket/data.h"
-#include "../serialization/serialization.h"
-#include "../common/codes.h"
+#include "../client/client.h"
 
 /**
- * @def HOST_AUTH
- * @brief This code is the one to let the server know that the client is a player (inviting)
+ * @def PIPELINE_SIZE
+ * @brief Number of points that can be sent to the court before its answers (more are sent as it answers)
  */
-#define HOST_AUTH 1 // Player who invites
+#define PIPELINE_SIZE 64
 
 /**
- * @def INVITED_AUTH
- * @brief This code is the one to let the server know that the client is a player (invited)
+ * @struct player_session
+ * @brief State of the front-end of a player
+ * @var role: HOST_AUTH or INVITED_AUTH
+ * @var on_court: 1 once the court is found, the points are then read from the input
+ * @var answered: sequence number of the last point answered by the court
+ * @var send_times: send time of the points in flight, by sequence number (us)
+ * @var input_closed: 1 once the input has ended, the player then leaves with the last answer
+ * @var over: 1 once the match is over (or the connection lost)
  */
-#define INVITED_AUTH 2 // Player who is invited
+struct player_session {
+	int role;
+	int on_court;
+	unsigned long answered;
+	long send_times[PIPELINE_SIZE];
+	int input_closed;
+	int over;
+};
 
 /**
- * @brief Authenticates the player
- * @param socket: Server socket
- * @param type: Whether the player is inviting or invited
- * @param first_name: Player's first name
- * @param last_name: Player's last name
+ * @typedef player_session_t
+ * @brief Typedef for the player_session structure
  */
-void authenticate(socket_t socket, char type, char* first_name, char* last_name);
+typedef struct player_session player_session_t;
 
 /**
- * @fn void wait_for_partner(socket_t socket)
- * @brief Function for the player waiting for an invitation
- * @param socket: Server socket
+ * @fn int read_line(char* line, size_t size)
+ * @brief Reads a line of the input, without the newline (read as is, the input is then polled in match mode)
+ * @param line: filled with the line
+ * @param size: size of line
+ * @return int: length of the line, -1 at the end of the input
  */
-void wait_for_partner(socket_t socket);
+int read_line(char* line, size_t size);
 
 /**
- * @fn void invited_player(socket_t socket)
- * @brief Function for the invited player
- * @param socket: Server socket
+ * @fn void choose_partner(client_t* client)
+ * @brief Asks the host who to invite (or to list the players, or to join the queue)
+ * @param client: host player
  */
-void invited_player(socket_t socket);
+void choose_partner(client_t* client);
 
 /**
  * @fn void print_list_of_players(char* data)
@@ -50,25 +61,87 @@ void invited_player(socket_t socket);
 void print_list_of_players(char* data);
 
 /**
- * @fn void invite_partner(socket_t socket)
- * @brief Function to invite a partner
- * @param socket: Server socket
+ * @fn void on_answer(client_t* client, char request, int accepted, char* data)
+ * @brief Handles the answer of the server to the authentication, an invitation or joining the queue
+ * @param client: player
+ * @param request: code of the request
+ * @param accepted: 1 for OK, 0 for NOK
+ * @param data: data of the answer
  */
-void invite_partner(socket_t socket);
+void on_answer(client_t* client, char request, int accepted, char* data);
 
 /**
- * @fn socket_t connect_to_court()
- * @brief Connects to a court given by the server
- * @param socket: Server socket
- * @return Court socket
+ * @fn void on_player_id(client_t* client, int id)
+ * @brief Prints the id given to the invited player
+ * @param client: invited player
+ * @param id: player's id
  */
-socket_t connect_to_court(socket_t* socket);
+void on_player_id(client_t* client, int id);
 
 /**
- * @fn void match_mode(socket_t court_socket)
- * @brief Enters the match mode
- * @param court_socket: Court socket
+ * @fn void on_invitation(client_t* client, char* last_name, char* first_name)
+ * @brief Asks the invited player to accept or refuse an invitation
+ * @param client: invited player
+ * @param last_name: last name of the host
+ * @param first_name: first name of the host
  */
-void match_mode(socket_t* court_socket);
+void on_invitation(client_t* client, char* last_name, char* first_name);
+
+/**
+ * @fn void on_players(client_t* client, char* list)
+ * @brief Prints the list of the available players and asks again who to invite
+ * @param client: host player
+ * @param list: formatted list of players
+ */
+void on_players(client_t* client, char* list);
+
+/**
+ * @fn void on_queued(client_t* client, int position, int wait)
+ * @brief Prints the position in the matchmaking queue and the estimated wait
+ * @param client: player
+ * @param position: position in the queue
+ * @param wait: estimated wait (s), negative if no court is available
+ */
+void on_queued(client_t* client, int position, int wait);
+
+/**
+ * @fn void on_court_found(client_t* client, char* ip, int port)
+ * @brief Enters the match mode once the court is found
+ * @param client: player
+ * @param ip: court's address
+ * @param port: court's port
+ */
+void on_court_found(client_t* client, char* ip, int port);
+
+/**
+ * @fn void on_point(client_t* client, unsigned long sequence, int accepted)
+ * @brief Prints the answer of the court to a point
+ * @param client: player
+ * @param sequence: sequence number of the point
+ * @param accepted: 1 if the point is counted
+ */
+void on_point(client_t* client, unsigned long sequence, int accepted);
+
+/**
+ * @fn void on_match_end(client_t* client, int court)
+ * @brief Ends the match mode
+ * @param client: player
+ * @param court: unused
+ */
+void on_match_end(client_t* client, int court);
+
+/**
+ * @fn void on_closed(client_t* client)
+ * @brief Stops the player once the connection is closed
+ * @param client: player
+ */
+void on_closed(client_t* client);
+
+/**
+ * @fn void read_points(client_t* client)
+ * @brief Sends a point for each Enter pressed, without waiting for the answers of the court
+ * @param client: player on a court
+ */
+void read_points(client_t* client);
 
 #endif //PANTALLA_DEPORTIVA_V2_PLAYER_H
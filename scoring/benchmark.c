@@ -0,0 +1,79 @@
+/**
+ * @file benchmark.c
+ * @brief Measures the points per second applied by the scoring engine, for each format
+ * @date 2024-05-24
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "scoring.h"
+
+/**
+ * @def DEFAULT_POINTS
+ * @brief Number of points played for each format
+ */
+#define DEFAULT_POINTS 100000000L
+
+/**
+ * @fn double elapsed(struct timespec* start)
+ * @brief Seconds elapsed since a given time
+ * @param start: start time
+ * @return double: seconds
+ */
+double elapsed(struct timespec* start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char** argv) {
+	const char* names[] = {"bo3", "bo5", "bo3-super", "bo3-noad", "bo5-advantage"};
+	const scoring_format_t* format;
+	match_score_t score;
+	struct timespec start;
+	unsigned int random_state = 42;
+	long nb_points = DEFAULT_POINTS, point, nb_matches;
+	double seconds;
+	char data[64];
+	size_t i;
+
+	if (argc > 1)
+		nb_points = atol(argv[1]);
+
+	printf("format points seconds points_per_second matches\n");
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		format = find_scoring_format(names[i]);
+		init_match_score(&score);
+		nb_matches = 0;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (point = 0; point < nb_points; point++) {
+			// Xorshift: the winner of each point is random, without a call to rand()
+			random_state ^= random_state << 13;
+			random_state ^= random_state >> 17;
+			random_state ^= random_state << 5;
+
+			if (score_point(format, &score, 1 + (random_state & 1))) {
+				init_match_score(&score);
+				nb_matches++;
+			}
+		}
+		seconds = elapsed(&start);
+
+		printf("%s %ld %.3f %.0f %ld\n", format->name, nb_points, seconds, nb_points / seconds, nb_matches);
+	}
+
+	// Formatting is done once per point by the court, measured apart
+	format = find_scoring_format(DEFAULT_SCORING_FORMAT);
+	init_match_score(&score);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (point = 0; point < nb_points / 10; point++)
+		format_match_score(format, &score, data, sizeof(data));
+	seconds = elapsed(&start);
+	printf("format_match_score %ld %.3f %.0f -\n", nb_points / 10, seconds, nb_points / 10 / seconds);
+
+	return 0;
+}
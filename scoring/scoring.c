@@ -0,0 +1,181 @@
+/**
+ * @file scoring.c
+ * @brief Tennis scoring engine, shared by the court and the server
+ * @date 2024-05-24
+ */
+
+#include "scoring.h"
+
+/**
+ * Points of a game are a state of a transition table: ADVANTAGE_POINT is the
+ * advantage, and the state of a game is first player's points * 5 + second
+ * player's points. A transition gives the next state, or GAME_WON when the
+ * player who has won the point has won the game.
+ */
+#define ADVANTAGE_POINT 4
+#define GAME_WON 25
+#define STATE(a, b) ((a) * 5 + (b))
+
+// Transition when the winner of the point has w points and the other one l points
+#define WINS_GAME(w, l, no_ad) ((w) == ADVANTAGE_POINT || ((w) == 3 && ((l) <= 2 || ((l) == 3 && (no_ad)))))
+#define WINNER_NEXT(w, l) ((w) <= 2 ? (w) + 1 : ((l) == 3 ? ADVANTAGE_POINT : 3))
+#define LOSER_NEXT(w, l) ((l) == ADVANTAGE_POINT ? 3 : (l))
+
+// Transitions of a state, for a point won by the first player and by the second player
+#define TRANSITIONS(a, b, no_ad) { \
+	WINS_GAME(a, b, no_ad) ? GAME_WON : STATE(WINNER_NEXT(a, b), LOSER_NEXT(a, b)), \
+	WINS_GAME(b, a, no_ad) ? GAME_WON : STATE(LOSER_NEXT(b, a), WINNER_NEXT(b, a)) \
+}
+#define TRANSITIONS_ROW(a, no_ad) \
+	TRANSITIONS(a, 0, no_ad), TRANSITIONS(a, 1, no_ad), TRANSITIONS(a, 2, no_ad), \
+	TRANSITIONS(a, 3, no_ad), TRANSITIONS(a, 4, no_ad)
+#define TRANSITIONS_TABLE(no_ad) { \
+	TRANSITIONS_ROW(0, no_ad), TRANSITIONS_ROW(1, no_ad), TRANSITIONS_ROW(2, no_ad), \
+	TRANSITIONS_ROW(3, no_ad), TRANSITIONS_ROW(4, no_ad) \
+}
+
+// Game transition tables, built by the compiler: with advantages, and no-ad
+static const unsigned char game_transitions[2][25][2] = {
+	TRANSITIONS_TABLE(0),
+	TRANSITIONS_TABLE(1)
+};
+
+// Points of a game as displayed
+static const char* point_names[5] = {"0", "15", "30", "40", "ADV"};
+
+// Formats known by the court and the server
+static const scoring_format_t formats[] = {
+	{"bo3", 2, 6, 0, 7, FINAL_SET_TIEBREAK, 10},
+	{"bo5", 3, 6, 0, 7, FINAL_SET_TIEBREAK, 10},
+	{"bo3-super", 2, 6, 0, 7, FINAL_SET_SUPER_TIEBREAK, 10},
+	{"bo3-noad", 2, 6, 1, 7, FINAL_SET_SUPER_TIEBREAK, 10},
+	{"bo5-advantage", 3, 6, 0, 7, FINAL_SET_ADVANTAGE, 10}
+};
+
+/**
+ * @fn const scoring_format_t* find_scoring_format(const char* name)
+ * @brief Finds a format by its name ("bo3", "bo5", "bo3-super", "bo3-noad", "bo5-advantage")
+ * @param name: name of the format
+ * @return const scoring_format_t*: format, NULL if it does not exist
+ */
+const scoring_format_t* find_scoring_format(const char* name) {
+	size_t i;
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+		if (strcmp(formats[i].name, name) == 0)
+			return &formats[i];
+
+	return NULL;
+}
+
+/**
+ * @fn void init_match_score(match_score_t* score)
+ * @brief Initializes the score of a match
+ * @param score: score to initialize
+ */
+void init_match_score(match_score_t* score) {
+	memset(score, 0, sizeof(match_score_t));
+}
+
+/**
+ * @fn int is_final_set(const scoring_format_t* format, const match_score_t* score)
+ * @brief Checks if the set being played is the last possible one
+ * @param format: rules of the match
+ * @param score: score of the match
+ * @return int: 1 if it is the final set, 0 otherwise
+ */
+static int is_final_set(const scoring_format_t* format, const match_score_t* score) {
+	return score->sets[0] == format->sets_to_win - 1 && score->sets[1] == format->sets_to_win - 1;
+}
+
+/**
+ * @fn int score_point(const scoring_format_t* format, match_score_t* score, int player)
+ * @brief Gives a point to a player
+ * @param format: rules of the match
+ * @param score: score of the match
+ * @param player: player winning the point (1 or 2)
+ * @return int: winner of the match (1 or 2), 0 if it goes on (the point is ignored once it is finished)
+ */
+int score_point(const scoring_format_t* format, match_score_t* score, int player) {
+	int winner = player - 1, loser = 2 - player;
+	int* games;
+	int tiebreak_played;
+
+	if (score->winner)
+		return score->winner;
+
+	// Most points do not end a game: one lookup (or one comparison in a tiebreak)
+	if (!score->in_tiebreak) {
+		score->game = game_transitions[format->no_ad][score->game][winner];
+		if (score->game != GAME_WON)
+			return 0;
+	}
+	else {
+		score->tiebreak[winner]++;
+		if (score->tiebreak[winner] < score->tiebreak_target
+		|| score->tiebreak[winner] - score->tiebreak[loser] < 2)
+			return 0;
+	}
+
+	// The game (or the tiebreak, counted as a game) is won
+	tiebreak_played = score->in_tiebreak;
+	score->game = STATE(0, 0);
+	score->in_tiebreak = 0;
+	score->tiebreak[0] = 0;
+	score->tiebreak[1] = 0;
+	games = score->games[score->current_set];
+	games[winner]++;
+
+	if (!tiebreak_played
+	&& (games[winner] < format->games_per_set || games[winner] - games[loser] < 2)) {
+		// Playing a tiebreak at 6-6 (unless the final set is played with advantages)
+		if (games[winner] == format->games_per_set && games[loser] == format->games_per_set
+		&& format->tiebreak_points > 0
+		&& !(is_final_set(format, score) && format->final_set == FINAL_SET_ADVANTAGE)) {
+			score->in_tiebreak = 1;
+			score->tiebreak_target = format->tiebreak_points;
+		}
+		return 0;
+	}
+
+	// The set is won
+	score->sets[winner]++;
+	if (score->sets[winner] == format->sets_to_win) {
+		score->winner = player;
+		return player;
+	}
+	score->current_set++;
+
+	// The final set may be a super-tiebreak only
+	if (is_final_set(format, score) && format->final_set == FINAL_SET_SUPER_TIEBREAK) {
+		score->in_tiebreak = 1;
+		score->tiebreak_target = format->super_tiebreak_points;
+	}
+
+	return 0;
+}
+
+/**
+ * @fn int format_match_score(const scoring_format_t* format, const match_score_t* score, char* data, size_t size)
+ * @brief Writes a score as sent to the server and the spectators ("40/15:6/1:4/2:0/0", one field per set)
+ * @param format: rules of the match
+ * @param score: score of the match
+ * @param data: buffer to fill
+ * @param size: size of the buffer
+ * @return int: length of the string written
+ */
+int format_match_score(const scoring_format_t* format, const match_score_t* score, char* data, size_t size) {
+	int length, set;
+
+	// Points of the current game, or of the tiebreak
+	if (score->in_tiebreak)
+		length = snprintf(data, size, "%d/%d", score->tiebreak[0], score->tiebreak[1]);
+	else
+		length = snprintf(data, size, "%s/%s", point_names[score->game / 5], point_names[score->game % 5]);
+
+	// Games of each set
+	for (set = 0; set < 2 * format->sets_to_win - 1 && (size_t) length < size; set++)
+		length += snprintf(data + length, size - length, ":%d/%d", score->games[set][0], score->games[set][1]);
+
+	return length;
+}
@@ -0,0 +1,127 @@
+#ifndef PANTALLA_DEPORTIVA_V2_SCORING_H
+#define PANTALLA_DEPORTIVA_V2_SCORING_H
+
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @def MAX_SETS
+ * @brief Maximum number of sets of a match (best of 5)
+ */
+#define MAX_SETS 5
+
+/**
+ * @def DEFAULT_SCORING_FORMAT
+ * @brief Name of the format used when none is given
+ */
+#define DEFAULT_SCORING_FORMAT "bo3"
+
+/**
+ * @def FINAL_SET_TIEBREAK
+ * @brief The final set is played like the others (tiebreak at 6-6)
+ */
+#define FINAL_SET_TIEBREAK 0
+/**
+ * @def FINAL_SET_ADVANTAGE
+ * @brief The final set has no tiebreak, it is won with two games ahead
+ */
+#define FINAL_SET_ADVANTAGE 1
+/**
+ * @def FINAL_SET_SUPER_TIEBREAK
+ * @brief The final set is replaced by a super-tiebreak
+ */
+#define FINAL_SET_SUPER_TIEBREAK 2
+
+/**
+ * @struct scoring_format
+ * @brief Rules of a match
+ * @var name: name of the format (given to the court and the server)
+ * @var sets_to_win: 2 for best of 3 sets, 3 for best of 5 sets
+ * @var games_per_set: games to win a set (with two games ahead)
+ * @var no_ad: 1 if the point at 40-40 wins the game, 0 for advantages
+ * @var tiebreak_points: points to win a tiebreak (with two points ahead), 0 for no tiebreak
+ * @var final_set: FINAL_SET_TIEBREAK, FINAL_SET_ADVANTAGE or FINAL_SET_SUPER_TIEBREAK
+ * @var super_tiebreak_points: points to win the super-tiebreak
+ */
+struct scoring_format {
+	const char* name;
+	int sets_to_win;
+	int games_per_set;
+	int no_ad;
+	int tiebreak_points;
+	int final_set;
+	int super_tiebreak_points;
+};
+
+/**
+ * @typedef scoring_format_t
+ * @brief Typedef for the scoring_format structure
+ */
+typedef struct scoring_format scoring_format_t;
+
+/**
+ * @struct match_score
+ * @brief Score of a match
+ * @var game: points of the current game (state of the game table)
+ * @var in_tiebreak: 1 while a tiebreak (or super-tiebreak) is played
+ * @var tiebreak_target: points to win the current tiebreak
+ * @var tiebreak: points of each player in the current tiebreak
+ * @var games: games won by each player in each set
+ * @var sets: sets won by each player
+ * @var current_set: set being played
+ * @var winner: 1 or 2 once the match is finished, 0 before
+ */
+struct match_score {
+	int game;
+	int in_tiebreak;
+	int tiebreak_target;
+	int tiebreak[2];
+	int games[MAX_SETS][2];
+	int sets[2];
+	int current_set;
+	int winner;
+};
+
+/**
+ * @typedef match_score_t
+ * @brief Typedef for the match_score structure
+ */
+typedef struct match_score match_score_t;
+
+/**
+ * @fn const scoring_format_t* find_scoring_format(const char* name)
+ * @brief Finds a format by its name ("bo3", "bo5", "bo3-super", "bo3-noad", "bo5-advantage")
+ * @param name: name of the format
+ * @return const scoring_format_t*: format, NULL if it does not exist
+ */
+const scoring_format_t* find_scoring_format(const char* name);
+
+/**
+ * @fn void init_match_score(match_score_t* score)
+ * @brief Initializes the score of a match
+ * @param score: score to initialize
+ */
+void init_match_score(match_score_t* score);
+
+/**
+ * @fn int score_point(const scoring_format_t* format, match_score_t* score, int player)
+ * @brief Gives a point to a player
+ * @param format: rules of the match
+ * @param score: score of the match
+ * @param player: player winning the point (1 or 2)
+ * @return int: winner of the match (1 or 2), 0 if it goes on (the point is ignored once it is finished)
+ */
+int score_point(const scoring_format_t* format, match_score_t* score, int player);
+
+/**
+ * @fn int format_match_score(const scoring_format_t* format, const match_score_t* score, char* data, size_t size)
+ * @brief Writes a score as sent to the server and the spectators ("40/15:6/1:4/2:0/0", one field per set)
+ * @param format: rules of the match
+ * @param score: score of the match
+ * @param data: buffer to fill
+ * @param size: size of the buffer
+ * @return int: length of the string written
+ */
+int format_match_score(const scoring_format_t* format, const match_score_t* score, char* data, size_t size);
+
+#endif //PANTALLA_DEPORTIVA_V2_SCORING_H
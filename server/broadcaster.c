@@ -0,0 +1,204 @@
+/**
+ * @file broadcaster.c
+ * @brief One thread per court sending its score to all the spectators
+ * @date 2024-05-17
+ */
+
+#include "broadcaster.h"
+
+/**
+ * @fn size_t encode_publication(int court_id, message_t* message, char* encoded)
+ * @brief Serializes a publication once for all the subscribers, tagged with the court's id
+ * @param court_id: id of the court
+ * @param message: publication to serialize
+ * @param encoded: filled with the messages to send (each one ending with its \0)
+ * @return size_t: number of bytes to send
+ * @note END_MATCH carries the final score: the SCORE is sent with it, in the same write
+ */
+size_t encode_publication(int court_id, message_t* message, char* encoded) {
+	message_t tagged_msg;
+	buffer_t data;
+	size_t size;
+
+	// Formatted example: "3|40/15:6/1:4/2:0/0"
+	snprintf(data, sizeof(buffer_t), "%d|%s", court_id, message->data);
+	prepare_message(&tagged_msg, (char) SCORE, data);
+	serialize_message(&tagged_msg, encoded);
+	size = strlen(encoded) + 1;
+
+	if (message->code == (char) END_MATCH) {
+		sprintf(data, "%d", court_id);
+		prepare_message(&tagged_msg, (char) END_MATCH, data);
+		serialize_message(&tagged_msg, encoded + size);
+		size += strlen(encoded + size) + 1;
+	}
+
+	return size;
+}
+
+/**
+ * @fn void broadcast_thread(void* broadcaster)
+ * @brief Waits for each publication and sends it to all the subscribers
+ * @param broadcaster: broadcaster of the court
+ */
+void broadcast_thread(void* broadcaster) {
+	broadcaster_t* b = (broadcaster_t*) broadcaster;
+	subscriber_node_t* node;
+	message_t message;
+	unsigned long version;
+	char encoded[2 * MAX_BUFFER], *trace_text;
+	unsigned long long last_trace = 0;
+	trace_t trace;
+	size_t size;
+
+	// The current publication is sent by add_subscriber, starting from the next one
+	version = read_publication(b->channel, &message);
+
+	while (1) {
+		wait_for_publication(b->channel, &version, &message);
+		if (atomic_load(&b->stopping))
+			break;
+
+		// Formatted example: "40/15:6/1:4/2:0/0|9f3a1c2b44d0e1f7.1717584000123456" (the trace is optional)
+		trace_text = strchr(message.data, '|');
+		parse_trace(trace_text == NULL ? NULL : trace_text + 1, &trace);
+
+		// END_MATCH repeats the trace of the final score, which only counts if that score was skipped
+		if (trace.id != 0 && trace.id == last_trace) {
+			*trace_text = '\0';
+			trace.id = 0;
+		}
+		else if (trace.id != 0) {
+			last_trace = trace.id;
+		}
+
+		// Serializing once, then handing the same bytes to every spectator's session
+		size = encode_publication(b->court_id, &message, encoded);
+
+		// Sessions that have left are removed by their own thread
+		pthread_mutex_lock(&b->mutex);
+		for (node = b->subscribers; node != NULL; node = node->next)
+			session_publish(node->session, b->court_id, message.code == (char) END_MATCH, encoded, size);
+		pthread_mutex_unlock(&b->mutex);
+		record_span(&trace, TRACE_SERVER_FANNED_OUT, b->court_id);
+	}
+}
+
+/**
+ * @fn void start_broadcaster(broadcaster_t* broadcaster, int court_id, channel_t* channel)
+ * @brief Starts the thread broadcasting a channel
+ * @param broadcaster: broadcaster to start
+ * @param court_id: id of the court, tagging the messages sent
+ * @param channel: channel to broadcast
+ */
+void start_broadcaster(broadcaster_t* broadcaster, int court_id, channel_t* channel) {
+	broadcaster->court_id = court_id;
+	broadcaster->channel = channel;
+	broadcaster->subscribers = NULL;
+	pthread_mutex_init(&broadcaster->mutex, NULL);
+	atomic_init(&broadcaster->stopping, 0);
+
+	pthread_create(&broadcaster->thread, NULL, (void*) broadcast_thread, (void*) broadcaster);
+}
+
+/**
+ * @fn void stop_broadcaster(broadcaster_t* broadcaster)
+ * @brief Stops the thread of a removed court and frees its list of subscribers (their sessions stay open)
+ * @param broadcaster: broadcaster to stop
+ * @note nothing else may publish on the channel meanwhile (its court process is gone)
+ */
+void stop_broadcaster(broadcaster_t* broadcaster) {
+	subscriber_node_t* node;
+	message_t message;
+
+	// Waking up the thread with a last publication, which it does not send
+	atomic_store(&broadcaster->stopping, 1);
+	read_publication(broadcaster->channel, &message);
+	publish(broadcaster->channel, message.code, message.data);
+	pthread_join(broadcaster->thread, NULL);
+
+	while ((node = broadcaster->subscribers) != NULL) {
+		broadcaster->subscribers = node->next;
+		free(node);
+	}
+	pthread_mutex_destroy(&broadcaster->mutex);
+}
+
+/**
+ * @fn void add_subscriber(broadcaster_t* broadcaster, spectator_session_t* session)
+ * @brief Sends the last publication to a spectator and adds them to the subscribers
+ * @param broadcaster: broadcaster of the court
+ * @param session: spectator's session
+ */
+void add_subscriber(broadcaster_t* broadcaster, spectator_session_t* session) {
+	subscriber_node_t* new_node = (subscriber_node_t*) malloc(sizeof(subscriber_node_t));
+	message_t message;
+	char encoded[2 * MAX_BUFFER], *trace_text;
+	size_t size;
+
+	new_node->session = session;
+
+	// Holding the list while sending, so the broadcaster cannot send a newer score before this one
+	pthread_mutex_lock(&broadcaster->mutex);
+
+	// Only the final score of a finished match: the spectator follows the next one
+	read_publication(broadcaster->channel, &message);
+	message.code = (char) SCORE;
+
+	// The point of this score reached the other spectators long ago: its trace is left out
+	if ((trace_text = strchr(message.data, '|')) != NULL)
+		*trace_text = '\0';
+	size = encode_publication(broadcaster->court_id, &message, encoded);
+	session_publish(session, broadcaster->court_id, 0, encoded, size);
+
+	new_node->next = broadcaster->subscribers;
+	broadcaster->subscribers = new_node;
+
+	pthread_mutex_unlock(&broadcaster->mutex);
+}
+
+/**
+ * @fn int remove_subscriber(broadcaster_t* broadcaster, spectator_session_t* session)
+ * @brief Removes a spectator from the subscribers (nothing is sent to them afterwards)
+ * @param broadcaster: broadcaster of the court
+ * @param session: spectator's session
+ * @return int: 1 if the spectator was subscribed, 0 otherwise
+ */
+int remove_subscriber(broadcaster_t* broadcaster, spectator_session_t* session) {
+	subscriber_node_t **node_ptr, *node;
+	int found = 0;
+
+	pthread_mutex_lock(&broadcaster->mutex);
+
+	for (node_ptr = &broadcaster->subscribers; *node_ptr != NULL; node_ptr = &(*node_ptr)->next) {
+		if ((*node_ptr)->session == session) {
+			node = *node_ptr;
+			*node_ptr = node->next;
+			free(node);
+			found = 1;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&broadcaster->mutex);
+
+	return found;
+}
+
+/**
+ * @fn int count_subscribers(broadcaster_t* broadcaster)
+ * @brief Counts the spectators following a court
+ * @param broadcaster: broadcaster of the court
+ * @return int: number of subscribers
+ */
+int count_subscribers(broadcaster_t* broadcaster) {
+	subscriber_node_t* node;
+	int count = 0;
+
+	pthread_mutex_lock(&broadcaster->mutex);
+	for (node = broadcaster->subscribers; node != NULL; node = node->next)
+		count++;
+	pthread_mutex_unlock(&broadcaster->mutex);
+
+	return count;
+}
@@ -0,0 +1,97 @@
+#ifndef PANTALLA_DEPORTIVA_V2_BROADCASTER_H
+#define PANTALLA_DEPORTIVA_V2_BROADCASTER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "../socket/data.h"
+#include "../common/codes.h"
+#include "../trace/trace.h"
+#include "channel.h"
+#include "spectator_session.h"
+
+/**
+ * @struct subscriber_node
+ * @brief Structure of a list of spectators' sessions
+ * @var session: spectator's session
+ * @var next: next subscriber in the list
+ */
+struct subscriber_node {
+	spectator_session_t* session;
+	struct subscriber_node* next;
+};
+
+/**
+ * @typedef subscriber_node_t
+ * @brief Typedef for subscriber_node structure
+ */
+typedef struct subscriber_node subscriber_node_t;
+
+/**
+ * @struct broadcaster
+ * @brief Thread sending each publication of a channel to all the subscribed spectators
+ * @var court_id: id of the court, tagging the messages sent
+ * @var channel: channel to broadcast
+ * @var subscribers: spectators' sessions
+ * @var mutex: mutex for the list of subscribers
+ * @var thread: broadcasting thread
+ * @var stopping: 1 once the court is removed, the thread ends at the next publication
+ */
+struct broadcaster {
+	int court_id;
+	channel_t* channel;
+	subscriber_node_t* subscribers;
+	pthread_mutex_t mutex;
+	pthread_t thread;
+	atomic_int stopping;
+};
+
+/**
+ * @typedef broadcaster_t
+ * @brief Typedef for broadcaster structure
+ */
+typedef struct broadcaster broadcaster_t;
+
+/**
+ * @fn void start_broadcaster(broadcaster_t* broadcaster, int court_id, channel_t* channel)
+ * @brief Starts the thread broadcasting a channel
+ * @param broadcaster: broadcaster to start
+ * @param court_id: id of the court, tagging the messages sent
+ * @param channel: channel to broadcast
+ */
+void start_broadcaster(broadcaster_t* broadcaster, int court_id, channel_t* channel);
+
+/**
+ * @fn void stop_broadcaster(broadcaster_t* broadcaster)
+ * @brief Stops the thread of a removed court and frees its list of subscribers (their sessions stay open)
+ * @param broadcaster: broadcaster to stop
+ * @note nothing else may publish on the channel meanwhile (its court process is gone)
+ */
+void stop_broadcaster(broadcaster_t* broadcaster);
+
+/**
+ * @fn void add_subscriber(broadcaster_t* broadcaster, spectator_session_t* session)
+ * @brief Sends the last publication to a spectator and adds them to the subscribers
+ * @param broadcaster: broadcaster of the court
+ * @param session: spectator's session
+ */
+void add_subscriber(broadcaster_t* broadcaster, spectator_session_t* session);
+
+/**
+ * @fn int remove_subscriber(broadcaster_t* broadcaster, spectator_session_t* session)
+ * @brief Removes a spectator from the subscribers (nothing is sent to them afterwards)
+ * @param broadcaster: broadcaster of the court
+ * @param session: spectator's session
+ * @return int: 1 if the spectator was subscribed, 0 otherwise
+ */
+int remove_subscriber(broadcaster_t* broadcaster, spectator_session_t* session);
+
+/**
+ * @fn int count_subscribers(broadcaster_t* broadcaster)
+ * @brief Counts the spectators following a court
+ * @param broadcaster: broadcaster of the court
+ * @return int: number of subscribers
+ */
+int count_subscribers(broadcaster_t* broadcaster);
+
+#endif //PANTALLA_DEPORTIVA_V2_BROADCASTER_H
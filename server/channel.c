@@ -0,0 +1,84 @@
+/**
+ * @file channel.c
+ * @brief Publish/subscribe channel used to push the score of a court to its spectators
+ * @date 2024-05-15
+ */
+
+#include "channel.h"
+
+/**
+ * @fn void init_channel(channel_t* channel, char code, char* data)
+ * @brief Initializes a channel with a first publication (version 1)
+ * @param channel: channel to initialize
+ * @param code: code of the first message
+ * @param data: data of the first message
+ */
+void init_channel(channel_t* channel, char code, char* data) {
+	seqlock_init(&channel->lock);
+	atomic_init(&channel->waiters, 0);
+	pthread_mutex_init(&channel->mutex, NULL);
+	pthread_cond_init(&channel->published, NULL);
+	publish(channel, code, data);
+}
+
+/**
+ * @fn unsigned long publish(channel_t* channel, char code, char* data)
+ * @brief Publishes a message and wakes up the subscribers
+ * @param channel: channel to publish on
+ * @param code: message code
+ * @param data: message data
+ * @return unsigned long: version of the publication
+ * @note only one thread can publish at a time on a channel (the thread listening to the court)
+ */
+unsigned long publish(channel_t* channel, char code, char* data) {
+	message_t message;
+	unsigned long version;
+
+	prepare_message(&message, code, data);
+	version = seqlock_write(&channel->lock, &channel->message, &message, sizeof(message_t));
+
+	// Taking the mutex only if a subscriber is sleeping (it holds the mutex while checking the version)
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&channel->waiters) > 0) {
+		pthread_mutex_lock(&channel->mutex);
+		pthread_cond_broadcast(&channel->published);
+		pthread_mutex_unlock(&channel->mutex);
+	}
+
+	return version;
+}
+
+/**
+ * @fn unsigned long read_publication(channel_t* channel, message_t* message)
+ * @brief Reads the last publication without waiting (and without locking)
+ * @param channel: channel to read
+ * @param message: filled with the last message published
+ * @return unsigned long: version of the message
+ */
+unsigned long read_publication(channel_t* channel, message_t* message) {
+	return seqlock_read(&channel->lock, &channel->message, message, sizeof(message_t));
+}
+
+/**
+ * @fn void wait_for_publication(channel_t* channel, unsigned long* version, message_t* message)
+ * @brief Waits (without consuming CPU) for a publication newer than the version already seen
+ * @param channel: channel to wait on
+ * @param version: last version seen, updated with the version of the message returned
+ * @param message: filled with the last message published
+ * @note intermediate publications are skipped if the subscriber is late: only the last one matters
+ */
+void wait_for_publication(channel_t* channel, unsigned long* version, message_t* message) {
+	// Sleeping only if nothing new has been published
+	if (seqlock_version(&channel->lock) == *version) {
+		pthread_mutex_lock(&channel->mutex);
+		atomic_fetch_add(&channel->waiters, 1);
+
+		while (seqlock_version(&channel->lock) == *version)
+			pthread_cond_wait(&channel->published, &channel->mutex);
+
+		atomic_fetch_sub(&channel->waiters, 1);
+		pthread_mutex_unlock(&channel->mutex);
+	}
+
+	*version = read_publication(channel, message);
+}
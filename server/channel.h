@@ -0,0 +1,71 @@
+#ifndef PANTALLA_DEPORTIVA_V2_CHANNEL_H
+#define PANTALLA_DEPORTIVA_V2_CHANNEL_H
+
+#include <pthread.h>
+
+#include "../serialization/serialization.h"
+#include "seqlock.h"
+
+/**
+ * @struct channel
+ * @brief Publish/subscribe channel keeping the last message published (score or END_MATCH)
+ * @var lock: sequence lock of the message, its version is the version of the publication
+ * @var message: last message published (read through the sequence lock only)
+ * @var waiters: number of subscribers sleeping on the condition
+ * @var mutex: mutex used by the sleeping subscribers only
+ * @var published: condition broadcast to the sleeping subscribers on each publication
+ */
+struct channel {
+	seqlock_t lock;
+	message_t message;
+	atomic_int waiters;
+	pthread_mutex_t mutex;
+	pthread_cond_t published;
+};
+
+/**
+ * @typedef channel_t
+ * @brief Typedef for channel structure
+ */
+typedef struct channel channel_t;
+
+/**
+ * @fn void init_channel(channel_t* channel, char code, char* data)
+ * @brief Initializes a channel with a first publication (version 1)
+ * @param channel: channel to initialize
+ * @param code: code of the first message
+ * @param data: data of the first message
+ */
+void init_channel(channel_t* channel, char code, char* data);
+
+/**
+ * @fn unsigned long publish(channel_t* channel, char code, char* data)
+ * @brief Publishes a message and wakes up the subscribers
+ * @param channel: channel to publish on
+ * @param code: message code
+ * @param data: message data
+ * @return unsigned long: version of the publication
+ * @note only one thread can publish at a time on a channel (the thread listening to the court)
+ */
+unsigned long publish(channel_t* channel, char code, char* data);
+
+/**
+ * @fn unsigned long read_publication(channel_t* channel, message_t* message)
+ * @brief Reads the last publication without waiting (and without locking)
+ * @param channel: channel to read
+ * @param message: filled with the last message published
+ * @return unsigned long: version of the message
+ */
+unsigned long read_publication(channel_t* channel, message_t* message);
+
+/**
+ * @fn void wait_for_publication(channel_t* channel, unsigned long* version, message_t* message)
+ * @brief Waits (without consuming CPU) for a publication newer than the version already seen
+ * @param channel: channel to wait on
+ * @param version: last version seen, updated with the version of the message returned
+ * @param message: filled with the last message published
+ * @note intermediate publications are skipped if the subscriber is late: only the last one matters
+ */
+void wait_for_publication(channel_t* channel, unsigned long* version, message_t* message);
+
+#endif //PANTALLA_DEPORTIVA_V2_CHANNEL_H
@@ -5,317 +5,706 @@
  */
 
 #include "court_functions.h"
+#include "matchmaking.h"
+#include "history.h"
+#include "snapshot.h"
 
-court_node_t* courts = NULL; // Global list of courts
+court_node_t* courts = NULL; // Global list of courts (a court waits for its court process, it is removed once gone for good)
 pthread_mutex_t courts_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for the global list of courts
 
 int court_id_counter = 1; // Global counter for court ids
 pthread_mutex_t court_id_counter_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for the global counter of court ids
 
 /**
- * @fn void add_court(court_t court)
- * @brief Adds a court to the list of available courts
+ * @fn court_t* add_court(court_t court)
+ * @brief Adds a court to the list of courts
  * @param court: court to add (structure)
+ * @return court_t*: court stored in the list
  */
-void add_court(court_t court) {
-	pthread_mutex_lock(&courts_mutex);
+court_t* add_court(court_t court) {
+	lock_registry(&courts_mutex, LOCK_COURTS);
 
 	court_node_t* new_node = (court_node_t*) malloc(sizeof(court_node_t));
+	match_score_t score;
+	buffer_t data;
+
+	// The spectators get the initial score in the format of the court ("0/0:0/0:0/0:0/0")
+	init_match_score(&score);
+	format_match_score(court.format, &score, data, sizeof(buffer_t));
+
 	new_node->court = court;
+	new_node->court.reserved = 0;
+	init_channel(&new_node->court.channel, (char) SCORE, data);
+	start_broadcaster(&new_node->court.broadcaster, court.id, &new_node->court.channel);
 	new_node->next = courts;
 	courts = new_node;
 
-	pthread_mutex_unlock(&courts_mutex);
+	unlock_registry(&courts_mutex, LOCK_COURTS);
+
+	return &new_node->court;
 }
 
 /**
- * @fn void remove_court(int id)
- * @brief Removes a court from the list of available courts
- * @param id: court's id to remove
+ * @fn court_t* register_court(socket_t* socket, char* ip, int listen_port, const scoring_format_t* format, unsigned long long key)
+ * @brief Registers a court hosted by a court process and gives it an id
+ * @param socket: socket of the court process (shared by all its courts)
+ * @param ip: court's IP
+ * @param listen_port: port the players connect to
+ * @param format: rules of the matches played on the court
+ * @param key: durable identity of the court (0 if it has none)
+ * @return court_t*: court stored in the list
  */
-void remove_court(int id) {
-	pthread_mutex_lock(&courts_mutex);
-
-	court_node_t* current = courts;
-	court_node_t* prev = NULL;
-
-	while (current != NULL) {
-		if (current->court.id == id) {
-			if (prev == NULL)
-				courts = current->next;
-			else
-				prev->next = current->next;
-			free(current);
+court_t* register_court(socket_t* socket, char* ip, int listen_port, const scoring_format_t* format, unsigned long long key) {
+	court_t court, *registered;
+
+	// Setting the IP and the listen port
+	strcpy(court.ip, ip);
+	court.listen_port = listen_port;
+	court.format = format;
+
+	// Setting court socket
+	court.socket = socket;
+	court.key = key;
+	court.sequence = 0;
+	court.connected = 1;
+	court.disconnected_at = 0;
+
+	// Setting court id
+	lock_registry(&court_id_counter_mutex, LOCK_COURT_ID);
+	court.id = court_id_counter++;
+	snapshot_court_id(court.id);
+	unlock_registry(&court_id_counter_mutex, LOCK_COURT_ID);
+
+	// The court is made available once registered, by the matchmaking
+	court.available = 0;
+	court.match_start = 0;
+	memset(court.players, 0, sizeof(court.players));
+
+	// A court with a key is kept in the snapshot, to be recognized after a restart
+	court.snapshot_slot = reserve_snapshot_slot(key);
+
+	// Adding the court to the list (with its score channel)
+	log_message(LOG_INFO, "Court %d is available for players with %s:%d", court.id, court.ip, court.listen_port);
+	registered = add_court(court);
+	snapshot_court(registered);
+
+	return registered;
+}
+
+/**
+ * @fn court_t* restore_court(court_t court, char code, char* score)
+ * @brief Adds a court restored from the snapshot, waiting for its court process to reconnect
+ * @param court: court as it was before the restart (id, key, match...)
+ * @param code: code of its last publication (SCORE or END_MATCH)
+ * @param score: its last score published ("" for the initial score)
+ * @return court_t*: court stored in the list
+ */
+court_t* restore_court(court_t court, char code, char* score) {
+	court_t* restored;
+
+	court.socket = NULL;
+	court.connected = 0;
+	restored = add_court(court);
+
+	// The spectators get the score it had, until its court process sends the next one
+	if (score[0] != '\0')
+		publish(&restored->channel, code, score);
+
+	log_message(LOG_INFO, "Court %d restored, waiting for its court process", restored->id);
+	return restored;
+}
+
+/**
+ * @fn void continue_court_ids(int last_id)
+ * @brief Makes the next courts' ids follow an id already given (by a previous run of the server)
+ * @param last_id: id already given
+ */
+void continue_court_ids(int last_id) {
+	lock_registry(&court_id_counter_mutex, LOCK_COURT_ID);
+	if (court_id_counter <= last_id)
+		court_id_counter = last_id + 1;
+	unlock_registry(&court_id_counter_mutex, LOCK_COURT_ID);
+}
+
+/**
+ * @fn int reattach_court(socket_t* socket, char* ip, int listen_port, unsigned long long key, court_t** court)
+ * @brief Gives back its court to a court process that has reconnected (same id, spectators and match)
+ * @param socket: new socket of the court process
+ * @param ip: court's IP
+ * @param listen_port: port the players connect to
+ * @param key: durable identity of the court
+ * @param court: filled with the court found
+ * @return int: 1 if given back, 0 if no court has this key, -1 if its court process is still connected
+ */
+int reattach_court(socket_t* socket, char* ip, int listen_port, unsigned long long key, court_t** court) {
+	court_node_t* current;
+	int status = 0;
+
+	if (key == 0)
+		return 0;
+
+	lock_registry(&courts_mutex, LOCK_COURTS);
+
+	// Only a court whose connection has been lost can be taken over (the key is not a password)
+	for (current = courts; current != NULL; current = current->next) {
+		if (current->court.key == key) {
+			status = -1;
+			if (!current->court.connected) {
+				*court = &current->court;
+				(*court)->socket = socket;
+				strcpy((*court)->ip, ip);
+				(*court)->listen_port = listen_port;
+				(*court)->connected = 1;
+				(*court)->disconnected_at = 0;
+				status = 1;
+
+				// Kept in the snapshot again if it was gone for too long
+				if ((*court)->snapshot_slot == -1)
+					(*court)->snapshot_slot = reserve_snapshot_slot(key);
+			}
 			break;
 		}
-		prev = current;
-		current = current->next;
 	}
 
-	pthread_mutex_unlock(&courts_mutex);
+	unlock_registry(&courts_mutex, LOCK_COURTS);
+
+	if (status == 1) {
+		log_message(LOG_INFO, "Court %d is back with %s:%d", (*court)->id, (*court)->ip, (*court)->listen_port);
+		snapshot_court(*court);
+	}
+	else if (status == -1)
+		log_message(LOG_WARNING, "A court with the key %llx is already connected", key);
+
+	return status;
+}
+
+/**
+ * @fn void free_courts(court_node_t* removed)
+ * @brief Stops the broadcasters of courts unlinked from the list and frees them (no other thread can reach them)
+ * @param removed: list of the removed courts
+ */
+void free_courts(court_node_t* removed) {
+	court_node_t* node;
+
+	while ((node = removed) != NULL) {
+		removed = node->next;
+		log_message(LOG_INFO, "Court %d removed", node->court.id);
+
+		// Its spectators stay connected, they no longer get anything from it
+		stop_broadcaster(&node->court.broadcaster);
+		free_snapshot_slot(&node->court);
+		free(node);
+	}
+}
+
+/**
+ * @fn void expire_courts(int expiry)
+ * @brief Removes the courts whose court process has been away for too long (they are not restored anymore, their
+ * slots go to the next courts)
+ * @param expiry: time a court can stay without its court process (s)
+ */
+void expire_courts(int expiry) {
+	court_node_t **node_ptr, *current, *removed = NULL;
+	time_t now = time(NULL);
+
+	// Unlinked under the mutex, stopped once it is released (a court being handed to its players is kept)
+	lock_registry(&courts_mutex, LOCK_COURTS);
+	for (node_ptr = &courts; (current = *node_ptr) != NULL;) {
+		if (current->court.connected || current->court.reserved || now - current->court.disconnected_at < expiry) {
+			node_ptr = &current->next;
+			continue;
+		}
+
+		log_message(LOG_INFO, "Court %d: no court process for %d s, no longer kept", current->court.id, expiry);
+		*node_ptr = current->next;
+		current->next = removed;
+		removed = current;
+	}
+	unlock_registry(&courts_mutex, LOCK_COURTS);
+
+	free_courts(removed);
 }
 
 /**
- * @fn void new_court(void* socket)
- * @brief Thread to manage a court
- * @param socket: court's socket (for receiving the listen port and score update)
+ * @fn int check_court_message(int court_id, socket_t* socket, unsigned long sequence, court_t** court)
+ * @brief Checks that a message is for a court of the connection, and that it has not been applied yet
+ * @param court_id: id of the court of the message
+ * @param socket: socket of the court process
+ * @param sequence: sequence number of the message (0 if it has none)
+ * @param court: filled with the court of the message (it stays in the list while its court process is connected)
+ * @return int: 1 if the message is new, 0 if it was already applied (sent again after a reconnection), -1 if invalid
+ */
+int check_court_message(int court_id, socket_t* socket, unsigned long sequence, court_t** court) {
+	int status = 1;
+
+	// The socket changes when the court process reconnects (by the thread of the new connection)
+	lock_registry(&courts_mutex, LOCK_COURTS);
+
+	*court = find_court(court_id);
+	if (*court == NULL || (*court)->socket != socket)
+		status = -1;
+	else if (sequence != 0 && sequence <= (*court)->sequence)
+		status = 0;
+	else if (sequence != 0)
+		(*court)->sequence = sequence;
+
+	unlock_registry(&courts_mutex, LOCK_COURTS);
+
+	return status;
+}
+
+/**
+ * @fn void new_court(void* socket, char* ip)
+ * @brief Thread to manage a court process, which can host several courts
+ * @param socket: socket of the court process (for receiving the listen ports and score updates)
  * @param ip: court's IP
  */
 void new_court(void* socket, char* ip) {
-	message_t send_msg, received_msg;
-	court_t court;
+	message_t send_msg, received_msg, last_score;
+	const scoring_format_t* format;
+	court_node_t **node_ptr, *current, *removed = NULL;
+	court_t* court;
+	buffer_t data;
+	char *save_ptr, *token, *score, *points, *trace_text;
+	unsigned long long key;
+	unsigned long sequence;
+	trace_t trace;
+	int port, court_id, status;
 
 	// First answering OK to the court
 	prepare_message(&send_msg, (char) OK, "");
-	send_message(socket, &send_msg, serialize_message);
+	timed_send(socket, &send_msg);
+	end_request();
 
-	// Waiting for a listen port
-	receive_message(socket, &received_msg, deserialize_message);
-	if (received_msg.code != (char) LISTEN_PORT) {
-		fprintf(stderr, "Error: expected LISTEN_PORT message\n");
-		return;
-	}
+	// Each message is for one of the courts of the process, in the order they were sent
+	while (receive_request(socket, &received_msg) != 0) {
+		switch (received_msg.code) {
+			case LISTEN_PORT:
+				// Formatted example: "4242:bo3:5be1c0de2a4f9e11" (the format and the key are optional)
+				token = strtok_r(received_msg.data, ":", &save_ptr);
+				port = token == NULL ? 0 : atoi(token);
+				token = strtok_r(NULL, ":", &save_ptr);
+				format = find_scoring_format(token == NULL ? DEFAULT_SCORING_FORMAT : token);
+				token = strtok_r(NULL, ":", &save_ptr);
+				key = token == NULL ? 0 : strtoull(token, NULL, 16);
+
+				// A court that has reconnected keeps its id, its spectators and its match (a key in use is refused)
+				status = (port <= 0 || format == NULL) ? -1 : reattach_court(socket, ip, port, key, &court);
+				if (status == -1) {
+					prepare_message(&send_msg, (char) NOK, "");
+					timed_send(socket, &send_msg);
+					break;
+				}
+				if (status == 0)
+					court = register_court(socket, ip, port, format, key);
+				status = (status == 0 || court->available);
+
+				// Its id is sent back with the OK
+				sprintf(data, "%d", court->id);
+				prepare_message(&send_msg, (char) OK, data);
+				timed_send(socket, &send_msg);
+
+				// Giving the court to the pairs waiting in the queue (unless its match goes on)
+				if (status)
+					release_court(court);
+				break;
 
-	// Setting the IP
-	strcpy(court.ip, ip);
+			case SCORE:
+				// Formatted example: "3|40/15:6/1:4/2:0/0|5|1204|9f3a1c2b44d0e1f7.1717584000123456" (the points played,
+				// the sequence number and the trace of the oldest point are optional)
+				token = strtok_r(received_msg.data, "|", &save_ptr);
+				court_id = token == NULL ? 0 : atoi(token);
+				score = strtok_r(NULL, "|", &save_ptr);
+				points = strtok_r(NULL, "|", &save_ptr);
+				token = strtok_r(NULL, "|", &save_ptr);
+				sequence = token == NULL ? 0 : strtoul(token, NULL, 10);
+				trace_text = strtok_r(NULL, "|", &save_ptr);
+				parse_trace(trace_text, &trace);
+
+				status = score == NULL ? -1 : check_court_message(court_id, socket, sequence, &court);
+				prepare_message(&send_msg, (char) (status == -1 ? NOK : OK), "");
+				if (status != 1) {
+					timed_send(socket, &send_msg);
+					break;
+				}
 
-	// Setting the listen port
-	court.listen_port = atoi(received_msg.data);
+				// Publishing the latest score to the spectators, once for all the points (the trace goes with it)
+				record_span(&trace, TRACE_SERVER_RECEIVED, court->id);
+				if (trace.id != 0) {
+					snprintf(data, sizeof(buffer_t), "%s|%s", score, trace_text);
+					publish(&court->channel, (char) SCORE, data);
+				}
+				else
+					publish(&court->channel, (char) SCORE, score);
+				snapshot_court(court);
+				log_sampled(LOG_SAMPLING, LOG_INFO, "Court %d: %s (%s points)", court->id, score, points == NULL ? "1" : points);
 
-	// Setting court socket
-	court.socket = socket;
+				timed_send(socket, &send_msg);
+				break;
 
-	// Setting court id
-	pthread_mutex_lock(&court_id_counter_mutex);
-	court.id = court_id_counter++;
-	pthread_mutex_unlock(&court_id_counter_mutex);
+			case END_MATCH:
+				// Formatted example: "3|1205" (the sequence number is optional)
+				token = strtok_r(received_msg.data, "|", &save_ptr);
+				court_id = token == NULL ? 0 : atoi(token);
+				token = strtok_r(NULL, "|", &save_ptr);
+				sequence = token == NULL ? 0 : strtoul(token, NULL, 10);
+
+				status = check_court_message(court_id, socket, sequence, &court);
+				prepare_message(&send_msg, (char) (status == -1 ? NOK : OK), "");
+				if (status != 1) {
+					timed_send(socket, &send_msg);
+					break;
+				}
 
-	// Marking court as available
-	court.available = 1;
+				// END_MATCH carries the final score, so late spectators cannot miss it
+				read_publication(&court->channel, &last_score);
+				publish(&court->channel, (char) END_MATCH, last_score.data);
 
-	// Initializing the score
-	strcpy(court.score, "0-0:0/0:0/0:0/0");
+				timed_send(socket, &send_msg);
 
-	// Adding the court to the list
-	add_court(court);
-	printf("Court %d is available for players with %s:%d\n", court.id, court.ip, court.listen_port);
+				// Keeping the match in the history, with the final score without its trace
+				last_score.data[strcspn(last_score.data, "|")] = '\0';
+				append_match(court->id, court->players, court->format->name, court->match_start, last_score.data);
 
-	// Responding OK to the court
-	prepare_message(&send_msg, (char) OK, "");
-	send_message(socket, &send_msg, serialize_message);
+				// Giving the court to the next pair in the queue (or making it available)
+				log_message(LOG_INFO, "Court %d has finished its match", court->id);
+				release_court(court);
+				break;
+
+			default:
+				prepare_message(&send_msg, (char) NOK, "");
+				timed_send(socket, &send_msg);
+				break;
+		}
+		end_request();
+	}
+
+	// The court process has left: its courts wait for it to reconnect, with their spectators (a court without a key
+	// cannot be recognized again, it is removed unless it is being handed to players: it expires later)
+	lock_registry(&courts_mutex, LOCK_COURTS);
+	for (node_ptr = &courts; (current = *node_ptr) != NULL;) {
+		if (current->court.socket == socket) {
+			current->court.socket = NULL;
+			current->court.connected = 0;
+			current->court.disconnected_at = time(NULL);
+
+			if (current->court.key == 0 && !current->court.reserved) {
+				*node_ptr = current->next;
+				current->next = removed;
+				removed = current;
+				continue;
+			}
+			snapshot_court(&current->court);
+		}
+		node_ptr = &current->next;
+	}
+	unlock_registry(&courts_mutex, LOCK_COURTS);
+
+	free_courts(removed);
+
+	log_message(LOG_INFO, "A court process has left");
+	close(((socket_t*) socket)->file_descriptor);
+	free(socket);
 }
 
 /**
- * @fn court_t* get_first_available_court()
- * @brief Returns the first available court
- * @return
+ * @fn court_t* claim_available_court()
+ * @brief Finds an available court (whose court process is connected) and marks it as unavailable
+ * @return court_t*: claimed court, NULL if no court is available
  */
-court_t* get_first_available_court() {
-	court_node_t* current = courts;
-
-	// Searching for a court that is available
-	while (current != NULL) {
-		if (current->court.available)
-			return &current->court;
-		current = current->next;
+court_t* claim_available_court() {
+	court_node_t* current;
+	court_t* court = NULL;
+
+	lock_registry(&courts_mutex, LOCK_COURTS);
+
+	// Searching for a court that is available (and whose court process is connected)
+	for (current = courts; current != NULL; current = current->next) {
+		if (current->court.available && current->court.connected) {
+			court = &current->court;
+			court->available = 0;
+			court->reserved = 1;
+			break;
+		}
 	}
 
-	// Returning NULL otherwise
-	return NULL;
+	unlock_registry(&courts_mutex, LOCK_COURTS);
+
+	return court;
 }
 
 /**
- * @fn void listen_for_score(court_t* court)
- * @brief Listens for score and END_MATCH messages
- * @param court: court structure with all data
+ * @fn void set_court_available(court_t* court)
+ * @brief Marks a court as available
+ * @param court: court to mark
  */
-void listen_for_score(court_t* court) {
-	message_t received_msg, send_msg;
+void set_court_available(court_t* court) {
+	lock_registry(&courts_mutex, LOCK_COURTS);
+	court->available = 1;
+	court->reserved = 0;
+	unlock_registry(&courts_mutex, LOCK_COURTS);
+}
 
-	do {
-		receive_message(court->socket, &received_msg, deserialize_message);
+/**
+ * @fn int count_connected_courts()
+ * @brief Counts the courts whose court process is connected (the others cannot take a match)
+ * @return int: number of courts
+ */
+int count_connected_courts() {
+	court_node_t* current;
+	int count = 0;
 
-		if (received_msg.code == (char) SCORE) {
-			// Copying the score
-			strcpy(court->score, received_msg.data);
-			printf("Court %d: %s\n", court->id, court->score);
-		}
-		else if (received_msg.code == (char) END_MATCH) {
-			// Removing the court from the list
-			court->available = 1;
-			printf("Court %d is now available\n", court->id);
-		}
+	lock_registry(&courts_mutex, LOCK_COURTS);
+	for (current = courts; current != NULL; current = current->next)
+		count += current->court.connected;
+	unlock_registry(&courts_mutex, LOCK_COURTS);
 
-		// Sending OK to the court
-		prepare_message(&send_msg, (char) OK, "");
-		send_message(court->socket, &send_msg, serialize_message);
-		sleep(1);
-	} while (received_msg.code != (char) END_MATCH);
+	return count;
 }
 
-int court_available() {
-	court_node_t* current = courts;
-
-	while (current != NULL) {
-		if (current->court.available)
-			return 1;
-		current = current->next;
+/**
+ * @fn void print_court_metrics(FILE* stream)
+ * @brief Prints the number of courts (registered, connected, available) and the spectators of each court
+ * @param stream: stream to print on, in the Prometheus text format
+ */
+void print_court_metrics(FILE* stream) {
+	court_node_t* current;
+	int nb_courts = 0, nb_connected = 0, nb_available = 0;
+
+	lock_registry(&courts_mutex, LOCK_COURTS);
+	for (current = courts; current != NULL; current = current->next) {
+		nb_courts++;
+		nb_connected += current->court.connected;
+		nb_available += current->court.available && current->court.connected;
 	}
 
-	return 0;
+	fprintf(stream, "# HELP pantalla_courts Registered courts\n# TYPE pantalla_courts gauge\n"
+					"pantalla_courts %d\n", nb_courts);
+	fprintf(stream, "# HELP pantalla_courts_connected Courts whose court process is connected\n"
+					"# TYPE pantalla_courts_connected gauge\npantalla_courts_connected %d\n", nb_connected);
+	fprintf(stream, "# HELP pantalla_courts_available Courts waiting for players\n"
+					"# TYPE pantalla_courts_available gauge\npantalla_courts_available %d\n", nb_available);
+
+	fprintf(stream, "# HELP pantalla_court_spectators Spectators following each court\n"
+					"# TYPE pantalla_court_spectators gauge\n");
+	for (current = courts; current != NULL; current = current->next)
+		fprintf(stream, "pantalla_court_spectators{court=\"%d\"} %d\n", current->court.id,
+				count_subscribers(&current->court.broadcaster));
+	unlock_registry(&courts_mutex, LOCK_COURTS);
 }
 
 /**
- * @fn void reserve_court(player_t p1, player_t p2)
- * @brief Reserves a court for two players
- * @param p1: player 1
- * @param p2: player 2
+ * @fn void reserve_court(player_t players[2], int nb_players)
+ * @brief Reserves a court through the matchmaking queue and sends it to the players
+ * @param players: players of the match (only the first one is set for a solo player)
+ * @param nb_players: 1 for a solo player waiting for an opponent, 2 for an agreed pair
  */
-void reserve_court(player_t p1, player_t p2) {
-	court_t* court = get_first_available_court();
+void reserve_court(player_t players[2], int nb_players) {
+	court_t* court;
 	message_t send_msg;
 	buffer_t data;
+	int nb_sent, i;
 
-	// If no court is available, sending NOK to both players
-	if (court == NULL) {
-		prepare_message(&send_msg, (char) NOK, "");
-		send_message(p1.socket, &send_msg, serialize_message);
-		send_message(p2.socket, &send_msg, serialize_message);
-		return;
-	}
+	// Waiting for a court (the players are notified of their position meanwhile)
+	court = wait_for_court(players, nb_players);
+	if (court == NULL)
+		return; // The match is handled by the thread of the earlier solo player (or the players have left)
 
-	// Marking the court as unavailable and setting the players
-	court->available = 0;
-	court->players[0] = p1;
-	court->players[1] = p2;
+	// Setting the players (their ids and names: their sockets are closed below)
+	for (i = 0; i < 2; i++) {
+		court->players[i] = players[i];
+		court->players[i].socket = NULL;
+	}
+	snapshot_court(court);
 
-	// Sending the court's IP and listen port to the players
-	sprintf(data, "%s:%d", court->ip, court->listen_port);
+	// Sending the court's IP, listen port and id to the players ("127.0.0.1:4242:3", the id tells the spectators which court to follow)
+	sprintf(data, "%s:%d:%d", court->ip, court->listen_port, court->id);
 	prepare_message(&send_msg, (char) COURT_FOUND, data);
-	send_message(p1.socket, &send_msg, serialize_message);
-	send_message(p2.socket, &send_msg, serialize_message);
+	nb_sent = (timed_try_send(players[0].socket, &send_msg) == 0) + (timed_try_send(players[1].socket, &send_msg) == 0);
 
-	// Listening for SCORE and END_MATCH
-	listen_for_score(court);
+	// A player who has left right after the queue checked them: the court goes to the next pair
+	if (nb_sent < 2) {
+		log_message(LOG_WARNING, "Court %d: a player has left before getting it, the match is cancelled", court->id);
+		court->match_start = 0;
+		release_court(court);
+	}
+	else {
+		// The match is on: the court can be removed if its court process leaves for good
+		lock_registry(&courts_mutex, LOCK_COURTS);
+		court->reserved = 0;
+		unlock_registry(&courts_mutex, LOCK_COURTS);
+	}
+
+	// The players now talk to the court, their connections to the server are no longer needed
+	for (i = 0; i < 2; i++) {
+		close(players[i].socket->file_descriptor);
+		free(players[i].socket);
+		count_metric(COUNTER_CONNECTIONS_CLOSED + ROLE_PLAYER, 1);
+	}
+
+	// The score is then received by the thread of the court process
 }
 
 /**
- * @fn list_courts(socket_t socket)
- * @brief Send a list of courts to a spectator
- * @param socket: spectator's socket
+ * @fn court_t* find_court(int court_id)
+ * @brief Finds a court by its id
+ * @param court_id: court's id
+ * @return court_t*: court, NULL if it does not exist
+ * @note the mutex of the courts must be held (and the court not used once released: it may be removed)
  */
-void list_courts(socket_t socket) {
-	court_node_t* current = courts;
+court_t* find_court(int court_id) {
+	court_node_t* current;
+
+	for (current = courts; current != NULL; current = current->next)
+		if (current->court.id == court_id)
+			return &current->court;
+
+	return NULL;
+}
+
+/**
+ * @fn list_courts(spectator_session_t* session, int offset)
+ * @brief Send a page of the list of courts whose court process is connected to a spectator, as many as one message holds
+ * @param session: spectator's session
+ * @param offset: number of courts of the list already sent (by the previous pages)
+ */
+void list_courts(spectator_session_t* session, int offset) {
+	court_node_t* current;
 	message_t send_msg;
-	buffer_t data, tmp;
-
-	// Preparing the list of courts
-	strcpy(data, "");
-	while (current != NULL) {
-		sprintf(tmp, "%d\n", current->court.id);
-		strcat(data, tmp);
-		current = current->next;
+	buffer_t data;
+	size_t length = 0;
+	int i = 0;
+
+	// Preparing the page, one id per line ('\0' and the code of the message have to fit too)
+	data[0] = '\0';
+	lock_registry(&courts_mutex, LOCK_COURTS);
+	for (current = courts; current != NULL; current = current->next) {
+		// The courts waiting for their court process are not listed (no match is played on them until it is back)
+		if (!current->court.connected)
+			continue;
+		if (i < offset) {
+			i++;
+			continue;
+		}
+
+		// The last line of a full page gives the next one ("+42"), the spectator asks for it
+		if (length + 2 * COURT_LINE_SIZE > sizeof(buffer_t) - 2) {
+			snprintf(data + length, sizeof(buffer_t) - 1 - length, "+%d\n", i);
+			break;
+		}
+		length += snprintf(data + length, sizeof(buffer_t) - 1 - length, "%d\n", current->court.id);
+		i++;
 	}
+	unlock_registry(&courts_mutex, LOCK_COURTS);
 
 	// Sending the list of courts
 	prepare_message(&send_msg, (char) LIST_COURTS, data);
-	send_message(&socket, &send_msg, serialize_message);
+	session_send_message(session, &send_msg);
 }
 
 /**
- * @fn subscribe_to_court(socket_t socket, int court_id)
- * @param socket: spectator's socket
+ * @fn subscribe_to_court(spectator_session_t* session, int court_id)
+ * @brief Adds a spectator to the subscribers of a court
+ * @param session: spectator's session
  * @param court_id: court's id
- * @return court_t*: court structure to read score afterwards, NULL if the court does not exist
+ * @return int: 1 if subscribed, 0 if the court does not exist
  */
-court_t* subscribe_to_court(socket_t socket, int court_id) {
-	court_node_t* current = courts;
+int subscribe_to_court(spectator_session_t* session, int court_id) {
 	message_t send_msg;
-
-	// Searching for the court
-	while (current != NULL) {
-		if (current->court.id == court_id) {
-			// Sending the subscription message
-			prepare_message(&send_msg, (char) OK, "");
-			send_message(&socket, &send_msg, serialize_message);
-
-			return &current->court;
-		}
-		current = current->next;
+	court_t* court;
+	int found;
+
+	lock_registry(&courts_mutex, LOCK_COURTS);
+	found = find_court(court_id) != NULL;
+	unlock_registry(&courts_mutex, LOCK_COURTS);
+
+	// Sending NOK if the court does not exist, the subscription message otherwise
+	prepare_message(&send_msg, (char) (found ? OK : NOK), "");
+	session_send_message(session, &send_msg);
+	if (!found)
+		return 0;
+
+	// The broadcaster sends the current score (again if already subscribed), then each update (the court is looked
+	// up again: it may have been removed meanwhile, the ids are never given twice)
+	lock_registry(&courts_mutex, LOCK_COURTS);
+	if ((court = find_court(court_id)) != NULL) {
+		remove_subscriber(&court->broadcaster, session);
+		add_subscriber(&court->broadcaster, session);
 	}
+	unlock_registry(&courts_mutex, LOCK_COURTS);
 
-	// Sending NOK if the court does not exist
-	prepare_message(&send_msg, (char) NOK, "");
-	send_message(&socket, &send_msg, serialize_message);
-	return NULL;
-
+	return 1;
 }
 
 /**
- * @fn void watch(socket_t socket, court_t court)
- * @brief Listens for score and sends update to the spectator
- * @param spectator_socket: spectator's socket
- * @param court: court to watch for score
+ * @fn unsubscribe_from_court(spectator_session_t* session, int court_id)
+ * @brief Removes a spectator from the subscribers of a court
+ * @param session: spectator's session
+ * @param court_id: court's id
  */
-void watch(socket_t spectator_socket, court_t* court) {
+void unsubscribe_from_court(spectator_session_t* session, int court_id) {
 	message_t send_msg;
-	court_t court_copy; // For detecting changes in the score
-
-	// Copying the court score to detect further changes
-	strcpy(court_copy.score, court->score);
-
-	// Sending the current score
-	sleep(1);
-	prepare_message(&send_msg, (char) SCORE, court_copy.score);
-	send_message(&spectator_socket, &send_msg, serialize_message);
-	sleep(1);
-
-	// Listening for changes in the score while the court is taken by the two players
-	while (1) {
-		if (strcmp(court_copy.score, court->score) != 0) {
-			strcpy(court_copy.score, court->score);
-			prepare_message(&send_msg, (char) SCORE, court_copy.score);
-			if (send_message(&spectator_socket, &send_msg, serialize_message) == -1)
-				break;
-			sleep(1);
-		}
-	}
+	court_t* court;
+	int found;
+
+	lock_registry(&courts_mutex, LOCK_COURTS);
+	court = find_court(court_id);
+	found = court != NULL && remove_subscriber(&court->broadcaster, session);
+	unlock_registry(&courts_mutex, LOCK_COURTS);
+
+	prepare_message(&send_msg, (char) (found ? OK : NOK), "");
+	session_send_message(session, &send_msg);
 }
 
 /**
  * @fn spectator_function(socket_t socket)
- * @brief Function to manage a spectator
+ * @brief Function to manage a spectator, who can follow several courts until they leave
  * @param socket: spectator's socket
  */
 void spectator_function(socket_t* socket) {
+	spectator_session_t* session = (spectator_session_t*) malloc(sizeof(spectator_session_t));
 	message_t send_msg, received_msg;
-	int subscribed = 0;
-	court_t* court;
+	court_node_t* current;
+	int court_id;
 
-	sleep(1);
+	init_session(session, socket);
 
 	// Answering OK
 	prepare_message(&send_msg, (char) OK, "");
-	send_message(socket, &send_msg, serialize_message);
-	sleep(1);
-
-	do {
-		receive_message(socket, &received_msg, deserialize_message);
+	session_send_message(session, &send_msg);
+	end_request();
 
+	// The scores are sent by the broadcasters, this thread only handles the requests (and sends what they leave pending)
+	while (session_wait_request(session) && receive_request(socket, &received_msg) != 0) {
 		switch (received_msg.code) {
 			case ASK_COURTS:
-				printf("Spectator is asking for the list of courts\n");
-				list_courts(*socket);
+				log_message(LOG_DEBUG, "Spectator is asking for the list of courts");
+				list_courts(session, atoi(received_msg.data));
 				break;
 			case SUBSCRIBE:
-				printf("Spectator wants to subscribe to court %s\n", received_msg.data);
-				court = subscribe_to_court(*socket, atoi(received_msg.data));
-				if (court != NULL) {
-					subscribed = 1;
-					printf("Spectator has subscribed to court %d\n", court->id);
-					watch(*socket, court);
-				}
+				court_id = atoi(received_msg.data);
+				if (subscribe_to_court(session, court_id))
+					log_message(LOG_INFO, "Spectator has subscribed to court %d", court_id);
+				break;
+			case UNSUBSCRIBE:
+				unsubscribe_from_court(session, atoi(received_msg.data));
+				break;
+			default:
+				prepare_message(&send_msg, (char) NOK, "");
+				session_send_message(session, &send_msg);
 				break;
 		}
-	} while (!subscribed);
-}
\ No newline at end of file
+		end_request();
+	}
+
+	// The spectator has left: no broadcaster may use the session anymore
+	lock_registry(&courts_mutex, LOCK_COURTS);
+	for (current = courts; current != NULL; current = current->next)
+		remove_subscriber(&current->court.broadcaster, session);
+	unlock_registry(&courts_mutex, LOCK_COURTS);
+
+	close(socket->file_descriptor);
+	free(socket);
+	close_session(session);
+	free(session);
+}
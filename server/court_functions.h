@@ -1,26 +1,50 @@
 #ifndef PANTALLA_DEPORTIVA_V2_COURT_FUNCTIONS_H
 #define PANTALLA_DEPORTIVA_V2_COURT_FUNCTIONS_H
 
+#include <time.h>
+
 #include "server.h"
 #include "player_functions.h"
+#include "channel.h"
+#include "broadcaster.h"
+#include "../scoring/scoring.h"
 
 /**
  * @struct court
  * @brief Structure to keep infos about a court
  * @var id: court's id
- * @var socket: court's socket used to receive the score
+ * @var socket: socket of the court process hosting the court (shared with its other courts), NULL while disconnected
+ * @var key: durable identity of the court, given again when its court process reconnects
+ * @var sequence: sequence number of the last message of the court applied (older ones are sent again after a reconnection)
+ * @var connected: 1 if the court process is connected, 0 while it is away
  * @var listen_port: port to send players on
+ * @var format: rules of the matches played on the court
  * @var players: players in the court (for printing names only)
  * @var available: 1 if the court is available, 0 otherwise
+ * @var reserved: 1 while the matchmaking hands the court to its players (it cannot be removed meanwhile)
+ * @var match_start: time the current match was assigned at (0 if none)
+ * @var channel: channel publishing the score (and END_MATCH) to the spectators
+ * @var broadcaster: thread sending the publications of the channel to the spectators
+ * @var snapshot_slot: slot of the court in the snapshot of the registries (-1 if it is not kept)
+ * @var disconnected_at: time the court process left at (0 while connected)
  */
 struct court {
 	int id;
 	socket_t* socket;
+	unsigned long long key;
+	unsigned long sequence;
+	char connected;
 	char ip[16];
 	int listen_port;
+	const scoring_format_t* format;
 	player_t players[2];
 	char available;
-	buffer_t score;
+	char reserved;
+	time_t match_start;
+	channel_t channel;
+	broadcaster_t broadcaster;
+	int snapshot_slot;
+	time_t disconnected_at;
 };
 
 /**
@@ -47,54 +71,146 @@ struct court_node {
 typedef struct court_node court_node_t;
 
 /**
- * @fn void new_court(void* socket)
- * @brief Thread to manage a court
- * @param socket: court's socket (for receiving the listen port and score update)
+ * @fn court_t* register_court(socket_t* socket, char* ip, int listen_port, const scoring_format_t* format, unsigned long long key)
+ * @brief Registers a court hosted by a court process and gives it an id
+ * @param socket: socket of the court process (shared by all its courts)
+ * @param ip: court's IP
+ * @param listen_port: port the players connect to
+ * @param format: rules of the matches played on the court
+ * @param key: durable identity of the court (0 if it has none)
+ * @return court_t*: court stored in the list
+ */
+court_t* register_court(socket_t* socket, char* ip, int listen_port, const scoring_format_t* format, unsigned long long key);
+
+/**
+ * @fn court_t* restore_court(court_t court, char code, char* score)
+ * @brief Adds a court restored from the snapshot, waiting for its court process to reconnect
+ * @param court: court as it was before the restart (id, key, match...)
+ * @param code: code of its last publication (SCORE or END_MATCH)
+ * @param score: its last score published ("" for the initial score)
+ * @return court_t*: court stored in the list
+ */
+court_t* restore_court(court_t court, char code, char* score);
+
+/**
+ * @fn void continue_court_ids(int last_id)
+ * @brief Makes the next courts' ids follow an id already given (by a previous run of the server)
+ * @param last_id: id already given
+ */
+void continue_court_ids(int last_id);
+
+/**
+ * @fn int reattach_court(socket_t* socket, char* ip, int listen_port, unsigned long long key, court_t** court)
+ * @brief Gives back its court to a court process that has reconnected (same id, spectators and match)
+ * @param socket: new socket of the court process
+ * @param ip: court's IP
+ * @param listen_port: port the players connect to
+ * @param key: durable identity of the court
+ * @param court: filled with the court found
+ * @return int: 1 if given back, 0 if no court has this key, -1 if its court process is still connected
+ */
+int reattach_court(socket_t* socket, char* ip, int listen_port, unsigned long long key, court_t** court);
+
+/**
+ * @fn void expire_courts(int expiry)
+ * @brief Removes the courts whose court process has been away for too long (they are not restored anymore, their
+ * slots go to the next courts)
+ * @param expiry: time a court can stay without its court process (s)
+ */
+void expire_courts(int expiry);
+
+/**
+ * @fn int check_court_message(int court_id, socket_t* socket, unsigned long sequence, court_t** court)
+ * @brief Checks that a message is for a court of the connection, and that it has not been applied yet
+ * @param court_id: id of the court of the message
+ * @param socket: socket of the court process
+ * @param sequence: sequence number of the message (0 if it has none)
+ * @param court: filled with the court of the message (it stays in the list while its court process is connected)
+ * @return int: 1 if the message is new, 0 if it was already applied (sent again after a reconnection), -1 if invalid
+ */
+int check_court_message(int court_id, socket_t* socket, unsigned long sequence, court_t** court);
+
+/**
+ * @fn void new_court(void* socket, char* ip)
+ * @brief Thread to manage a court process, which can host several courts
+ * @param socket: socket of the court process (for receiving the listen ports and score updates)
  * @param ip: court's IP
  */
 void new_court(void* socket, char* ip);
 
 /**
- * @fn void listen_for_score(court_t* court)
- * @brief Listens for score and END_MATCH messages
- * @param court: court structure with all data
+ * @fn court_t* claim_available_court()
+ * @brief Finds an available court (whose court process is connected) and marks it as unavailable
+ * @return court_t*: claimed court, NULL if no court is available
  */
-void listen_for_score(court_t* court);
+court_t* claim_available_court();
 
 /**
- * @fn void reserve_court(player_t p1, player_t p2)
- * @brief Reserves a court for two players
- * @param p1: player 1
- * @param p2: player 2
+ * @fn void set_court_available(court_t* court)
+ * @brief Marks a court as available
+ * @param court: court to mark
  */
-void reserve_court(player_t p1, player_t p2);
+void set_court_available(court_t* court);
 
 /**
- * @fn list_courts(socket_t socket)
- * @brief Send a list of courts to a spectator
- * @param socket: spectator's socket
+ * @fn int count_connected_courts()
+ * @brief Counts the courts whose court process is connected (the others cannot take a match)
+ * @return int: number of courts
  */
-void list_courts(socket_t socket);
+int count_connected_courts();
 
 /**
- * @fn subscribe_to_court(socket_t socket, int court_id)
- * @param socket: spectator's socket
+ * @fn void print_court_metrics(FILE* stream)
+ * @brief Prints the number of courts (registered, connected, available) and the spectators of each court
+ * @param stream: stream to print on, in the Prometheus text format
+ */
+void print_court_metrics(FILE* stream);
+
+/**
+ * @fn void reserve_court(player_t players[2], int nb_players)
+ * @brief Reserves a court through the matchmaking queue and sends it to the players
+ * @param players: players of the match (only the first one is set for a solo player)
+ * @param nb_players: 1 for a solo player waiting for an opponent, 2 for an agreed pair
+ */
+void reserve_court(player_t players[2], int nb_players);
+
+/**
+ * @fn court_t* find_court(int court_id)
+ * @brief Finds a court by its id
  * @param court_id: court's id
- * @return court_t*: court structure to read score afterwards, NULL if the court does not exist
+ * @return court_t*: court, NULL if it does not exist
+ * @note the mutex of the courts must be held (and the court not used once released: it may be removed)
  */
-court_t* subscribe_to_court(socket_t socket, int court_id);
+court_t* find_court(int court_id);
 
 /**
- * @fn void watch(socket_t socket, court_t court)
- * @brief Listens for score and sends update to the spectator
- * @param spectator_socket: spectator's socket
- * @param court: court to watch for score
+ * @fn list_courts(spectator_session_t* session, int offset)
+ * @brief Send a page of the list of courts whose court process is connected to a spectator, as many as one message holds
+ * @param session: spectator's session
+ * @param offset: number of courts of the list already sent (by the previous pages)
+ */
+void list_courts(spectator_session_t* session, int offset);
+
+/**
+ * @fn subscribe_to_court(spectator_session_t* session, int court_id)
+ * @brief Adds a spectator to the subscribers of a court
+ * @param session: spectator's session
+ * @param court_id: court's id
+ * @return int: 1 if subscribed, 0 if the court does not exist
+ */
+int subscribe_to_court(spectator_session_t* session, int court_id);
+
+/**
+ * @fn unsubscribe_from_court(spectator_session_t* session, int court_id)
+ * @brief Removes a spectator from the subscribers of a court
+ * @param session: spectator's session
+ * @param court_id: court's id
  */
-void watch(socket_t spectator_socket, court_t* court);
+void unsubscribe_from_court(spectator_session_t* session, int court_id);
 
 /**
  * @fn spectator_function(socket_t socket)
- * @brief Function to manage a spectator
+ * @brief Function to manage a spectator, who can follow several courts until they leave
  * @param socket: spectator's socket
  */
 void spectator_function(socket_t* socket);
@@ -0,0 +1,533 @@
+/**
+ * @file history.c
+ * @brief Append-only history of the completed matches, indexed by player, by court and by time
+ * @date 2024-06-08
+ */
+
+#include "history.h"
+
+/**
+ * @def HISTORY_HEADER_SIZE
+ * @brief Size of the header, the records start after it
+ */
+#define HISTORY_HEADER_SIZE 64
+
+/**
+ * @def HISTORY_MAGIC
+ * @brief Identifies a history file
+ */
+#define HISTORY_MAGIC "PDHIST1"
+
+int history_file = -1; // Records of the matches, -1 if the history is not open
+int players_index = -1; // Number of the last match of each player, at the offset of their id
+int courts_index = -1; // Number of the last match of each court, at the offset of its id
+history_header_t history_header; // Header of the history file
+match_record_t last_match; // Last match written (its end is the earliest end of the next one)
+atomic_uint history_count = 0; // Matches that can be read, written before being counted
+
+pending_match_t* pending_matches = NULL; // Matches waiting for the writer thread, in the order they have ended
+pending_match_t** pending_end = &pending_matches; // Where the next match is queued
+int writing_matches = 0; // 1 while the writer thread writes the matches taken from the queue
+pthread_mutex_t pending_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for the queue (only the writer thread appends)
+pthread_cond_t match_pending = PTHREAD_COND_INITIALIZER; // Condition signaled when a match is queued
+pthread_cond_t matches_written = PTHREAD_COND_INITIALIZER; // Condition broadcast when the writer thread is done
+
+/**
+ * @fn uint32_t match_checksum(match_record_t* record)
+ * @brief Computes the checksum of a record (FNV-1a of its bytes, the checksum counted as 0)
+ * @param record: record to check
+ * @return uint32_t: checksum
+ */
+static uint32_t match_checksum(match_record_t* record) {
+	match_record_t copy = *record;
+	unsigned char* bytes = (unsigned char*) &copy;
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	copy.checksum = 0;
+	for (i = 0; i < sizeof(match_record_t); i++)
+		hash = (hash ^ bytes[i]) * 16777619u;
+
+	return hash;
+}
+
+/**
+ * @fn off_t match_offset(uint32_t number)
+ * @brief Gives the offset of a match in the history file
+ * @param number: number of the match (starting at 1)
+ * @return off_t: offset
+ */
+static off_t match_offset(uint32_t number) {
+	return HISTORY_HEADER_SIZE + (off_t) (number - 1) * sizeof(match_record_t);
+}
+
+/**
+ * @fn int read_match(uint32_t number, match_record_t* record)
+ * @brief Reads a match of the history, checking that it was fully written
+ * @param number: number of the match
+ * @param record: filled with the match
+ * @return int: 1 if read, 0 if it does not exist or is torn
+ */
+static int read_match(uint32_t number, match_record_t* record) {
+	if (number == 0 || pread(history_file, record, sizeof(match_record_t), match_offset(number))
+		!= sizeof(match_record_t))
+		return 0;
+
+	return record->number == number && record->checksum == match_checksum(record);
+}
+
+/**
+ * @fn uint32_t read_head(int index, int id)
+ * @brief Reads the number of the last match of a player or a court in an index
+ * @param index: players_index or courts_index
+ * @param id: player's or court's id
+ * @return uint32_t: number of the match, 0 if none
+ */
+static uint32_t read_head(int index, int id) {
+	uint32_t number;
+
+	if (id <= 0 || pread(index, &number, sizeof(uint32_t), (off_t) id * sizeof(uint32_t)) != sizeof(uint32_t))
+		return 0;
+
+	return number;
+}
+
+/**
+ * @fn void index_match(match_record_t* record)
+ * @brief Makes a match the last one of its court and of its players in the indexes
+ * @param record: match
+ */
+static void index_match(match_record_t* record) {
+	int i;
+
+	if (record->court_id > 0)
+		pwrite(courts_index, &record->number, sizeof(uint32_t), (off_t) record->court_id * sizeof(uint32_t));
+	if (record->court_id > history_header.last_court_id)
+		history_header.last_court_id = record->court_id;
+
+	for (i = 0; i < 2; i++) {
+		if (record->player_ids[i] > 0)
+			pwrite(players_index, &record->number, sizeof(uint32_t), (off_t) record->player_ids[i] * sizeof(uint32_t));
+		if (record->player_ids[i] > history_header.last_player_id)
+			history_header.last_player_id = record->player_ids[i];
+	}
+}
+
+/**
+ * @fn void link_match(pending_match_t* batch, pending_match_t* match)
+ * @brief Points a match to the previous one of its court and of its players: a query never scans the history
+ * @param batch: matches written with it, the earlier ones are not indexed yet
+ * @param match: match to link
+ */
+static void link_match(pending_match_t* batch, pending_match_t* match) {
+	match_record_t* record = &match->record;
+	pending_match_t* earlier;
+	int i, j;
+
+	record->previous_court = read_head(courts_index, record->court_id);
+	for (i = 0; i < 2; i++)
+		record->previous_player[i] = read_head(players_index, record->player_ids[i]);
+
+	for (earlier = batch; earlier != match; earlier = earlier->next) {
+		if (record->court_id > 0 && earlier->record.court_id == record->court_id)
+			record->previous_court = earlier->record.number;
+		for (i = 0; i < 2; i++)
+			for (j = 0; j < 2; j++)
+				if (record->player_ids[i] > 0 && earlier->record.player_ids[j] == record->player_ids[i])
+					record->previous_player[i] = earlier->record.number;
+	}
+}
+
+/**
+ * @fn void write_matches(pending_match_t* batch)
+ * @brief Writes matches at the end of the history, then indexes them by court and by player (on the disk before
+ * returning, one sync for all of them)
+ * @param batch: matches, in the order they have ended
+ */
+static void write_matches(pending_match_t* batch) {
+	uint32_t count = atomic_load_explicit(&history_count, memory_order_relaxed);
+	pending_match_t *match, *last = NULL;
+	int64_t end = last_match.end;
+	int nb_matches = 0, written = 1;
+
+	// The ends never go back (even if the clock does), so that the history stays in their order
+	for (match = batch; match != NULL; match = match->next) {
+		match->record.number = count + ++nb_matches;
+		link_match(batch, match);
+		if (match->record.end < end)
+			match->record.end = end;
+		end = match->record.end;
+		match->record.checksum = match_checksum(&match->record);
+	}
+
+	// The matches on the disk first, then their indexes: a crash in between only leaves them to be indexed again
+	for (match = batch; match != NULL && written; match = match->next)
+		written = pwrite(history_file, &match->record, sizeof(match_record_t), match_offset(match->record.number))
+			== sizeof(match_record_t);
+	if (!written || fdatasync(history_file) == -1) {
+		log_message(LOG_ERROR, "%d matches could not be written to the history", nb_matches);
+		ftruncate(history_file, match_offset(count + 1));
+		return;
+	}
+
+	for (match = batch; match != NULL; match = match->next) {
+		index_match(&match->record);
+		last = match;
+	}
+	fdatasync(players_index);
+	fdatasync(courts_index);
+	history_header.indexed = last->record.number;
+	pwrite(history_file, &history_header, sizeof(history_header_t), 0);
+
+	last_match = last->record;
+	atomic_store_explicit(&history_count, last->record.number, memory_order_release);
+}
+
+/**
+ * @fn void history_writer_thread()
+ * @brief Writes the queued matches, all the ones that have ended meanwhile at once
+ */
+void history_writer_thread() {
+	pending_match_t *batch, *match;
+
+	while (1) {
+		pthread_mutex_lock(&pending_mutex);
+		while (pending_matches == NULL)
+			pthread_cond_wait(&match_pending, &pending_mutex);
+		batch = pending_matches;
+		pending_matches = NULL;
+		pending_end = &pending_matches;
+		writing_matches = 1;
+		pthread_mutex_unlock(&pending_mutex);
+
+		write_matches(batch);
+		while ((match = batch) != NULL) {
+			batch = match->next;
+			free(match);
+		}
+
+		pthread_mutex_lock(&pending_mutex);
+		writing_matches = 0;
+		pthread_cond_broadcast(&matches_written);
+		pthread_mutex_unlock(&pending_mutex);
+	}
+}
+
+/**
+ * @fn int open_history(const char* path)
+ * @brief Opens the history of the matches and its indexes (created if needed), dropping a match that was not fully
+ * written and indexing the ones that were not
+ * @param path: history file
+ * @return int: number of matches, -1 if the files cannot be opened
+ */
+int open_history(const char* path) {
+	char index_path[256];
+	match_record_t record;
+	uint32_t count, number;
+	pthread_t thread;
+	off_t size;
+
+	history_file = open(path, O_RDWR | O_CREAT, 0644);
+	snprintf(index_path, sizeof(index_path), "%s.players", path);
+	players_index = open(index_path, O_RDWR | O_CREAT, 0644);
+	snprintf(index_path, sizeof(index_path), "%s.courts", path);
+	courts_index = open(index_path, O_RDWR | O_CREAT, 0644);
+	if (history_file == -1 || players_index == -1 || courts_index == -1) {
+		log_message(LOG_ERROR, "History '%s' cannot be opened, the matches will not be kept", path);
+		history_file = -1;
+		return -1;
+	}
+
+	// A new history gets its header, one written with other records is left untouched
+	size = lseek(history_file, 0, SEEK_END);
+	if (size < HISTORY_HEADER_SIZE) {
+		memset(&history_header, 0, sizeof(history_header_t));
+		strcpy(history_header.magic, HISTORY_MAGIC);
+		history_header.record_size = sizeof(match_record_t);
+		pwrite(history_file, &history_header, sizeof(history_header_t), 0);
+		size = HISTORY_HEADER_SIZE;
+		ftruncate(history_file, size);
+	}
+	else if (pread(history_file, &history_header, sizeof(history_header_t), 0) != sizeof(history_header_t)
+			 || strcmp(history_header.magic, HISTORY_MAGIC) != 0
+			 || history_header.record_size != sizeof(match_record_t)) {
+		log_message(LOG_ERROR, "'%s' is not a history of this server, the matches will not be kept", path);
+		history_file = -1;
+		return -1;
+	}
+
+	// A match torn by a crash while it was written is dropped, with whatever follows it
+	count = (uint32_t) ((size - HISTORY_HEADER_SIZE) / sizeof(match_record_t));
+	while (count > 0 && !read_match(count, &record))
+		count--;
+	ftruncate(history_file, match_offset(count + 1));
+
+	// The indexes are written after the match: the matches they miss are indexed again, in order
+	if (history_header.indexed > count)
+		history_header.indexed = count;
+	for (number = history_header.indexed + 1; number <= count; number++)
+		if (read_match(number, &record))
+			index_match(&record);
+	history_header.indexed = count;
+	fdatasync(players_index);
+	fdatasync(courts_index);
+	pwrite(history_file, &history_header, sizeof(history_header_t), 0);
+
+	memset(&last_match, 0, sizeof(match_record_t));
+	if (count > 0)
+		read_match(count, &last_match);
+	atomic_store_explicit(&history_count, count, memory_order_release);
+
+	// The court processes' threads only queue their matches
+	pthread_create(&thread, NULL, (void*) history_writer_thread, NULL);
+	pthread_detach(thread);
+
+	log_message(LOG_INFO, "History '%s': %u matches", path, count);
+	return (int) count;
+}
+
+/**
+ * @fn void append_match(int court_id, player_t players[2], const char* format, time_t start, const char* score)
+ * @brief Queues a completed match for the writer thread, which writes it at the end of the history then indexes it by
+ * court and by player (without waiting for the disk)
+ * @param court_id: court's id
+ * @param players: players of the match
+ * @param format: name of the scoring format
+ * @param start: time the match was assigned at (0 if unknown)
+ * @param score: final score
+ */
+void append_match(int court_id, player_t players[2], const char* format, time_t start, const char* score) {
+	pending_match_t* match;
+	match_record_t* record;
+	int i;
+
+	if (history_file == -1)
+		return;
+
+	match = (pending_match_t*) malloc(sizeof(pending_match_t));
+	record = &match->record;
+	memset(record, 0, sizeof(match_record_t));
+
+	// Both names of a player come from one message: they always fit
+	record->court_id = court_id;
+	for (i = 0; i < 2; i++) {
+		record->player_ids[i] = players[i].id;
+		if (snprintf(record->names[i], HISTORY_NAME_SIZE, "%s %s", players[i].first_name, players[i].last_name)
+			>= HISTORY_NAME_SIZE)
+			log_message(LOG_WARNING, "Court %d: the name of player %d is cut in the history", court_id, i + 1);
+	}
+	record->start = start;
+	record->end = time(NULL);
+	snprintf(record->format, sizeof(record->format), "%s", format);
+	snprintf(record->score, HISTORY_SCORE_SIZE, "%s", score);
+
+	match->next = NULL;
+	pthread_mutex_lock(&pending_mutex);
+	*pending_end = match;
+	pending_end = &match->next;
+	pthread_cond_signal(&match_pending);
+	pthread_mutex_unlock(&pending_mutex);
+}
+
+/**
+ * @fn void close_history()
+ * @brief Waits for the matches queued to be written (before the server closes)
+ */
+void close_history() {
+	if (history_file == -1)
+		return;
+
+	pthread_mutex_lock(&pending_mutex);
+	while (pending_matches != NULL || writing_matches)
+		pthread_cond_wait(&matches_written, &pending_mutex);
+	pthread_mutex_unlock(&pending_mutex);
+}
+
+/**
+ * @fn int history_player_matches(int player_id, int max_matches, match_record_t* matches)
+ * @brief Gives the last matches of a player, following the index (never the whole history)
+ * @param player_id: player's id
+ * @param max_matches: number of matches at most
+ * @param matches: filled with the matches, the last one first
+ * @return int: number of matches
+ */
+int history_player_matches(int player_id, int max_matches, match_record_t* matches) {
+	uint32_t number;
+	int nb_matches = 0;
+
+	if (history_file == -1)
+		return 0;
+
+	number = read_head(players_index, player_id);
+	while (nb_matches < max_matches && read_match(number, &matches[nb_matches])) {
+		number = matches[nb_matches].player_ids[0] == player_id ? matches[nb_matches].previous_player[0]
+																 : matches[nb_matches].previous_player[1];
+		nb_matches++;
+	}
+
+	return nb_matches;
+}
+
+/**
+ * @fn int history_court_matches(int court_id, int max_matches, match_record_t* matches)
+ * @brief Gives the last matches of a court, following the index (never the whole history)
+ * @param court_id: court's id
+ * @param max_matches: number of matches at most
+ * @param matches: filled with the matches, the last one first
+ * @return int: number of matches
+ */
+int history_court_matches(int court_id, int max_matches, match_record_t* matches) {
+	uint32_t number;
+	int nb_matches = 0;
+
+	if (history_file == -1)
+		return 0;
+
+	number = read_head(courts_index, court_id);
+	while (nb_matches < max_matches && read_match(number, &matches[nb_matches])) {
+		number = matches[nb_matches].previous_court;
+		nb_matches++;
+	}
+
+	return nb_matches;
+}
+
+/**
+ * @fn int history_matches_between(time_t from, time_t to, int max_matches, match_record_t* matches)
+ * @brief Gives the last matches that have ended in a period (found by a binary search, the history being in the
+ * order of the ends)
+ * @param from: beginning of the period
+ * @param to: end of the period (included)
+ * @param max_matches: number of matches at most
+ * @param matches: filled with the matches, the last one first
+ * @return int: number of matches
+ */
+int history_matches_between(time_t from, time_t to, int max_matches, match_record_t* matches) {
+	uint32_t low = 1, high, middle, last = 0;
+	match_record_t record;
+	int nb_matches = 0;
+
+	if (history_file == -1)
+		return 0;
+
+	// Finding the last match that has ended before the end of the period
+	high = atomic_load_explicit(&history_count, memory_order_acquire);
+	while (low <= high) {
+		middle = low + (high - low) / 2;
+		if (!read_match(middle, &record))
+			return 0;
+		if (record.end <= to) {
+			last = middle;
+			low = middle + 1;
+		}
+		else
+			high = middle - 1;
+	}
+
+	// Then going back until the beginning of the period
+	while (nb_matches < max_matches && read_match(last, &matches[nb_matches]) && matches[nb_matches].end >= from) {
+		nb_matches++;
+		last--;
+	}
+
+	return nb_matches;
+}
+
+/**
+ * @fn int history_last_player_id()
+ * @brief Gives the highest player's id of the history
+ * @return int: id, 0 if there is no match
+ */
+int history_last_player_id() {
+	return history_file == -1 ? 0 : history_header.last_player_id;
+}
+
+/**
+ * @fn int history_last_court_id()
+ * @brief Gives the highest court's id of the history
+ * @return int: id, 0 if there is no match
+ */
+int history_last_court_id() {
+	return history_file == -1 ? 0 : history_header.last_court_id;
+}
+
+/**
+ * @fn void print_match(FILE* stream, match_record_t* record)
+ * @brief Prints a match on one line ("#12 2024-06-08 14:52:11 court 3 bo3 52 min: John DOE (1) vs Jane SMITH (2) 0/0:6/4:6/3")
+ * @param stream: stream to print on
+ * @param record: match
+ */
+static void print_match(FILE* stream, match_record_t* record) {
+	time_t end = (time_t) record->end;
+	char ended_at[24], duration[24];
+	struct tm date;
+
+	localtime_r(&end, &date);
+	strftime(ended_at, sizeof(ended_at), "%Y-%m-%d %H:%M:%S", &date);
+	if (record->start == 0)
+		strcpy(duration, "?");
+	else
+		snprintf(duration, sizeof(duration), "%ld", (long) (record->end - record->start) / 60);
+
+	fprintf(stream, "#%u %s court %d %s %s min: %s (%d) vs %s (%d) %s\n", record->number, ended_at, record->court_id,
+			record->format, duration, record->names[0], record->player_ids[0], record->names[1], record->player_ids[1],
+			record->score);
+}
+
+/**
+ * @fn void print_history_query(FILE* stream, const char* query)
+ * @brief Answers a query of the endpoint ("player=3&last=5", "court=2", "from=1717840000&to=1717850000" or nothing for the
+ * last matches), one match per line
+ * @param stream: stream to print on
+ * @param query: query, after the '?' of the request (NULL if none)
+ */
+void print_history_query(FILE* stream, const char* query) {
+	match_record_t* matches;
+	char *save_ptr, *token, *value;
+	int player_id = 0, court_id = 0, max_matches = HISTORY_DEFAULT_RESULTS, nb_matches, i;
+	time_t from = 0, to = (time_t) INT64_MAX;
+	buffer_t copy;
+
+	if (history_file == -1) {
+		fprintf(stream, "History disabled\n");
+		return;
+	}
+
+	// Formatted example: "player=3&last=5" (the request line ends at the first space)
+	snprintf(copy, sizeof(buffer_t), "%s", query == NULL ? "" : query);
+	copy[strcspn(copy, " \r\n")] = '\0';
+	for (token = strtok_r(copy, "&", &save_ptr); token != NULL; token = strtok_r(NULL, "&", &save_ptr)) {
+		value = strchr(token, '=');
+		if (value == NULL)
+			continue;
+		*value++ = '\0';
+
+		if (strcmp(token, "player") == 0)
+			player_id = atoi(value);
+		else if (strcmp(token, "court") == 0)
+			court_id = atoi(value);
+		else if (strcmp(token, "from") == 0)
+			from = (time_t) atoll(value);
+		else if (strcmp(token, "to") == 0)
+			to = (time_t) atoll(value);
+		else if (strcmp(token, "last") == 0)
+			max_matches = atoi(value);
+	}
+	if (max_matches < 1)
+		max_matches = 1;
+	if (max_matches > HISTORY_MAX_RESULTS)
+		max_matches = HISTORY_MAX_RESULTS;
+
+	matches = (match_record_t*) malloc(max_matches * sizeof(match_record_t));
+	if (player_id != 0)
+		nb_matches = history_player_matches(player_id, max_matches, matches);
+	else if (court_id != 0)
+		nb_matches = history_court_matches(court_id, max_matches, matches);
+	else
+		nb_matches = history_matches_between(from, to, max_matches, matches);
+
+	for (i = 0; i < nb_matches; i++)
+		print_match(stream, &matches[i]);
+
+	free(matches);
+}
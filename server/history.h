@@ -0,0 +1,204 @@
+#ifndef PANTALLA_DEPORTIVA_V2_HISTORY_H
+#define PANTALLA_DEPORTIVA_V2_HISTORY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "server.h"
+#include "player_functions.h"
+
+/**
+ * @def DEFAULT_HISTORY_FILE
+ * @brief History file used when none is given (its indexes are next to it, ".players" and ".courts")
+ */
+#define DEFAULT_HISTORY_FILE "server.history"
+
+/**
+ * @def HISTORY_NAME_SIZE
+ * @brief Size of a player's name in a record ("John DOE"), a whole message: both names of a player always fit
+ */
+#define HISTORY_NAME_SIZE MAX_BUFFER
+
+/**
+ * @def HISTORY_SCORE_SIZE
+ * @brief Size of the final score in a record ("0/0:6/4:3/6:7/5")
+ */
+#define HISTORY_SCORE_SIZE 48
+
+/**
+ * @def HISTORY_DEFAULT_RESULTS
+ * @brief Matches given by a query of the endpoint that does not say how many
+ */
+#define HISTORY_DEFAULT_RESULTS 10
+
+/**
+ * @def HISTORY_MAX_RESULTS
+ * @brief Matches given at most by a query of the endpoint
+ */
+#define HISTORY_MAX_RESULTS 100
+
+/**
+ * @struct match_record
+ * @brief Completed match, as written in the history (fixed size: the n-th match is at a known offset)
+ * @var number: number of the match in the history (starting at 1)
+ * @var court_id: court's id
+ * @var player_ids: players' ids
+ * @var previous_court: number of the previous match of the court (0 if none)
+ * @var previous_player: number of the previous match of each player (0 if none)
+ * @var checksum: checksum of the other fields, written with them
+ * @var start: time the match was assigned at (0 if unknown)
+ * @var end: time the match has ended at (never before the end of the previous match)
+ * @var format: name of the scoring format
+ * @var names: players' names
+ * @var score: final score, as published to the spectators
+ */
+struct match_record {
+	uint32_t number;
+	int32_t court_id;
+	int32_t player_ids[2];
+	uint32_t previous_court;
+	uint32_t previous_player[2];
+	uint32_t checksum;
+	int64_t start;
+	int64_t end;
+	char format[16];
+	char names[2][HISTORY_NAME_SIZE];
+	char score[HISTORY_SCORE_SIZE];
+};
+
+/**
+ * @typedef match_record_t
+ * @brief Typedef for the match_record structure
+ */
+typedef struct match_record match_record_t;
+
+/**
+ * @struct pending_match
+ * @brief Completed match waiting for the writer thread
+ * @var record: match (its number, links and checksum are set when it is written)
+ * @var next: next match in the queue
+ */
+struct pending_match {
+	match_record_t record;
+	struct pending_match* next;
+};
+
+/**
+ * @typedef pending_match_t
+ * @brief Typedef for the pending_match structure
+ */
+typedef struct pending_match pending_match_t;
+
+/**
+ * @struct history_header
+ * @brief Beginning of the history file
+ * @var magic: identifies a history file
+ * @var record_size: size of the records (a file with other records is not read)
+ * @var indexed: number of matches whose indexes are written (the next ones are indexed again when opening)
+ * @var last_player_id: highest player's id of the matches (the ids continue after it across restarts)
+ * @var last_court_id: highest court's id of the matches
+ */
+struct history_header {
+	char magic[8];
+	uint32_t record_size;
+	uint32_t indexed;
+	int32_t last_player_id;
+	int32_t last_court_id;
+};
+
+/**
+ * @typedef history_header_t
+ * @brief Typedef for the history_header structure
+ */
+typedef struct history_header history_header_t;
+
+/**
+ * @fn int open_history(const char* path)
+ * @brief Opens the history of the matches and its indexes (created if needed), dropping a match that was not fully
+ * written and indexing the ones that were not, then starts the thread writing the next matches
+ * @param path: history file
+ * @return int: number of matches, -1 if the files cannot be opened
+ */
+int open_history(const char* path);
+
+/**
+ * @fn void append_match(int court_id, player_t players[2], const char* format, time_t start, const char* score)
+ * @brief Queues a completed match for the writer thread, which writes it at the end of the history then indexes it by
+ * court and by player (without waiting for the disk)
+ * @param court_id: court's id
+ * @param players: players of the match
+ * @param format: name of the scoring format
+ * @param start: time the match was assigned at (0 if unknown)
+ * @param score: final score
+ */
+void append_match(int court_id, player_t players[2], const char* format, time_t start, const char* score);
+
+/**
+ * @fn void close_history()
+ * @brief Waits for the matches queued to be written (before the server closes)
+ */
+void close_history();
+
+/**
+ * @fn int history_player_matches(int player_id, int max_matches, match_record_t* matches)
+ * @brief Gives the last matches of a player, following the index (never the whole history)
+ * @param player_id: player's id
+ * @param max_matches: number of matches at most
+ * @param matches: filled with the matches, the last one first
+ * @return int: number of matches
+ */
+int history_player_matches(int player_id, int max_matches, match_record_t* matches);
+
+/**
+ * @fn int history_court_matches(int court_id, int max_matches, match_record_t* matches)
+ * @brief Gives the last matches of a court, following the index (never the whole history)
+ * @param court_id: court's id
+ * @param max_matches: number of matches at most
+ * @param matches: filled with the matches, the last one first
+ * @return int: number of matches
+ */
+int history_court_matches(int court_id, int max_matches, match_record_t* matches);
+
+/**
+ * @fn int history_matches_between(time_t from, time_t to, int max_matches, match_record_t* matches)
+ * @brief Gives the last matches that have ended in a period (found by a binary search, the history being in the
+ * order of the ends)
+ * @param from: beginning of the period
+ * @param to: end of the period (included)
+ * @param max_matches: number of matches at most
+ * @param matches: filled with the matches, the last one first
+ * @return int: number of matches
+ */
+int history_matches_between(time_t from, time_t to, int max_matches, match_record_t* matches);
+
+/**
+ * @fn int history_last_player_id()
+ * @brief Gives the highest player's id of the history
+ * @return int: id, 0 if there is no match
+ */
+int history_last_player_id();
+
+/**
+ * @fn int history_last_court_id()
+ * @brief Gives the highest court's id of the history
+ * @return int: id, 0 if there is no match
+ */
+int history_last_court_id();
+
+/**
+ * @fn void print_history_query(FILE* stream, const char* query)
+ * @brief Answers a query of the endpoint ("player=3&last=5", "court=2", "from=1717840000&to=1717850000" or nothing for the
+ * last matches), one match per line
+ * @param stream: stream to print on
+ * @param query: query, after the '?' of the request (NULL if none)
+ */
+void print_history_query(FILE* stream, const char* query);
+
+#endif //PANTALLA_DEPORTIVA_V2_HISTORY_H
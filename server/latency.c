@@ -0,0 +1,503 @@
+/**
+ * @file latency.c
+ * @brief Per-thread latency histograms of the requests handled by the server and of the waits for its mutexes
+ * @date 2024-06-03
+ */
+
+#include <signal.h>
+
+#include "latency.h"
+#include "metrics.h"
+#include "lock_profiler.h"
+
+const char tracked_codes[NB_TRACKED_CODES] = {AUTH, ASK_PLAYERS, PLAY_WITH, QUEUE, ASK_COURTS, SUBSCRIBE, UNSUBSCRIBE,
+											  LISTEN_PORT, SCORE, END_MATCH};
+const char* code_names[NB_TRACKED_CODES] = {"AUTH", "ASK_PLAYERS", "PLAY_WITH", "QUEUE", "ASK_COURTS", "SUBSCRIBE",
+											"UNSUBSCRIBE", "LISTEN_PORT", "SCORE", "END_MATCH"};
+const char* phase_names[NB_PHASES] = {"decode", "handle", "send"};
+
+latency_recorder_t* recorders = NULL; // Recorders of the threads alive
+latency_recorder_t retired_recorder; // Samples of the threads that have ended
+pthread_mutex_t recorders_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for the list of recorders and the retired samples
+
+__thread latency_recorder_t* thread_recorder = NULL; // Recorder of the calling thread, created on its first sample
+pthread_key_t recorder_key; // Retires the recorder of a thread when it ends
+pthread_once_t recorder_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @fn long monotonic_ns()
+ * @brief Gives the time of a monotonic clock
+ * @return long: time (ns)
+ */
+long monotonic_ns() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/**
+ * @fn int code_slot(char code)
+ * @brief Gives the slot of the histograms of a request code
+ * @param code: request code
+ * @return int: slot, -1 if the code is not measured
+ */
+int code_slot(char code) {
+	int i;
+
+	for (i = 0; i < NB_TRACKED_CODES; i++)
+		if (tracked_codes[i] == code)
+			return i;
+
+	return -1;
+}
+
+/**
+ * @fn int bucket_of(unsigned long value)
+ * @brief Gives the bucket of a duration
+ * @param value: duration (ns)
+ * @return int: bucket (the last one for the durations too high)
+ */
+int bucket_of(unsigned long value) {
+	int magnitude;
+
+	if (value < HISTOGRAM_SUB_BUCKETS)
+		return (int) value;
+
+	// Keeping the HISTOGRAM_SUB_BUCKET_BITS highest bits of the value
+	magnitude = 63 - __builtin_clzl(value) - HISTOGRAM_SUB_BUCKET_BITS;
+	if (magnitude >= HISTOGRAM_MAGNITUDES)
+		return HISTOGRAM_BUCKETS - 1;
+
+	return HISTOGRAM_SUB_BUCKETS * magnitude + (int) (value >> magnitude);
+}
+
+/**
+ * @fn unsigned long bucket_value(int bucket)
+ * @brief Gives the highest duration of a bucket
+ * @param bucket: bucket
+ * @return unsigned long: duration (ns)
+ */
+unsigned long bucket_value(int bucket) {
+	int magnitude;
+
+	if (bucket < HISTOGRAM_SUB_BUCKETS)
+		return (unsigned long) bucket;
+
+	magnitude = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	return ((unsigned long) (bucket % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS + 1) << magnitude) - 1;
+}
+
+/**
+ * @fn void add_to_counter(atomic_ulong* counter, unsigned long value)
+ * @brief Adds to a counter with a single writer (no atomic read-modify-write, the readers see either value)
+ * @param counter: counter
+ * @param value: value to add
+ */
+void add_to_counter(atomic_ulong* counter, unsigned long value) {
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+/**
+ * @fn void add_histogram(histogram_t* into, histogram_t* histogram)
+ * @brief Adds the samples of a histogram to another one (written by the calling thread only)
+ * @param into: histogram added to
+ * @param histogram: histogram to add
+ */
+void add_histogram(histogram_t* into, histogram_t* histogram) {
+	unsigned long max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+	int i;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+		add_to_counter(&into->counts[i], atomic_load_explicit(&histogram->counts[i], memory_order_relaxed));
+	add_to_counter(&into->count, atomic_load_explicit(&histogram->count, memory_order_relaxed));
+	add_to_counter(&into->sum, atomic_load_explicit(&histogram->sum, memory_order_relaxed));
+	if (max > atomic_load_explicit(&into->max, memory_order_relaxed))
+		atomic_store_explicit(&into->max, max, memory_order_relaxed);
+}
+
+/**
+ * @fn void retire_recorder(void* recorder)
+ * @brief Moves the samples of a thread that ends to the retired ones, and forgets its recorder
+ * @param recorder: recorder of the thread
+ */
+void retire_recorder(void* recorder) {
+	latency_recorder_t* r = (latency_recorder_t*) recorder;
+	latency_recorder_t** node_ptr;
+	histogram_t* histogram;
+	int i;
+
+	pthread_mutex_lock(&recorders_mutex);
+
+	// In the same critical section as the merges, so a sample is never counted twice or missed
+	for (i = 0; i < LATENCY_SERIES; i++) {
+		histogram = atomic_load_explicit(&r->histograms[i], memory_order_acquire);
+		if (histogram == NULL)
+			continue;
+		if (atomic_load_explicit(&retired_recorder.histograms[i], memory_order_relaxed) == NULL)
+			atomic_store_explicit(&retired_recorder.histograms[i], (histogram_t*) calloc(1, sizeof(histogram_t)),
+								  memory_order_release);
+		add_histogram(atomic_load_explicit(&retired_recorder.histograms[i], memory_order_relaxed), histogram);
+		free(histogram);
+	}
+
+	for (node_ptr = &recorders; *node_ptr != NULL; node_ptr = &(*node_ptr)->next) {
+		if (*node_ptr == r) {
+			*node_ptr = r->next;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&recorders_mutex);
+
+	free(r);
+}
+
+/**
+ * @fn void create_recorder_key()
+ * @brief Creates the key retiring the recorders of the threads that end
+ */
+void create_recorder_key() {
+	pthread_key_create(&recorder_key, retire_recorder);
+}
+
+/**
+ * @fn latency_recorder_t* get_thread_recorder()
+ * @brief Gives the recorder of the calling thread, registering it on first use
+ * @return latency_recorder_t*: recorder
+ */
+latency_recorder_t* get_thread_recorder() {
+	latency_recorder_t* recorder = thread_recorder;
+
+	if (recorder != NULL)
+		return recorder;
+
+	recorder = (latency_recorder_t*) calloc(1, sizeof(latency_recorder_t));
+	recorder->current_slot = -1;
+
+	pthread_once(&recorder_key_once, create_recorder_key);
+	pthread_setspecific(recorder_key, recorder);
+
+	pthread_mutex_lock(&recorders_mutex);
+	recorder->next = recorders;
+	recorders = recorder;
+	pthread_mutex_unlock(&recorders_mutex);
+
+	thread_recorder = recorder;
+	return recorder;
+}
+
+/**
+ * @fn void record_latency(int series, long duration)
+ * @brief Adds a sample to a histogram of the calling thread
+ * @param series: series (slot * NB_PHASES + phase, or NB_TRACKED_CODES * NB_PHASES + lock)
+ * @param duration: duration (ns)
+ */
+void record_latency(int series, long duration) {
+	latency_recorder_t* recorder = get_thread_recorder();
+	histogram_t* histogram = atomic_load_explicit(&recorder->histograms[series], memory_order_relaxed);
+	unsigned long value = duration < 0 ? 0 : (unsigned long) duration;
+
+	// The histogram is published once zeroed, the merges then read it at any time
+	if (histogram == NULL) {
+		histogram = (histogram_t*) calloc(1, sizeof(histogram_t));
+		atomic_store_explicit(&recorder->histograms[series], histogram, memory_order_release);
+	}
+
+	add_to_counter(&histogram->counts[bucket_of(value)], 1);
+	add_to_counter(&histogram->count, 1);
+	add_to_counter(&histogram->sum, value);
+	if (value > atomic_load_explicit(&histogram->max, memory_order_relaxed))
+		atomic_store_explicit(&histogram->max, value, memory_order_relaxed);
+}
+
+/**
+ * @fn ssize_t receive_request(socket_t* socket, message_t* message)
+ * @brief Receives a message and measures its decoding, then starts measuring its handling
+ * @param socket: socket to receive from
+ * @param message: filled with the message
+ * @return ssize_t: number of bytes received, 0 once the connection is closed
+ */
+ssize_t receive_request(socket_t* socket, message_t* message) {
+	buffer_t serialized_content;
+	ssize_t read_size;
+	long start;
+	int slot;
+
+	// Receiving as is, to time the deserialization apart from the wait for the message
+	read_size = receive_message(socket, serialized_content, NULL);
+	start = monotonic_ns();
+	deserialize_message(message, serialized_content);
+
+	if (read_size != 0) {
+		count_metric(COUNTER_MESSAGES_RECEIVED, 1);
+		count_metric(COUNTER_BYTES_RECEIVED, read_size);
+	}
+
+	slot = code_slot(message->code);
+	if (read_size == 0 || slot == -1)
+		return read_size;
+
+	record_latency(slot * NB_PHASES + PHASE_DECODE, monotonic_ns() - start);
+	thread_recorder->current_slot = slot;
+	thread_recorder->request_start = start;
+
+	return read_size;
+}
+
+/**
+ * @fn void begin_request(char code)
+ * @brief Starts measuring the handling of a request (already decoded)
+ * @param code: code of the request
+ */
+void begin_request(char code) {
+	latency_recorder_t* recorder = get_thread_recorder();
+
+	recorder->current_slot = code_slot(code);
+	recorder->request_start = monotonic_ns();
+}
+
+/**
+ * @fn void end_request()
+ * @brief Ends measuring the handling of the current request (nothing if none)
+ */
+void end_request() {
+	latency_recorder_t* recorder = thread_recorder;
+
+	if (recorder == NULL || recorder->current_slot == -1)
+		return;
+
+	record_latency(recorder->current_slot * NB_PHASES + PHASE_HANDLE, monotonic_ns() - recorder->request_start);
+	recorder->current_slot = -1;
+}
+
+/**
+ * @fn void timed_send(socket_t* socket, message_t* message)
+ * @brief Sends an answer, its time counted in the send phase of the current request
+ * @param socket: socket to send on
+ * @param message: message to send
+ */
+void timed_send(socket_t* socket, message_t* message) {
+	long start = monotonic_ns();
+
+	send_message(socket, message, serialize_message);
+	record_send(monotonic_ns() - start);
+
+	count_metric(COUNTER_MESSAGES_SENT, 1);
+	count_metric(COUNTER_BYTES_SENT, strlen(message->data) + 2);
+}
+
+/**
+ * @fn int timed_try_send(socket_t* socket, message_t* message)
+ * @brief Sends a message to a client that may have left, without exiting (nor being killed by SIGPIPE) if it has
+ * @param socket: socket to send on
+ * @param message: message to send
+ * @return int: 0 if sent, -1 if the connection is lost
+ */
+int timed_try_send(socket_t* socket, message_t* message) {
+	long start = monotonic_ns();
+	buffer_t serialized;
+	size_t size, offset = 0;
+	ssize_t write_size;
+
+	serialize_message(message, serialized);
+	size = strlen(serialized) + 1;
+
+	while (offset < size) {
+		write_size = send(socket->file_descriptor, serialized + offset, size - offset, MSG_NOSIGNAL);
+		if (write_size == -1)
+			return -1;
+		offset += write_size;
+	}
+	record_send(monotonic_ns() - start);
+
+	count_metric(COUNTER_MESSAGES_SENT, 1);
+	count_metric(COUNTER_BYTES_SENT, strlen(message->data) + 2);
+	return 0;
+}
+
+/**
+ * @fn void record_send(long duration)
+ * @brief Counts a send in the send phase of the current request (nothing if none)
+ * @param duration: time spent sending (ns)
+ */
+void record_send(long duration) {
+	if (thread_recorder != NULL && thread_recorder->current_slot != -1)
+		record_latency(thread_recorder->current_slot * NB_PHASES + PHASE_SEND, duration);
+}
+
+/**
+ * @fn void merge_latencies(int series, histogram_t* merged)
+ * @brief Sums a series over all the threads (alive or not), without stopping them
+ * @param series: series to merge
+ * @param merged: filled with the sum
+ */
+void merge_latencies(int series, histogram_t* merged) {
+	latency_recorder_t* recorder;
+	histogram_t* histogram;
+
+	memset(merged, 0, sizeof(histogram_t));
+
+	// Only the threads starting or ending wait for the merge, the others keep recording
+	pthread_mutex_lock(&recorders_mutex);
+
+	histogram = atomic_load_explicit(&retired_recorder.histograms[series], memory_order_acquire);
+	if (histogram != NULL)
+		add_histogram(merged, histogram);
+
+	for (recorder = recorders; recorder != NULL; recorder = recorder->next) {
+		histogram = atomic_load_explicit(&recorder->histograms[series], memory_order_acquire);
+		if (histogram != NULL)
+			add_histogram(merged, histogram);
+	}
+
+	pthread_mutex_unlock(&recorders_mutex);
+}
+
+/**
+ * @fn unsigned long histogram_percentile(histogram_t* histogram, double percentile)
+ * @brief Gives a percentile of a histogram
+ * @param histogram: histogram
+ * @param percentile: percentile (between 0 and 100)
+ * @return unsigned long: highest duration of the bucket of the percentile (ns), 0 if there is no sample
+ */
+unsigned long histogram_percentile(histogram_t* histogram, double percentile) {
+	unsigned long total = 0, rank, max = atomic_load(&histogram->max);
+	int i;
+
+	// The buckets were read one by one while being written: counting them again rather than trusting count
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+		total += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+	if (total == 0)
+		return 0;
+
+	rank = (unsigned long) (percentile / 100 * total + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0, total = 0; i < HISTOGRAM_BUCKETS; i++) {
+		total += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+		if (total >= rank)
+			return bucket_value(i) < max ? bucket_value(i) : max;
+	}
+
+	return max;
+}
+
+/**
+ * @fn char* series_name(int series, char* name)
+ * @brief Names a series ("SCORE decode", "courts_mutex wait"...)
+ * @param series: series
+ * @param name: filled with the name
+ * @return char*: name
+ */
+char* series_name(int series, char* name) {
+	if (series < NB_TRACKED_CODES * NB_PHASES)
+		sprintf(name, "%s %s", code_names[series / NB_PHASES], phase_names[series % NB_PHASES]);
+	else
+		sprintf(name, "%s wait", lock_name(series - NB_TRACKED_CODES * NB_PHASES));
+
+	return name;
+}
+
+/**
+ * @fn void print_latency_report(FILE* stream)
+ * @brief Prints the percentiles of every series that has samples
+ * @param stream: stream to print on
+ */
+void print_latency_report(FILE* stream) {
+	histogram_t* merged = (histogram_t*) malloc(sizeof(histogram_t));
+	char name[64];
+	int i;
+
+	fprintf(stream, "%-32s %10s %10s %10s %10s %10s %10s\n", "latency (us)", "count", "p50", "p90", "p99", "p99.9", "max");
+
+	for (i = 0; i < LATENCY_SERIES; i++) {
+		merge_latencies(i, merged);
+		if (atomic_load(&merged->count) == 0)
+			continue;
+
+		fprintf(stream, "%-32s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f\n", series_name(i, name),
+				atomic_load(&merged->count), histogram_percentile(merged, 50) / 1000.0,
+				histogram_percentile(merged, 90) / 1000.0, histogram_percentile(merged, 99) / 1000.0,
+				histogram_percentile(merged, 99.9) / 1000.0, atomic_load(&merged->max) / 1000.0);
+	}
+
+	fflush(stream);
+	free(merged);
+}
+
+/**
+ * @fn void print_latency_metrics(FILE* stream)
+ * @brief Prints the percentiles of every series that has samples, in the Prometheus text format
+ * @param stream: stream to print on
+ */
+void print_latency_metrics(FILE* stream) {
+	histogram_t* merged = (histogram_t*) malloc(sizeof(histogram_t));
+	double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+	char labels[96];
+	const char* metric;
+	int i, j;
+
+	for (i = 0; i < LATENCY_SERIES; i++) {
+		if (i == 0)
+			fprintf(stream, "# HELP pantalla_request_latency_us Time of the requests by code and phase\n"
+							"# TYPE pantalla_request_latency_us summary\n");
+		if (i == NB_TRACKED_CODES * NB_PHASES)
+			fprintf(stream, "# HELP pantalla_lock_wait_us Wait of the contended acquisitions of the mutexes\n# TYPE pantalla_lock_wait_us summary\n");
+
+		merge_latencies(i, merged);
+		if (atomic_load(&merged->count) == 0)
+			continue;
+
+		// The requests by code and phase, then the waits by mutex
+		if (i < NB_TRACKED_CODES * NB_PHASES) {
+			metric = "pantalla_request_latency_us";
+			sprintf(labels, "code=\"%s\",phase=\"%s\"", code_names[i / NB_PHASES], phase_names[i % NB_PHASES]);
+		}
+		else {
+			metric = "pantalla_lock_wait_us";
+			sprintf(labels, "mutex=\"%s\"", lock_name(i - NB_TRACKED_CODES * NB_PHASES));
+		}
+
+		for (j = 0; j < (int) (sizeof(quantiles) / sizeof(quantiles[0])); j++)
+			fprintf(stream, "%s{%s,quantile=\"%g\"} %.1f\n", metric, labels, quantiles[j],
+					histogram_percentile(merged, quantiles[j] * 100) / 1000.0);
+		fprintf(stream, "%s_sum{%s} %.1f\n", metric, labels, atomic_load(&merged->sum) / 1000.0);
+		fprintf(stream, "%s_count{%s} %lu\n", metric, labels, atomic_load(&merged->count));
+	}
+
+	free(merged);
+}
+
+/**
+ * @fn void latency_reporter_thread(void* signals)
+ * @brief Prints the reports (latencies and mutexes) on stderr each time SIGUSR1 is received
+ * @param signals: set of the signals waited for (SIGUSR1)
+ */
+void latency_reporter_thread(void* signals) {
+	int signal_number;
+
+	while (sigwait((sigset_t*) signals, &signal_number) == 0) {
+		print_latency_report(stderr);
+		print_lock_report(stderr);
+	}
+}
+
+/**
+ * @fn void start_latency_reporter()
+ * @brief Starts the thread printing the reports (latencies and mutexes) on stderr on each SIGUSR1
+ * @note must be called before any other thread is created, SIGUSR1 being blocked in all the threads
+ */
+void start_latency_reporter() {
+	static sigset_t signals;
+	pthread_t thread;
+
+	// Blocked here, the threads created afterwards inherit the mask: only the reporter receives it
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	pthread_create(&thread, NULL, (void*) latency_reporter_thread, (void*) &signals);
+	pthread_detach(thread);
+}
@@ -0,0 +1,258 @@
+#ifndef PANTALLA_DEPORTIVA_V2_LATENCY_H
+#define PANTALLA_DEPORTIVA_V2_LATENCY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "../socket/data.h"
+#include "../serialization/serialization.h"
+#include "../common/codes.h"
+
+/**
+ * @def HISTOGRAM_SUB_BUCKET_BITS
+ * @brief Significant bits kept of each sample (4 gives a precision of about 6%)
+ */
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+
+/**
+ * @def HISTOGRAM_SUB_BUCKETS
+ * @brief Buckets of each power of two
+ */
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+
+/**
+ * @def HISTOGRAM_MAGNITUDES
+ * @brief Powers of two covered above the first HISTOGRAM_SUB_BUCKETS ns (up to about 68 s)
+ */
+#define HISTOGRAM_MAGNITUDES 32
+
+/**
+ * @def HISTOGRAM_BUCKETS
+ * @brief Buckets of a histogram: the first ones are exact, then HISTOGRAM_SUB_BUCKETS per power of two
+ */
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS * (HISTOGRAM_MAGNITUDES + 1))
+
+/**
+ * @def PHASE_DECODE
+ * @brief Deserializing a request
+ */
+#define PHASE_DECODE 0
+/**
+ * @def PHASE_HANDLE
+ * @brief Handling a request, from its decoding to its last answer (sends and lock waits included)
+ */
+#define PHASE_HANDLE 1
+/**
+ * @def PHASE_SEND
+ * @brief Sending an answer of a request (serializing and writing on the socket)
+ */
+#define PHASE_SEND 2
+/**
+ * @def NB_PHASES
+ * @brief Number of phases measured for each code
+ */
+#define NB_PHASES 3
+
+/**
+ * @def NB_TRACKED_CODES
+ * @brief Number of request codes measured (AUTH, ASK_PLAYERS, PLAY_WITH, QUEUE, ASK_COURTS, SUBSCRIBE,
+ * UNSUBSCRIBE, LISTEN_PORT, SCORE and END_MATCH)
+ */
+#define NB_TRACKED_CODES 10
+
+/**
+ * @def LOCK_PLAYERS
+ * @brief Wait for players_mutex
+ */
+#define LOCK_PLAYERS 0
+/**
+ * @def LOCK_COURTS
+ * @brief Wait for courts_mutex
+ */
+#define LOCK_COURTS 1
+/**
+ * @def LOCK_PLAYER_ID
+ * @brief Wait for id_counter_mutex
+ */
+#define LOCK_PLAYER_ID 2
+/**
+ * @def LOCK_COURT_ID
+ * @brief Wait for court_id_counter_mutex
+ */
+#define LOCK_COURT_ID 3
+/**
+ * @def NB_LOCKS
+ * @brief Number of mutexes measured
+ */
+#define NB_LOCKS 4
+
+/**
+ * @def LATENCY_SERIES
+ * @brief Histograms of a thread: one per phase of each code, then one per mutex
+ */
+#define LATENCY_SERIES (NB_TRACKED_CODES * NB_PHASES + NB_LOCKS)
+
+/**
+ * @struct histogram
+ * @brief Log-linear histogram of durations (ns), in the manner of HdrHistogram
+ * @var counts: samples of each bucket
+ * @var count: number of samples
+ * @var sum: sum of the samples (ns)
+ * @var max: highest sample (ns)
+ * @note a histogram of a thread is only written by this thread, so the counters are not incremented atomically:
+ * they are only atomic to be read by the merge at any time
+ */
+struct histogram {
+	atomic_ulong counts[HISTOGRAM_BUCKETS];
+	atomic_ulong count;
+	atomic_ulong sum;
+	atomic_ulong max;
+};
+
+/**
+ * @typedef histogram_t
+ * @brief Typedef for histogram structure
+ */
+typedef struct histogram histogram_t;
+
+/**
+ * @struct latency_recorder
+ * @brief Histograms of a thread, registered so that they can be merged while the thread records
+ * @var histograms: histograms of each series, allocated on their first sample (NULL before)
+ * @var current_slot: slot of the code of the request being handled, -1 if none
+ * @var request_start: time the request being handled was decoded at (ns)
+ * @var next: next recorder in the list
+ */
+struct latency_recorder {
+	_Atomic(histogram_t*) histograms[LATENCY_SERIES];
+	int current_slot;
+	long request_start;
+	struct latency_recorder* next;
+};
+
+/**
+ * @typedef latency_recorder_t
+ * @brief Typedef for latency_recorder structure
+ */
+typedef struct latency_recorder latency_recorder_t;
+
+/**
+ * @fn long monotonic_ns()
+ * @brief Gives the time of a monotonic clock
+ * @return long: time (ns)
+ */
+long monotonic_ns();
+
+/**
+ * @fn int code_slot(char code)
+ * @brief Gives the slot of the histograms of a request code
+ * @param code: request code
+ * @return int: slot, -1 if the code is not measured
+ */
+int code_slot(char code);
+
+/**
+ * @fn void record_latency(int series, long duration)
+ * @brief Adds a sample to a histogram of the calling thread
+ * @param series: series (slot * NB_PHASES + phase, or NB_TRACKED_CODES * NB_PHASES + lock)
+ * @param duration: duration (ns)
+ */
+void record_latency(int series, long duration);
+
+/**
+ * @fn ssize_t receive_request(socket_t* socket, message_t* message)
+ * @brief Receives a message and measures its decoding, then starts measuring its handling
+ * @param socket: socket to receive from
+ * @param message: filled with the message
+ * @return ssize_t: number of bytes received, 0 once the connection is closed
+ */
+ssize_t receive_request(socket_t* socket, message_t* message);
+
+/**
+ * @fn void begin_request(char code)
+ * @brief Starts measuring the handling of a request (already decoded)
+ * @param code: code of the request
+ */
+void begin_request(char code);
+
+/**
+ * @fn void end_request()
+ * @brief Ends measuring the handling of the current request (nothing if none)
+ */
+void end_request();
+
+/**
+ * @fn void timed_send(socket_t* socket, message_t* message)
+ * @brief Sends an answer, its time counted in the send phase of the current request
+ * @param socket: socket to send on
+ * @param message: message to send
+ */
+void timed_send(socket_t* socket, message_t* message);
+
+/**
+ * @fn int timed_try_send(socket_t* socket, message_t* message)
+ * @brief Sends a message to a client that may have left, without exiting (nor being killed by SIGPIPE) if it has
+ * @param socket: socket to send on
+ * @param message: message to send
+ * @return int: 0 if sent, -1 if the connection is lost
+ */
+int timed_try_send(socket_t* socket, message_t* message);
+
+/**
+ * @fn void record_send(long duration)
+ * @brief Counts a send in the send phase of the current request (nothing if none)
+ * @param duration: time spent sending (ns)
+ */
+void record_send(long duration);
+
+/**
+ * @fn void merge_latencies(int series, histogram_t* merged)
+ * @brief Sums a series over all the threads (alive or not), without stopping them
+ * @param series: series to merge
+ * @param merged: filled with the sum
+ */
+void merge_latencies(int series, histogram_t* merged);
+
+/**
+ * @fn unsigned long histogram_percentile(histogram_t* histogram, double percentile)
+ * @brief Gives a percentile of a histogram
+ * @param histogram: histogram
+ * @param percentile: percentile (between 0 and 100)
+ * @return unsigned long: highest duration of the bucket of the percentile (ns), 0 if there is no sample
+ */
+unsigned long histogram_percentile(histogram_t* histogram, double percentile);
+
+/**
+ * @fn char* series_name(int series, char* name)
+ * @brief Names a series ("SCORE decode", "courts_mutex wait"...)
+ * @param series: series
+ * @param name: filled with the name
+ * @return char*: name
+ */
+char* series_name(int series, char* name);
+
+/**
+ * @fn void print_latency_report(FILE* stream)
+ * @brief Prints the percentiles of every series that has samples
+ * @param stream: stream to print on
+ */
+void print_latency_report(FILE* stream);
+
+/**
+ * @fn void print_latency_metrics(FILE* stream)
+ * @brief Prints the percentiles of every series that has samples, in the Prometheus text format
+ * @param stream: stream to print on
+ */
+void print_latency_metrics(FILE* stream);
+
+/**
+ * @fn void start_latency_reporter()
+ * @brief Starts the thread printing the reports (latencies and mutexes) on stderr on each SIGUSR1
+ * @note must be called before any other thread is created, SIGUSR1 being blocked in all the threads
+ */
+void start_latency_reporter();
+
+#endif //PANTALLA_DEPORTIVA_V2_LATENCY_H
@@ -0,0 +1,110 @@
+/**
+ * @file lock_benchmark.c
+ * @brief Stresses the registries of the server with concurrent players and courts, then prints the profile of their mutexes
+ * @date 2024-06-07
+ */
+
+#include "server.h"
+#include "player_functions.h"
+#include "court_functions.h"
+
+/**
+ * @def BENCHMARK_WINDOW
+ * @brief Players each thread keeps in the list, the oldest one being removed when a new one is added
+ */
+#define BENCHMARK_WINDOW 16
+
+/**
+ * @def BENCHMARK_MAX_COURTS
+ * @brief Courts registered at most (each one has its broadcaster thread), then the courts are claimed and released
+ */
+#define BENCHMARK_MAX_COURTS 256
+
+int nb_operations = 200000; // Operations of each thread
+int court_every = 100; // One court operation every court_every operations
+const scoring_format_t* benchmark_format; // Format of the courts registered
+atomic_int courts_registered = 0; // Courts registered by all the threads
+
+/**
+ * @fn void benchmark_thread(void* arg)
+ * @brief Adds and removes players as the players' threads do, and registers or claims courts
+ * @param arg: index of the thread
+ */
+void benchmark_thread(void* arg) {
+	int ids[BENCHMARK_WINDOW] = {0};
+	player_t player;
+	court_t* court;
+	int i;
+
+	memset(&player, 0, sizeof(player_t));
+	strcpy(player.first_name, "Bench");
+	strcpy(player.last_name, "Mark");
+
+	for (i = 0; i < nb_operations; i++) {
+		// A player joining the list, and the one that joined BENCHMARK_WINDOW operations ago leaving it (invited)
+		if (ids[i % BENCHMARK_WINDOW] != 0)
+			remove_player(ids[i % BENCHMARK_WINDOW]);
+		player.id = (int) (long) arg * nb_operations + i + 1;
+		ids[i % BENCHMARK_WINDOW] = player.id;
+		add_player(player);
+
+		// Listing the players, as the hosts do
+		if (i % 64 == 0)
+			count_players();
+
+		// A court process registering a court, or the matchmaking giving a court to a pair and getting it back
+		if (i % court_every == 0) {
+			if (atomic_fetch_add(&courts_registered, 1) < BENCHMARK_MAX_COURTS)
+				set_court_available(register_court(NULL, "127.0.0.1", 4242, benchmark_format, 0));
+			else if ((court = claim_available_court()) != NULL)
+				set_court_available(court);
+		}
+	}
+
+	for (i = 0; i < BENCHMARK_WINDOW; i++)
+		if (ids[i] != 0)
+			remove_player(ids[i]);
+}
+
+int main(int argc, char** argv) {
+	pthread_t* threads;
+	long start, elapsed;
+	int nb_threads = 8, i;
+
+	if (argc > 1)
+		nb_threads = atoi(argv[1]);
+	if (argc > 2)
+		nb_operations = atoi(argv[2]);
+	if (argc > 3)
+		court_every = atoi(argv[3]);
+	if (nb_threads < 1 || nb_operations < 1 || court_every < 1) {
+		fprintf(stderr, "Usage: %s [Threads] [OperationsPerThread] [CourtEvery]\n", argv[0]);
+		return 1;
+	}
+
+	// Only the warnings: a line per court registered would be measured as well
+	setenv("LOG_LEVEL", "warning", 0);
+	log_init();
+	benchmark_format = find_scoring_format(DEFAULT_SCORING_FORMAT);
+
+	threads = (pthread_t*) malloc(nb_threads * sizeof(pthread_t));
+	start = monotonic_ns();
+	for (i = 0; i < nb_threads; i++)
+		pthread_create(&threads[i], NULL, (void*) benchmark_thread, (void*) (long) i);
+	for (i = 0; i < nb_threads; i++)
+		pthread_join(threads[i], NULL);
+	elapsed = monotonic_ns() - start;
+
+	printf("%d threads, %d operations each: %.3f s, %.0f operations/s (LOCK_PROFILING=%d)\n\n", nb_threads,
+		   nb_operations, elapsed / 1e9, (double) nb_threads * nb_operations / (elapsed / 1e9), LOCK_PROFILING);
+	print_lock_report(stdout);
+
+	// The waits of the contended acquisitions (only recorded when profiling)
+	if (LOCK_PROFILING) {
+		printf("\n");
+		print_latency_report(stdout);
+	}
+
+	free(threads);
+	return 0;
+}
@@ -0,0 +1,175 @@
+/**
+ * @file lock_profiler.c
+ * @brief Profile of the mutexes of the registries: acquisitions, contention, waits and longest holders
+ * @date 2024-06-07
+ */
+
+#include "lock_profiler.h"
+
+const char* lock_names[NB_LOCKS] = {"players_mutex", "courts_mutex", "id_counter_mutex", "court_id_counter_mutex"};
+
+lock_profile_t lock_profiles[NB_LOCKS]; // Profile of each mutex, written under the mutex itself
+
+/**
+ * @fn const char* lock_name(int lock)
+ * @brief Names a mutex of the registries
+ * @param lock: LOCK_PLAYERS, LOCK_COURTS, LOCK_PLAYER_ID or LOCK_COURT_ID
+ * @return const char*: name ("players_mutex"...)
+ */
+const char* lock_name(int lock) {
+	return lock_names[lock];
+}
+
+/**
+ * @fn void add_to_profile(atomic_ulong* counter, unsigned long value)
+ * @brief Adds to a counter of a profile (only the holder of the mutex writes it: no atomic read-modify-write)
+ * @param counter: counter
+ * @param value: value to add
+ */
+static void add_to_profile(atomic_ulong* counter, unsigned long value) {
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+/**
+ * @fn void profile_lock(pthread_mutex_t* mutex, int lock, const lock_site_t* site)
+ * @brief Locks a mutex, counting the acquisition, whether it was contended and the wait
+ * @param mutex: mutex to lock
+ * @param lock: LOCK_PLAYERS, LOCK_COURTS, LOCK_PLAYER_ID or LOCK_COURT_ID
+ * @param site: call site locking it
+ */
+void profile_lock(pthread_mutex_t* mutex, int lock, const lock_site_t* site) {
+	lock_profile_t* profile = &lock_profiles[lock];
+	long start = 0, wait;
+	int contended;
+
+	// A free mutex costs no clock read before locking it
+	contended = (pthread_mutex_trylock(mutex) != 0);
+	if (contended) {
+		start = monotonic_ns();
+		pthread_mutex_lock(mutex);
+	}
+
+	// Holding the mutex, this thread is the only one writing its profile
+	profile->held_since = monotonic_ns();
+	profile->holder = site;
+	add_to_profile(&profile->acquisitions, 1);
+	if (contended) {
+		// The distribution of the waits only holds the contended acquisitions, the others waited for nothing
+		add_to_profile(&profile->contended, 1);
+		wait = profile->held_since - start;
+		add_to_profile(&profile->total_wait, wait);
+		record_latency(NB_TRACKED_CODES * NB_PHASES + lock, wait);
+	}
+}
+
+/**
+ * @fn void profile_unlock(pthread_mutex_t* mutex, int lock)
+ * @brief Unlocks a mutex, recording how long it was held and by which call site
+ * @param mutex: mutex to unlock
+ * @param lock: LOCK_PLAYERS, LOCK_COURTS, LOCK_PLAYER_ID or LOCK_COURT_ID
+ */
+void profile_unlock(pthread_mutex_t* mutex, int lock) {
+	lock_profile_t* profile = &lock_profiles[lock];
+	long hold = monotonic_ns() - profile->held_since;
+
+	add_to_profile(&profile->total_hold, hold);
+	if ((unsigned long) hold > atomic_load_explicit(&profile->longest_hold, memory_order_relaxed)) {
+		atomic_store_explicit(&profile->longest_hold, hold, memory_order_relaxed);
+		atomic_store_explicit(&profile->longest_site, profile->holder, memory_order_relaxed);
+	}
+
+	pthread_mutex_unlock(mutex);
+}
+
+/**
+ * @fn char* site_name(const lock_site_t* site, char* name, size_t size)
+ * @brief Names a call site ("add_court (court_functions.c:23)")
+ * @param site: call site, NULL if none
+ * @param name: filled with the name
+ * @param size: size of name
+ * @return char*: name
+ */
+static char* site_name(const lock_site_t* site, char* name, size_t size) {
+	if (site == NULL)
+		snprintf(name, size, "-");
+	else
+		snprintf(name, size, "%s (%s:%d)", site->function, site->file, site->line);
+
+	return name;
+}
+
+/**
+ * @fn void print_lock_report(FILE* stream)
+ * @brief Prints the profile of every mutex of the registries
+ * @param stream: stream to print on
+ */
+void print_lock_report(FILE* stream) {
+	lock_profile_t* profile;
+	unsigned long acquisitions, contended;
+	char site[128];
+	int i;
+
+	if (!LOCK_PROFILING) {
+		fprintf(stream, "Lock profiling disabled (build with make LOCK_PROFILING=1)\n");
+		return;
+	}
+
+	fprintf(stream, "%-24s %10s %10s %10s %14s %14s %14s  %s\n", "mutex", "acquired", "contended", "contended %",
+			"wait (ms)", "hold mean (us)", "longest (us)", "longest holder");
+
+	for (i = 0; i < NB_LOCKS; i++) {
+		profile = &lock_profiles[i];
+		acquisitions = atomic_load_explicit(&profile->acquisitions, memory_order_relaxed);
+		contended = atomic_load_explicit(&profile->contended, memory_order_relaxed);
+
+		fprintf(stream, "%-24s %10lu %10lu %10.1f %14.3f %14.2f %14.1f  %s\n", lock_names[i], acquisitions, contended,
+				acquisitions == 0 ? 0.0 : 100.0 * contended / acquisitions,
+				atomic_load_explicit(&profile->total_wait, memory_order_relaxed) / 1e6,
+				acquisitions == 0 ? 0.0 : atomic_load_explicit(&profile->total_hold, memory_order_relaxed) / 1e3 / acquisitions,
+				atomic_load_explicit(&profile->longest_hold, memory_order_relaxed) / 1e3,
+				site_name(atomic_load_explicit(&profile->longest_site, memory_order_relaxed), site, sizeof(site)));
+	}
+
+	fflush(stream);
+}
+
+/**
+ * @fn void print_lock_metrics(FILE* stream)
+ * @brief Prints the profile of every mutex of the registries, in the Prometheus text format
+ * @param stream: stream to print on
+ */
+void print_lock_metrics(FILE* stream) {
+	lock_profile_t* profile;
+	char site[128];
+	int i;
+
+	if (!LOCK_PROFILING)
+		return;
+
+	fprintf(stream, "# HELP pantalla_lock_acquisitions_total Acquisitions of the mutexes\n"
+					"# TYPE pantalla_lock_acquisitions_total counter\n");
+	for (i = 0; i < NB_LOCKS; i++)
+		fprintf(stream, "pantalla_lock_acquisitions_total{mutex=\"%s\"} %lu\n", lock_names[i],
+				atomic_load_explicit(&lock_profiles[i].acquisitions, memory_order_relaxed));
+
+	fprintf(stream, "# HELP pantalla_lock_contended_total Acquisitions of the mutexes that had to wait\n"
+					"# TYPE pantalla_lock_contended_total counter\n");
+	for (i = 0; i < NB_LOCKS; i++)
+		fprintf(stream, "pantalla_lock_contended_total{mutex=\"%s\"} %lu\n", lock_names[i],
+				atomic_load_explicit(&lock_profiles[i].contended, memory_order_relaxed));
+
+	fprintf(stream, "# HELP pantalla_lock_hold_us_total Time the mutexes were held\n"
+					"# TYPE pantalla_lock_hold_us_total counter\n");
+	for (i = 0; i < NB_LOCKS; i++)
+		fprintf(stream, "pantalla_lock_hold_us_total{mutex=\"%s\"} %.1f\n", lock_names[i],
+				atomic_load_explicit(&lock_profiles[i].total_hold, memory_order_relaxed) / 1e3);
+
+	fprintf(stream, "# HELP pantalla_lock_longest_hold_us Longest time the mutexes were held, by call site\n"
+					"# TYPE pantalla_lock_longest_hold_us gauge\n");
+	for (i = 0; i < NB_LOCKS; i++) {
+		profile = &lock_profiles[i];
+		fprintf(stream, "pantalla_lock_longest_hold_us{mutex=\"%s\",site=\"%s\"} %.1f\n", lock_names[i],
+				site_name(atomic_load_explicit(&profile->longest_site, memory_order_relaxed), site, sizeof(site)),
+				atomic_load_explicit(&profile->longest_hold, memory_order_relaxed) / 1e3);
+	}
+}
@@ -0,0 +1,131 @@
+#ifndef PANTALLA_DEPORTIVA_V2_LOCK_PROFILER_H
+#define PANTALLA_DEPORTIVA_V2_LOCK_PROFILER_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "latency.h"
+#include "metrics.h"
+
+/**
+ * @def LOCK_PROFILING
+ * @brief 1 to profile the mutexes of the registries (make LOCK_PROFILING=1, always for the lock benchmark), 0 to lock
+ * them directly
+ */
+#ifndef LOCK_PROFILING
+#define LOCK_PROFILING 0
+#endif
+
+/**
+ * @def lock_registry
+ * @brief Locks a mutex of the registries, profiled with its call site if LOCK_PROFILING is 1
+ * @param mutex: mutex to lock
+ * @param lock: LOCK_PLAYERS, LOCK_COURTS, LOCK_PLAYER_ID or LOCK_COURT_ID
+ */
+/**
+ * @def unlock_registry
+ * @brief Unlocks a mutex locked with lock_registry
+ * @param mutex: mutex to unlock
+ * @param lock: LOCK_PLAYERS, LOCK_COURTS, LOCK_PLAYER_ID or LOCK_COURT_ID
+ */
+#if LOCK_PROFILING
+#define lock_registry(mutex, lock) do { \
+	static const lock_site_t lock_site_ = {__func__, __FILE__, __LINE__}; \
+	profile_lock(mutex, lock, &lock_site_); \
+} while (0)
+#define unlock_registry(mutex, lock) profile_unlock(mutex, lock)
+#else
+#define lock_registry(mutex, lock) pthread_mutex_lock(mutex)
+#define unlock_registry(mutex, lock) pthread_mutex_unlock(mutex)
+#endif
+
+/**
+ * @struct lock_site
+ * @brief Call site locking a mutex
+ * @var function: function locking it
+ * @var file: file of this function
+ * @var line: line it is locked at
+ */
+struct lock_site {
+	const char* function;
+	const char* file;
+	int line;
+};
+
+/**
+ * @typedef lock_site_t
+ * @brief Typedef for lock_site structure
+ */
+typedef struct lock_site lock_site_t;
+
+/**
+ * @struct lock_profile
+ * @brief Profile of a mutex, only written by the thread holding it (atomic only to be read by the reports at any time),
+ * alone on its cache line so that the holders of two mutexes do not share one
+ * @var acquisitions: number of times the mutex was locked
+ * @var contended: number of times it was held by another thread
+ * @var total_wait: time spent waiting for it (ns)
+ * @var total_hold: time it was held (ns)
+ * @var longest_hold: longest time it was held (ns)
+ * @var longest_site: call site that held it the longest
+ * @var held_since: time the current holder locked it at (ns)
+ * @var holder: call site of the current holder
+ */
+struct lock_profile {
+	_Alignas(CACHE_LINE_SIZE) atomic_ulong acquisitions;
+	atomic_ulong contended;
+	atomic_ulong total_wait;
+	atomic_ulong total_hold;
+	atomic_ulong longest_hold;
+	_Atomic(const lock_site_t*) longest_site;
+	long held_since;
+	const lock_site_t* holder;
+};
+
+/**
+ * @typedef lock_profile_t
+ * @brief Typedef for lock_profile structure
+ */
+typedef struct lock_profile lock_profile_t;
+
+/**
+ * @fn const char* lock_name(int lock)
+ * @brief Names a mutex of the registries
+ * @param lock: LOCK_PLAYERS, LOCK_COURTS, LOCK_PLAYER_ID or LOCK_COURT_ID
+ * @return const char*: name ("players_mutex"...)
+ */
+const char* lock_name(int lock);
+
+/**
+ * @fn void profile_lock(pthread_mutex_t* mutex, int lock, const lock_site_t* site)
+ * @brief Locks a mutex, counting the acquisition, whether it was contended and the wait
+ * @param mutex: mutex to lock
+ * @param lock: LOCK_PLAYERS, LOCK_COURTS, LOCK_PLAYER_ID or LOCK_COURT_ID
+ * @param site: call site locking it
+ */
+void profile_lock(pthread_mutex_t* mutex, int lock, const lock_site_t* site);
+
+/**
+ * @fn void profile_unlock(pthread_mutex_t* mutex, int lock)
+ * @brief Unlocks a mutex, recording how long it was held and by which call site
+ * @param mutex: mutex to unlock
+ * @param lock: LOCK_PLAYERS, LOCK_COURTS, LOCK_PLAYER_ID or LOCK_COURT_ID
+ */
+void profile_unlock(pthread_mutex_t* mutex, int lock);
+
+/**
+ * @fn void print_lock_report(FILE* stream)
+ * @brief Prints the profile of every mutex of the registries
+ * @param stream: stream to print on
+ */
+void print_lock_report(FILE* stream);
+
+/**
+ * @fn void print_lock_metrics(FILE* stream)
+ * @brief Prints the profile of every mutex of the registries, in the Prometheus text format
+ * @param stream: stream to print on
+ */
+void print_lock_metrics(FILE* stream);
+
+#endif //PANTALLA_DEPORTIVA_V2_LOCK_PROFILER_H
@@ -0,0 +1,344 @@
+/**
+ * @file matchmaking.c
+ * @brief FIFO queue of the players waiting for a court
+ * @date 2024-05-14
+ */
+
+#include "matchmaking.h"
+#include "snapshot.h"
+
+queue_entry_t* queue = NULL; // FIFO of the players waiting for a court
+pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for the queue and the match statistics
+
+int average_match_duration = DEFAULT_MATCH_DURATION; // Average duration of a match (in seconds)
+int matches_played = 0; // Number of matches taken into account in the average
+
+/**
+ * @fn int estimate_wait(int position)
+ * @brief Estimates the wait (in seconds) for a position in the queue
+ * @param position: position in the queue (starting at 1)
+ * @return int: estimated wait, -1 if no court process is connected
+ * @note queue_mutex must be held
+ */
+int estimate_wait(int position) {
+	int nb_courts = count_connected_courts();
+
+	if (nb_courts == 0)
+		return -1;
+
+	// Each round of matches serves as many entries as there are courts
+	return ((position - 1) / nb_courts + 1) * average_match_duration;
+}
+
+/**
+ * @fn void wake_entry(queue_entry_t* entry)
+ * @brief Wakes up the thread of an entry, waiting for its players to leave
+ * @param entry: entry to wake up
+ */
+void wake_entry(queue_entry_t* entry) {
+	write(entry->wakeup[1], "", 1); // A full pipe already wakes it up
+}
+
+/**
+ * @fn void notify_positions()
+ * @brief Wakes up the threads of the entries whose position has changed, to send it to their players
+ * @note queue_mutex must be held (the sends are made without it: a slow client only delays its own thread)
+ */
+void notify_positions() {
+	queue_entry_t* entry;
+	int position = 1;
+
+	for (entry = queue; entry != NULL; entry = entry->next, position++) {
+		if (entry->notified_position == position)
+			continue;
+
+		entry->notified_position = position;
+		entry->position_changed = 1;
+		wake_entry(entry);
+	}
+}
+
+/**
+ * @fn void send_position(queue_entry_t* entry)
+ * @brief Sends their position and estimated wait to the players of an entry, releasing queue_mutex meanwhile
+ * @param entry: entry of the calling thread
+ * @note queue_mutex must be held
+ */
+void send_position(queue_entry_t* entry) {
+	socket_t* sockets[2];
+	message_t send_msg;
+	buffer_t data;
+	int nb_players = entry->nb_players, i;
+
+	// Copying what is needed under the lock (a solo entry can be completed meanwhile)
+	sprintf(data, "%d:%d", entry->notified_position, estimate_wait(entry->notified_position));
+	for (i = 0; i < nb_players; i++)
+		sockets[i] = entry->players[i].socket;
+	entry->position_changed = 0;
+
+	pthread_mutex_unlock(&queue_mutex);
+
+	// A player who has left is seen by the poll of the thread
+	prepare_message(&send_msg, (char) QUEUED, data);
+	for (i = 0; i < nb_players; i++)
+		timed_try_send(sockets[i], &send_msg);
+
+	pthread_mutex_lock(&queue_mutex);
+}
+
+/**
+ * @fn void dispatch_courts()
+ * @brief Assigns the available courts to the pairs waiting in the queue, in FIFO order
+ * @note queue_mutex must be held
+ */
+void dispatch_courts() {
+	queue_entry_t **entry_ptr = &queue, *entry;
+	court_t* court;
+
+	while (*entry_ptr != NULL) {
+		entry = *entry_ptr;
+
+		// Solo players wait for an opponent before getting a court
+		if (entry->nb_players < 2) {
+			entry_ptr = &entry->next;
+			continue;
+		}
+
+		court = claim_available_court();
+		if (court == NULL)
+			break;
+
+		// Removing the entry from the queue and waking up its thread
+		court->match_start = time(NULL);
+		entry->court = court;
+		*entry_ptr = entry->next;
+		wake_entry(entry);
+	}
+
+	notify_positions();
+}
+
+/**
+ * @fn int player_left(socket_t* socket)
+ * @brief Checks whether a queued player whose socket is readable has left (a queued player has nothing to send, what
+ * they send is discarded)
+ * @param socket: player's socket
+ * @return int: 1 if the player has left, 0 otherwise
+ */
+int player_left(socket_t* socket) {
+	char discarded[MAX_BUFFER];
+	ssize_t read_size;
+
+	read_size = recv(socket->file_descriptor, discarded, sizeof(discarded), MSG_DONTWAIT);
+	return read_size == 0 || (read_size == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+/**
+ * @fn void remove_queued_player(queue_entry_t* entry, int index)
+ * @brief Removes a player who has left from their entry, the other player stays in the queue as a solo player (with
+ * the earlier solo player if there is one, the thread of the entry then returns)
+ * @param entry: entry of the calling thread
+ * @param index: index of the player in the entry
+ * @note queue_mutex must be held
+ */
+void remove_queued_player(queue_entry_t* entry, int index) {
+	queue_entry_t **entry_ptr, **solo_ptr, *solo, *scan;
+
+	log_message(LOG_INFO, "'%s %s' has left the queue", entry->players[index].first_name, entry->players[index].last_name);
+	close(entry->players[index].socket->file_descriptor);
+	free(entry->players[index].socket);
+	count_metric(COUNTER_CONNECTIONS_CLOSED + ROLE_PLAYER, 1);
+
+	if (index == 0)
+		entry->players[0] = entry->players[1];
+	entry->nb_players--;
+	entry->notified_position = 0;
+
+	// A court already assigned goes to the next pair, the other player keeps the first position
+	if (entry->court != NULL) {
+		entry->court->match_start = 0;
+		set_court_available(entry->court);
+		entry->court = NULL;
+		entry->next = queue;
+		queue = entry;
+	}
+
+	// Unlinking the entry, the other player takes its place
+	for (entry_ptr = &queue; *entry_ptr != entry; entry_ptr = &(*entry_ptr)->next);
+	*entry_ptr = entry->next;
+	if (entry->nb_players == 1) {
+		for (solo_ptr = &queue; *solo_ptr != NULL && (*solo_ptr)->nb_players != 1; solo_ptr = &(*solo_ptr)->next);
+
+		if (*solo_ptr == NULL) {
+			entry->next = *entry_ptr;
+			*entry_ptr = entry;
+		}
+		else {
+			// Completing the solo entry (its thread handles the match), at the earlier of both positions
+			solo = *solo_ptr;
+			solo->players[1] = entry->players[0];
+			solo->nb_players = 2;
+			solo->notified_position = 0;
+			entry->nb_players = 0;
+			for (scan = *entry_ptr; scan != NULL && scan != solo; scan = scan->next);
+			if (scan == solo) {
+				*solo_ptr = solo->next;
+				solo->next = *entry_ptr;
+				*entry_ptr = solo;
+			}
+			wake_entry(solo);
+			log_message(LOG_INFO, "'%s %s' will play against '%s %s'",
+						solo->players[1].first_name, solo->players[1].last_name,
+						solo->players[0].first_name, solo->players[0].last_name);
+		}
+	}
+
+	dispatch_courts();
+}
+
+/**
+ * @fn court_t* wait_for_court(player_t players[2], int nb_players)
+ * @brief Enters the matchmaking queue and waits until a court is assigned
+ * @param players: players entering the queue, filled with the players of the match (a player who leaves the queue is
+ * replaced by the next solo player)
+ * @param nb_players: 1 for a solo player, 2 for an agreed pair
+ * @return court_t*: court assigned, NULL if the solo player has joined an earlier solo player (the thread of this
+ * earlier player handles the match), or if all the players have left
+ */
+court_t* wait_for_court(player_t players[2], int nb_players) {
+	queue_entry_t entry, **last;
+	struct pollfd fds[3];
+	char drained[16];
+	int nb_fds, nb_ready, timeout, i;
+
+	pthread_mutex_lock(&queue_mutex);
+
+	// A solo player completes the first solo entry, which keeps its position
+	if (nb_players == 1) {
+		for (last = &queue; *last != NULL; last = &(*last)->next) {
+			if ((*last)->nb_players == 1) {
+				(*last)->players[1] = players[0];
+				(*last)->nb_players = 2;
+				(*last)->notified_position = 0;
+				(*last)->position_changed = 0;
+				log_message(LOG_INFO, "'%s %s' will play against '%s %s'",
+								players[0].first_name, players[0].last_name,
+					   (*last)->players[0].first_name, (*last)->players[0].last_name);
+
+				dispatch_courts();
+				pthread_mutex_unlock(&queue_mutex);
+				return NULL;
+			}
+		}
+	}
+
+	// Appending the entry at the end of the queue
+	entry.players[0] = players[0];
+	if (nb_players == 2)
+		entry.players[1] = players[1];
+	entry.nb_players = nb_players;
+	entry.court = NULL;
+	entry.notified_position = 0;
+	entry.position_changed = 0;
+	entry.next = NULL;
+	pipe(entry.wakeup);
+	fcntl(entry.wakeup[0], F_SETFL, O_NONBLOCK);
+	fcntl(entry.wakeup[1], F_SETFL, O_NONBLOCK);
+
+	for (last = &queue; *last != NULL; last = &(*last)->next);
+	*last = &entry;
+
+	// Taking a free court right away if there is one
+	dispatch_courts();
+
+	// Sending the positions as they change and watching the players leave, until a court is assigned
+	while (1) {
+		if (entry.court == NULL && entry.position_changed) {
+			send_position(&entry);
+			continue;
+		}
+
+		// Once a court is assigned, the sockets are checked once more without waiting (a dead player cannot have it)
+		nb_fds = entry.nb_players;
+		for (i = 0; i < nb_fds; i++) {
+			fds[i].fd = entry.players[i].socket->file_descriptor;
+			fds[i].events = POLLIN;
+		}
+		fds[nb_fds].fd = entry.wakeup[0];
+		fds[nb_fds].events = POLLIN;
+		timeout = entry.court == NULL ? -1 : 0;
+
+		pthread_mutex_unlock(&queue_mutex);
+		nb_ready = poll(fds, nb_fds + 1, timeout);
+		while (read(entry.wakeup[0], drained, sizeof(drained)) > 0);
+		pthread_mutex_lock(&queue_mutex);
+
+		// The second player first: the first one is replaced by the second one when they leave
+		for (i = nb_fds - 1; i >= 0 && nb_ready > 0; i--) {
+			if (fds[i].revents != 0 && i < entry.nb_players && entry.players[i].socket->file_descriptor == fds[i].fd
+				&& player_left(entry.players[i].socket))
+				remove_queued_player(&entry, i);
+		}
+
+		if (entry.nb_players == 0 || (entry.court != NULL && timeout == 0))
+			break;
+	}
+
+	pthread_mutex_unlock(&queue_mutex);
+	close(entry.wakeup[0]);
+	close(entry.wakeup[1]);
+
+	players[0] = entry.players[0];
+	players[1] = entry.players[1];
+	return entry.nb_players == 0 ? NULL : entry.court;
+}
+
+/**
+ * @fn void release_court(court_t* court)
+ * @brief Makes a court available again and gives it to the first pair waiting in the queue
+ * @param court: court whose match is over (or newly registered court)
+ */
+void release_court(court_t* court) {
+	int duration;
+
+	pthread_mutex_lock(&queue_mutex);
+
+	// Updating the average match duration (moving average once the first match is known)
+	if (court->match_start != 0) {
+		duration = (int) (time(NULL) - court->match_start);
+		if (matches_played == 0)
+			average_match_duration = duration;
+		else
+			average_match_duration = (3 * average_match_duration + duration) / 4;
+		matches_played++;
+		court->match_start = 0;
+	}
+
+	set_court_available(court);
+	dispatch_courts();
+
+	pthread_mutex_unlock(&queue_mutex);
+
+	// The court is kept available (or reserved by the next pair, which snapshots it again with its players)
+	snapshot_court(court);
+}
+
+/**
+ * @fn void queue_depth(int* entries, int* players)
+ * @brief Counts the entries of the matchmaking queue and the players in them
+ * @param entries: filled with the number of entries (pairs and solo players)
+ * @param players: filled with the number of players
+ */
+void queue_depth(int* entries, int* players) {
+	queue_entry_t* entry;
+
+	*entries = 0;
+	*players = 0;
+
+	pthread_mutex_lock(&queue_mutex);
+	for (entry = queue; entry != NULL; entry = entry->next) {
+		(*entries)++;
+		*players += entry->nb_players;
+	}
+	pthread_mutex_unlock(&queue_mutex);
+}
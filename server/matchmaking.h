@@ -0,0 +1,74 @@
+#ifndef PANTALLA_DEPORTIVA_V2_MATCHMAKING_H
+#define PANTALLA_DEPORTIVA_V2_MATCHMAKING_H
+
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "player_functions.h"
+#include "court_functions.h"
+
+/**
+ * @def DEFAULT_MATCH_DURATION
+ * @brief Match duration (in seconds) used for the wait estimation until a match has been played
+ */
+#define DEFAULT_MATCH_DURATION 1800
+
+/**
+ * @struct queue_entry
+ * @brief Structure of an entry in the matchmaking queue
+ * @var players: players of the entry (only the first one is set for a solo player)
+ * @var nb_players: 1 for a solo player waiting for an opponent, 2 for a pair
+ * @var court: court assigned to the entry, NULL while waiting
+ * @var notified_position: last position given to the players (0 if none)
+ * @var position_changed: 1 while the position has to be sent to the players (by the thread of the entry)
+ * @var wakeup: pipe written when a court is assigned to the entry, or when its position changes (the thread of the
+ * entry polls it with the sockets of its players, to see them leave)
+ * @var next: next entry in the queue
+ */
+struct queue_entry {
+	player_t players[2];
+	int nb_players;
+	court_t* court;
+	int notified_position;
+	int position_changed;
+	int wakeup[2];
+	struct queue_entry* next;
+};
+
+/**
+ * @typedef queue_entry_t
+ * @brief Typedef for queue_entry structure
+ */
+typedef struct queue_entry queue_entry_t;
+
+/**
+ * @fn court_t* wait_for_court(player_t players[2], int nb_players)
+ * @brief Enters the matchmaking queue and waits until a court is assigned
+ * @param players: players entering the queue, filled with the players of the match (a player who leaves the queue is
+ * replaced by the next solo player)
+ * @param nb_players: 1 for a solo player, 2 for an agreed pair
+ * @return court_t*: court assigned, NULL if the solo player has joined an earlier solo player (the thread of this
+ * earlier player handles the match), or if all the players have left
+ */
+court_t* wait_for_court(player_t players[2], int nb_players);
+
+/**
+ * @fn void release_court(court_t* court)
+ * @brief Makes a court available again and gives it to the first pair waiting in the queue
+ * @param court: court whose match is over (or newly registered court)
+ */
+void release_court(court_t* court);
+
+/**
+ * @fn void queue_depth(int* entries, int* players)
+ * @brief Counts the entries of the matchmaking queue and the players in them
+ * @param entries: filled with the number of entries (pairs and solo players)
+ * @param players: filled with the number of players
+ */
+void queue_depth(int* entries, int* players);
+
+#endif //PANTALLA_DEPORTIVA_V2_MATCHMAKING_H
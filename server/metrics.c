@@ -0,0 +1,290 @@
+/**
+ * @file metrics.c
+ * @brief Per-thread counters of the server and local endpoint serving a snapshot of its metrics
+ * @date 2024-06-04
+ */
+
+#include <poll.h>
+
+#include "metrics.h"
+#include "latency.h"
+#include "lock_profiler.h"
+#include "player_functions.h"
+#include "court_functions.h"
+#include "matchmaking.h"
+#include "history.h"
+
+const char* role_names[NB_ROLES] = {"player", "court", "spectator"};
+
+thread_counters_t* counters = NULL; // Counters of the threads alive
+unsigned long retired_counters[NB_COUNTERS]; // Counts of the threads that have ended
+pthread_mutex_t counters_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for the list of counters and the retired counts
+
+__thread thread_counters_t* own_counters = NULL; // Counters of the calling thread, created on its first count
+pthread_key_t counters_key; // Retires the counters of a thread when it ends
+pthread_once_t counters_key_once = PTHREAD_ONCE_INIT;
+
+double rates[NB_COUNTERS]; // Increase of each counter per second, over the last RATE_INTERVAL (endpoint thread only)
+
+/**
+ * @fn void retire_counters(void* thread_counters)
+ * @brief Moves the counts of a thread that ends to the retired ones, and forgets its counters
+ * @param thread_counters: counters of the thread
+ */
+void retire_counters(void* thread_counters) {
+	thread_counters_t* c = (thread_counters_t*) thread_counters;
+	thread_counters_t** node_ptr;
+	int i;
+
+	pthread_mutex_lock(&counters_mutex);
+
+	for (i = 0; i < NB_COUNTERS; i++)
+		retired_counters[i] += atomic_load_explicit(&c->values[i], memory_order_relaxed);
+
+	for (node_ptr = &counters; *node_ptr != NULL; node_ptr = &(*node_ptr)->next) {
+		if (*node_ptr == c) {
+			*node_ptr = c->next;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&counters_mutex);
+
+	free(c);
+}
+
+/**
+ * @fn void create_counters_key()
+ * @brief Creates the key retiring the counters of the threads that end
+ */
+void create_counters_key() {
+	pthread_key_create(&counters_key, retire_counters);
+}
+
+/**
+ * @fn void count_metric(int counter, unsigned long value)
+ * @brief Adds to a counter of the calling thread
+ * @param counter: counter (COUNTER_MESSAGES_RECEIVED...)
+ * @param value: value to add
+ */
+void count_metric(int counter, unsigned long value) {
+	thread_counters_t* c = own_counters;
+
+	// Registering the counters of the thread on its first count (aligned, so they share no line with another thread)
+	if (c == NULL) {
+		c = (thread_counters_t*) aligned_alloc(CACHE_LINE_SIZE, sizeof(thread_counters_t));
+		memset(c, 0, sizeof(thread_counters_t));
+
+		pthread_once(&counters_key_once, create_counters_key);
+		pthread_setspecific(counters_key, c);
+
+		pthread_mutex_lock(&counters_mutex);
+		c->next = counters;
+		counters = c;
+		pthread_mutex_unlock(&counters_mutex);
+
+		own_counters = c;
+	}
+
+	// Only this thread writes its counters: no atomic read-modify-write
+	atomic_store_explicit(&c->values[counter], atomic_load_explicit(&c->values[counter], memory_order_relaxed) + value,
+						  memory_order_relaxed);
+}
+
+/**
+ * @fn unsigned long sum_counter(int counter)
+ * @brief Sums a counter over all the threads (alive or not), without stopping them
+ * @param counter: counter
+ * @return unsigned long: sum
+ */
+unsigned long sum_counter(int counter) {
+	thread_counters_t* c;
+	unsigned long sum;
+
+	// Only the threads starting or ending wait for the sum, the others keep counting
+	pthread_mutex_lock(&counters_mutex);
+
+	sum = retired_counters[counter];
+	for (c = counters; c != NULL; c = c->next)
+		sum += atomic_load_explicit(&c->values[counter], memory_order_relaxed);
+
+	pthread_mutex_unlock(&counters_mutex);
+
+	return sum;
+}
+
+/**
+ * @fn void print_metric_header(FILE* stream, char* name, char* type, char* help)
+ * @brief Prints the HELP and TYPE lines of a metric
+ * @param stream: stream to print on
+ * @param name: name of the metric
+ * @param type: counter, gauge or summary
+ * @param help: description of the metric
+ */
+void print_metric_header(FILE* stream, char* name, char* type, char* help) {
+	fprintf(stream, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * @fn void print_metrics(FILE* stream)
+ * @brief Prints a snapshot of the metrics of the server, in the Prometheus text format
+ * @param stream: stream to print on
+ */
+void print_metrics(FILE* stream) {
+	unsigned long opened, closed;
+	int entries, waiting_players, i;
+
+	// Connections
+	print_metric_header(stream, "pantalla_connections", "gauge", "Open connections by role");
+	for (i = 0; i < NB_ROLES; i++) {
+		opened = sum_counter(COUNTER_CONNECTIONS_OPENED + i);
+		closed = sum_counter(COUNTER_CONNECTIONS_CLOSED + i);
+		fprintf(stream, "pantalla_connections{role=\"%s\"} %lu\n", role_names[i], opened > closed ? opened - closed : 0);
+	}
+	print_metric_header(stream, "pantalla_connections_total", "counter", "Connections authenticated by role");
+	for (i = 0; i < NB_ROLES; i++)
+		fprintf(stream, "pantalla_connections_total{role=\"%s\"} %lu\n", role_names[i],
+				sum_counter(COUNTER_CONNECTIONS_OPENED + i));
+
+	// Traffic
+	print_metric_header(stream, "pantalla_messages_received_total", "counter", "Requests received");
+	fprintf(stream, "pantalla_messages_received_total %lu\n", sum_counter(COUNTER_MESSAGES_RECEIVED));
+	print_metric_header(stream, "pantalla_messages_sent_total", "counter", "Messages sent (answers and scores)");
+	fprintf(stream, "pantalla_messages_sent_total %lu\n", sum_counter(COUNTER_MESSAGES_SENT));
+	print_metric_header(stream, "pantalla_bytes_received_total", "counter", "Bytes received");
+	fprintf(stream, "pantalla_bytes_received_total %lu\n", sum_counter(COUNTER_BYTES_RECEIVED));
+	print_metric_header(stream, "pantalla_bytes_sent_total", "counter", "Bytes sent");
+	fprintf(stream, "pantalla_bytes_sent_total %lu\n", sum_counter(COUNTER_BYTES_SENT));
+
+	print_metric_header(stream, "pantalla_messages_received_per_second", "gauge", "Requests received per second");
+	fprintf(stream, "pantalla_messages_received_per_second %.1f\n", rates[COUNTER_MESSAGES_RECEIVED]);
+	print_metric_header(stream, "pantalla_messages_sent_per_second", "gauge", "Messages sent per second");
+	fprintf(stream, "pantalla_messages_sent_per_second %.1f\n", rates[COUNTER_MESSAGES_SENT]);
+	print_metric_header(stream, "pantalla_bytes_received_per_second", "gauge", "Bytes received per second");
+	fprintf(stream, "pantalla_bytes_received_per_second %.1f\n", rates[COUNTER_BYTES_RECEIVED]);
+	print_metric_header(stream, "pantalla_bytes_sent_per_second", "gauge", "Bytes sent per second");
+	fprintf(stream, "pantalla_bytes_sent_per_second %.1f\n", rates[COUNTER_BYTES_SENT]);
+
+	// Players and matchmaking queue
+	print_metric_header(stream, "pantalla_players_registered", "gauge", "Players waiting for an invitation");
+	fprintf(stream, "pantalla_players_registered %d\n", count_players());
+
+	queue_depth(&entries, &waiting_players);
+	print_metric_header(stream, "pantalla_queue_entries", "gauge", "Entries of the matchmaking queue (pairs and solo players)");
+	fprintf(stream, "pantalla_queue_entries %d\n", entries);
+	print_metric_header(stream, "pantalla_queue_players", "gauge", "Players waiting in the matchmaking queue");
+	fprintf(stream, "pantalla_queue_players %d\n", waiting_players);
+
+	// Courts and their spectators
+	print_court_metrics(stream);
+
+	// Latencies, then the profile of the mutexes
+	print_latency_metrics(stream);
+	print_lock_metrics(stream);
+}
+
+/**
+ * @fn void update_rates(unsigned long previous[NB_COUNTERS], long* previous_time)
+ * @brief Computes the rates per second of the counters since the previous sample
+ * @param previous: counters at the previous sample, updated
+ * @param previous_time: time of the previous sample (ns), updated
+ */
+void update_rates(unsigned long previous[NB_COUNTERS], long* previous_time) {
+	long now = monotonic_ns();
+	unsigned long value;
+	int i;
+
+	for (i = 0; i < NB_COUNTERS; i++) {
+		value = sum_counter(i);
+		if (*previous_time != 0)
+			rates[i] = (value - previous[i]) * 1e9 / (now - *previous_time);
+		previous[i] = value;
+	}
+
+	*previous_time = now;
+}
+
+/**
+ * @fn void serve_metrics(int file_descriptor)
+ * @brief Sends a snapshot to a client of the endpoint, as an HTTP response if it has sent an HTTP request
+ * @param file_descriptor: client's socket
+ */
+void serve_metrics(int file_descriptor) {
+	struct pollfd request = {file_descriptor, POLLIN, 0};
+	char *body = NULL, header[128], line[256];
+	size_t body_size = 0;
+	ssize_t read_size = 0;
+	FILE* stream;
+
+	// The request is only read to tell HTTP (Prometheus, curl) from a bare connection (nc), and the history from the metrics
+	if (poll(&request, 1, SCRAPE_TIMEOUT) == 1)
+		read_size = recv(file_descriptor, line, sizeof(line) - 1, 0);
+	line[read_size > 0 ? read_size : 0] = '\0';
+
+	stream = open_memstream(&body, &body_size);
+	if (strncmp(line, "GET /history", 12) == 0)
+		print_history_query(stream, strchr(line, '?') == NULL ? NULL : strchr(line, '?') + 1);
+	else
+		print_metrics(stream);
+	fclose(stream);
+
+	if (read_size > 3 && strncmp(line, "GET", 3) == 0) {
+		sprintf(header, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+				body_size);
+		send(file_descriptor, header, strlen(header), MSG_NOSIGNAL);
+	}
+	send(file_descriptor, body, body_size, MSG_NOSIGNAL);
+
+	free(body);
+}
+
+/**
+ * @fn void metrics_thread(void* socket)
+ * @brief Samples the counters for the rates, and serves the snapshots, one client at a time
+ * @param socket: listen socket of the endpoint
+ */
+void metrics_thread(void* socket) {
+	socket_t* listen_socket = (socket_t*) socket;
+	struct pollfd listener = {listen_socket->file_descriptor, POLLIN, 0};
+	unsigned long previous[NB_COUNTERS] = {0};
+	long previous_time = 0, timeout;
+	int ready, client;
+
+	update_rates(previous, &previous_time);
+
+	while (1) {
+		timeout = RATE_INTERVAL - (monotonic_ns() - previous_time) / 1000000;
+		ready = timeout <= 0 ? 0 : poll(&listener, 1, (int) timeout);
+		if (ready == 0) {
+			update_rates(previous, &previous_time);
+			continue;
+		}
+		if (ready == -1)
+			continue; // Interrupted by a signal
+
+		// A client that has given up before being accepted is no reason to stop the server
+		client = accept(listen_socket->file_descriptor, NULL, NULL);
+		if (client == -1)
+			continue;
+		serve_metrics(client);
+		close(client);
+	}
+}
+
+/**
+ * @fn void start_metrics_endpoint(int port)
+ * @brief Starts the thread serving the metrics on a local port (each connection gets a snapshot, HTTP or not), and the
+ * history of the matches to the requests of /history
+ * @param port: TCP port on 127.0.0.1
+ */
+void start_metrics_endpoint(int port) {
+	socket_t* listen_socket = (socket_t*) malloc(sizeof(socket_t));
+	pthread_t thread;
+
+	// Local only: the monitoring agent runs on the same host
+	*listen_socket = create_listen_socket("127.0.0.1", port);
+	log_message(LOG_INFO, "Metrics on 127.0.0.1:%d", ntohs(((struct sockaddr_in*) &listen_socket->local_address)->sin_port));
+
+	pthread_create(&thread, NULL, (void*) metrics_thread, (void*) listen_socket);
+	pthread_detach(thread);
+}
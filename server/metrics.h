@@ -0,0 +1,132 @@
+#ifndef PANTALLA_DEPORTIVA_V2_METRICS_H
+#define PANTALLA_DEPORTIVA_V2_METRICS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * @def CACHE_LINE_SIZE
+ * @brief Size of a cache line: the counters of two threads are never on the same line
+ */
+#define CACHE_LINE_SIZE 64
+
+/**
+ * @def ROLE_PLAYER
+ * @brief Connection of a player (inviting, invited or in the queue)
+ */
+#define ROLE_PLAYER 0
+/**
+ * @def ROLE_COURT
+ * @brief Connection of a court process
+ */
+#define ROLE_COURT 1
+/**
+ * @def ROLE_SPECTATOR
+ * @brief Connection of a spectator
+ */
+#define ROLE_SPECTATOR 2
+/**
+ * @def NB_ROLES
+ * @brief Number of roles of the connections
+ */
+#define NB_ROLES 3
+
+/**
+ * @def COUNTER_MESSAGES_RECEIVED
+ * @brief Requests received by the server
+ */
+#define COUNTER_MESSAGES_RECEIVED 0
+/**
+ * @def COUNTER_BYTES_RECEIVED
+ * @brief Bytes of the requests received
+ */
+#define COUNTER_BYTES_RECEIVED 1
+/**
+ * @def COUNTER_MESSAGES_SENT
+ * @brief Messages sent by the server (answers and scores)
+ */
+#define COUNTER_MESSAGES_SENT 2
+/**
+ * @def COUNTER_BYTES_SENT
+ * @brief Bytes of the messages sent
+ */
+#define COUNTER_BYTES_SENT 3
+/**
+ * @def COUNTER_CONNECTIONS_OPENED
+ * @brief Connections authenticated, followed by one counter per role
+ */
+#define COUNTER_CONNECTIONS_OPENED 4
+/**
+ * @def COUNTER_CONNECTIONS_CLOSED
+ * @brief Connections closed, followed by one counter per role
+ */
+#define COUNTER_CONNECTIONS_CLOSED (COUNTER_CONNECTIONS_OPENED + NB_ROLES)
+/**
+ * @def NB_COUNTERS
+ * @brief Number of counters of a thread
+ */
+#define NB_COUNTERS (COUNTER_CONNECTIONS_CLOSED + NB_ROLES)
+
+/**
+ * @def RATE_INTERVAL
+ * @brief Time between two samples of the counters giving the rates per second (ms)
+ */
+#define RATE_INTERVAL 1000
+
+/**
+ * @def SCRAPE_TIMEOUT
+ * @brief Time given to a client of the endpoint to send its request, before the metrics are sent anyway (ms)
+ */
+#define SCRAPE_TIMEOUT 100
+
+/**
+ * @struct thread_counters
+ * @brief Counters of a thread, alone on their cache lines so that incrementing them never invalidates another core
+ * @var values: counters (COUNTER_MESSAGES_RECEIVED...)
+ * @var next: next thread in the list
+ */
+struct thread_counters {
+	_Alignas(CACHE_LINE_SIZE) atomic_ulong values[NB_COUNTERS];
+	_Alignas(CACHE_LINE_SIZE) struct thread_counters* next;
+};
+
+/**
+ * @typedef thread_counters_t
+ * @brief Typedef for thread_counters structure
+ */
+typedef struct thread_counters thread_counters_t;
+
+/**
+ * @fn void count_metric(int counter, unsigned long value)
+ * @brief Adds to a counter of the calling thread
+ * @param counter: counter (COUNTER_MESSAGES_RECEIVED...)
+ * @param value: value to add
+ */
+void count_metric(int counter, unsigned long value);
+
+/**
+ * @fn unsigned long sum_counter(int counter)
+ * @brief Sums a counter over all the threads (alive or not), without stopping them
+ * @param counter: counter
+ * @return unsigned long: sum
+ */
+unsigned long sum_counter(int counter);
+
+/**
+ * @fn void print_metrics(FILE* stream)
+ * @brief Prints a snapshot of the metrics of the server, in the Prometheus text format
+ * @param stream: stream to print on
+ */
+void print_metrics(FILE* stream);
+
+/**
+ * @fn void start_metrics_endpoint(int port)
+ * @brief Starts the thread serving the metrics on a local port (each connection gets a snapshot, HTTP or not), and the
+ * history of the matches to the requests of /history
+ * @param port: TCP port on 127.0.0.1
+ */
+void start_metrics_endpoint(int port);
+
+#endif //PANTALLA_DEPORTIVA_V2_METRICS_H
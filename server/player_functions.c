@@ -6,6 +6,7 @@
 
 #include "player_functions.h"
 #include "court_functions.h"
+#include "snapshot.h"
 
 player_node_t* players = NULL; // Global list of players
 pthread_mutex_t players_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for the global list of players
@@ -19,14 +20,16 @@ pthread_mutex_t id_counter_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for the g
  * @param player: player to add (structure)
  */
 void add_player(player_t player) {
-	pthread_mutex_lock(&players_mutex);
+	lock_registry(&players_mutex, LOCK_PLAYERS);
 
 	player_node_t* new_node = (player_node_t*) malloc(sizeof(player_node_t));
 	new_node->player = player;
 	new_node->next = players;
 	players = new_node;
 
-	pthread_mutex_unlock(&players_mutex);
+	unlock_registry(&players_mutex, LOCK_PLAYERS);
+
+	snapshot_waiting_player(&player);
 }
 
 /**
@@ -35,7 +38,7 @@ void add_player(player_t player) {
  * @param id: player's id
  */
 void remove_player(int id) {
-	pthread_mutex_lock(&players_mutex);
+	lock_registry(&players_mutex, LOCK_PLAYERS);
 
 	player_node_t* current = players;
 	player_node_t* prev = NULL;
@@ -53,7 +56,38 @@ void remove_player(int id) {
 		current = current->next;
 	}
 
-	pthread_mutex_unlock(&players_mutex);
+	unlock_registry(&players_mutex, LOCK_PLAYERS);
+
+	forget_waiting_player(id);
+}
+
+/**
+ * @fn void continue_player_ids(int last_id)
+ * @brief Makes the next players' ids follow an id already given (by a previous run of the server)
+ * @param last_id: id already given
+ */
+void continue_player_ids(int last_id) {
+	lock_registry(&id_counter_mutex, LOCK_PLAYER_ID);
+	if (player_id_counter <= last_id)
+		player_id_counter = last_id + 1;
+	unlock_registry(&id_counter_mutex, LOCK_PLAYER_ID);
+}
+
+/**
+ * @fn int count_players()
+ * @brief Counts the players waiting for an invitation
+ * @return int: number of players
+ */
+int count_players() {
+	player_node_t* current;
+	int count = 0;
+
+	lock_registry(&players_mutex, LOCK_PLAYERS);
+	for (current = players; current != NULL; current = current->next)
+		count++;
+	unlock_registry(&players_mutex, LOCK_PLAYERS);
+
+	return count;
 }
 
 /**
@@ -75,8 +109,9 @@ void invited_player(socket_t* client_socket, char* data) {
 	token = strtok_r(data, ":", &save_ptr);
 	if (token == NULL) {
 		prepare_message(&send_msg, (char) NOK, "");
-		send_message(client_socket, &send_msg, serialize_message);
+		timed_send(client_socket, &send_msg);
 		close(client_socket->file_descriptor);
+		count_metric(COUNTER_CONNECTIONS_CLOSED + ROLE_PLAYER, 1);
 		return;
 	}
 	strcpy(player.last_name, token);
@@ -85,8 +120,9 @@ void invited_player(socket_t* client_socket, char* data) {
 	token = strtok_r(NULL, ":", &save_ptr);
 	if (token == NULL) {
 		prepare_message(&send_msg, (char) NOK, "");
-		send_message(client_socket, &send_msg, serialize_message);
+		timed_send(client_socket, &send_msg);
 		close(client_socket->file_descriptor);
+		count_metric(COUNTER_CONNECTIONS_CLOSED + ROLE_PLAYER, 1);
 		return;
 	}
 	strcpy(player.first_name, token);
@@ -94,26 +130,29 @@ void invited_player(socket_t* client_socket, char* data) {
 	// Setting the player's socket
 	player.socket = client_socket;
 
-	// Creating the player's id
-	pthread_mutex_lock(&id_counter_mutex);
-	player.id = player_id_counter++;
-	pthread_mutex_unlock(&id_counter_mutex);
+	// Creating the player's id (the one they had if they were waiting before a restart)
+	player.id = returning_player_id(player.first_name, player.last_name);
+	if (player.id == 0) {
+		lock_registry(&id_counter_mutex, LOCK_PLAYER_ID);
+		player.id = player_id_counter++;
+		snapshot_player_id(player.id);
+		unlock_registry(&id_counter_mutex, LOCK_PLAYER_ID);
+	}
 
 	// Adding client to the list of available players
 	add_player(player);
-	printf("'%s %s' (%d) has been added to the list of available players\n",
-		   player.first_name, player.last_name, player.id);
+	log_message(LOG_INFO, "'%s %s' (%d) has been added to the list of available players",
+				player.first_name, player.last_name, player.id);
 
 	// Answer OK to the client
 	prepare_message(&send_msg, (char) OK, "");
-	send_message(client_socket, &send_msg, serialize_message);
-
-	sleep(1); // Mandatory sleep to prevent an issue when sending two messages in a row
+	timed_send(client_socket, &send_msg);
 
 	// Giving the player its id
 	sprintf(id_str, "%d", player.id);
 	prepare_message(&send_msg, (char) INFO_PLAYER, id_str);
-	send_message(client_socket, &send_msg, serialize_message);
+	timed_send(client_socket, &send_msg);
+	end_request();
 }
 
 /**
@@ -136,7 +175,7 @@ int invite_player(socket_t host_socket, int id, player_t* host, player_t* partne
 			// Sending the invitation
 			sprintf(data, "%s:%s", host->last_name, host->first_name);
 			prepare_message(&send_msg, (char) INVITE, data);
-			send_message(current->player.socket, &send_msg, serialize_message);
+			timed_send(current->player.socket, &send_msg);
 			break;
 		}
 		current = current->next;
@@ -144,7 +183,7 @@ int invite_player(socket_t host_socket, int id, player_t* host, player_t* partne
 
 	if (current == NULL) {
 		prepare_message(&send_msg, (char) NOK, "");
-		send_message(&host_socket, &send_msg, serialize_message);
+		timed_send(&host_socket, &send_msg);
 		return 0;
 	}
 
@@ -152,7 +191,7 @@ int invite_player(socket_t host_socket, int id, player_t* host, player_t* partne
 	receive_message(current->player.socket, &received_msg, deserialize_message);
 	if (received_msg.code != (char) OK) {
 		prepare_message(&send_msg, (char) NOK, "");
-		send_message(&host_socket, &send_msg, serialize_message);
+		timed_send(&host_socket, &send_msg);
 		return 0;
 	}
 
@@ -167,7 +206,7 @@ int invite_player(socket_t host_socket, int id, player_t* host, player_t* partne
 
 	// Answering OK to the host
 	prepare_message(&send_msg, (char) OK, "");
-	send_message(&host_socket, &send_msg, serialize_message);
+	timed_send(&host_socket, &send_msg);
 
 	return 1;
 }
@@ -195,7 +234,7 @@ void list_players(socket_t* host_socket) {
 
 	// Sending the list of players
 	prepare_message(&send_msg, (char) LIST_PLAYERS, data);
-	send_message(host_socket, &send_msg, serialize_message);
+	timed_send(host_socket, &send_msg);
 }
 
 /**
@@ -207,7 +246,7 @@ void list_players(socket_t* host_socket) {
 void host_player(socket_t* client_socket, char* data) {
 	char *save_ptr, *token;
 	message_t send_msg, received_msg;
-	player_t host, partner_player;
+	player_t host, match_players[2];
 	int partner_found = 0;
 
 	// Skipping the auth code
@@ -217,8 +256,9 @@ void host_player(socket_t* client_socket, char* data) {
 	token = strtok_r(data, ":", &save_ptr);
 	if (token == NULL) {
 		prepare_message(&send_msg, (char) NOK, "");
-		send_message(client_socket, &send_msg, serialize_message);
+		timed_send(client_socket, &send_msg);
 		close(client_socket->file_descriptor);
+		count_metric(COUNTER_CONNECTIONS_CLOSED + ROLE_PLAYER, 1);
 		return;
 	}
 	strcpy(host.last_name, token);
@@ -227,8 +267,9 @@ void host_player(socket_t* client_socket, char* data) {
 	token = strtok_r(NULL, ":", &save_ptr);
 	if (token == NULL) {
 		prepare_message(&send_msg, (char) NOK, "");
-		send_message(client_socket, &send_msg, serialize_message);
+		timed_send(client_socket, &send_msg);
 		close(client_socket->file_descriptor);
+		count_metric(COUNTER_CONNECTIONS_CLOSED + ROLE_PLAYER, 1);
 		return;
 	}
 	strcpy(host.first_name, token);
@@ -237,27 +278,41 @@ void host_player(socket_t* client_socket, char* data) {
 	host.socket = client_socket;
 
 	// Creating the player's id
-	pthread_mutex_lock(&id_counter_mutex);
+	lock_registry(&id_counter_mutex, LOCK_PLAYER_ID);
 	host.id = player_id_counter++;
-	pthread_mutex_unlock(&id_counter_mutex);
+	snapshot_player_id(host.id);
+	unlock_registry(&id_counter_mutex, LOCK_PLAYER_ID);
 
 	// Answer OK to the client
 	prepare_message(&send_msg, (char) OK, "");
-	send_message(client_socket, &send_msg, serialize_message);
+	timed_send(client_socket, &send_msg);
+	end_request();
 
 	// Receiving and handling its requests
 	do {
-		receive_message(client_socket, &received_msg, deserialize_message);
+		receive_request(client_socket, &received_msg);
 
 		switch (received_msg.code) {
 			case PLAY_WITH:
 				// Inviting a player
-				if (invite_player(*client_socket, atoi(received_msg.data), &host, &partner_player)) {
+				if (invite_player(*client_socket, atoi(received_msg.data), &host, &match_players[1])) {
+					end_request(); // The wait for a court is not part of the request
 					partner_found = 1;
-					reserve_court(host, partner_player);
+					match_players[0] = host;
+					reserve_court(match_players, 2);
 				}
 				break;
 
+			case QUEUE:
+				// Joining the matchmaking queue, the opponent is the next solo player
+				prepare_message(&send_msg, (char) OK, "");
+				timed_send(client_socket, &send_msg);
+				end_request();
+				partner_found = 1;
+				match_players[0] = host;
+				reserve_court(match_players, 1);
+				break;
+
 			case ASK_PLAYERS:
 				// Sending a list of available players
 				list_players(client_socket);
@@ -265,8 +320,9 @@ void host_player(socket_t* client_socket, char* data) {
 
 			default:
 				prepare_message(&send_msg, (char) NOK, "");
-				send_message(client_socket, &send_msg, serialize_message);
+				timed_send(client_socket, &send_msg);
 				break;
 		}
+		end_request();
 	} while (!partner_found);
 }
\ No newline at end of file
@@ -40,6 +40,34 @@ struct player_node {
  */
 typedef struct player_node player_node_t;
 
+/**
+ * @fn void add_player(player_t player)
+ * @brief Adds a player to the list of available players
+ * @param player: player to add (structure)
+ */
+void add_player(player_t player);
+
+/**
+ * @fn void remove_player(int id)
+ * @brief Removes a player from the list of available players (if they are invited)
+ * @param id: player's id
+ */
+void remove_player(int id);
+
+/**
+ * @fn void continue_player_ids(int last_id)
+ * @brief Makes the next players' ids follow an id already given (by a previous run of the server)
+ * @param last_id: id already given
+ */
+void continue_player_ids(int last_id);
+
+/**
+ * @fn int count_players()
+ * @brief Counts the players waiting for an invitation
+ * @return int: number of players
+ */
+int count_players();
+
 /**
  * @fn void invited_player(socket_t* client_socket, buffer_t ip, int port)
  * @brief Function to handle an invited player
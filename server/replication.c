@@ -0,0 +1,351 @@
+/**
+ * @file replication.c
+ * @brief Streaming of the registries from the primary server to a standby, which takes over when the primary is lost
+ * @date 2024-06-10
+ */
+
+#include "replication.h"
+
+/**
+ * @fn int send_frame(int file_descriptor, message_t* message)
+ * @brief Sends a message without exiting (nor being killed by SIGPIPE) if the connection is lost
+ * @param file_descriptor: socket of the other server
+ * @param message: message to send
+ * @return int: 0 if sent, -1 if the connection is lost
+ */
+static int send_frame(int file_descriptor, message_t* message) {
+	buffer_t serialized;
+	size_t size, offset = 0;
+	ssize_t write_size;
+
+	serialize_message(message, serialized);
+	size = strlen(serialized) + 1;
+
+	while (offset < size) {
+		write_size = send(file_descriptor, serialized + offset, size - offset, MSG_NOSIGNAL);
+		if (write_size == -1)
+			return -1;
+		offset += write_size;
+	}
+
+	return 0;
+}
+
+/**
+ * @fn void to_hex(const void* bytes, size_t size, char* hex)
+ * @brief Writes bytes in hexadecimal (the images hold '\0', which would end a message)
+ * @param bytes: bytes to write
+ * @param size: number of bytes
+ * @param hex: filled with 2 * size digits and a '\0'
+ */
+static void to_hex(const void* bytes, size_t size, char* hex) {
+	const unsigned char* b = (const unsigned char*) bytes;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		sprintf(hex + 2 * i, "%02x", b[i]);
+	hex[2 * size] = '\0';
+}
+
+/**
+ * @fn int from_hex(const char* hex, void* bytes, size_t size)
+ * @brief Reads bytes written in hexadecimal
+ * @param hex: digits
+ * @param bytes: filled with the bytes
+ * @param size: number of bytes expected
+ * @return int: 0 if read, -1 if the digits are not the size expected
+ */
+static int from_hex(const char* hex, void* bytes, size_t size) {
+	unsigned char* b = (unsigned char*) bytes;
+	unsigned int byte;
+	size_t i;
+
+	if (strlen(hex) != 2 * size)
+		return -1;
+
+	for (i = 0; i < size; i++) {
+		if (sscanf(hex + 2 * i, "%2x", &byte) != 1)
+			return -1;
+		b[i] = (unsigned char) byte;
+	}
+
+	return 0;
+}
+
+/**
+ * @fn int stream_changes(int file_descriptor, uint32_t* court_versions, player_image_t* players, int ids[2])
+ * @brief Sends to a standby the images that have changed since they were last sent
+ * @param file_descriptor: standby's socket
+ * @param court_versions: versions of the images of the courts last sent (updated)
+ * @param players: images of the players last sent (updated)
+ * @param ids: last ids sent (updated)
+ * @return int: number of messages sent, -1 if the standby is lost
+ */
+static int stream_changes(int file_descriptor, uint32_t* court_versions, player_image_t* players, int ids[2]) {
+	court_image_t court_image;
+	player_image_t player_image;
+	message_t message;
+	uint32_t version;
+	int last_ids[2], nb_sent = 0, slot, length;
+
+	message.code = REPLICATE;
+
+	// Courts: added, reserved, scored, released (a slot's version changes with each of them)
+	for (slot = 0; slot < SNAPSHOT_MAX_COURTS; slot++) {
+		version = copy_court_image(slot, &court_image);
+		if (version == court_versions[slot])
+			continue;
+
+		length = sprintf(message.data, "c:%d:", slot);
+		to_hex(&court_image, sizeof(court_image_t), message.data + length);
+		if (send_frame(file_descriptor, &message) == -1)
+			return -1;
+		court_versions[slot] = version;
+		nb_sent++;
+	}
+
+	// Players waiting for an invitation (an image being written is sent at the next scan)
+	for (slot = 0; slot < SNAPSHOT_MAX_PLAYERS; slot++) {
+		if (copy_player_image(slot, &player_image) == -1
+			|| memcmp(&player_image, &players[slot], sizeof(player_image_t)) == 0)
+			continue;
+
+		length = sprintf(message.data, "p:%d:", slot);
+		to_hex(&player_image, sizeof(player_image_t), message.data + length);
+		if (send_frame(file_descriptor, &message) == -1)
+			return -1;
+		players[slot] = player_image;
+		nb_sent++;
+	}
+
+	// Ids given
+	copy_snapshot_ids(&last_ids[0], &last_ids[1]);
+	if (last_ids[0] != ids[0] || last_ids[1] != ids[1]) {
+		sprintf(message.data, "i:%d:%d", last_ids[0], last_ids[1]);
+		if (send_frame(file_descriptor, &message) == -1)
+			return -1;
+		ids[0] = last_ids[0];
+		ids[1] = last_ids[1];
+		nb_sent++;
+	}
+
+	return nb_sent;
+}
+
+/**
+ * @fn void replicate_to_standby(socket_t* socket)
+ * @brief Function to stream the registries to a standby: all of them first, then their changes as they are written in
+ * the snapshot (by this thread alone, the threads of the courts never wait for the standby)
+ * @param socket: standby's socket
+ */
+void replicate_to_standby(socket_t* socket) {
+	struct timeval timeout = {REPLICATION_TIMEOUT / 1000, (REPLICATION_TIMEOUT % 1000) * 1000};
+	uint32_t* court_versions;
+	player_image_t* players;
+	message_t message;
+	long last_sent;
+	int ids[2] = {-1, -1}, nb_sent, i;
+
+	// Only the registries kept in the snapshot can be streamed
+	prepare_message(&message, (char) (snapshot_kept() ? OK : NOK), "");
+	timed_send(socket, &message);
+	end_request();
+	if (!snapshot_kept()) {
+		log_message(LOG_WARNING, "A standby cannot follow a server which does not keep its registries");
+		close(socket->file_descriptor);
+		free(socket);
+		return;
+	}
+
+	// A standby that stops reading is dropped rather than holding this thread forever
+	setsockopt(socket->file_descriptor, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	// Nothing has been sent yet: every slot differs from what the standby has
+	court_versions = (uint32_t*) malloc(SNAPSHOT_MAX_COURTS * sizeof(uint32_t));
+	players = (player_image_t*) malloc(SNAPSHOT_MAX_PLAYERS * sizeof(player_image_t));
+	memset(court_versions, 0xff, SNAPSHOT_MAX_COURTS * sizeof(uint32_t));
+	for (i = 0; i < SNAPSHOT_MAX_PLAYERS; i++)
+		players[i].id = -1;
+
+	// Full copy, then the standby knows it can take over
+	nb_sent = stream_changes(socket->file_descriptor, court_versions, players, ids);
+	prepare_message(&message, REPLICATE, "s");
+	if (nb_sent != -1 && send_frame(socket->file_descriptor, &message) != -1)
+		log_message(LOG_INFO, "Standby in sync (%d images sent)", nb_sent);
+	last_sent = monotonic_ns();
+
+	// Then the changes, coalesced: a court scored many times between two scans is sent once
+	while (nb_sent != -1) {
+		usleep(REPLICATION_INTERVAL * 1000);
+
+		nb_sent = stream_changes(socket->file_descriptor, court_versions, players, ids);
+		if (nb_sent > 0)
+			last_sent = monotonic_ns();
+		else if (nb_sent == 0 && monotonic_ns() - last_sent >= REPLICATION_HEARTBEAT * 1000000L) {
+			prepare_message(&message, REPLICATE, "h");
+			nb_sent = send_frame(socket->file_descriptor, &message);
+			last_sent = monotonic_ns();
+		}
+	}
+
+	log_message(LOG_WARNING, "Standby lost");
+	close(socket->file_descriptor);
+	free(court_versions);
+	free(players);
+	free(socket);
+}
+
+/**
+ * @fn int apply_change(char* data)
+ * @brief Writes a change streamed by the primary in the snapshot
+ * @param data: change ("c:<slot>:<image>", "p:<slot>:<image>", "i:<player id>:<court id>", "s" or "h")
+ * @return int: 1 if a change was written, 0 otherwise
+ */
+static int apply_change(char* data) {
+	court_image_t court_image;
+	player_image_t player_image;
+	int slot, last_player_id, last_court_id, offset = 0;
+
+	switch (data[0]) {
+		case 'c':
+			if (sscanf(data, "c:%d:%n", &slot, &offset) == 1 && offset > 0 && slot >= 0 && slot < SNAPSHOT_MAX_COURTS
+				&& from_hex(data + offset, &court_image, sizeof(court_image_t)) == 0) {
+				apply_court_image(slot, &court_image);
+				return 1;
+			}
+			break;
+
+		case 'p':
+			if (sscanf(data, "p:%d:%n", &slot, &offset) == 1 && offset > 0 && slot >= 0 && slot < SNAPSHOT_MAX_PLAYERS
+				&& from_hex(data + offset, &player_image, sizeof(player_image_t)) == 0) {
+				apply_player_image(slot, &player_image);
+				return 1;
+			}
+			break;
+
+		case 'i':
+			if (sscanf(data, "i:%d:%d", &last_player_id, &last_court_id) == 2) {
+				apply_snapshot_ids(last_player_id, last_court_id);
+				return 1;
+			}
+			break;
+
+		case 's':
+			log_message(LOG_INFO, "In sync with the primary, ready to take over");
+			return 0;
+
+		case 'h':
+			return 0;
+	}
+
+	log_message(LOG_WARNING, "Invalid change from the primary: '%.32s'", data);
+	return 0;
+}
+
+/**
+ * @fn int follow_primary(char* primary)
+ * @brief Copies the registries streamed by the primary in the snapshot of the standby, until the primary is lost
+ * @param primary: address of the primary ("ip:port")
+ * @return int: 1 if the primary has sent messages, 0 if it could not be reached or has stayed silent
+ */
+int follow_primary(char* primary) {
+	struct timeval timeout = {REPLICATION_TIMEOUT / 1000, (REPLICATION_TIMEOUT % 1000) * 1000};
+	char input[16 * MAX_BUFFER];
+	char ip[16], *frame, *end;
+	size_t input_size = 0;
+	ssize_t read_size;
+	socket_t sock;
+	message_t message;
+	unsigned long nb_changes = 0;
+	int port, reached = 0;
+
+	if (sscanf(primary, "%15[^:]:%d", ip, &port) != 2) {
+		log_message(LOG_ERROR, "Invalid address of the primary '%s' (ip:port expected)", primary);
+		exit(1);
+	}
+
+	// Reaching the primary (if it is already gone, taking over right away)
+	sock = create_socket(SOCK_STREAM);
+	addr2struct(&sock.remote_address, ip, port);
+	if (connect(sock.file_descriptor, (struct sockaddr *)&sock.remote_address, sizeof(sock.remote_address)) == -1) {
+		log_message(LOG_WARNING, "Can't reach the primary %s:%d, taking over", ip, port);
+		close(sock.file_descriptor);
+		return 0;
+	}
+
+	// A primary that stays silent longer than its heartbeats is taken for lost
+	setsockopt(sock.file_descriptor, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	prepare_message(&message, AUTH, "5");
+	if (send_frame(sock.file_descriptor, &message) == -1) {
+		close(sock.file_descriptor);
+		return 0;
+	}
+	log_message(LOG_INFO, "Standby of the primary %s:%d", ip, port);
+
+	// Each message ends with a '\0', several can come in one read
+	while ((read_size = recv(sock.file_descriptor, input + input_size, sizeof(input) - input_size, 0)) > 0) {
+		input_size += read_size;
+		reached = 1;
+
+		frame = input;
+		while ((end = memchr(frame, '\0', input_size - (frame - input))) != NULL) {
+			deserialize_message(&message, frame);
+			frame = end + 1;
+
+			if (message.code == (char) NOK) {
+				log_message(LOG_ERROR, "The primary %s:%d does not keep its registries, nothing to follow", ip, port);
+				exit(1);
+			}
+			if (message.code == REPLICATE)
+				nb_changes += apply_change(message.data);
+		}
+
+		input_size -= frame - input;
+		memmove(input, frame, input_size);
+	}
+
+	if (read_size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		log_message(LOG_WARNING, "No news from the primary for %d ms (%lu changes copied), taking over",
+					REPLICATION_TIMEOUT, nb_changes);
+	else
+		log_message(LOG_WARNING, "Primary lost (%lu changes copied), taking over", nb_changes);
+	close(sock.file_descriptor);
+	return reached;
+}
+
+/**
+ * @fn socket_t take_over(char* primary, int port)
+ * @brief Follows the primary until it is lost, then listens on its port in its place (a primary only paused, or too
+ * busy to send its heartbeats, still holds the port: it is followed again, after a backoff)
+ * @param primary: address of the primary ("ip:port")
+ * @param port: port of the primary, to listen on
+ * @return socket_t: listen socket
+ */
+socket_t take_over(char* primary, int port) {
+	int backoff = REPLICATION_RETRY_MIN;
+	socklen_t length;
+	socket_t sock;
+
+	while (1) {
+		if (follow_primary(primary))
+			backoff = REPLICATION_RETRY_MIN;
+
+		// Binding without exiting if the port is still taken (the other errors are fatal, as for any server)
+		sock = create_socket(SOCK_STREAM);
+		setsockopt(sock.file_descriptor, SOL_SOCKET, SO_REUSEADDR, &(int) {1}, sizeof(int));
+		addr2struct(&sock.local_address, "0.0.0.0", port);
+		if (bind(sock.file_descriptor, (struct sockaddr *)&sock.local_address, sizeof(sock.local_address)) == 0) {
+			CHECK(listen(sock.file_descriptor, SOMAXCONN), "Can't listen on socket");
+			length = sizeof(sock.local_address);
+			CHECK(getsockname(sock.file_descriptor, (struct sockaddr *)&sock.local_address, &length), "Can't get local address");
+			return sock;
+		}
+		CHECK(errno == EADDRINUSE ? 0 : -1, "Can't bind socket");
+		close(sock.file_descriptor);
+
+		log_message(LOG_WARNING, "The primary still holds port %d, following it again in %d ms", port, backoff);
+		usleep(backoff * 1000);
+		backoff = backoff * 2 > REPLICATION_RETRY_MAX ? REPLICATION_RETRY_MAX : backoff * 2;
+	}
+}
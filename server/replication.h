@@ -0,0 +1,72 @@
+#ifndef PANTALLA_DEPORTIVA_V2_REPLICATION_H
+#define PANTALLA_DEPORTIVA_V2_REPLICATION_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "server.h"
+#include "snapshot.h"
+
+/**
+ * @def REPLICATION_INTERVAL
+ * @brief Time between two scans of the snapshot for the changes to stream to a standby (ms)
+ */
+#define REPLICATION_INTERVAL 10
+
+/**
+ * @def REPLICATION_HEARTBEAT
+ * @brief Time without changes after which the primary tells a standby it is still alive (ms)
+ */
+#define REPLICATION_HEARTBEAT 200
+
+/**
+ * @def REPLICATION_TIMEOUT
+ * @brief Time without any message from the primary after which a standby takes over (ms)
+ */
+#define REPLICATION_TIMEOUT 600
+
+/**
+ * @def REPLICATION_RETRY_MIN
+ * @brief First wait before following again a primary lost that still holds its port (ms, doubled at each retry)
+ */
+#define REPLICATION_RETRY_MIN 100
+
+/**
+ * @def REPLICATION_RETRY_MAX
+ * @brief Longest wait before following again a primary lost that still holds its port (ms)
+ */
+#define REPLICATION_RETRY_MAX 5000
+
+/**
+ * @fn void replicate_to_standby(socket_t* socket)
+ * @brief Function to stream the registries to a standby: all of them first, then their changes as they are written in
+ * the snapshot (by this thread alone, the threads of the courts never wait for the standby)
+ * @param socket: standby's socket
+ */
+void replicate_to_standby(socket_t* socket);
+
+/**
+ * @fn int follow_primary(char* primary)
+ * @brief Copies the registries streamed by the primary in the snapshot of the standby, until the primary is lost
+ * @param primary: address of the primary ("ip:port")
+ * @return int: 1 if the primary has sent messages, 0 if it could not be reached or has stayed silent
+ */
+int follow_primary(char* primary);
+
+/**
+ * @fn socket_t take_over(char* primary, int port)
+ * @brief Follows the primary until it is lost, then listens on its port in its place (a primary only paused, or too
+ * busy to send its heartbeats, still holds the port: it is followed again, after a backoff)
+ * @param primary: address of the primary ("ip:port")
+ * @param port: port of the primary, to listen on
+ * @return socket_t: listen socket
+ */
+socket_t take_over(char* primary, int port);
+
+#endif //PANTALLA_DEPORTIVA_V2_REPLICATION_H
@@ -0,0 +1,79 @@
+/**
+ * @file seqlock.c
+ * @brief Sequence lock for the hot per-court fields (lock-free reads, single writer)
+ * @date 2024-05-16
+ */
+
+#include <string.h>
+
+#include "seqlock.h"
+
+/**
+ * @fn void seqlock_init(seqlock_t* lock)
+ * @brief Initializes a sequence lock (version 0)
+ * @param lock: lock to initialize
+ */
+void seqlock_init(seqlock_t* lock) {
+	atomic_init(&lock->sequence, 0);
+}
+
+/**
+ * @fn unsigned long seqlock_write(seqlock_t* lock, void* slot, const void* value, size_t size)
+ * @brief Writes a value in the slot protected by the lock
+ * @param lock: lock of the slot
+ * @param slot: slot to write
+ * @param value: value to copy in the slot
+ * @param size: size of the value
+ * @return unsigned long: version of the slot after the write
+ * @note only one thread can write at a time
+ */
+unsigned long seqlock_write(seqlock_t* lock, void* slot, const void* value, size_t size) {
+	unsigned long sequence = atomic_load_explicit(&lock->sequence, memory_order_relaxed);
+
+	// Odd sequence: the readers know a write is in progress
+	atomic_store_explicit(&lock->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	memcpy(slot, value, size);
+
+	// Even sequence: the new value is complete
+	atomic_store_explicit(&lock->sequence, sequence + 2, memory_order_release);
+
+	return (sequence + 2) / 2;
+}
+
+/**
+ * @fn unsigned long seqlock_read(seqlock_t* lock, const void* slot, void* value, size_t size)
+ * @brief Reads a consistent snapshot of the slot protected by the lock
+ * @param lock: lock of the slot
+ * @param slot: slot to read
+ * @param value: filled with the snapshot
+ * @param size: size of the value
+ * @return unsigned long: version of the snapshot
+ */
+unsigned long seqlock_read(seqlock_t* lock, const void* slot, void* value, size_t size) {
+	unsigned long before, after;
+
+	do {
+		// Waiting for the write in progress to be over
+		while ((before = atomic_load_explicit(&lock->sequence, memory_order_acquire)) & 1);
+
+		memcpy(value, slot, size);
+
+		// Retrying if the slot has been written during the copy
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&lock->sequence, memory_order_relaxed);
+	} while (before != after);
+
+	return before / 2;
+}
+
+/**
+ * @fn unsigned long seqlock_version(seqlock_t* lock)
+ * @brief Returns the version of the last complete write
+ * @param lock: lock of the slot
+ * @return unsigned long: number of writes done in the slot
+ */
+unsigned long seqlock_version(seqlock_t* lock) {
+	return atomic_load_explicit(&lock->sequence, memory_order_acquire) / 2;
+}
@@ -0,0 +1,61 @@
+#ifndef PANTALLA_DEPORTIVA_V2_SEQLOCK_H
+#define PANTALLA_DEPORTIVA_V2_SEQLOCK_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/**
+ * @struct seqlock
+ * @brief Sequence lock protecting a slot written by one thread and read by any number of threads
+ * @var sequence: odd while a write is in progress, incremented twice by each write
+ * @note readers never block the writer: they copy the slot and retry if a write happened meanwhile
+ */
+struct seqlock {
+	atomic_ulong sequence;
+};
+
+/**
+ * @typedef seqlock_t
+ * @brief Typedef for seqlock structure
+ */
+typedef struct seqlock seqlock_t;
+
+/**
+ * @fn void seqlock_init(seqlock_t* lock)
+ * @brief Initializes a sequence lock (version 0)
+ * @param lock: lock to initialize
+ */
+void seqlock_init(seqlock_t* lock);
+
+/**
+ * @fn unsigned long seqlock_write(seqlock_t* lock, void* slot, const void* value, size_t size)
+ * @brief Writes a value in the slot protected by the lock
+ * @param lock: lock of the slot
+ * @param slot: slot to write
+ * @param value: value to copy in the slot
+ * @param size: size of the value
+ * @return unsigned long: version of the slot after the write
+ * @note only one thread can write at a time
+ */
+unsigned long seqlock_write(seqlock_t* lock, void* slot, const void* value, size_t size);
+
+/**
+ * @fn unsigned long seqlock_read(seqlock_t* lock, const void* slot, void* value, size_t size)
+ * @brief Reads a consistent snapshot of the slot protected by the lock
+ * @param lock: lock of the slot
+ * @param slot: slot to read
+ * @param value: filled with the snapshot
+ * @param size: size of the value
+ * @return unsigned long: version of the snapshot
+ */
+unsigned long seqlock_read(seqlock_t* lock, const void* slot, void* value, size_t size);
+
+/**
+ * @fn unsigned long seqlock_version(seqlock_t* lock)
+ * @brief Returns the version of the last complete write
+ * @param lock: lock of the slot
+ * @return unsigned long: number of writes done in the slot
+ */
+unsigned long seqlock_version(seqlock_t* lock);
+
+#endif //PANTALLA_DEPORTIVA_V2_SEQLOCK_H
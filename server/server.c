@@ -7,11 +7,17 @@
 #include "server.h"
 #include "player_functions.h"
 #include "court_functions.h"
+#include "history.h"
+#include "snapshot.h"
+#include "replication.h"
 
-socket_t listen_socket; // Declared globally to be closed in the signal handler function
+volatile sig_atomic_t stopping = 0; // Set by SIGINT, the main thread then closes the server
 
 int main(int argc, char** argv) {
-	socket_t client_socket;
+	struct sigaction action;
+	sigset_t interrupt, unblocked;
+	fd_set listener;
+	socket_t listen_socket, *client_socket;
 	pthread_t thread;
 	int port = 0; // 0 = default for random
 
@@ -23,25 +29,71 @@ int main(int argc, char** argv) {
 			port = 0;
 	}
 
-	// Creating STREAM listen socket
-	listen_socket = create_listen_socket("0.0.0.0", port);
-	printf("Listening on port %d\n", ntohs(((struct sockaddr_in*)&listen_socket.local_address)->sin_port));
-
-	// Setting up signal handler to close the socket properly
-	signal(SIGINT, sigint_handler);
-
-	// Accepting clients
-	while (1) {
-		client_socket = accept_client(listen_socket);
-		thread = pthread_create(&thread,
-								NULL,
-								(void*) listen_thread,
-								(void*) &client_socket);
-		sleep(1); // Wait for proper copy of the socket in the created thread
+	// SIGINT is only received by the main thread, while it waits for a client (the other threads inherit the mask)
+	sigemptyset(&interrupt);
+	sigaddset(&interrupt, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &interrupt, &unblocked);
+
+	// The hops of the points are printed on each SIGUSR2 (kill -USR2), then the latency histograms on each SIGUSR1
+	// (kill -USR1), before any thread is created
+	start_trace_dumper();
+	start_latency_reporter();
+
+	// Events are written by a background thread (threshold from LOG_LEVEL)
+	log_init();
+
+	// Keeping the completed matches, the ids of the players and the courts continuing after the ones it holds
+	open_history(argc > 3 ? argv[3] : DEFAULT_HISTORY_FILE);
+	continue_player_ids(history_last_player_id());
+	continue_court_ids(history_last_court_id());
+
+	// A standby copies the registries of the primary in its snapshot, and only listens once the primary is lost (on the
+	// same machine, on the same port: the clients reconnecting to it find the standby)
+	listen_socket.file_descriptor = -1;
+	if (argc > 5 && map_snapshot(argv[4]) == 0) {
+		pthread_sigmask(SIG_SETMASK, &unblocked, NULL); // Nothing to close yet, SIGINT ends the standby at once
+		listen_socket = take_over(argv[5], port);
+		pthread_sigmask(SIG_BLOCK, &interrupt, NULL);
 	}
 
-	// Closing socket
+	// Restoring the registries as they were before a restart: the courts and players reconnecting keep their ids
+	load_snapshot(argc > 4 ? argv[4] : DEFAULT_SNAPSHOT_FILE);
+
+	// Creating STREAM listen socket (the standby's is already listening)
+	if (listen_socket.file_descriptor == -1)
+		listen_socket = create_listen_socket("0.0.0.0", port);
+	log_message(LOG_INFO, "Listening on port %d", ntohs(((struct sockaddr_in*)&listen_socket.local_address)->sin_port));
+
+	// Serving the metrics (and the history) on a local port if asked (0 for a random one, -1 for none)
+	if (argc > 2 && atoi(argv[2]) >= 0)
+		start_metrics_endpoint(atoi(argv[2]));
+
+	// Setting up signal handler to close the socket properly (without SA_RESTART, so the wait is interrupted)
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = sigint_handler;
+	sigaction(SIGINT, &action, NULL);
+
+	// Accepting clients until SIGINT
+	while (!stopping) {
+		FD_ZERO(&listener);
+		FD_SET(listen_socket.file_descriptor, &listener);
+		if (pselect(listen_socket.file_descriptor + 1, &listener, NULL, NULL, NULL, &unblocked) != 1)
+			continue; // Interrupted by a signal
+
+		// Allocating the socket: it lives as long as the client is referenced (players, courts)
+		client_socket = (socket_t*) malloc(sizeof(socket_t));
+		*client_socket = accept_client(listen_socket);
+		pthread_create(&thread,
+					   NULL,
+					   (void*) listen_thread,
+					   (void*) client_socket);
+		pthread_detach(thread);
+	}
+
+	// Closing socket, once the last matches are in the history (the log is written at exit)
 	close(listen_socket.file_descriptor);
+	close_history();
+	log_message(LOG_INFO, "Server closed.");
 
 	return 0;
 }
@@ -53,27 +105,22 @@ int main(int argc, char** argv) {
  */
 void listen_thread(void* socket) {
 	socket_t* client_socket = (socket_t *) socket;
-	socket_t client_socket_copy;
 	message_t message;
 	buffer_t ip;
 	int port;
 
-	// Creating a copy of the socket because other threads will overwrite it
-	client_socket_copy.file_descriptor = client_socket->file_descriptor;
-	client_socket_copy.remote_address = client_socket->remote_address;
-	client_socket_copy.local_address = client_socket->local_address;
-	client_socket_copy.mode = client_socket->mode;
-
-	strcpy(ip, inet_ntoa(((struct sockaddr_in*)&client_socket_copy.remote_address)->sin_addr));
-	port = ntohs(((struct sockaddr_in*)&client_socket_copy.remote_address)->sin_port);
+	strcpy(ip, inet_ntoa(((struct sockaddr_in*)&client_socket->remote_address)->sin_addr));
+	port = ntohs(((struct sockaddr_in*)&client_socket->remote_address)->sin_port);
 
-	// Receiving message from the client
-	receive_message(&client_socket_copy, &message, deserialize_message);
+	// Receiving message from the client (its handling ends with the answer of the role's function)
+	receive_request(client_socket, &message);
 
 	// Rejecting if the client is not trying to authenticate first
 	if (message.code != AUTH) {
-		fprintf(stderr, "[%s:%d] has sent a non-auth request and is not authenticated.\n", ip, port);
-		close(client_socket_copy.file_descriptor);
+		end_request();
+		log_message(LOG_WARNING, "[%s:%d] has sent a non-auth request and is not authenticated.", ip, port);
+		close(client_socket->file_descriptor);
+		free(client_socket);
 		return;
 	}
 
@@ -81,42 +128,52 @@ void listen_thread(void* socket) {
 	switch (message.data[0]) {
 		// Player who invites
 		case '1':
-			printf("[%s:%d] is a player who invites.\n", ip, port);
-			host_player(&client_socket_copy, message.data);
+			count_metric(COUNTER_CONNECTIONS_OPENED + ROLE_PLAYER, 1);
+			log_message(LOG_INFO, "[%s:%d] is a player who invites.", ip, port);
+			host_player(client_socket, message.data);
 			break;
 
 		// Player who is invited
 		case '2':
-			printf("[%s:%d] is a player who is invited.\n", ip, port);
-			invited_player(&client_socket_copy, message.data);
+			count_metric(COUNTER_CONNECTIONS_OPENED + ROLE_PLAYER, 1);
+			log_message(LOG_INFO, "[%s:%d] is a player who is invited.", ip, port);
+			invited_player(client_socket, message.data);
 			break;
 
 		// Court
 		case '3':
-			printf("[%s:%d] is a court.\n", ip, port);
-			new_court(&client_socket_copy, ip);
+			count_metric(COUNTER_CONNECTIONS_OPENED + ROLE_COURT, 1);
+			log_message(LOG_INFO, "[%s:%d] is a court.", ip, port);
+			new_court(client_socket, ip);
+			count_metric(COUNTER_CONNECTIONS_CLOSED + ROLE_COURT, 1);
 			break;
 
 		// Spectator
 		case '4':
-			printf("[%s:%d] is a spectator.\n", ip, port);
-			spectator_function(&client_socket_copy);
+			count_metric(COUNTER_CONNECTIONS_OPENED + ROLE_SPECTATOR, 1);
+			log_message(LOG_INFO, "[%s:%d] is a spectator.", ip, port);
+			spectator_function(client_socket);
+			count_metric(COUNTER_CONNECTIONS_CLOSED + ROLE_SPECTATOR, 1);
+			break;
+
+		// Standby server
+		case '5':
+			log_message(LOG_INFO, "[%s:%d] is a standby server.", ip, port);
+			replicate_to_standby(client_socket);
 			break;
 
 		// Unknown
 		default:
-			fprintf(stderr, "[%s:%d] is trying to authenticate with an unknown role.\n", ip, port);
+			log_message(LOG_WARNING, "[%s:%d] is trying to authenticate with an unknown role.", ip, port);
 			break;
 	}
 }
 
 /**
  * @fn void sigint_handler(int signum)
- * @brief Signal handler for SIGINT, closing the socket properly
+ * @brief Signal handler for SIGINT, asking the main thread to close the server (only async-signal-safe code here)
  * @param signum: unused
  */
 void sigint_handler(int signum) {
-	close(listen_socket.file_descriptor);
-	printf("\nServer closed.\n");
-	exit(0);
+	stopping = 1;
 }
\ No newline at end of file
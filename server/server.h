@@ -5,10 +5,17 @@
 #include <stdlib.h>
 #include <pthread.h>
 #include <signal.h>
+#include <string.h>
+#include <sys/select.h>
 
 #include "../socket/data.h"
 #include "../serialization/serialization.h"
 #include "../common/codes.h"
+#include "../log/log.h"
+#include "../trace/trace.h"
+#include "latency.h"
+#include "metrics.h"
+#include "lock_profiler.h"
 
 /**
  * @fn void listen_thread(void* socket)
@@ -19,7 +26,7 @@ void listen_thread(void* socket);
 
 /**
  * @fn void sigint_handler(int signum)
- * @brief Signal handler for SIGINT, closing the socket properly
+ * @brief Signal handler for SIGINT, asking the main thread to close the server (only async-signal-safe code here)
  * @param signum: unused
  */
 void sigint_handler(int signum);
@@ -0,0 +1,568 @@
+/**
+ * @file snapshot.c
+ * @brief Snapshot of the registries in a memory-mapped file, updated on each change and restored on startup
+ * @date 2024-06-09
+ */
+
+#include "snapshot.h"
+
+/**
+ * @def SNAPSHOT_HEADER_SIZE
+ * @brief Size of the header, the slots of the courts start on the next page
+ */
+#define SNAPSHOT_HEADER_SIZE 4096
+
+/**
+ * @def SNAPSHOT_MAGIC
+ * @brief Identifies a snapshot file
+ */
+#define SNAPSHOT_MAGIC "PDSNAP1"
+
+char* mapped_snapshot = NULL; // Mapped snapshot file (written by the replication alone on a standby)
+char* snapshot_mapping = NULL; // Mapped snapshot file once restored, NULL while the registries are not kept
+size_t snapshot_size; // Size of the mapping
+snapshot_header_t* snapshot_header; // Header of the snapshot
+court_image_t (*court_slots)[2]; // Two images per court, written in turn: a torn one leaves the other
+player_image_t* player_slots; // Players waiting for an invitation
+uint32_t slot_versions[SNAPSHOT_MAX_COURTS]; // Version of the last image of each court
+pthread_mutex_t slot_mutexes[SNAPSHOT_MAX_COURTS]; // Mutex of each court's slot (its court and players threads write it)
+char slot_taken[SNAPSHOT_MAX_COURTS]; // 1 if a court has the slot, 0 if it is free
+pthread_mutex_t slots_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for the slots taken
+pthread_mutex_t player_slots_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for the slots of the players (taken by their threads)
+atomic_ulong snapshot_changes = 0; // Number of writes in the mapping (read by the sync thread)
+
+player_image_t* returning_players = NULL; // Players who were waiting before the restart, until they reconnect
+int nb_returning_players = 0;
+pthread_mutex_t returning_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex for the returning players
+
+/**
+ * @fn uint32_t image_checksum(void* image, size_t size, uint32_t* checksum)
+ * @brief Computes the checksum of an image (FNV-1a of its bytes, the checksum counted as 0)
+ * @param image: image to check
+ * @param size: size of the image
+ * @param checksum: checksum field of the image
+ * @return uint32_t: checksum
+ */
+static uint32_t image_checksum(void* image, size_t size, uint32_t* checksum) {
+	unsigned char* bytes = (unsigned char*) image;
+	size_t skip = (unsigned char*) checksum - bytes, i;
+	uint32_t hash = 2166136261u;
+
+	// The image is only read: it can be the one in the mapping
+	for (i = 0; i < size; i++)
+		hash = (hash ^ (i >= skip && i < skip + sizeof(uint32_t) ? 0 : bytes[i])) * 16777619u;
+
+	return hash;
+}
+
+/**
+ * @fn court_image_t* last_court_image(int slot)
+ * @brief Finds the last image of a court that was fully written
+ * @param slot: court's slot
+ * @return court_image_t*: image, NULL if none
+ */
+static court_image_t* last_court_image(int slot) {
+	court_image_t *image, *last = NULL;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		image = &court_slots[slot][i];
+		if (image->version != 0 && image->checksum == image_checksum(image, sizeof(court_image_t), &image->checksum)
+			&& (last == NULL || image->version > last->version))
+			last = image;
+	}
+
+	return last;
+}
+
+/**
+ * @fn int restore_courts()
+ * @brief Restores the courts of the snapshot, waiting for their court processes to reconnect
+ * @return int: number of courts restored
+ */
+static int restore_courts() {
+	const scoring_format_t* format;
+	court_image_t* image;
+	court_t court;
+	int nb_courts = 0, slot, i;
+
+	for (slot = 0; slot < SNAPSHOT_MAX_COURTS; slot++) {
+		image = last_court_image(slot);
+		if (image == NULL)
+			continue;
+		slot_versions[slot] = image->version;
+
+		format = find_scoring_format(image->format);
+		if (format == NULL)
+			continue;
+		slot_taken[slot] = 1;
+
+		memset(&court, 0, sizeof(court_t));
+		court.id = image->id;
+		court.key = image->key;
+		court.sequence = image->sequence;
+		strcpy(court.ip, image->ip);
+		court.listen_port = image->listen_port;
+		court.format = format;
+		for (i = 0; i < 2; i++) {
+			court.players[i].id = image->player_ids[i];
+			strcpy(court.players[i].first_name, image->first_names[i]);
+			strcpy(court.players[i].last_name, image->last_names[i]);
+		}
+		court.available = image->available;
+		court.match_start = (time_t) image->match_start;
+		court.snapshot_slot = slot;
+
+		// The time a court process has been away for goes on across restarts (from now on if it was connected)
+		court.disconnected_at = image->disconnected_at != 0 ? (time_t) image->disconnected_at : time(NULL);
+
+		restore_court(court, image->code, image->score);
+		nb_courts++;
+	}
+
+	return nb_courts;
+}
+
+/**
+ * @fn void snapshot_sync_thread()
+ * @brief Writes the snapshot to the disk when it has changed since the last write
+ */
+void snapshot_sync_thread() {
+	unsigned long changes, synced = 0;
+
+	while (1) {
+		usleep(SNAPSHOT_SYNC_INTERVAL * 1000);
+
+		// The courts whose court process is gone for good are removed (and not restored anymore)
+		expire_courts(SNAPSHOT_COURT_EXPIRY);
+
+		changes = atomic_load_explicit(&snapshot_changes, memory_order_relaxed);
+		if (changes == synced)
+			continue;
+
+		msync(mapped_snapshot, snapshot_size, MS_SYNC);
+		synced = changes;
+	}
+}
+
+/**
+ * @fn int map_snapshot(const char* path)
+ * @brief Maps the snapshot file (created if needed, reset if written with other images), without restoring it
+ * @param path: snapshot file
+ * @return int: 0 if mapped (or already), -1 if the file cannot be mapped
+ */
+int map_snapshot(const char* path) {
+	char* mapping;
+	int file_descriptor, i;
+
+	if (mapped_snapshot != NULL)
+		return 0;
+
+	snapshot_size = SNAPSHOT_HEADER_SIZE + SNAPSHOT_MAX_COURTS * 2 * sizeof(court_image_t)
+					+ SNAPSHOT_MAX_PLAYERS * sizeof(player_image_t);
+
+	// Mapping the file, the changes are in the page cache (safe from a crash of the process) once written
+	file_descriptor = open(path, O_RDWR | O_CREAT, 0644);
+	if (file_descriptor == -1 || ftruncate(file_descriptor, snapshot_size) == -1) {
+		log_message(LOG_ERROR, "Snapshot '%s' cannot be opened, the registries will not be kept", path);
+		if (file_descriptor != -1)
+			close(file_descriptor);
+		return -1;
+	}
+	mapping = mmap(NULL, snapshot_size, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+	close(file_descriptor);
+	if (mapping == MAP_FAILED) {
+		log_message(LOG_ERROR, "Snapshot '%s' cannot be mapped, the registries will not be kept", path);
+		return -1;
+	}
+
+	snapshot_header = (snapshot_header_t*) mapping;
+	court_slots = (court_image_t (*)[2]) (mapping + SNAPSHOT_HEADER_SIZE);
+	player_slots = (player_image_t*) (mapping + SNAPSHOT_HEADER_SIZE + SNAPSHOT_MAX_COURTS * 2 * sizeof(court_image_t));
+	for (i = 0; i < SNAPSHOT_MAX_COURTS; i++)
+		pthread_mutex_init(&slot_mutexes[i], NULL);
+
+	// Resetting a snapshot written with other images
+	if (strcmp(snapshot_header->magic, SNAPSHOT_MAGIC) != 0
+	|| snapshot_header->court_image_size != sizeof(court_image_t)
+	|| snapshot_header->player_image_size != sizeof(player_image_t)) {
+		memset(mapping, 0, snapshot_size);
+		strcpy(snapshot_header->magic, SNAPSHOT_MAGIC);
+		snapshot_header->court_image_size = sizeof(court_image_t);
+		snapshot_header->player_image_size = sizeof(player_image_t);
+		msync(mapping, SNAPSHOT_HEADER_SIZE, MS_SYNC);
+	}
+
+	mapped_snapshot = mapping;
+	return 0;
+}
+
+/**
+ * @fn int load_snapshot(const char* path)
+ * @brief Maps the snapshot of the registries (created if needed) and restores them: the id counters, the courts
+ * (waiting for their court process to reconnect, with their match and score) and the players waiting for an invitation
+ * (given their id back when they reconnect)
+ * @param path: snapshot file
+ * @return int: number of courts restored, -1 if the file cannot be mapped (the registries are not kept)
+ */
+int load_snapshot(const char* path) {
+	long start = monotonic_ns();
+	player_image_t* image;
+	pthread_t thread;
+	int nb_courts, i;
+
+	// Without the file, the courts gone for good are still removed (nothing is written)
+	if (map_snapshot(path) == -1) {
+		pthread_create(&thread, NULL, (void*) snapshot_sync_thread, NULL);
+		pthread_detach(thread);
+		return -1;
+	}
+
+	// The ids continue after the ones given before the restart
+	continue_player_ids(snapshot_header->last_player_id);
+	continue_court_ids(snapshot_header->last_court_id);
+
+	// The courts wait for their court processes, which are recognized by their keys
+	nb_courts = restore_courts();
+
+	// The players who were waiting for an invitation get their id back when they reconnect
+	returning_players = (player_image_t*) malloc(SNAPSHOT_MAX_PLAYERS * sizeof(player_image_t));
+	for (i = 0; i < SNAPSHOT_MAX_PLAYERS; i++) {
+		image = &player_slots[i];
+		if (image->id != 0 && image->checksum == image_checksum(image, sizeof(player_image_t), &image->checksum))
+			returning_players[nb_returning_players++] = *image;
+	}
+
+	// Only from now on are the changes written
+	snapshot_mapping = mapped_snapshot;
+	pthread_create(&thread, NULL, (void*) snapshot_sync_thread, NULL);
+	pthread_detach(thread);
+
+	log_message(LOG_INFO, "Snapshot '%s': %d courts and %d waiting players restored in %ld us", path, nb_courts,
+				nb_returning_players, (monotonic_ns() - start) / 1000);
+	return nb_courts;
+}
+
+/**
+ * @fn int reserve_snapshot_slot(unsigned long long key)
+ * @brief Gives a new court its slot in the snapshot
+ * @param key: durable identity of the court (a court without one cannot be recognized after a restart)
+ * @return int: slot, -1 if the court is not kept
+ */
+int reserve_snapshot_slot(unsigned long long key) {
+	int slot;
+
+	if (snapshot_mapping == NULL || key == 0)
+		return -1;
+
+	// The first free slot, those of the courts gone for good are given again
+	pthread_mutex_lock(&slots_mutex);
+	for (slot = 0; slot < SNAPSHOT_MAX_COURTS && slot_taken[slot]; slot++);
+	if (slot < SNAPSHOT_MAX_COURTS)
+		slot_taken[slot] = 1;
+	pthread_mutex_unlock(&slots_mutex);
+
+	if (slot == SNAPSHOT_MAX_COURTS) {
+		log_message(LOG_WARNING, "Snapshot full: the court with the key %llx will get a new id after a restart", key);
+		return -1;
+	}
+
+	return slot;
+}
+
+/**
+ * @fn void free_snapshot_slot(court_t* court)
+ * @brief Frees the slot of a court no longer kept in the snapshot, for the next courts
+ * @param court: court whose slot is freed
+ */
+void free_snapshot_slot(court_t* court) {
+	int slot = court->snapshot_slot;
+
+	if (snapshot_mapping == NULL || slot < 0)
+		return;
+
+	// Its version still increases: the next court of the slot is never taken for this one (by a standby)
+	pthread_mutex_lock(&slot_mutexes[slot]);
+	court->snapshot_slot = -1;
+	memset(court_slots[slot], 0, 2 * sizeof(court_image_t));
+	pthread_mutex_unlock(&slot_mutexes[slot]);
+
+	pthread_mutex_lock(&slots_mutex);
+	slot_taken[slot] = 0;
+	pthread_mutex_unlock(&slots_mutex);
+
+	atomic_fetch_add_explicit(&snapshot_changes, 1, memory_order_relaxed);
+}
+
+/**
+ * @fn void snapshot_court(court_t* court)
+ * @brief Writes the current state of a court in its slot (in the mapping: safe from a crash of the process)
+ * @param court: court that has changed
+ */
+void snapshot_court(court_t* court) {
+	int slot = court->snapshot_slot, i;
+	message_t publication;
+	court_image_t image;
+
+	if (snapshot_mapping == NULL || slot < 0)
+		return;
+
+	// The image is built under the mutex of the slot: an older state never gets a newer version
+	pthread_mutex_lock(&slot_mutexes[slot]);
+
+	// Its slot may have been freed meanwhile, and given to another court
+	if (court->snapshot_slot != slot) {
+		pthread_mutex_unlock(&slot_mutexes[slot]);
+		return;
+	}
+
+	memset(&image, 0, sizeof(court_image_t));
+	image.id = court->id;
+	image.listen_port = court->listen_port;
+	image.key = court->key;
+	image.sequence = court->sequence;
+	image.match_start = court->match_start;
+	image.disconnected_at = court->disconnected_at;
+	snprintf(image.ip, sizeof(image.ip), "%s", court->ip);
+	snprintf(image.format, sizeof(image.format), "%s", court->format->name);
+	for (i = 0; i < 2; i++) {
+		image.player_ids[i] = court->players[i].id;
+		snprintf(image.first_names[i], SNAPSHOT_NAME_SIZE, "%s", court->players[i].first_name);
+		snprintf(image.last_names[i], SNAPSHOT_NAME_SIZE, "%s", court->players[i].last_name);
+	}
+	image.available = court->available;
+
+	// The score as the spectators have it, without its trace
+	read_publication(&court->channel, &publication);
+	image.code = publication.code;
+	snprintf(image.score, SNAPSHOT_SCORE_SIZE, "%.*s", (int) strcspn(publication.data, "|"), publication.data);
+
+	// Overwriting the older image: the newer one stays valid if the process dies meanwhile
+	image.version = ++slot_versions[slot];
+	image.checksum = image_checksum(&image, sizeof(court_image_t), &image.checksum);
+	court_slots[slot][image.version & 1] = image;
+	pthread_mutex_unlock(&slot_mutexes[slot]);
+
+	atomic_fetch_add_explicit(&snapshot_changes, 1, memory_order_relaxed);
+}
+
+/**
+ * @fn int find_player_slot(int id, int wanted)
+ * @brief Finds a slot of the players, from the one of a player's id modulo SNAPSHOT_MAX_PLAYERS
+ * @param id: player's id
+ * @param wanted: id the slot must hold (0 for a free slot)
+ * @return int: slot, -1 if none
+ */
+static int find_player_slot(int id, int wanted) {
+	int slot, i;
+
+	for (i = 0; i < SNAPSHOT_MAX_PLAYERS; i++) {
+		slot = (id + i) % SNAPSHOT_MAX_PLAYERS;
+		if (player_slots[slot].id == wanted)
+			return slot;
+	}
+
+	return -1;
+}
+
+/**
+ * @fn void snapshot_waiting_player(player_t* player)
+ * @brief Writes a player waiting for an invitation in the snapshot
+ * @param player: player added to the list
+ */
+void snapshot_waiting_player(player_t* player) {
+	player_image_t image;
+	int slot;
+
+	if (snapshot_mapping == NULL || player->id <= 0)
+		return;
+
+	memset(&image, 0, sizeof(player_image_t));
+	image.id = player->id;
+	snprintf(image.first_name, SNAPSHOT_NAME_SIZE, "%s", player->first_name);
+	snprintf(image.last_name, SNAPSHOT_NAME_SIZE, "%s", player->last_name);
+	image.checksum = image_checksum(&image, sizeof(player_image_t), &image.checksum);
+
+	// A player whose id collides with another one's takes the next free slot
+	pthread_mutex_lock(&player_slots_mutex);
+	slot = find_player_slot(player->id, player->id);
+	if (slot == -1)
+		slot = find_player_slot(player->id, 0);
+	if (slot != -1)
+		player_slots[slot] = image;
+	pthread_mutex_unlock(&player_slots_mutex);
+
+	if (slot == -1) {
+		log_message(LOG_WARNING, "Snapshot full: player %d will get a new id after a restart", player->id);
+		return;
+	}
+	atomic_fetch_add_explicit(&snapshot_changes, 1, memory_order_relaxed);
+}
+
+/**
+ * @fn void forget_waiting_player(int id)
+ * @brief Removes a player who no longer waits for an invitation from the snapshot
+ * @param id: player's id
+ */
+void forget_waiting_player(int id) {
+	int slot;
+
+	if (snapshot_mapping == NULL || id <= 0)
+		return;
+
+	pthread_mutex_lock(&player_slots_mutex);
+	slot = find_player_slot(id, id);
+	if (slot != -1)
+		memset(&player_slots[slot], 0, sizeof(player_image_t));
+	pthread_mutex_unlock(&player_slots_mutex);
+
+	if (slot != -1)
+		atomic_fetch_add_explicit(&snapshot_changes, 1, memory_order_relaxed);
+}
+
+/**
+ * @fn void snapshot_player_id(int id)
+ * @brief Writes the last player's id given in the snapshot
+ * @param id: id given
+ */
+void snapshot_player_id(int id) {
+	if (snapshot_mapping != NULL && id > snapshot_header->last_player_id)
+		snapshot_header->last_player_id = id;
+}
+
+/**
+ * @fn void snapshot_court_id(int id)
+ * @brief Writes the last court's id given in the snapshot
+ * @param id: id given
+ */
+void snapshot_court_id(int id) {
+	if (snapshot_mapping != NULL && id > snapshot_header->last_court_id)
+		snapshot_header->last_court_id = id;
+}
+
+/**
+ * @fn int returning_player_id(const char* first_name, const char* last_name)
+ * @brief Gives back their id to a player who was waiting for an invitation before a restart (once)
+ * @param first_name: player's first name
+ * @param last_name: player's last name
+ * @return int: previous id, 0 if the player was not waiting
+ */
+int returning_player_id(const char* first_name, const char* last_name) {
+	int id = 0, i;
+
+	if (nb_returning_players == 0)
+		return 0;
+
+	pthread_mutex_lock(&returning_mutex);
+	for (i = 0; i < nb_returning_players && id == 0; i++) {
+		if (returning_players[i].id != 0
+			&& strncmp(returning_players[i].first_name, first_name, SNAPSHOT_NAME_SIZE - 1) == 0
+			&& strncmp(returning_players[i].last_name, last_name, SNAPSHOT_NAME_SIZE - 1) == 0) {
+			id = returning_players[i].id;
+			returning_players[i].id = 0;
+		}
+	}
+	pthread_mutex_unlock(&returning_mutex);
+
+	return id;
+}
+
+/**
+ * @fn int snapshot_kept()
+ * @brief Tells if the registries are kept in the snapshot (and can be copied by a standby)
+ * @return int: 1 if kept, 0 otherwise
+ */
+int snapshot_kept() {
+	return snapshot_mapping != NULL;
+}
+
+/**
+ * @fn uint32_t copy_court_image(int slot, court_image_t* image)
+ * @brief Copies the last image of a court (for a standby)
+ * @param slot: court's slot
+ * @param image: filled with the image (zeroed if the slot is free)
+ * @return uint32_t: version of the image, 0 if the slot is free
+ */
+uint32_t copy_court_image(int slot, court_image_t* image) {
+	court_image_t* last;
+
+	// Under the mutex of the slot: the court thread never overwrites the image while it is copied
+	pthread_mutex_lock(&slot_mutexes[slot]);
+	last = last_court_image(slot);
+	if (last != NULL)
+		*image = *last;
+	else
+		memset(image, 0, sizeof(court_image_t));
+	pthread_mutex_unlock(&slot_mutexes[slot]);
+
+	return image->version;
+}
+
+/**
+ * @fn int copy_player_image(int slot, player_image_t* image)
+ * @brief Copies the image of a player waiting for an invitation (for a standby)
+ * @param slot: player's slot
+ * @param image: filled with the image (zeroed if the slot is free)
+ * @return int: 0 if copied, -1 if it was being written (copied again later)
+ */
+int copy_player_image(int slot, player_image_t* image) {
+	*image = player_slots[slot];
+
+	if (image->id == 0)
+		return 0;
+
+	return image->checksum == image_checksum(image, sizeof(player_image_t), &image->checksum) ? 0 : -1;
+}
+
+/**
+ * @fn void copy_snapshot_ids(int* last_player_id, int* last_court_id)
+ * @brief Copies the last ids given (for a standby)
+ * @param last_player_id: filled with the last player's id given
+ * @param last_court_id: filled with the last court's id given
+ */
+void copy_snapshot_ids(int* last_player_id, int* last_court_id) {
+	*last_player_id = snapshot_header->last_player_id;
+	*last_court_id = snapshot_header->last_court_id;
+}
+
+/**
+ * @fn void apply_court_image(int slot, court_image_t* image)
+ * @brief Writes the image of a court received from the primary in the snapshot of a standby
+ * @param slot: court's slot
+ * @param image: image (version 0 to free the slot)
+ */
+void apply_court_image(int slot, court_image_t* image) {
+	court_image_t* other;
+
+	if (image->version == 0) {
+		memset(court_slots[slot], 0, 2 * sizeof(court_image_t));
+		return;
+	}
+
+	// An image of a previous run left in the other place must not be taken for a newer one
+	other = &court_slots[slot][(image->version & 1) ^ 1];
+	if (other->version > image->version)
+		memset(other, 0, sizeof(court_image_t));
+	court_slots[slot][image->version & 1] = *image;
+}
+
+/**
+ * @fn void apply_player_image(int slot, player_image_t* image)
+ * @brief Writes the image of a player received from the primary in the snapshot of a standby
+ * @param slot: player's slot
+ * @param image: image (id 0 to free the slot)
+ */
+void apply_player_image(int slot, player_image_t* image) {
+	player_slots[slot] = *image;
+}
+
+/**
+ * @fn void apply_snapshot_ids(int last_player_id, int last_court_id)
+ * @brief Writes the last ids given by the primary in the snapshot of a standby
+ * @param last_player_id: last player's id given
+ * @param last_court_id: last court's id given
+ */
+void apply_snapshot_ids(int last_player_id, int last_court_id) {
+	snapshot_header->last_player_id = last_player_id;
+	snapshot_header->last_court_id = last_court_id;
+}
@@ -0,0 +1,285 @@
+#ifndef PANTALLA_DEPORTIVA_V2_SNAPSHOT_H
+#define PANTALLA_DEPORTIVA_V2_SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "server.h"
+#include "player_functions.h"
+#include "court_functions.h"
+
+/**
+ * @def DEFAULT_SNAPSHOT_FILE
+ * @brief Snapshot file used when none is given
+ */
+#define DEFAULT_SNAPSHOT_FILE "server.snapshot"
+
+/**
+ * @def SNAPSHOT_MAX_COURTS
+ * @brief Courts kept in the snapshot at most (the next ones get new ids after a restart)
+ */
+#define SNAPSHOT_MAX_COURTS 256
+
+/**
+ * @def SNAPSHOT_COURT_EXPIRY
+ * @brief Time a court can stay without its court process before it is removed (and no longer kept in the snapshot, s)
+ */
+#define SNAPSHOT_COURT_EXPIRY 600
+
+/**
+ * @def SNAPSHOT_MAX_PLAYERS
+ * @brief Slots of the players waiting for an invitation (a player takes the first free slot from their id modulo this
+ * number)
+ */
+#define SNAPSHOT_MAX_PLAYERS 1024
+
+/**
+ * @def SNAPSHOT_NAME_SIZE
+ * @brief Size of a first or last name in the snapshot (truncated)
+ */
+#define SNAPSHOT_NAME_SIZE 24
+
+/**
+ * @def SNAPSHOT_SCORE_SIZE
+ * @brief Size of the score of a court in the snapshot
+ */
+#define SNAPSHOT_SCORE_SIZE 48
+
+/**
+ * @def SNAPSHOT_SYNC_INTERVAL
+ * @brief Time between two writes of the changed snapshot to the disk (ms), a crash of the process loses nothing
+ */
+#define SNAPSHOT_SYNC_INTERVAL 1000
+
+/**
+ * @struct court_image
+ * @brief State of a court, as written in the snapshot
+ * @var version: number of the image (the valid image with the highest one is the state of the court)
+ * @var checksum: checksum of the other fields, written with them
+ * @var id: court's id
+ * @var listen_port: port the players connect to
+ * @var key: durable identity of the court
+ * @var sequence: sequence number of the last message of the court applied
+ * @var match_start: time the current match was assigned at (0 if none)
+ * @var disconnected_at: time the court process left at (0 while connected)
+ * @var player_ids: ids of the players of the current match
+ * @var ip: court's IP
+ * @var format: name of the scoring format
+ * @var first_names: first names of the players
+ * @var last_names: last names of the players
+ * @var score: last publication of the court (score, without its trace)
+ * @var code: code of the last publication (SCORE or END_MATCH)
+ * @var available: 1 if the court is available, 0 otherwise
+ */
+struct court_image {
+	uint32_t version;
+	uint32_t checksum;
+	int32_t id;
+	int32_t listen_port;
+	uint64_t key;
+	uint64_t sequence;
+	int64_t match_start;
+	int64_t disconnected_at;
+	int32_t player_ids[2];
+	char ip[16];
+	char format[16];
+	char first_names[2][SNAPSHOT_NAME_SIZE];
+	char last_names[2][SNAPSHOT_NAME_SIZE];
+	char score[SNAPSHOT_SCORE_SIZE];
+	char code;
+	char available;
+	char padding[6];
+};
+
+/**
+ * @typedef court_image_t
+ * @brief Typedef for the court_image structure
+ */
+typedef struct court_image court_image_t;
+
+/**
+ * @struct player_image
+ * @brief Player waiting for an invitation, as written in the snapshot
+ * @var checksum: checksum of the other fields, written with them
+ * @var id: player's id (0 if the slot is free)
+ * @var first_name: player's first name
+ * @var last_name: player's last name
+ */
+struct player_image {
+	uint32_t checksum;
+	int32_t id;
+	char first_name[SNAPSHOT_NAME_SIZE];
+	char last_name[SNAPSHOT_NAME_SIZE];
+};
+
+/**
+ * @typedef player_image_t
+ * @brief Typedef for the player_image structure
+ */
+typedef struct player_image player_image_t;
+
+/**
+ * @struct snapshot_header
+ * @brief First page of the snapshot file
+ * @var magic: identifies a snapshot file
+ * @var court_image_size: size of the images of the courts (a file with other images is reset)
+ * @var player_image_size: size of the images of the players
+ * @var last_player_id: last player's id given
+ * @var last_court_id: last court's id given
+ */
+struct snapshot_header {
+	char magic[8];
+	uint32_t court_image_size;
+	uint32_t player_image_size;
+	int32_t last_player_id;
+	int32_t last_court_id;
+};
+
+/**
+ * @typedef snapshot_header_t
+ * @brief Typedef for the snapshot_header structure
+ */
+typedef struct snapshot_header snapshot_header_t;
+
+/**
+ * @fn int map_snapshot(const char* path)
+ * @brief Maps the snapshot file (created if needed, reset if written with other images), without restoring it
+ * @param path: snapshot file
+ * @return int: 0 if mapped (or already), -1 if the file cannot be mapped
+ */
+int map_snapshot(const char* path);
+
+/**
+ * @fn int load_snapshot(const char* path)
+ * @brief Maps the snapshot of the registries (created if needed) and restores them: the id counters, the courts
+ * (waiting for their court process to reconnect, with their match and score) and the players waiting for an invitation
+ * (given their id back when they reconnect)
+ * @param path: snapshot file
+ * @return int: number of courts restored, -1 if the file cannot be mapped (the registries are not kept)
+ */
+int load_snapshot(const char* path);
+
+/**
+ * @fn int reserve_snapshot_slot(unsigned long long key)
+ * @brief Gives a new court its slot in the snapshot
+ * @param key: durable identity of the court (a court without one cannot be recognized after a restart)
+ * @return int: slot, -1 if the court is not kept
+ */
+int reserve_snapshot_slot(unsigned long long key);
+
+/**
+ * @fn void free_snapshot_slot(court_t* court)
+ * @brief Frees the slot of a court no longer kept in the snapshot, for the next courts
+ * @param court: court whose slot is freed
+ */
+void free_snapshot_slot(court_t* court);
+
+/**
+ * @fn void snapshot_court(court_t* court)
+ * @brief Writes the current state of a court in its slot (in the mapping: safe from a crash of the process)
+ * @param court: court that has changed
+ */
+void snapshot_court(court_t* court);
+
+/**
+ * @fn void snapshot_waiting_player(player_t* player)
+ * @brief Writes a player waiting for an invitation in the snapshot
+ * @param player: player added to the list
+ */
+void snapshot_waiting_player(player_t* player);
+
+/**
+ * @fn void forget_waiting_player(int id)
+ * @brief Removes a player who no longer waits for an invitation from the snapshot
+ * @param id: player's id
+ */
+void forget_waiting_player(int id);
+
+/**
+ * @fn void snapshot_player_id(int id)
+ * @brief Writes the last player's id given in the snapshot
+ * @param id: id given
+ */
+void snapshot_player_id(int id);
+
+/**
+ * @fn void snapshot_court_id(int id)
+ * @brief Writes the last court's id given in the snapshot
+ * @param id: id given
+ */
+void snapshot_court_id(int id);
+
+/**
+ * @fn int returning_player_id(const char* first_name, const char* last_name)
+ * @brief Gives back their id to a player who was waiting for an invitation before a restart (once)
+ * @param first_name: player's first name
+ * @param last_name: player's last name
+ * @return int: previous id, 0 if the player was not waiting
+ */
+int returning_player_id(const char* first_name, const char* last_name);
+
+/**
+ * @fn int snapshot_kept()
+ * @brief Tells if the registries are kept in the snapshot (and can be copied by a standby)
+ * @return int: 1 if kept, 0 otherwise
+ */
+int snapshot_kept();
+
+/**
+ * @fn uint32_t copy_court_image(int slot, court_image_t* image)
+ * @brief Copies the last image of a court (for a standby)
+ * @param slot: court's slot
+ * @param image: filled with the image (zeroed if the slot is free)
+ * @return uint32_t: version of the image, 0 if the slot is free
+ */
+uint32_t copy_court_image(int slot, court_image_t* image);
+
+/**
+ * @fn int copy_player_image(int slot, player_image_t* image)
+ * @brief Copies the image of a player waiting for an invitation (for a standby)
+ * @param slot: player's slot
+ * @param image: filled with the image (zeroed if the slot is free)
+ * @return int: 0 if copied, -1 if it was being written (copied again later)
+ */
+int copy_player_image(int slot, player_image_t* image);
+
+/**
+ * @fn void copy_snapshot_ids(int* last_player_id, int* last_court_id)
+ * @brief Copies the last ids given (for a standby)
+ * @param last_player_id: filled with the last player's id given
+ * @param last_court_id: filled with the last court's id given
+ */
+void copy_snapshot_ids(int* last_player_id, int* last_court_id);
+
+/**
+ * @fn void apply_court_image(int slot, court_image_t* image)
+ * @brief Writes the image of a court received from the primary in the snapshot of a standby
+ * @param slot: court's slot
+ * @param image: image (version 0 to free the slot)
+ */
+void apply_court_image(int slot, court_image_t* image);
+
+/**
+ * @fn void apply_player_image(int slot, player_image_t* image)
+ * @brief Writes the image of a player received from the primary in the snapshot of a standby
+ * @param slot: player's slot
+ * @param image: image (id 0 to free the slot)
+ */
+void apply_player_image(int slot, player_image_t* image);
+
+/**
+ * @fn void apply_snapshot_ids(int last_player_id, int last_court_id)
+ * @brief Writes the last ids given by the primary in the snapshot of a standby
+ * @param last_player_id: last player's id given
+ * @param last_court_id: last court's id given
+ */
+void apply_snapshot_ids(int last_player_id, int last_court_id);
+
+#endif //PANTALLA_DEPORTIVA_V2_SNAPSHOT_H
@@ -0,0 +1,305 @@
+/**
+ * @file spectator_session.c
+ * @brief Connection of a spectator following one or several courts
+ * @date 2024-05-20
+ */
+
+#include <errno.h>
+#include <sched.h>
+
+#include "spectator_session.h"
+#include "latency.h"
+#include "metrics.h"
+
+/**
+ * @fn void init_session(spectator_session_t* session, socket_t* socket)
+ * @brief Initializes the session of a spectator
+ * @param session: session to initialize
+ * @param socket: spectator's socket
+ */
+void init_session(spectator_session_t* session, socket_t* socket) {
+	session->socket = socket;
+	pthread_mutex_init(&session->mutex, NULL);
+	session->pending_size = 0;
+	session->deferred = NULL;
+	session->nb_deferred = 0;
+	session->flushing = 0;
+	session->closed = 0;
+	pipe(session->wakeup);
+	fcntl(session->wakeup[0], F_SETFL, O_NONBLOCK);
+	fcntl(session->wakeup[1], F_SETFL, O_NONBLOCK);
+}
+
+/**
+ * @fn void close_session(spectator_session_t* session)
+ * @brief Frees what the session holds, once no broadcaster can use it anymore
+ * @param session: spectator's session
+ */
+void close_session(spectator_session_t* session) {
+	deferred_publication_t* publication;
+
+	while ((publication = session->deferred) != NULL) {
+		session->deferred = publication->next;
+		free(publication);
+	}
+	close(session->wakeup[0]);
+	close(session->wakeup[1]);
+	pthread_mutex_destroy(&session->mutex);
+}
+
+/**
+ * @fn void append_pending(spectator_session_t* session, char* encoded, size_t size)
+ * @brief Appends messages to the pending ones (there must be room)
+ * @param session: spectator's session
+ * @param encoded: serialized messages (each one ending with its \0)
+ * @param size: number of bytes
+ * @note the mutex must be held
+ */
+void append_pending(spectator_session_t* session, char* encoded, size_t size) {
+	size_t nb_messages = 0, i;
+
+	memcpy(session->pending + session->pending_size, encoded, size);
+	session->pending_size += size;
+
+	// Each message ends with its \0
+	for (i = 0; i < size; i++)
+		nb_messages += encoded[i] == '\0';
+	count_metric(COUNTER_MESSAGES_SENT, nb_messages);
+	count_metric(COUNTER_BYTES_SENT, size);
+}
+
+/**
+ * @fn void move_deferred(spectator_session_t* session)
+ * @brief Moves the deferred publications to the pending messages, in order, as long as there is room
+ * @param session: spectator's session
+ * @note the mutex must be held
+ */
+void move_deferred(spectator_session_t* session) {
+	deferred_publication_t* publication;
+
+	while ((publication = session->deferred) != NULL && session->pending_size + publication->size <= SESSION_BUFFER) {
+		append_pending(session, publication->encoded, publication->size);
+		session->deferred = publication->next;
+		session->nb_deferred--;
+		free(publication);
+	}
+}
+
+/**
+ * @fn void defer_publication(spectator_session_t* session, int court_id, int final, char* encoded, size_t size)
+ * @brief Keeps a publication that does not fit in the buffer: it replaces the last SCORE of its court still deferred
+ * (which is stale), an END_MATCH is never replaced
+ * @param session: spectator's session
+ * @param court_id: id of the court
+ * @param final: 1 for an END_MATCH, 0 for a SCORE
+ * @param encoded: serialized messages (each one ending with its \0)
+ * @param size: number of bytes
+ * @note the mutex must be held
+ */
+void defer_publication(spectator_session_t* session, int court_id, int final, char* encoded, size_t size) {
+	deferred_publication_t **publication_ptr, *last = NULL;
+
+	for (publication_ptr = &session->deferred; *publication_ptr != NULL; publication_ptr = &(*publication_ptr)->next)
+		if ((*publication_ptr)->court_id == court_id)
+			last = *publication_ptr;
+
+	if (last == NULL || last->final) {
+		// A spectator who stays late for that many publications cannot follow anymore
+		if (session->nb_deferred == SESSION_MAX_DEFERRED) {
+			session->closed = 1;
+			shutdown(session->socket->file_descriptor, SHUT_RDWR);
+			return;
+		}
+
+		last = (deferred_publication_t*) malloc(sizeof(deferred_publication_t));
+		last->court_id = court_id;
+		last->next = NULL;
+		*publication_ptr = last;
+		session->nb_deferred++;
+	}
+
+	memcpy(last->encoded, encoded, size);
+	last->size = size;
+	last->final = final;
+}
+
+/**
+ * @fn void flush_pending(spectator_session_t* session, int flags)
+ * @brief Writes the pending messages, including the ones added by other threads meanwhile (and the deferred ones)
+ * @param session: spectator's session
+ * @param flags: flags of send (MSG_DONTWAIT to leave the rest pending if the spectator is late)
+ * @note the mutex must be held and flushing set: it is released during each write
+ */
+void flush_pending(spectator_session_t* session, int flags) {
+	ssize_t write_size;
+	size_t batch_size;
+
+	while (session->pending_size > 0 && !session->closed) {
+		// Only this thread touches the start of the buffer, the others append after batch_size
+		batch_size = session->pending_size;
+		pthread_mutex_unlock(&session->mutex);
+		write_size = send(session->socket->file_descriptor, session->pending, batch_size, MSG_NOSIGNAL | flags);
+		pthread_mutex_lock(&session->mutex);
+
+		if (write_size == -1) {
+			// Late spectator: the session thread sends the rest once the socket is writable
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				write(session->wakeup[1], "", 1);
+				break;
+			}
+
+			// The spectator has left: waking up the session thread
+			session->closed = 1;
+			shutdown(session->socket->file_descriptor, SHUT_RDWR);
+			break;
+		}
+
+		memmove(session->pending, session->pending + write_size, session->pending_size - write_size);
+		session->pending_size -= write_size;
+		move_deferred(session);
+	}
+}
+
+/**
+ * @fn int session_send(spectator_session_t* session, char* encoded, size_t size)
+ * @brief Sends serialized messages to the spectator from the session thread, waiting for room if needed
+ * @param session: spectator's session
+ * @param encoded: serialized messages (each one ending with its \0)
+ * @param size: number of bytes
+ * @return int: 0 if sent or queued, -1 if the session is closed
+ */
+int session_send(spectator_session_t* session, char* encoded, size_t size) {
+	int result;
+
+	pthread_mutex_lock(&session->mutex);
+
+	// Making room for the messages (another thread may be writing)
+	while (!session->closed && session->pending_size + size > SESSION_BUFFER) {
+		if (session->flushing) {
+			pthread_mutex_unlock(&session->mutex);
+			sched_yield();
+			pthread_mutex_lock(&session->mutex);
+		}
+		else {
+			session->flushing = 1;
+			flush_pending(session, 0);
+			session->flushing = 0;
+		}
+	}
+
+	if (session->closed) {
+		pthread_mutex_unlock(&session->mutex);
+		return -1;
+	}
+
+	append_pending(session, encoded, size);
+
+	// If another thread is writing, it sends these messages with its batch
+	if (!session->flushing) {
+		session->flushing = 1;
+		flush_pending(session, 0);
+		session->flushing = 0;
+	}
+
+	result = session->closed ? -1 : 0;
+	pthread_mutex_unlock(&session->mutex);
+
+	return result;
+}
+
+/**
+ * @fn int session_publish(spectator_session_t* session, int court_id, int final, char* encoded, size_t size)
+ * @brief Sends a publication of a court to the spectator from a broadcaster, batched with the messages of the other
+ * courts, without waiting: a publication that does not fit is deferred
+ * @param session: spectator's session
+ * @param court_id: id of the court
+ * @param final: 1 for an END_MATCH, 0 for a SCORE
+ * @param encoded: serialized messages (each one ending with its \0)
+ * @param size: number of bytes
+ * @return int: 0 if sent, queued or deferred, -1 if the session is closed
+ */
+int session_publish(spectator_session_t* session, int court_id, int final, char* encoded, size_t size) {
+	int result;
+
+	pthread_mutex_lock(&session->mutex);
+
+	if (session->closed) {
+		pthread_mutex_unlock(&session->mutex);
+		return -1;
+	}
+
+	// Behind the deferred publications, so that a court's scores are received in order
+	if (session->deferred != NULL || session->pending_size + size > SESSION_BUFFER)
+		defer_publication(session, court_id, final, encoded, size);
+	else
+		append_pending(session, encoded, size);
+
+	if (!session->flushing) {
+		session->flushing = 1;
+		flush_pending(session, MSG_DONTWAIT);
+		session->flushing = 0;
+	}
+
+	result = session->closed ? -1 : 0;
+	pthread_mutex_unlock(&session->mutex);
+
+	return result;
+}
+
+/**
+ * @fn int session_wait_request(spectator_session_t* session)
+ * @brief Waits for a request of the spectator, sending meanwhile the messages left pending once the socket is writable
+ * @param session: spectator's session
+ * @return int: 1 once a request (or the end of the connection) can be read, 0 if the session is closed
+ */
+int session_wait_request(spectator_session_t* session) {
+	struct pollfd fds[2];
+	char drained[16];
+
+	fds[0].fd = session->socket->file_descriptor;
+	fds[1].fd = session->wakeup[0];
+	fds[1].events = POLLIN;
+
+	while (1) {
+		pthread_mutex_lock(&session->mutex);
+		if (session->closed) {
+			pthread_mutex_unlock(&session->mutex);
+			return 0;
+		}
+		fds[0].events = POLLIN | (session->pending_size > 0 ? POLLOUT : 0);
+		pthread_mutex_unlock(&session->mutex);
+
+		// Woken up by the broadcasters leaving messages pending
+		if (poll(fds, 2, -1) == -1)
+			continue;
+		while (read(session->wakeup[0], drained, sizeof(drained)) > 0);
+
+		if (fds[0].revents & POLLOUT) {
+			pthread_mutex_lock(&session->mutex);
+			if (!session->flushing) {
+				session->flushing = 1;
+				flush_pending(session, MSG_DONTWAIT);
+				session->flushing = 0;
+			}
+			pthread_mutex_unlock(&session->mutex);
+		}
+
+		if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+			return 1;
+	}
+}
+
+/**
+ * @fn void session_send_message(spectator_session_t* session, message_t* message)
+ * @brief Serializes and sends a message to the spectator (from the session thread)
+ * @param session: spectator's session
+ * @param message: message to send
+ */
+void session_send_message(spectator_session_t* session, message_t* message) {
+	buffer_t serialized_content;
+	long start = monotonic_ns();
+
+	serialize_message(message, serialized_content);
+	session_send(session, serialized_content, strlen(serialized_content) + 1);
+	record_send(monotonic_ns() - start);
+}
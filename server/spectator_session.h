@@ -0,0 +1,132 @@
+#ifndef PANTALLA_DEPORTIVA_V2_SPECTATOR_SESSION_H
+#define PANTALLA_DEPORTIVA_V2_SPECTATOR_SESSION_H
+
+#include <pthread.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../socket/data.h"
+#include "../serialization/serialization.h"
+
+/**
+ * @def SESSION_BUFFER
+ * @brief Size of the buffer of the messages waiting to be sent to a spectator
+ */
+#define SESSION_BUFFER (16 * MAX_BUFFER)
+
+/**
+ * @def SESSION_MAX_DEFERRED
+ * @brief Maximum number of publications deferred for a spectator (beyond, they are too late to follow)
+ */
+#define SESSION_MAX_DEFERRED 64
+
+/**
+ * @struct deferred_publication
+ * @brief Publication of a court that did not fit in the buffer of a spectator, sent once there is room
+ * @var court_id: id of the court
+ * @var final: 1 for an END_MATCH (never replaced), 0 for a SCORE (replaced by the next publication of the court)
+ * @var encoded: serialized messages (each one ending with its \0)
+ * @var size: number of bytes
+ * @var next: next publication, in the order they are sent
+ */
+struct deferred_publication {
+	int court_id;
+	int final;
+	char encoded[2 * MAX_BUFFER];
+	size_t size;
+	struct deferred_publication* next;
+};
+
+/**
+ * @typedef deferred_publication_t
+ * @brief Typedef for deferred_publication structure
+ */
+typedef struct deferred_publication deferred_publication_t;
+
+/**
+ * @struct spectator_session
+ * @brief Connection of a spectator, shared by the broadcasters of all the courts they follow
+ * @var socket: spectator's socket
+ * @var mutex: mutex for the buffer and the flags
+ * @var pending: messages waiting to be sent (the whole batch is sent in one write)
+ * @var pending_size: number of bytes in pending
+ * @var deferred: publications waiting for room in pending
+ * @var nb_deferred: number of publications deferred
+ * @var flushing: 1 while a thread is writing pending on the socket
+ * @var closed: 1 once the spectator has left (or is too late to follow)
+ * @var wakeup: pipe written when messages are left pending, the session thread then waits for the socket to be writable
+ */
+struct spectator_session {
+	socket_t* socket;
+	pthread_mutex_t mutex;
+	char pending[SESSION_BUFFER];
+	size_t pending_size;
+	deferred_publication_t* deferred;
+	int nb_deferred;
+	int flushing;
+	int closed;
+	int wakeup[2];
+};
+
+/**
+ * @typedef spectator_session_t
+ * @brief Typedef for spectator_session structure
+ */
+typedef struct spectator_session spectator_session_t;
+
+/**
+ * @fn void init_session(spectator_session_t* session, socket_t* socket)
+ * @brief Initializes the session of a spectator
+ * @param session: session to initialize
+ * @param socket: spectator's socket
+ */
+void init_session(spectator_session_t* session, socket_t* socket);
+
+/**
+ * @fn void close_session(spectator_session_t* session)
+ * @brief Frees what the session holds, once no broadcaster can use it anymore
+ * @param session: spectator's session
+ */
+void close_session(spectator_session_t* session);
+
+/**
+ * @fn int session_send(spectator_session_t* session, char* encoded, size_t size)
+ * @brief Sends serialized messages to the spectator from the session thread, waiting for room if needed
+ * @param session: spectator's session
+ * @param encoded: serialized messages (each one ending with its \0)
+ * @param size: number of bytes
+ * @return int: 0 if sent or queued, -1 if the session is closed
+ */
+int session_send(spectator_session_t* session, char* encoded, size_t size);
+
+/**
+ * @fn int session_publish(spectator_session_t* session, int court_id, int final, char* encoded, size_t size)
+ * @brief Sends a publication of a court to the spectator from a broadcaster, batched with the messages of the other
+ * courts, without waiting: a publication that does not fit is deferred
+ * @param session: spectator's session
+ * @param court_id: id of the court
+ * @param final: 1 for an END_MATCH, 0 for a SCORE
+ * @param encoded: serialized messages (each one ending with its \0)
+ * @param size: number of bytes
+ * @return int: 0 if sent, queued or deferred, -1 if the session is closed
+ */
+int session_publish(spectator_session_t* session, int court_id, int final, char* encoded, size_t size);
+
+/**
+ * @fn int session_wait_request(spectator_session_t* session)
+ * @brief Waits for a request of the spectator, sending meanwhile the messages left pending once the socket is writable
+ * @param session: spectator's session
+ * @return int: 1 once a request (or the end of the connection) can be read, 0 if the session is closed
+ */
+int session_wait_request(spectator_session_t* session);
+
+/**
+ * @fn void session_send_message(spectator_session_t* session, message_t* message)
+ * @brief Serializes and sends a message to the spectator (from the session thread)
+ * @param session: spectator's session
+ * @param message: message to send
+ */
+void session_send_message(spectator_session_t* session, message_t* message);
+
+#endif //PANTALLA_DEPORTIVA_V2_SPECTATOR_SESSION_H
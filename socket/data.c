@@ -8,6 +8,8 @@
  * 	- DELANNOY Anaël
  */
 
+#include <errno.h>
+
 #include "data.h"
 
 /**
@@ -19,7 +21,8 @@
 ssize_t send_stream_message(socket_t *exchange_socket, buffer_t content) {
 	ssize_t write_size;
 
-	CHECK(write_size = write(exchange_socket->file_descriptor, content, strlen(content)), "Can't send STREAM message")
+	// Sending the \0 as well: it delimits the messages on the stream
+	CHECK(write_size = write(exchange_socket->file_descriptor, content, strlen(content) + 1), "Can't send STREAM message")
 
 	return write_size;
 }
@@ -91,16 +94,29 @@ ssize_t send_message(socket_t *exchange_socket, generic content, fct_ptr seriali
  * @param content: received content
  */
 ssize_t receive_stream_message(socket_t *exchange_socket, buffer_t content) {
-	ssize_t read_size;
+	ssize_t read_size = 0, peek_size;
+	char *end;
 
 	// Clearing the buffer
 	memset(content, 0, sizeof(buffer_t));
 
-	// Using read to receive data
-	CHECK(read_size = read(exchange_socket->file_descriptor, content, sizeof(buffer_t) - 1), "Can't read STREAM message");
-
-	// Ending received data with \0
-	content[strlen(content)] = '\0';
+	// Reading one message only: peeking first to find its \0, so the following messages stay in the socket
+	do {
+		peek_size = recv(exchange_socket->file_descriptor, content + read_size, sizeof(buffer_t) - 1 - read_size, MSG_PEEK);
+		if (peek_size == -1 && errno == ECONNRESET)
+			peek_size = 0; // The peer has left without reading everything, same as closing
+		CHECK(peek_size, "Can't read STREAM message");
+		if (peek_size == 0)
+			break; // Connection closed
+
+		end = memchr(content + read_size, '\0', peek_size);
+		if (end != NULL)
+			peek_size = end - (content + read_size) + 1;
+
+		// Using read to consume the message
+		CHECK(peek_size = read(exchange_socket->file_descriptor, content + read_size, peek_size), "Can't read STREAM message");
+		read_size += peek_size;
+	} while (end == NULL && read_size < sizeof(buffer_t) - 1);
 
 	return read_size;
 }
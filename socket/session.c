@@ -64,6 +64,10 @@ socket_t create_addressed_socket(int mode, char *ip_address, short port){
 	// Creating the socket
 	sock = create_socket(mode);
 
+	// A restarted server binds its port again right away, despite the connections of the previous one in TIME_WAIT
+	if (mode == SOCK_STREAM)
+		CHECK(setsockopt(sock.file_descriptor, SOL_SOCKET, SO_REUSEADDR, &(int) {1}, sizeof(int)), "Can't reuse address");
+
 	// Filling the structure
 	addr2struct(&sock.local_address, ip_address, port);
 
@@ -90,8 +94,9 @@ socket_t create_listen_socket(char *ip_address, short port){
 	// Creating the socket
 	sock = create_addressed_socket(SOCK_STREAM, ip_address, port);
 
-	// Listening, with a maximum of 5 clients
-	CHECK(listen(sock.file_descriptor, 5), "Can't listen on socket");
+	// Listening, with as many connections waiting for accept as the system allows (a burst of clients would
+	// otherwise have their SYN dropped and retried a second later)
+	CHECK(listen(sock.file_descriptor, SOMAXCONN), "Can't listen on socket");
 
 	return sock;
 }
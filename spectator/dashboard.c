@@ -0,0 +1,251 @@
+/**
+ * @file dashboard.c
+ * @brief Live scores of all the courts on one screen, for a display at the entrance of a venue
+ * @date 2024-05-31
+ */
+
+#include "dashboard.h"
+
+const client_callbacks_t dashboard_callbacks = {
+	.on_answer = on_dashboard_answer,
+	.on_courts = on_dashboard_courts,
+	.on_score = on_dashboard_score,
+	.on_match_end = on_dashboard_match_end,
+	.on_closed = on_dashboard_closed
+};
+
+/**
+ * @fn int run_dashboard(char* ip, int port, int frame_rate)
+ * @brief Follows all the courts of the server and shows their scores live until the connection is lost
+ * @param ip: server's address
+ * @param port: server's port
+ * @param frame_rate: maximum number of redraws per second
+ * @return int: exit status
+ */
+int run_dashboard(char* ip, int port, int frame_rate) {
+	dashboard_t* dashboard = (dashboard_t*) calloc(1, sizeof(dashboard_t));
+	client_t* client;
+	long now, timeout;
+
+	memset(dashboard->row_of_court, -1, sizeof(dashboard->row_of_court));
+	dashboard->frame_interval = 1000000 / (frame_rate > 0 ? frame_rate : DEFAULT_FRAME_RATE);
+	dashboard->full_redraw = 1;
+
+	client = client_connect(ip, port, &dashboard_callbacks, dashboard);
+	if (client == NULL) {
+		fprintf(stderr, "Impossible de se connecter au serveur\n");
+		return 1;
+	}
+
+	// Following all the courts once authenticated
+	client_authenticate(client, SPECTATOR_AUTH, NULL, NULL);
+	client_ask_courts(client);
+	dashboard->last_refresh = monotonic_time();
+
+	while (!dashboard->over) {
+		// Sleeping until the next message, the next frame if a row has changed, or the next list of the courts
+		now = monotonic_time();
+		timeout = dashboard->last_refresh + COURTS_REFRESH_INTERVAL * 1000L - now;
+		if ((dashboard->nb_dirty > 0 || dashboard->full_redraw) && dashboard->last_frame + dashboard->frame_interval - now < timeout)
+			timeout = dashboard->last_frame + dashboard->frame_interval - now;
+
+		client_poll(&client, 1, timeout > 0 ? (int) ((timeout + 999) / 1000) : 0);
+
+		// The rows that have changed are drawn at most frame_rate times per second, however many updates came
+		now = monotonic_time();
+		if ((dashboard->nb_dirty > 0 || dashboard->full_redraw) && now - dashboard->last_frame >= dashboard->frame_interval)
+			draw_dashboard(dashboard, now);
+
+		if (now - dashboard->last_refresh >= COURTS_REFRESH_INTERVAL * 1000L) {
+			client_ask_courts(client);
+			dashboard->last_refresh = now;
+		}
+	}
+
+	client_free(client);
+	free(dashboard);
+
+	return 0;
+}
+
+/**
+ * @fn void draw_dashboard(dashboard_t* dashboard, long now)
+ * @brief Redraws the rows that have changed (or the whole screen when courts were added) in one write
+ * @param dashboard: dashboard
+ * @param now: current time (us)
+ */
+void draw_dashboard(dashboard_t* dashboard, long now) {
+	static char frame[DASHBOARD_MAX_COURTS * 2 * COLUMN_WIDTH + 256];
+	struct winsize window;
+	court_row_t* row;
+	char formatted[64];
+	size_t size = 0;
+	int height = 24, rows_per_column, i;
+
+	// Smoothing the update rate shown in the header
+	if (dashboard->last_frame != 0)
+		dashboard->update_rate = 0.8 * dashboard->update_rate
+			+ 0.2 * dashboard->updates * 1e6 / (now - dashboard->last_frame);
+	dashboard->updates = 0;
+
+	// The courts fill the height of the terminal, then the next columns
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == 0 && window.ws_row > HEADER_LINES + 1)
+		height = window.ws_row;
+	rows_per_column = height - HEADER_LINES - 1; // The cursor waits on the last line
+
+	if (dashboard->full_redraw)
+		size += sprintf(frame + size, "\033[H\033[2J");
+	size += sprintf(frame + size, "\033[1;1H\033[KTerrains en direct : %d terrains, %.0f mises à jour/s",
+					dashboard->nb_rows, dashboard->update_rate);
+
+	for (i = 0; i < dashboard->nb_rows; i++) {
+		row = &dashboard->rows[i];
+		if (!row->dirty && !dashboard->full_redraw)
+			continue;
+
+		// Fixed width, so the row overwrites the previous one without clearing it
+		format_score(row->score, formatted, sizeof(formatted));
+		size += sprintf(frame + size, "\033[%d;%dHTerrain %-5d %-28.28s%-5s", HEADER_LINES + 1 + i % rows_per_column,
+						1 + (i / rows_per_column) * COLUMN_WIDTH, row->id, formatted, row->finished ? " fini" : "");
+		row->dirty = 0;
+	}
+
+	size += sprintf(frame + size, "\033[%d;1H", height);
+	fwrite(frame, 1, size, stdout);
+	fflush(stdout);
+
+	dashboard->nb_dirty = 0;
+	dashboard->full_redraw = 0;
+	dashboard->last_frame = now;
+}
+
+/**
+ * @fn void format_score(char* score, char* formatted, size_t size)
+ * @brief Formats a score for the dashboard ("40/15:6/1:4/2:0/0" gives "40-15  6-1 4-2 0-0")
+ * @param score: score received
+ * @param formatted: filled with the formatted score
+ * @param size: size of formatted
+ */
+void format_score(char* score, char* formatted, size_t size) {
+	size_t length = 0;
+	char* c;
+
+	for (c = score; *c != '\0' && length < size - 2; c++) {
+		if (*c == '/')
+			formatted[length++] = '-';
+		else if (*c == ':') {
+			formatted[length++] = ' ';
+			if (c == strchr(score, ':'))
+				formatted[length++] = ' '; // Separating the points from the games
+		}
+		else
+			formatted[length++] = *c;
+	}
+
+	formatted[length] = '\0';
+}
+
+/**
+ * @fn void on_dashboard_answer(client_t* client, char request, int accepted, char* data)
+ * @brief Handles the answers of the server to the authentication and the subscriptions
+ * @param client: spectator
+ * @param request: code of the request
+ * @param accepted: 1 for OK, 0 for NOK
+ * @param data: data of the answer
+ */
+void on_dashboard_answer(client_t* client, char request, int accepted, char* data) {
+	if (request == AUTH && !accepted) {
+		fprintf(stderr, "Authentication failed\n");
+		exit(1);
+	}
+}
+
+/**
+ * @fn void on_dashboard_courts(client_t* client, char* list, int more)
+ * @brief Follows the courts not shown yet
+ * @param client: spectator
+ * @param list: courts' ids, one per line
+ * @param more: 1 if another page follows (unused)
+ */
+void on_dashboard_courts(client_t* client, char* list, int more) {
+	dashboard_t* dashboard = (dashboard_t*) client->user_data;
+	court_row_t* row;
+	char *save_ptr, *token;
+	int id;
+
+	for (token = strtok_r(list, "\n", &save_ptr); token != NULL; token = strtok_r(NULL, "\n", &save_ptr)) {
+		id = atoi(token);
+		if (id <= 0 || id >= DASHBOARD_MAX_COURT_ID || dashboard->row_of_court[id] != -1
+		|| dashboard->nb_rows == DASHBOARD_MAX_COURTS)
+			continue;
+
+		// The server sends the current score right after the subscription, then each update (tried again with the next list if it cannot be sent now)
+		if (client_subscribe(client, id) == -1)
+			break;
+
+		row = &dashboard->rows[dashboard->nb_rows];
+		row->id = id;
+		strcpy(row->score, "...");
+		row->finished = 0;
+		dashboard->row_of_court[id] = dashboard->nb_rows++;
+		dashboard->full_redraw = 1;
+	}
+}
+
+/**
+ * @fn void on_dashboard_score(client_t* client, int court, char* score)
+ * @brief Updates the row of a court (drawn with the next frame)
+ * @param client: spectator
+ * @param court: court's id
+ * @param score: formatted score
+ */
+void on_dashboard_score(client_t* client, int court, char* score) {
+	dashboard_t* dashboard = (dashboard_t*) client->user_data;
+	court_row_t* row;
+
+	dashboard->updates++;
+	if (court <= 0 || court >= DASHBOARD_MAX_COURT_ID || dashboard->row_of_court[court] == -1)
+		return;
+
+	// Only the last score of a row is drawn
+	row = &dashboard->rows[dashboard->row_of_court[court]];
+	snprintf(row->score, sizeof(row->score), "%s", score);
+	row->finished = 0;
+	if (!row->dirty) {
+		row->dirty = 1;
+		dashboard->nb_dirty++;
+	}
+}
+
+/**
+ * @fn void on_dashboard_match_end(client_t* client, int court)
+ * @brief Marks the match of a court as over (drawn with the next frame)
+ * @param client: spectator
+ * @param court: court's id
+ */
+void on_dashboard_match_end(client_t* client, int court) {
+	dashboard_t* dashboard = (dashboard_t*) client->user_data;
+	court_row_t* row;
+
+	if (court <= 0 || court >= DASHBOARD_MAX_COURT_ID || dashboard->row_of_court[court] == -1)
+		return;
+
+	row = &dashboard->rows[dashboard->row_of_court[court]];
+	row->finished = 1;
+	if (!row->dirty) {
+		row->dirty = 1;
+		dashboard->nb_dirty++;
+	}
+}
+
+/**
+ * @fn void on_dashboard_closed(client_t* client)
+ * @brief Stops the dashboard once the connection is lost
+ * @param client: spectator
+ */
+void on_dashboard_closed(client_t* client) {
+	dashboard_t* dashboard = (dashboard_t*) client->user_data;
+
+	fprintf(stderr, "\nConnexion perdue\n");
+	dashboard->over = 1;
+}
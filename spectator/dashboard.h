@@ -0,0 +1,172 @@
+#ifndef PANTALLA_DEPORTIVA_V2_DASHBOARD_H
+#define PANTALLA_DEPORTIVA_V2_DASHBOARD_H
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "../client/client.h"
+
+/**
+ * @def DASHBOARD_MAX_COURTS
+ * @brief Maximum number of courts shown by the dashboard
+ */
+#define DASHBOARD_MAX_COURTS 1024
+
+/**
+ * @def DASHBOARD_MAX_COURT_ID
+ * @brief Highest court id the dashboard can show
+ */
+#define DASHBOARD_MAX_COURT_ID 65536
+
+/**
+ * @def DEFAULT_FRAME_RATE
+ * @brief Maximum number of redraws per second when none is given
+ */
+#define DEFAULT_FRAME_RATE 10
+
+/**
+ * @def COURTS_REFRESH_INTERVAL
+ * @brief Time between two requests of the list of the courts, to follow the new ones (ms)
+ */
+#define COURTS_REFRESH_INTERVAL 5000
+
+/**
+ * @def COLUMN_WIDTH
+ * @brief Width of a column of courts (the courts are shown on several columns when they do not fit the height)
+ */
+#define COLUMN_WIDTH 48
+
+/**
+ * @def HEADER_LINES
+ * @brief Lines above the courts
+ */
+#define HEADER_LINES 2
+
+/**
+ * @struct court_row
+ * @brief Court shown by the dashboard
+ * @var id: court's id
+ * @var score: last score received
+ * @var finished: 1 once the match is over (until the next one starts)
+ * @var dirty: 1 if the row has changed since the last redraw
+ */
+struct court_row {
+	int id;
+	char score[64];
+	int finished;
+	int dirty;
+};
+
+/**
+ * @typedef court_row_t
+ * @brief Typedef for the court_row structure
+ */
+typedef struct court_row court_row_t;
+
+/**
+ * @struct dashboard
+ * @brief Live scores of all the courts, redrawn at a capped frame rate
+ * @var rows: courts shown, in the order they were found
+ * @var nb_rows: number of courts shown
+ * @var row_of_court: index of the row of each court id, -1 if not shown
+ * @var frame_interval: minimum time between two redraws (us)
+ * @var last_frame: time of the last redraw (us)
+ * @var last_refresh: time of the last request of the list of the courts (us)
+ * @var nb_dirty: number of rows changed since the last redraw
+ * @var full_redraw: 1 if the whole screen must be redrawn (new courts)
+ * @var updates: score updates received since the last redraw
+ * @var update_rate: score updates per second, shown in the header
+ * @var over: 1 once the connection is lost
+ */
+struct dashboard {
+	court_row_t rows[DASHBOARD_MAX_COURTS];
+	int nb_rows;
+	int row_of_court[DASHBOARD_MAX_COURT_ID];
+	long frame_interval;
+	long last_frame;
+	long last_refresh;
+	int nb_dirty;
+	int full_redraw;
+	long updates;
+	double update_rate;
+	int over;
+};
+
+/**
+ * @typedef dashboard_t
+ * @brief Typedef for the dashboard structure
+ */
+typedef struct dashboard dashboard_t;
+
+/**
+ * @fn int run_dashboard(char* ip, int port, int frame_rate)
+ * @brief Follows all the courts of the server and shows their scores live until the connection is lost
+ * @param ip: server's address
+ * @param port: server's port
+ * @param frame_rate: maximum number of redraws per second
+ * @return int: exit status
+ */
+int run_dashboard(char* ip, int port, int frame_rate);
+
+/**
+ * @fn void draw_dashboard(dashboard_t* dashboard, long now)
+ * @brief Redraws the rows that have changed (or the whole screen when courts were added) in one write
+ * @param dashboard: dashboard
+ * @param now: current time (us)
+ */
+void draw_dashboard(dashboard_t* dashboard, long now);
+
+/**
+ * @fn void format_score(char* score, char* formatted, size_t size)
+ * @brief Formats a score for the dashboard ("40/15:6/1:4/2:0/0" gives "40-15  6-1 4-2 0-0")
+ * @param score: score received
+ * @param formatted: filled with the formatted score
+ * @param size: size of formatted
+ */
+void format_score(char* score, char* formatted, size_t size);
+
+/**
+ * @fn void on_dashboard_answer(client_t* client, char request, int accepted, char* data)
+ * @brief Handles the answers of the server to the authentication and the subscriptions
+ * @param client: spectator
+ * @param request: code of the request
+ * @param accepted: 1 for OK, 0 for NOK
+ * @param data: data of the answer
+ */
+void on_dashboard_answer(client_t* client, char request, int accepted, char* data);
+
+/**
+ * @fn void on_dashboard_courts(client_t* client, char* list, int more)
+ * @brief Follows the courts not shown yet
+ * @param client: spectator
+ * @param list: courts' ids, one per line
+ * @param more: 1 if another page follows (unused)
+ */
+void on_dashboard_courts(client_t* client, char* list, int more);
+
+/**
+ * @fn void on_dashboard_score(client_t* client, int court, char* score)
+ * @brief Updates the row of a court (drawn with the next frame)
+ * @param client: spectator
+ * @param court: court's id
+ * @param score: formatted score
+ */
+void on_dashboard_score(client_t* client, int court, char* score);
+
+/**
+ * @fn void on_dashboard_match_end(client_t* client, int court)
+ * @brief Marks the match of a court as over (drawn with the next frame)
+ * @param client: spectator
+ * @param court: court's id
+ */
+void on_dashboard_match_end(client_t* client, int court);
+
+/**
+ * @fn void on_dashboard_closed(client_t* client)
+ * @brief Stops the dashboard once the connection is lost
+ * @param client: spectator
+ */
+void on_dashboard_closed(client_t* client);
+
+#endif //PANTALLA_DEPORTIVA_V2_DASHBOARD_H
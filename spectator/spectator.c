@@ -1,127 +1,213 @@
 #include "spectator.h"
 
+const client_callbacks_t callbacks = {
+	.on_answer = on_answer,
+	.on_courts = on_courts,
+	.on_score = on_score,
+	.on_match_end = on_match_end,
+	.on_closed = on_closed
+};
+
 int main(int argc, char** argv) {
-	socket_t socket;
+	spectator_session_t session = {0};
+	client_t* client;
 
 	if (argc < 3) {
-		fprintf(stderr, "Usage: %s <ServerIP> <ServerPort>\n", argv[0]);
+		fprintf(stderr, "Usage: %s <ServerIP> <ServerPort> [--dashboard [MaxFramesPerSecond]]\n", argv[0]);
 		return 1;
 	}
 
+	// The hops of the points seen here are printed on stderr on each SIGUSR2 (kill -USR2)
+	start_trace_dumper();
+
+	// Dashboard mode: all the courts live on one screen
+	if (argc > 3 && strcmp(argv[3], "--dashboard") == 0)
+		return run_dashboard(argv[1], atoi(argv[2]), argc > 4 ? atoi(argv[4]) : DEFAULT_FRAME_RATE);
+
 	// Connecting to the server
-	socket = connect_to(argv[1], atoi(argv[2]));
+	client = client_connect(argv[1], atoi(argv[2]), &callbacks, &session);
+	if (client == NULL) {
+		fprintf(stderr, "Impossible de se connecter au serveur\n");
+		return 1;
+	}
 
 	// Authenticating
 	printf("Authentification en cours...\n");
-	authenticate(socket);
-	printf("Authentification effectuée !\n");
-
-	// Selecting a court
-	select_and_subscribe(socket);
+	client_authenticate(client, SPECTATOR_AUTH, NULL, NULL);
+
+	// Selecting a court once authenticated, then displaying its score as it comes
+	while (!session.over) {
+		// Following the court on the server that takes over
+		if (session.lost) {
+			client_free(client);
+			client = reconnect(argv[1], atoi(argv[2]), &session);
+			if (client == NULL) {
+				fprintf(stderr, "Connexion perdue\n");
+				return 1;
+			}
+		}
 
-	// If one court is selected, listen for SCORE requests and display them
-	listen_for_score(socket);
+		if (client_poll(&client, 1, -1) == -1)
+			break;
+	}
 
-	// Closing socket
-	close(socket.file_descriptor);
+	client_free(client);
 
 	return 0;
 }
 
 /**
- * @brief Authenticates the spectator
- * @param socket Server socket
+ * @fn client_t* reconnect(char* ip, int port, spectator_session_t* session)
+ * @brief Connects again to the server (taken over by its standby) to follow the same court
+ * @param ip: server's address
+ * @param port: server's port
+ * @param session: spectator's session
+ * @return client_t*: new client, NULL once the attempts are exhausted
  */
-void authenticate(socket_t socket) {
-	message_t message;
-	char data[2];
+client_t* reconnect(char* ip, int port, spectator_session_t* session) {
+	client_t* client = NULL;
 
-	sprintf(data, "%d", SPECTATOR_AUTH); // Converting SPECTATOR_AUTH to a string
-
-	// Preparing the authentication message
-	prepare_message(&message, AUTH, data);
+	while (client == NULL && session->attempts++ < RECONNECT_ATTEMPTS) {
+		usleep(RECONNECT_DELAY * 1000);
+		client = client_connect(ip, port, &callbacks, session);
+	}
 
-	// Sending the message
-	send_message(&socket, &message, serialize_message);
+	// Subscribing again once authenticated (a refused connection is retried from on_closed)
+	if (client != NULL) {
+		session->lost = 0;
+		client_authenticate(client, SPECTATOR_AUTH, NULL, NULL);
+	}
 
-	// Waiting for the OK response
-	receive_message(&socket, &message, deserialize_message);
+	return client;
+}
 
-	if (message.code == (char) OK)
-		printf("Authenticated successfully\n");
+/**
+ * @fn void select_court(client_t* client)
+ * @brief Asks the spectator which court to follow (or to list the courts)
+ * @param client: spectator
+ */
+void select_court(client_t* client) {
+	spectator_session_t* session = (spectator_session_t*) client->user_data;
+
+	printf("A quel terrain voulez-vous vous abonner ? (numéro de terrain)\n"
+		   "(0 pour afficher la liste des terrains)\n\n"
+		   "Numéro : ");
+	fflush(stdout);
+	if (scanf("%d", &session->court) != 1)
+		exit(0);
+
+	if (session->court == 0) {
+		printf("Liste des terrains :\n");
+		client_ask_courts(client);
+	}
 	else
-		printf("Authentication failed\n");
+		client_subscribe(client, session->court);
 }
 
 /**
- * @fn void select_and_subscribe(socket_t socket)
- * @brief Selects a court and subscribes to it
- * @param socket Server socket
+ * @fn void on_answer(client_t* client, char request, int accepted, char* data)
+ * @brief Handles the answer of the server to the authentication or a subscription
+ * @param client: spectator
+ * @param request: code of the request
+ * @param accepted: 1 for OK, 0 for NOK
+ * @param data: data of the answer
  */
-void select_and_subscribe(socket_t socket) {
-	message_t send_msg, received_msg;
-	buffer_t data;
-	int choice, subscribed = 0;
-
-	do {
-		printf("A quel terrain voulez-vous vous abonner ? (numéro de terrain)\n"
-			   "(0 pour afficher la liste des terrains)\n\n"
-			   "Numéro : ");
-		scanf("%d", &choice);
-
-		switch (choice) {
-			case 0:
-				// Sending the request
-				prepare_message(&send_msg, ASK_COURTS, "");
-				send_message(&socket, &send_msg, serialize_message);
-				sleep(1);
-
-				// Receiving the response
-				receive_message(&socket, &received_msg, deserialize_message);
-				if (received_msg.code == (char) LIST_COURTS)
-					printf("Liste des terrains :\n%s\n", received_msg.data);
-				else
-					fprintf(stderr, "Erreur lors de la réception de la liste des terrains\n");
-				break;
-			default:
-				// Sending the subscription message
-				sprintf(data, "%d", choice);
-				prepare_message(&send_msg, SUBSCRIBE, data);
-				send_message(&socket, &send_msg, serialize_message);
-				sleep(1);
-
-				// Receiving the response
-				printf("Attente de la validation serveur\n");
-				receive_message(&socket, &received_msg, deserialize_message);
-
-				if (received_msg.code == (char) OK) {
-					subscribed = 1;
-					printf("Abonnement au terrain %d réussi\n", choice);
-				}
-				else
-					printf("Abonnement au terrain %d échoué\n", choice);
-				break;
-		}
-	} while (!subscribed);
+void on_answer(client_t* client, char request, int accepted, char* data) {
+	spectator_session_t* session = (spectator_session_t*) client->user_data;
+
+	switch (request) {
+		case AUTH:
+			if (!accepted) {
+				fprintf(stderr, "Authentication failed\n");
+				exit(1);
+			}
+			session->attempts = 0;
+			if (session->following) {
+				printf("Reconnecté, terrain %d\n", session->court);
+				client_subscribe(client, session->court);
+			}
+			else {
+				printf("Authentification effectuée !\n");
+				select_court(client);
+			}
+			break;
+
+		case SUBSCRIBE:
+			if (accepted) {
+				session->following = 1;
+				printf("Abonnement au terrain %d réussi\n", session->court);
+				printf("Attente des scores...\n");
+			}
+			else {
+				printf("Abonnement au terrain %d échoué\n", session->court);
+				select_court(client);
+			}
+			break;
+
+		default:
+			break;
+	}
 }
 
 /**
- * @fn void listen_for_score(socket_t socket)
- * @brief Listens for SCORE requests and displays them
- * @param socket Server socket
+ * @fn void on_courts(client_t* client, char* list, int more)
+ * @brief Prints a page of the list of the courts, and asks again which one to follow after the last page
+ * @param client: spectator
+ * @param list: courts' ids, one per line
+ * @param more: 1 if another page follows
  */
-void listen_for_score(socket_t socket) {
-	message_t received_msg;
+void on_courts(client_t* client, char* list, int more) {
+	printf("%s", list);
+	if (!more) {
+		printf("\n");
+		select_court(client);
+	}
+}
 
-	printf("Attente des scores...\n");
-	sleep(1);
+/**
+ * @fn void on_score(client_t* client, int court, char* score)
+ * @brief Displays the score of the court followed
+ * @param client: spectator
+ * @param court: court's id
+ * @param score: formatted score
+ */
+void on_score(client_t* client, int court, char* score) {
+	printf("Score : %s\n", score);
+	fflush(stdout);
+}
 
-	do {
-		receive_message(&socket, &received_msg, deserialize_message);
+/**
+ * @fn void on_match_end(client_t* client, int court)
+ * @brief Stops the spectator once the match is over
+ * @param client: spectator
+ * @param court: court's id
+ */
+void on_match_end(client_t* client, int court) {
+	spectator_session_t* session = (spectator_session_t*) client->user_data;
 
-		if (received_msg.code == (char) SCORE)
-			printf("Score : %s\n", received_msg.data);
+	printf("Fin du match !\n");
+	session->over = 1;
+}
 
-		sleep(1);
-	} while (received_msg.code != (char) END_MATCH);
-}
\ No newline at end of file
+/**
+ * @fn void on_closed(client_t* client)
+ * @brief Stops the spectator once the connection is closed, or reconnects if a court is followed
+ * @param client: spectator
+ */
+void on_closed(client_t* client) {
+	spectator_session_t* session = (spectator_session_t*) client->user_data;
+
+	if (session->over)
+		return;
+
+	// The server may be taken over by its standby: the court is followed there
+	if (session->following) {
+		if (!session->lost && session->attempts == 0)
+			fprintf(stderr, "Connexion perdue, reconnexion...\n");
+		session->lost = 1;
+		return;
+	}
+
+	fprintf(stderr, "Connexion perdue\n");
+	session->over = 1;
+}
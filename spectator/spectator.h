@@ -2,35 +2,104 @@
 #define PANTALLA_DEPORTIVA_V2_SPECTATOR_H
 
 #include <stdio.h>
+#include <unistd.h>
 
-#include "../socket/data.h"
-#include "../serialization/serialization.h"
-#include "../common/codes.h"
+#include "../client/client.h"
+#include "dashboard.h"
 
 /**
- * @def SPECTATOR_AUTH
- * @brief This code is the one to let the server know that the client is a spectator
+ * @def RECONNECT_DELAY
+ * @brief Time between two attempts to reconnect to the server, when it is taken over by its standby (ms)
  */
-#define SPECTATOR_AUTH 4 // 4 = Spectator
+#define RECONNECT_DELAY 200
 
 /**
- * @brief Authenticates the spectator
- * @param socket Server socket
+ * @def RECONNECT_ATTEMPTS
+ * @brief Attempts to reconnect before giving up
  */
-void authenticate(socket_t socket);
+#define RECONNECT_ATTEMPTS 25
 
 /**
- * @fn void select_and_subscribe(socket_t socket)
- * @brief Selects a court and subscribes to it
- * @param socket Server socket
+ * @struct spectator_session
+ * @brief State of the front-end of a spectator
+ * @var court: court being subscribed to, or followed
+ * @var following: 1 once subscribed (the court is followed again after a reconnection)
+ * @var lost: 1 while the connection to a followed court is lost
+ * @var attempts: attempts to reconnect since the connection was lost
+ * @var over: 1 once the match is over (or the connection lost for good)
  */
-void select_and_subscribe(socket_t socket);
+struct spectator_session {
+	int court;
+	int following;
+	int lost;
+	int attempts;
+	int over;
+};
 
 /**
- * @fn void listen_for_score(socket_t socket)
- * @brief Listens for SCORE requests and displays them
- * @param socket Server socket
+ * @typedef spectator_session_t
+ * @brief Typedef for the spectator_session structure
  */
-void listen_for_score(socket_t socket);
+typedef struct spectator_session spectator_session_t;
+
+/**
+ * @fn client_t* reconnect(char* ip, int port, spectator_session_t* session)
+ * @brief Connects again to the server (taken over by its standby) to follow the same court
+ * @param ip: server's address
+ * @param port: server's port
+ * @param session: spectator's session
+ * @return client_t*: new client, NULL once the attempts are exhausted
+ */
+client_t* reconnect(char* ip, int port, spectator_session_t* session);
+
+/**
+ * @fn void select_court(client_t* client)
+ * @brief Asks the spectator which court to follow (or to list the courts)
+ * @param client: spectator
+ */
+void select_court(client_t* client);
+
+/**
+ * @fn void on_answer(client_t* client, char request, int accepted, char* data)
+ * @brief Handles the answer of the server to the authentication or a subscription
+ * @param client: spectator
+ * @param request: code of the request
+ * @param accepted: 1 for OK, 0 for NOK
+ * @param data: data of the answer
+ */
+void on_answer(client_t* client, char request, int accepted, char* data);
+
+/**
+ * @fn void on_courts(client_t* client, char* list, int more)
+ * @brief Prints a page of the list of the courts, and asks again which one to follow after the last page
+ * @param client: spectator
+ * @param list: courts' ids, one per line
+ * @param more: 1 if another page follows
+ */
+void on_courts(client_t* client, char* list, int more);
+
+/**
+ * @fn void on_score(client_t* client, int court, char* score)
+ * @brief Displays the score of the court followed
+ * @param client: spectator
+ * @param court: court's id
+ * @param score: formatted score
+ */
+void on_score(client_t* client, int court, char* score);
+
+/**
+ * @fn void on_match_end(client_t* client, int court)
+ * @brief Stops the spectator once the match is over
+ * @param client: spectator
+ * @param court: court's id
+ */
+void on_match_end(client_t* client, int court);
+
+/**
+ * @fn void on_closed(client_t* client)
+ * @brief Stops the spectator once the connection is closed, or reconnects if a court is followed
+ * @param client: spectator
+ */
+void on_closed(client_t* client);
 
 #endif //PANTALLA_DEPORTIVA_V2_SPECTATOR_H
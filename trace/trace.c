@@ -0,0 +1,265 @@
+/**
+ * @file trace.c
+ * @brief Traces of the points, from the player to the spectators: each process keeps the hops it has seen
+ * @date 2024-06-06
+ */
+
+#include "trace.h"
+
+const char* hop_names[NB_TRACE_HOPS] = {"point sent", "court received", "court queued", "server received",
+										"server fanned out", "spectator received"};
+
+span_t spans[TRACE_BUFFER_SIZE]; // Last spans recorded by the process
+atomic_ulong next_span = 0; // Number of spans recorded, the next one goes in spans[next_span % TRACE_BUFFER_SIZE]
+atomic_ulong trace_counter = 0; // Points traced by the process, mixed into their ids
+
+/**
+ * @fn long realtime_us()
+ * @brief Gives the time of the wall clock, shared by the processes of the host
+ * @return long: time (us since the epoch)
+ */
+long realtime_us() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+/**
+ * @fn long monotonic_time()
+ * @brief Gives the time of a monotonic clock, for the delays measured by a process
+ * @return long: time (us)
+ */
+long monotonic_time() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+/**
+ * @fn void new_trace(trace_t* trace)
+ * @brief Starts the trace of a point, sent now
+ * @param trace: filled with a new id and the current time
+ */
+void new_trace(trace_t* trace) {
+	unsigned long long id;
+
+	trace->origin = realtime_us();
+
+	// Mixing the time, the process and a counter (splitmix64), so that two players never share an id
+	id = (unsigned long long) trace->origin ^ ((unsigned long long) getpid() << 40)
+		 ^ (atomic_fetch_add(&trace_counter, 1) * 0x9e3779b97f4a7c15ULL);
+	id = (id ^ (id >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	id = (id ^ (id >> 27)) * 0x94d049bb133111ebULL;
+	id ^= id >> 31;
+
+	trace->id = id != 0 ? id : 1;
+}
+
+/**
+ * @fn int format_trace(trace_t* trace, char* text, size_t size)
+ * @brief Writes a trace in a message ("<id>.<origin>", the id in hexadecimal)
+ * @param trace: trace
+ * @param text: filled with the trace, empty if the point is not traced
+ * @param size: size of text (TRACE_TEXT_SIZE)
+ * @return int: length of the text
+ */
+int format_trace(trace_t* trace, char* text, size_t size) {
+	if (trace->id == 0) {
+		text[0] = '\0';
+		return 0;
+	}
+
+	return snprintf(text, size, "%llx.%ld", trace->id, trace->origin);
+}
+
+/**
+ * @fn int parse_trace(const char* text, trace_t* trace)
+ * @brief Reads a trace written by format_trace
+ * @param text: trace, NULL if the message has none
+ * @param trace: filled with the trace (id 0 if there is none)
+ * @return int: 0 if read, -1 if there is no trace
+ */
+int parse_trace(const char* text, trace_t* trace) {
+	char* end;
+
+	trace->id = 0;
+	trace->origin = 0;
+	if (text == NULL)
+		return -1;
+
+	trace->id = strtoull(text, &end, 16);
+	if (end == text || *end != '.') {
+		trace->id = 0;
+		return -1;
+	}
+	trace->origin = strtol(end + 1, NULL, 10);
+
+	return 0;
+}
+
+/**
+ * @fn void record_span(trace_t* trace, int hop, int court)
+ * @brief Records a hop of a point in the buffer of the process, without locking (nothing if the point is not traced)
+ * @param trace: trace of the point
+ * @param hop: hop (TRACE_POINT_SENT...)
+ * @param court: court's id (0 if unknown)
+ */
+void record_span(trace_t* trace, int hop, int court) {
+	unsigned long index;
+	span_t* span;
+
+	if (trace->id == 0)
+		return;
+
+	// Each thread takes its own slot, the oldest span is overwritten
+	index = atomic_fetch_add(&next_span, 1);
+	span = &spans[index % TRACE_BUFFER_SIZE];
+
+	// Odd sequence: the dump skips the span while it is written
+	atomic_store_explicit(&span->sequence, 2 * index + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	span->id = trace->id;
+	span->hop = hop;
+	span->court = court;
+	span->origin = trace->origin;
+	span->elapsed = realtime_us() - trace->origin;
+
+	atomic_store_explicit(&span->sequence, 2 * index + 2, memory_order_release);
+}
+
+/**
+ * @fn int compare_spans(const void* a, const void* b)
+ * @brief Orders two spans by point (in the order they were sent), then by hop
+ * @param a: first span
+ * @param b: second span
+ * @return int: negative if a goes first, positive if b goes first, 0 otherwise
+ */
+int compare_spans(const void* a, const void* b) {
+	const span_t *span_a = (const span_t*) a, *span_b = (const span_t*) b;
+
+	if (span_a->origin != span_b->origin)
+		return span_a->origin < span_b->origin ? -1 : 1;
+	if (span_a->id != span_b->id)
+		return span_a->id < span_b->id ? -1 : 1;
+	return span_a->hop - span_b->hop;
+}
+
+/**
+ * @fn int compare_delays(const void* a, const void* b)
+ * @brief Compares two delays for qsort
+ * @param a: first delay
+ * @param b: second delay
+ * @return int: negative, 0 or positive
+ */
+int compare_delays(const void* a, const void* b) {
+	long delay_a = *(const long*) a, delay_b = *(const long*) b;
+
+	return (delay_a > delay_b) - (delay_a < delay_b);
+}
+
+/**
+ * @fn void dump_traces(FILE* stream)
+ * @brief Prints the spans of the buffer, grouped by point, then the delay of each hop since the origin
+ * @param stream: stream to print on
+ */
+void dump_traces(FILE* stream) {
+	span_t* copies = (span_t*) malloc(TRACE_BUFFER_SIZE * sizeof(span_t));
+	long* delays = (long*) malloc(TRACE_BUFFER_SIZE * sizeof(long));
+	unsigned long before, after;
+	int nb_spans = 0, nb_delays, hop, i;
+	long previous = 0;
+	time_t seconds;
+	struct tm date;
+	char sent_at[16];
+
+	// Copying the spans that are complete, the threads keep recording meanwhile
+	for (i = 0; i < TRACE_BUFFER_SIZE; i++) {
+		before = atomic_load_explicit(&spans[i].sequence, memory_order_acquire);
+		if (before == 0 || before & 1)
+			continue;
+
+		copies[nb_spans] = spans[i];
+
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&spans[i].sequence, memory_order_relaxed);
+		if (before == after)
+			nb_spans++;
+	}
+
+	qsort(copies, nb_spans, sizeof(span_t), compare_spans);
+
+	// One block per point, each hop with its delay since the origin and since the previous hop seen here
+	fprintf(stream, "Traces (%d spans):\n", nb_spans);
+	for (i = 0; i < nb_spans; i++) {
+		if (i == 0 || copies[i].id != copies[i - 1].id) {
+			seconds = copies[i].origin / 1000000;
+			localtime_r(&seconds, &date);
+			strftime(sent_at, sizeof(sent_at), "%H:%M:%S", &date);
+			fprintf(stream, "%016llx court %d, sent at %s.%06ld\n", copies[i].id, copies[i].court, sent_at,
+					copies[i].origin % 1000000);
+			previous = 0;
+		}
+
+		fprintf(stream, "  %-19s +%8ld us (+%ld us)\n", hop_names[copies[i].hop], copies[i].elapsed,
+				copies[i].elapsed - previous);
+		previous = copies[i].elapsed;
+	}
+
+	// The hop whose delay jumps is the one adding it
+	fprintf(stream, "%-19s %8s %10s %10s %10s\n", "Hop", "Spans", "p50 (us)", "p99 (us)", "Max (us)");
+	for (hop = 0; hop < NB_TRACE_HOPS; hop++) {
+		for (nb_delays = 0, i = 0; i < nb_spans; i++)
+			if (copies[i].hop == hop)
+				delays[nb_delays++] = copies[i].elapsed;
+		if (nb_delays == 0)
+			continue;
+
+		qsort(delays, nb_delays, sizeof(long), compare_delays);
+		fprintf(stream, "%-19s %8d %10ld %10ld %10ld\n", hop_names[hop], nb_delays, delays[(nb_delays - 1) / 2],
+				delays[(nb_delays - 1) * 99 / 100], delays[nb_delays - 1]);
+	}
+
+	fflush(stream);
+	free(copies);
+	free(delays);
+}
+
+/**
+ * @fn void trace_dumper_thread(void* signals)
+ * @brief Prints the spans on stderr each time SIGUSR2 is received
+ * @param signals: set of the signals waited for (SIGUSR2)
+ */
+void trace_dumper_thread(void* signals) {
+	int signal_number;
+
+	while (sigwait((sigset_t*) signals, &signal_number) == 0)
+		dump_traces(stderr);
+}
+
+/**
+ * @fn void start_trace_dumper()
+ * @brief Starts the thread printing the spans on stderr on each SIGUSR2
+ * @note must be called before any other thread is created, SIGUSR2 being blocked in all the threads
+ */
+void start_trace_dumper() {
+	static sigset_t signals;
+	sigset_t all_signals, mask;
+	pthread_t thread;
+
+	// Blocked here, the threads created afterwards inherit the mask: only the dumper receives it
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &signals, &mask);
+
+	// The dumper starts with every signal blocked, so the ones meant for the other threads never reach it
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, NULL);
+	pthread_create(&thread, NULL, (void*) trace_dumper_thread, (void*) &signals);
+	pthread_detach(thread);
+
+	sigaddset(&mask, SIGUSR2);
+	pthread_sigmask(SIG_SETMASK, &mask, NULL);
+}
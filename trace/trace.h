@@ -0,0 +1,159 @@
+#ifndef PANTALLA_DEPORTIVA_V2_TRACE_H
+#define PANTALLA_DEPORTIVA_V2_TRACE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * @def TRACE_POINT_SENT
+ * @brief Hop of a player sending the point to the court (origin of the trace)
+ */
+#define TRACE_POINT_SENT 0
+/**
+ * @def TRACE_COURT_RECEIVED
+ * @brief Hop of the court reading the point
+ */
+#define TRACE_COURT_RECEIVED 1
+/**
+ * @def TRACE_COURT_QUEUED
+ * @brief Hop of the court queuing the score update carrying the point for the server (after the coalescing window)
+ */
+#define TRACE_COURT_QUEUED 2
+/**
+ * @def TRACE_SERVER_RECEIVED
+ * @brief Hop of the server reading the score update and publishing it
+ */
+#define TRACE_SERVER_RECEIVED 3
+/**
+ * @def TRACE_SERVER_FANNED_OUT
+ * @brief Hop of the broadcaster of the court having handed the score to all its spectators' sessions
+ */
+#define TRACE_SERVER_FANNED_OUT 4
+/**
+ * @def TRACE_SPECTATOR_RECEIVED
+ * @brief Hop of a spectator reading the score
+ */
+#define TRACE_SPECTATOR_RECEIVED 5
+/**
+ * @def NB_TRACE_HOPS
+ * @brief Number of hops of a point
+ */
+#define NB_TRACE_HOPS 6
+
+/**
+ * @def TRACE_BUFFER_SIZE
+ * @brief Spans kept by a process, the oldest ones being overwritten
+ */
+#define TRACE_BUFFER_SIZE 4096
+
+/**
+ * @def TRACE_TEXT_SIZE
+ * @brief Size of a trace written in a message ("9f3a1c2b44d0e1f7.1717584000123456")
+ */
+#define TRACE_TEXT_SIZE 40
+
+/**
+ * @struct trace
+ * @brief Context of a point, carried by the messages from the player to the spectators
+ * @var id: id of the point (0 if the point is not traced)
+ * @var origin: time the player sent the point at (us since the epoch, so it can be compared between processes)
+ */
+struct trace {
+	unsigned long long id;
+	long origin;
+};
+
+/**
+ * @typedef trace_t
+ * @brief Typedef for trace structure
+ */
+typedef struct trace trace_t;
+
+/**
+ * @struct span
+ * @brief Hop of a point seen by the process
+ * @var sequence: odd while the span is written, so the dump skips it
+ * @var id: id of the point
+ * @var hop: hop (TRACE_POINT_SENT...)
+ * @var court: court's id (0 if unknown)
+ * @var origin: time the player sent the point at (us since the epoch)
+ * @var elapsed: time from the origin to the hop (us)
+ */
+struct span {
+	atomic_ulong sequence;
+	unsigned long long id;
+	int hop;
+	int court;
+	long origin;
+	long elapsed;
+};
+
+/**
+ * @typedef span_t
+ * @brief Typedef for span structure
+ */
+typedef struct span span_t;
+
+/**
+ * @fn long monotonic_time()
+ * @brief Gives the time of a monotonic clock, for the delays measured by a process
+ * @return long: time (us)
+ */
+long monotonic_time();
+
+/**
+ * @fn void new_trace(trace_t* trace)
+ * @brief Starts the trace of a point, sent now
+ * @param trace: filled with a new id and the current time
+ */
+void new_trace(trace_t* trace);
+
+/**
+ * @fn int format_trace(trace_t* trace, char* text, size_t size)
+ * @brief Writes a trace in a message ("<id>.<origin>", the id in hexadecimal)
+ * @param trace: trace
+ * @param text: filled with the trace, empty if the point is not traced
+ * @param size: size of text (TRACE_TEXT_SIZE)
+ * @return int: length of the text
+ */
+int format_trace(trace_t* trace, char* text, size_t size);
+
+/**
+ * @fn int parse_trace(const char* text, trace_t* trace)
+ * @brief Reads a trace written by format_trace
+ * @param text: trace, NULL if the message has none
+ * @param trace: filled with the trace (id 0 if there is none)
+ * @return int: 0 if read, -1 if there is no trace
+ */
+int parse_trace(const char* text, trace_t* trace);
+
+/**
+ * @fn void record_span(trace_t* trace, int hop, int court)
+ * @brief Records a hop of a point in the buffer of the process, without locking (nothing if the point is not traced)
+ * @param trace: trace of the point
+ * @param hop: hop (TRACE_POINT_SENT...)
+ * @param court: court's id (0 if unknown)
+ */
+void record_span(trace_t* trace, int hop, int court);
+
+/**
+ * @fn void dump_traces(FILE* stream)
+ * @brief Prints the spans of the buffer, grouped by point, then the delay of each hop since the origin
+ * @param stream: stream to print on
+ */
+void dump_traces(FILE* stream);
+
+/**
+ * @fn void start_trace_dumper()
+ * @brief Starts the thread printing the spans on stderr on each SIGUSR2
+ * @note must be called before any other thread is created, SIGUSR2 being blocked in all the threads
+ */
+void start_trace_dumper();
+
+#endif //PANTALLA_DEPORTIVA_V2_TRACE_H